@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "batch_runner.h"
+#include "thread_pool.h"
+
+namespace
+{
+void Usage()
+{
+  std::cerr << "usage: nes_batch [-j threads] [-f frames] [-l list] rom[:frames]...\n"
+               "  -j  worker threads, default one per hardware thread\n"
+               "  -f  frames for roms given without a count, default 600\n"
+               "  -l  file with one \"rom frames\" pair per line\n";
+}
+
+BatchJob ParseJob(const std::string& arg, uint64_t default_frames)
+{
+  size_t colon = arg.rfind(':');
+  if (colon == std::string::npos)
+    return BatchJob{arg, default_frames};
+  return BatchJob{arg.substr(0, colon), std::strtoull(arg.c_str() + colon + 1, nullptr, 10)};
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  unsigned threads = 0;
+  uint64_t default_frames = 600;
+  std::vector<std::string> args;
+  std::vector<BatchJob> jobs;
+
+  for (int i = 1; i < argc; i++)
+    {
+      std::string arg = argv[i];
+      if ((arg == "-j" || arg == "-f" || arg == "-l") && i + 1 < argc)
+        {
+          std::string value = argv[++i];
+          if (arg == "-j")
+            threads = std::strtoul(value.c_str(), nullptr, 10);
+          else if (arg == "-f")
+            default_frames = std::strtoull(value.c_str(), nullptr, 10);
+          else
+            {
+              std::ifstream list(value);
+              if (!list)
+                {
+                  std::cerr << "cannot open " << value << std::endl;
+                  return 1;
+                }
+
+              BatchJob job;
+              while (list >> job.rom_path >> job.frames)
+                jobs.push_back(job);
+            }
+        }
+      else if (!arg.empty() && arg[0] == '-')
+        {
+          Usage();
+          return 1;
+        }
+      else
+        {
+          args.push_back(arg);
+        }
+    }
+
+  for (const std::string& arg : args)
+    jobs.push_back(ParseJob(arg, default_frames));
+
+  if (jobs.empty())
+    {
+      Usage();
+      return 1;
+    }
+
+  ThreadPool pool(threads);
+  std::vector<BatchResult> results = RunBatch(jobs, pool);
+
+  int failures = 0;
+  double busy = 0;
+  uint64_t frames = 0;
+
+  for (size_t i = 0; i < results.size(); i++)
+    {
+      const BatchResult& result = results[i];
+      if (!result.ok)
+        {
+          std::printf("%zu\terror\t%s\t%s\n", i, result.rom_path.c_str(), result.error.c_str());
+          failures++;
+          continue;
+        }
+
+      std::printf("%zu\t%016llx\t%llu frames\t%llu cycles\t%.3f ms\t%s\n", i, (unsigned long long)result.hash,
+                  (unsigned long long)result.frames, (unsigned long long)result.cycles, result.seconds * 1000,
+                  result.rom_path.c_str());
+      busy += result.seconds;
+      frames += result.frames;
+    }
+
+  std::fprintf(stderr, "%zu instances on %u threads, %llu frames, %.1f frames per busy second\n", results.size(),
+               pool.Size(), (unsigned long long)frames, busy > 0 ? frames / busy : 0.0);
+
+  return failures ? 1 : 0;
+}
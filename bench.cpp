@@ -0,0 +1,291 @@
+#include <array>
+#include <string>
+#include <string_view>
+
+#include <benchmark/benchmark.h>
+
+#include "cpu.h"
+#include "disassembler.h"
+#include "instruction.h"
+#include "memory.h"
+#include "nes.h"
+
+/*
+ *  Microbenchmarks for the hot paths: dispatch of every straight-line
+ *  opcode, one representative per addressing mode, the bus accessors, a
+ *  cached full-range disassembly and whole frames of a synthetic loop on
+ *  each CPU engine.
+ *
+ *  For numbers to compare between commits run
+ *    nes_bench --benchmark_out=bench.json --benchmark_out_format=json
+ *  on an otherwise idle machine.
+ */
+namespace
+{
+constexpr word CODE = 0x8000;
+constexpr word CODE_END = 0x9000;
+
+// Zero page pointer and absolute operand of the generated programs. X and
+// Y stay 0, so indexed modes never cross a page
+constexpr byte ZERO_PAGE = 0x10;
+constexpr word DATA = 0x0300;
+
+// Cycles per iteration, as many as one Cpu::Execute call runs
+constexpr byte SLICE = 255;
+
+bool IsStraightLine(byte opcode)
+{
+  const OpcodeEntry& entry = OPCODE_TABLE[opcode];
+  switch (entry.op)
+    {
+      case Op::BRK:
+      case Op::JMP:
+      case Op::JSR:
+      case Op::RTI:
+      case Op::RTS:
+      case Op::XXX: return false;
+      default: return entry.mode != AddrMode::REL;
+    }
+}
+
+std::string OpcodeName(byte opcode)
+{
+  static constexpr std::array<std::string_view, 12> MODE_NAMES = {"IMP", "IMM", "ZP0", "ZPX", "ZPY", "REL",
+                                                                  "ABS", "ABX", "ABY", "IND", "IZX", "IZY"};
+
+  static constexpr char HEX[] = "0123456789ABCDEF";
+  std::string name(GetMnemonic(opcode));
+  name += '_';
+  name += MODE_NAMES[size_t(OPCODE_TABLE[opcode].mode)];
+  name += '/';
+  name += HEX[opcode >> 4];
+  name += HEX[opcode & 0x0F];
+  return name;
+}
+
+/*
+ *  Straight-line opcodes are repeated over $8000-$8FFF followed by a JMP
+ *  back, branches and JMP (ind) jump onto themselves. Either way the
+ *  instruction under test is almost all that runs.
+ */
+void LoadProgram(Memory& memory, byte opcode)
+{
+  const OpcodeEntry& entry = OPCODE_TABLE[opcode];
+  word addr = CODE;
+
+  if (entry.mode == AddrMode::REL)
+    {
+      memory.SetMemory(opcode, addr);
+      memory.SetMemory(0xFE, addr + 1);
+      return;
+    }
+
+  if (entry.mode == AddrMode::IND)
+    {
+      memory.SetMemory(opcode, addr);
+      memory.SetMemory(ZERO_PAGE, addr + 1);
+      memory.SetMemory(0x00, addr + 2);
+      memory.SetMemory(CODE & 0xFF, ZERO_PAGE);
+      memory.SetMemory(CODE >> 8, ZERO_PAGE + 1);
+      return;
+    }
+
+  memory.SetMemory(DATA & 0xFF, ZERO_PAGE);
+  memory.SetMemory(DATA >> 8, ZERO_PAGE + 1);
+
+  word operand = entry.mode == AddrMode::IMM ? 0x01 : entry.length == 2 ? ZERO_PAGE : DATA;
+  while (addr + entry.length + 3 <= CODE_END)
+    {
+      memory.SetMemory(opcode, addr);
+      if (entry.length > 1)
+        memory.SetMemory(operand & 0xFF, addr + 1);
+      if (entry.length > 2)
+        memory.SetMemory(operand >> 8, addr + 2);
+      addr += entry.length;
+    }
+
+  memory.SetMemory(0x4C, addr);
+  memory.SetMemory(CODE & 0xFF, addr + 1);
+  memory.SetMemory(CODE >> 8, addr + 2);
+}
+
+void ReportRates(benchmark::State& state, uint64_t cycles, double cycles_per_instruction)
+{
+  state.counters["cycles"] = benchmark::Counter(double(cycles), benchmark::Counter::kIsRate);
+  state.counters["instructions"] = benchmark::Counter(cycles / cycles_per_instruction, benchmark::Counter::kIsRate);
+}
+
+void BM_Opcode(benchmark::State& state, byte opcode)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+  LoadProgram(memory, opcode);
+
+  cpu.Reset();
+  cpu.PC = CODE;
+  cpu.status = 0x24; // Z clear, so BNE is taken
+
+  uint64_t start = cpu.cycles;
+  for (auto _ : state)
+    cpu.Execute(SLICE);
+
+  ReportRates(state, cpu.cycles - start, OPCODE_TABLE[opcode].cycles + (OPCODE_TABLE[opcode].mode == AddrMode::REL));
+}
+
+void BM_GetMemory(benchmark::State& state)
+{
+  Memory memory;
+  for (auto _ : state)
+    for (word addr = DATA; addr < DATA + 0x100; addr++)
+      benchmark::DoNotOptimize(memory.GetMemory(addr));
+
+  state.SetItemsProcessed(state.iterations() * 0x100);
+}
+
+void BM_SetMemory(benchmark::State& state)
+{
+  Memory memory;
+  for (auto _ : state)
+    {
+      for (word addr = DATA; addr < DATA + 0x100; addr++)
+        memory.SetMemory(byte(addr), addr);
+      benchmark::ClobberMemory();
+    }
+
+  state.SetItemsProcessed(state.iterations() * 0x100);
+}
+
+// A debugger view over all 64 KB, refreshed with nothing written since
+void BM_DisassembleFullRange(benchmark::State& state)
+{
+  Memory memory;
+  LoadProgram(memory, 0xBD);
+  Disassembler disassembler(memory);
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(disassembler.Disassemble(0x0000, 0xFFFF).data());
+}
+
+/*
+ *  Sums a 256 byte table into a second one, over and over:
+ *    $8000 LDX #$00; $8002 CLC; $8003 ADC $0300,X; $8006 STA $0400,X
+ *    $8009 EOR #$5A; $800B INX; $800C BNE $8002; $800E JMP $8000
+ */
+constexpr std::array<byte, 17> SYNTHETIC_LOOP = {0xA2, 0x00, 0x18, 0x7D, 0x00, 0x03, 0x9D, 0x00, 0x04,
+                                                 0x49, 0x5A, 0xE8, 0xD0, 0xF4, 0x4C, 0x00, 0x80};
+constexpr double LOOP_CYCLES_PER_INSTRUCTION = 18.0 / 6; // CLC .. BNE, branch taken
+
+void BM_SyntheticLoop(benchmark::State& state, CpuEngine engine)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+  for (size_t i = 0; i < SYNTHETIC_LOOP.size(); i++)
+    memory.SetMemory(SYNTHETIC_LOOP[i], CODE + i);
+
+  cpu.Reset();
+  cpu.PC = CODE;
+  cpu.engine = engine;
+
+  uint64_t start = cpu.cycles;
+  for (auto _ : state)
+    cpu.RunFrames(1);
+
+  ReportRates(state, cpu.cycles - start, LOOP_CYCLES_PER_INSTRUCTION);
+  state.counters["frames"] = benchmark::Counter(double(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+/*
+ *  The whole console on the same loop, from a ROM image mapped straight
+ *  onto the bus: rendering on, an NMI per frame that resets the scroll.
+ */
+void BM_NesFrame(benchmark::State& state, CpuEngine engine)
+{
+  static std::array<byte, 0x8000> prg{};
+
+  // LDA #$80; STA $2000; LDA #$1E; STA $2001, then the loop
+  constexpr std::array<byte, 10> SETUP = {0xA9, 0x80, 0x8D, 0x00, 0x20, 0xA9, 0x1E, 0x8D, 0x01, 0x20};
+  // NMI: LDA #0; STA $2005; STA $2005; RTI
+  constexpr std::array<byte, 9> NMI = {0xA9, 0x00, 0x8D, 0x05, 0x20, 0x8D, 0x05, 0x20, 0x40};
+
+  size_t at = 0;
+  for (byte data : SETUP)
+    prg[at++] = data;
+  for (byte data : SYNTHETIC_LOOP)
+    prg[at++] = data;
+  // the loop's JMP goes back past the setup
+  prg[at - 2] = byte(CODE + SETUP.size());
+
+  for (size_t i = 0; i < NMI.size(); i++)
+    prg[0x1000 + i] = NMI[i];
+  prg[0x7FFA] = 0x00; // NMI -> $9000
+  prg[0x7FFB] = 0x90;
+  prg[0x7FFC] = 0x00; // RESET -> $8000
+  prg[0x7FFD] = 0x80;
+
+  Nes nes;
+  nes.memory.MapReadOnly(0x80, 0xFF, prg.data(), prg.size());
+  nes.Reset();
+  nes.cpu.engine = engine;
+
+  for (auto _ : state)
+    nes.RunFrame();
+
+  state.counters["frames"] = benchmark::Counter(double(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+constexpr std::array<std::pair<std::string_view, CpuEngine>, 4> ENGINES = {{
+  {"Interpreter", CpuEngine::Interpreter},
+  {"Cached", CpuEngine::Cached},
+  {"Blocks", CpuEngine::Blocks},
+  {"Jit", CpuEngine::Jit},
+}};
+
+// One opcode per addressing mode, all of them loads where there is one
+constexpr std::array<std::pair<std::string_view, byte>, 12> ADDRESSING_MODES = {{
+  {"IMP", 0xEA}, // NOP
+  {"IMM", 0xA9}, // LDA #
+  {"ZP0", 0xA5}, // LDA zp
+  {"ZPX", 0xB5}, // LDA zp,X
+  {"ZPY", 0xB6}, // LDX zp,Y
+  {"REL", 0xD0}, // BNE
+  {"ABS", 0xAD}, // LDA abs
+  {"ABX", 0xBD}, // LDA abs,X
+  {"ABY", 0xB9}, // LDA abs,Y
+  {"IND", 0x6C}, // JMP (ind)
+  {"IZX", 0xA1}, // LDA (zp,X)
+  {"IZY", 0xB1}, // LDA (zp),Y
+}};
+
+void RegisterBenchmarks()
+{
+  for (int opcode = 0; opcode < 256; opcode++)
+    if (IsStraightLine(byte(opcode)))
+      benchmark::RegisterBenchmark(("BM_Opcode/" + OpcodeName(byte(opcode))).c_str(), BM_Opcode, byte(opcode));
+
+  for (const auto& [name, opcode] : ADDRESSING_MODES)
+    benchmark::RegisterBenchmark(("BM_AddressingMode/" + std::string(name)).c_str(), BM_Opcode, opcode);
+
+  benchmark::RegisterBenchmark("BM_GetMemory", BM_GetMemory);
+  benchmark::RegisterBenchmark("BM_SetMemory", BM_SetMemory);
+  benchmark::RegisterBenchmark("BM_DisassembleFullRange", BM_DisassembleFullRange);
+
+  for (const auto& [name, engine] : ENGINES)
+    benchmark::RegisterBenchmark(("BM_SyntheticLoop/" + std::string(name)).c_str(), BM_SyntheticLoop, engine);
+
+  for (const auto& [name, engine] : ENGINES)
+    benchmark::RegisterBenchmark(("BM_NesFrame/" + std::string(name)).c_str(), BM_NesFrame, engine);
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  RegisterBenchmarks();
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
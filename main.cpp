@@ -1,14 +1,25 @@
 #include <iostream>
 
-#include "cpu.h"
-#include "memory.h"
+#include "nes.h"
 
-int main()
+int main(int argc, char** argv)
 {
-  Memory *memory = new Memory();
-  Cpu *cpu = new Cpu(memory);
+  Nes nes;
 
-  cpu->Reset();
+  if (argc > 1)
+    {
+      if (!nes.LoadCartridge(argv[1]))
+        {
+          std::cerr << nes.cartridge.GetError() << std::endl;
+          return 1;
+        }
 
-  cpu->Execute(9);
-}
\ No newline at end of file
+      const CartridgeHeader& header = nes.cartridge.GetHeader();
+      std::cout << "mapper " << header.mapper << ", PRG " << header.prg_rom_size / 1024 << " KB, CHR "
+                << header.chr_rom_size / 1024 << " KB" << (header.battery ? ", battery" : "") << std::endl;
+    }
+
+  nes.Reset();
+
+  nes.cpu.Execute(9);
+}
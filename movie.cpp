@@ -0,0 +1,96 @@
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "movie.h"
+#include "nes.h"
+
+namespace
+{
+void Usage()
+{
+  std::cerr << "usage: nes_movie play rom movie\n"
+               "       nes_movie record rom movie frames [inputs]\n"
+               "  play    replays the movie headless and checks every frame's state hash\n"
+               "  record  records `frames` frames with the pads idle, or with the\n"
+               "          inputs of the movie `inputs`, hashing them with this build\n";
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  if (argc < 4)
+    {
+      Usage();
+      return 1;
+    }
+
+  std::string command = argv[1];
+  std::string rom_path = argv[2];
+  std::string movie_path = argv[3];
+
+  // consoles are large, keep this one off the stack
+  auto nes = std::make_unique<Nes>();
+  if (!nes->LoadCartridge(rom_path))
+    {
+      std::cerr << nes->cartridge.GetError() << std::endl;
+      return 1;
+    }
+
+  Movie movie;
+
+  if (command == "play" && argc == 4)
+    {
+      if (!movie.Load(movie_path))
+        {
+          std::cerr << movie.GetError() << std::endl;
+          return 1;
+        }
+
+      PlaybackResult result = PlayMovie(*nes, movie);
+      if (!result.ok)
+        {
+          std::printf("mismatch at frame %llu: %016llx, expected %016llx\n", (unsigned long long)result.frames - 1,
+                      (unsigned long long)result.hash, (unsigned long long)result.expected_hash);
+          return 1;
+        }
+
+      std::printf("%llu frames match, %.1f frames per second\n", (unsigned long long)result.frames,
+                  result.seconds > 0 ? result.frames / result.seconds : 0.0);
+      return 0;
+    }
+
+  if (command == "record" && (argc == 5 || argc == 6))
+    {
+      uint64_t frames = std::strtoull(argv[4], nullptr, 10);
+
+      Movie inputs;
+      if (argc == 6 && !inputs.Load(argv[5]))
+        {
+          std::cerr << inputs.GetError() << std::endl;
+          return 1;
+        }
+
+      StateHasher hasher;
+      for (uint64_t i = 0; i < frames; i++)
+        {
+          std::array<byte, 2> buttons{};
+          if (i < inputs.GetFrameCount())
+            buttons = inputs.GetFrame(i).buttons;
+          RecordFrame(*nes, hasher, movie, buttons);
+        }
+
+      if (!movie.Save(movie_path))
+        {
+          std::cerr << movie.GetError() << std::endl;
+          return 1;
+        }
+      return 0;
+    }
+
+  Usage();
+  return 1;
+}
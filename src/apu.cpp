@@ -0,0 +1,675 @@
+#include <algorithm>
+#include <array>
+
+#include "apu.h"
+#include "cpu.h"
+
+namespace
+{
+constexpr byte LENGTH_TABLE[32] = {
+  10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+  12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+constexpr byte DUTY_TABLE[4][8] = {
+  {0, 1, 0, 0, 0, 0, 0, 0},
+  {0, 1, 1, 0, 0, 0, 0, 0},
+  {0, 1, 1, 1, 1, 0, 0, 0},
+  {1, 0, 0, 1, 1, 1, 1, 1},
+};
+
+constexpr byte TRIANGLE_SEQUENCE[32] = {
+  15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+};
+
+// NTSC periods in CPU cycles
+constexpr word NOISE_PERIODS[16] = {4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+constexpr word DMC_PERIODS[16] = {428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54};
+
+// frame counter steps, in CPU cycles from the start of the sequence
+constexpr uint64_t FOUR_STEP_CYCLES[4] = {7457, 14913, 22371, 29829};
+constexpr uint64_t FIVE_STEP_CYCLES[5] = {7457, 14913, 22371, 29829, 37281};
+constexpr uint64_t FOUR_STEP_PERIOD = 29830;
+constexpr uint64_t FIVE_STEP_PERIOD = 37282;
+
+/*
+ *  The 2A03 mixes its channels through resistor networks that are not
+ *  linear in the channel levels. Both groups are tabulated at compile time
+ *  (nesdev approximation), scaled to 16-bit sample units.
+ */
+constexpr double MIXER_SCALE = 30000;
+
+constexpr std::array<int, 31> MakePulseMixer()
+{
+  std::array<int, 31> table{};
+  for (int n = 1; n < 31; n++)
+    table[n] = static_cast<int>(95.52 / (8128.0 / n + 100) * MIXER_SCALE);
+  return table;
+}
+
+constexpr std::array<int, 203> MakeTndMixer()
+{
+  std::array<int, 203> table{};
+  for (int n = 1; n < 203; n++)
+    table[n] = static_cast<int>(163.67 / (24329.0 / n + 100) * MIXER_SCALE);
+  return table;
+}
+
+constexpr std::array<int, 31> PULSE_MIXER = MakePulseMixer();
+constexpr std::array<int, 203> TND_MIXER = MakeTndMixer();
+} // namespace
+
+void Apu::Envelope::Clock()
+{
+  if (start)
+    {
+      start = false;
+      decay = 15;
+      divider = period;
+    }
+  else if (divider == 0)
+    {
+      divider = period;
+      if (decay > 0)
+        decay--;
+      else if (loop)
+        decay = 15;
+    }
+  else
+    {
+      divider--;
+    }
+}
+
+byte Apu::Envelope::Volume() const
+{
+  return constant ? period : decay;
+}
+
+void Apu::Pulse::Write(int reg, byte data)
+{
+  switch (reg)
+    {
+      case 0: {
+        duty = data >> 6;
+        envelope.loop = data & 0x20;
+        envelope.constant = data & 0x10;
+        envelope.period = data & 0x0F;
+      }
+      break;
+      case 1: {
+        sweep_enabled = data & 0x80;
+        sweep_period = (data >> 4) & 0x07;
+        sweep_negate = data & 0x08;
+        sweep_shift = data & 0x07;
+        sweep_reload = true;
+      }
+      break;
+      case 2: period = (period & 0x0700) | data; break;
+      case 3: {
+        period = (period & 0x00FF) | ((data & 0x07) << 8);
+        if (enabled)
+          length = LENGTH_TABLE[data >> 3];
+        step = 0;
+        envelope.start = true;
+      }
+      break;
+    }
+}
+
+void Apu::Pulse::ClockTimer()
+{
+  step = (step + 1) & 0x07;
+  next_clock += (period + 1) * 2;
+}
+
+void Apu::Pulse::ClockSweep()
+{
+  word target = SweepTarget();
+  if (sweep_divider == 0 && sweep_enabled && sweep_shift > 0 && period >= 8 && target <= 0x07FF)
+    period = target;
+
+  if (sweep_divider == 0 || sweep_reload)
+    {
+      sweep_divider = sweep_period;
+      sweep_reload = false;
+    }
+  else
+    {
+      sweep_divider--;
+    }
+}
+
+word Apu::Pulse::SweepTarget() const
+{
+  word change = period >> sweep_shift;
+  if (sweep_negate)
+    return period - change - (ones_complement ? 1 : 0);
+  return period + change;
+}
+
+byte Apu::Pulse::Output() const
+{
+  // the sweep unit mutes the channel even while disabled
+  if (length == 0 || period < 8 || SweepTarget() > 0x07FF || !DUTY_TABLE[duty][step])
+    return 0;
+  return envelope.Volume();
+}
+
+void Apu::Triangle::ClockTimer()
+{
+  if (linear > 0 && length > 0)
+    step = (step + 1) & 0x1F;
+
+  // ultrasonic periods are frozen rather than clocked every cycle
+  next_clock = period < 2 ? NEVER : next_clock + period + 1;
+}
+
+void Apu::Triangle::ClockLinear()
+{
+  if (linear_reload)
+    linear = linear_period;
+  else if (linear > 0)
+    linear--;
+
+  if (!control)
+    linear_reload = false;
+}
+
+byte Apu::Triangle::Output() const
+{
+  return TRIANGLE_SEQUENCE[step];
+}
+
+void Apu::Noise::ClockTimer()
+{
+  word feedback = (shift ^ (shift >> (short_mode ? 6 : 1))) & 0x01;
+  shift = (shift >> 1) | (feedback << 14);
+  next_clock += period;
+}
+
+byte Apu::Noise::Output() const
+{
+  if (length == 0 || (shift & 0x01))
+    return 0;
+  return envelope.Volume();
+}
+
+Apu::Apu(int sample_rate) : blip(CPU_CLOCK_NTSC, sample_rate, sample_rate / 4)
+{
+  Reset();
+}
+
+void Apu::Reset()
+{
+  pulse[0] = Pulse{};
+  pulse[1] = Pulse{};
+  pulse[0].ones_complement = true;
+  triangle = Triangle{};
+  noise = Noise{};
+  noise.period = NOISE_PERIODS[0];
+  dmc = Dmc{};
+  dmc.period = DMC_PERIODS[0];
+
+  pulse[0].next_clock = pulse[1].next_clock = noise.next_clock = dmc.next_clock = cycle;
+
+  five_step = false;
+  irq_inhibit = false;
+  frame_step = 0;
+  frame_start = cycle;
+
+  SetFrameIrq(false);
+  UpdateDmcIrq();
+  UpdateOutput(cycle);
+  Reschedule();
+}
+
+void Apu::ConnectCpu(Cpu* _cpu)
+{
+  cpu = _cpu;
+}
+
+void Apu::ConnectScheduler(Scheduler* _scheduler)
+{
+  scheduler = _scheduler;
+  if (scheduler)
+    {
+      scheduler->SetSource(EventType::FrameIrq, this);
+      scheduler->SetSource(EventType::DmcIrq, this);
+    }
+  Reschedule();
+}
+
+byte Apu::Read(word addr)
+{
+  if (cpu)
+    CatchUp(cpu->BusCycle());
+
+  if (addr != 0x4015)
+    return 0;
+
+  byte result = (pulse[0].length > 0 ? 0x01 : 0) | (pulse[1].length > 0 ? 0x02 : 0) | (triangle.length > 0 ? 0x04 : 0) |
+                (noise.length > 0 ? 0x08 : 0) | (dmc.bytes_remaining > 0 ? 0x10 : 0) | (frame_irq ? 0x40 : 0) |
+                (dmc.irq ? 0x80 : 0);
+
+  SetFrameIrq(false);
+  Reschedule();
+  return result;
+}
+
+void Apu::Write(word addr, byte data)
+{
+  if (cpu)
+    CatchUp(cpu->BusCycle());
+
+  switch (addr)
+    {
+      case 0x4000:
+      case 0x4001:
+      case 0x4002:
+      case 0x4003: pulse[0].Write(addr & 0x03, data); break;
+      case 0x4004:
+      case 0x4005:
+      case 0x4006:
+      case 0x4007: pulse[1].Write(addr & 0x03, data); break;
+      case 0x4008: {
+        triangle.control = data & 0x80;
+        triangle.linear_period = data & 0x7F;
+      }
+      break;
+      case 0x400A:
+      case 0x400B: {
+        if (addr == 0x400A)
+          {
+            triangle.period = (triangle.period & 0x0700) | data;
+          }
+        else
+          {
+            triangle.period = (triangle.period & 0x00FF) | ((data & 0x07) << 8);
+            if (triangle.enabled)
+              triangle.length = LENGTH_TABLE[data >> 3];
+            triangle.linear_reload = true;
+          }
+
+        if (triangle.next_clock == NEVER && triangle.period >= 2)
+          triangle.next_clock = cycle + triangle.period + 1;
+      }
+      break;
+      case 0x400C: {
+        noise.envelope.loop = data & 0x20;
+        noise.envelope.constant = data & 0x10;
+        noise.envelope.period = data & 0x0F;
+      }
+      break;
+      case 0x400E: {
+        noise.short_mode = data & 0x80;
+        noise.period = NOISE_PERIODS[data & 0x0F];
+      }
+      break;
+      case 0x400F: {
+        if (noise.enabled)
+          noise.length = LENGTH_TABLE[data >> 3];
+        noise.envelope.start = true;
+      }
+      break;
+      case 0x4010: {
+        dmc.irq_enabled = data & 0x80;
+        dmc.loop = data & 0x40;
+        dmc.period = DMC_PERIODS[data & 0x0F];
+        if (!dmc.irq_enabled)
+          {
+            dmc.irq = false;
+            UpdateDmcIrq();
+          }
+      }
+      break;
+      case 0x4011: dmc.level = data & 0x7F; break;
+      case 0x4012: dmc.sample_addr = 0xC000 | (data << 6); break;
+      case 0x4013: dmc.sample_length = (data << 4) | 0x0001; break;
+      case 0x4015: {
+        pulse[0].enabled = data & 0x01;
+        pulse[1].enabled = data & 0x02;
+        triangle.enabled = data & 0x04;
+        noise.enabled = data & 0x08;
+
+        if (!pulse[0].enabled)
+          pulse[0].length = 0;
+        if (!pulse[1].enabled)
+          pulse[1].length = 0;
+        if (!triangle.enabled)
+          triangle.length = 0;
+        if (!noise.enabled)
+          noise.length = 0;
+
+        if (data & 0x10)
+          {
+            if (dmc.bytes_remaining == 0)
+              RestartDmc();
+            FetchDmc();
+          }
+        else
+          {
+            dmc.bytes_remaining = 0;
+          }
+
+        dmc.irq = false;
+        UpdateDmcIrq();
+      }
+      break;
+      case 0x4017: {
+        five_step = data & 0x80;
+        irq_inhibit = data & 0x40;
+        if (irq_inhibit)
+          SetFrameIrq(false);
+
+        frame_start = cycle;
+        frame_step = 0;
+
+        // entering the 5-step sequence clocks everything at once
+        if (five_step)
+          {
+            QuarterFrame();
+            HalfFrame();
+          }
+      }
+      break;
+      default: break;
+    }
+
+  UpdateOutput(cycle);
+  Reschedule();
+}
+
+void Apu::CatchUp(uint64_t cpu_cycle)
+{
+  while (cycle < cpu_cycle)
+    {
+      uint64_t frame_event = NextFrameEvent();
+      uint64_t end = std::min(cpu_cycle, frame_event);
+
+      Run(end);
+      cycle = end;
+
+      if (cycle == frame_event)
+        {
+          ClockFrameCounter();
+          UpdateOutput(cycle);
+          EndBlock();
+        }
+    }
+
+  Reschedule();
+}
+
+void Apu::RunEvent(EventType, uint64_t cpu_cycle)
+{
+  CatchUp(cpu_cycle);
+}
+
+uint64_t Apu::NextIrqCycle() const
+{
+  return std::min(NextFrameIrqCycle(), NextDmcIrqCycle());
+}
+
+uint64_t Apu::NextFrameIrqCycle() const
+{
+  if (!five_step && !irq_inhibit && !frame_irq)
+    return frame_start + FOUR_STEP_CYCLES[3];
+  return NEVER;
+}
+
+uint64_t Apu::NextDmcIrqCycle() const
+{
+  // a lower bound: the last byte cannot be fetched any sooner than this
+  if (dmc.irq_enabled && !dmc.loop && !dmc.irq && dmc.bytes_remaining > 0)
+    return dmc.next_clock + uint64_t(dmc.bytes_remaining - 1) * 8 * dmc.period;
+  return NEVER;
+}
+
+template <typename Self, typename Archive>
+void Apu::Serialize(Self& self, Archive& archive)
+{
+  archive.Field(self.pulse);
+  archive.Field(self.triangle);
+  archive.Field(self.noise);
+  archive.Field(self.dmc);
+  archive.Field(self.five_step);
+  archive.Field(self.irq_inhibit);
+  archive.Field(self.frame_irq);
+  archive.Field(self.frame_step);
+  archive.Field(self.frame_start);
+  archive.Field(self.cycle);
+  archive.Field(self.output);
+}
+
+void Apu::SaveState(StateWriter& writer) const
+{
+  Serialize(*this, writer);
+}
+
+void Apu::LoadState(StateReader& reader)
+{
+  Serialize(*this, reader);
+
+  // the timeline may have jumped backwards, restart the audio from here
+  blip.Clear();
+  block_start = cycle;
+  Reschedule();
+}
+
+void Apu::CopyState(const Apu& other)
+{
+  Cpu* own_cpu = cpu;
+  Scheduler* own_scheduler = scheduler;
+
+  *this = other;
+
+  cpu = own_cpu;
+  scheduler = own_scheduler;
+  Reschedule();
+}
+
+int Apu::SamplesAvailable() const
+{
+  return blip.SamplesAvailable();
+}
+
+int Apu::ReadSamples(int16_t* out, int count)
+{
+  return blip.ReadSamples(out, count);
+}
+
+/*
+ *  Steps the channel timers from one expiry to the next up to (but not
+ *  including) `end`. Only expiries can change a channel's output, so the
+ *  cycles in between are never visited.
+ */
+void Apu::Run(uint64_t end)
+{
+  while (true)
+    {
+      uint64_t next = std::min({pulse[0].next_clock, pulse[1].next_clock, triangle.next_clock, noise.next_clock, dmc.next_clock});
+      if (next >= end)
+        return;
+
+      if (pulse[0].next_clock == next)
+        pulse[0].ClockTimer();
+      if (pulse[1].next_clock == next)
+        pulse[1].ClockTimer();
+      if (triangle.next_clock == next)
+        triangle.ClockTimer();
+      if (noise.next_clock == next)
+        noise.ClockTimer();
+      if (dmc.next_clock == next)
+        ClockDmc();
+
+      UpdateOutput(next);
+    }
+}
+
+void Apu::UpdateOutput(uint64_t at)
+{
+  int pulses = pulse[0].Output() + pulse[1].Output();
+  int tnd = 3 * triangle.Output() + 2 * noise.Output() + dmc.level;
+  int mixed = PULSE_MIXER[pulses] + TND_MIXER[tnd];
+
+  if (mixed != output)
+    {
+      blip.AddDelta(at - block_start, mixed - output);
+      output = mixed;
+    }
+}
+
+void Apu::EndBlock()
+{
+  blip.EndFrame(cycle - block_start);
+  block_start = cycle;
+}
+
+void Apu::ClockFrameCounter()
+{
+  if (five_step)
+    {
+      if (frame_step != 3)
+        QuarterFrame();
+      if (frame_step == 1 || frame_step == 4)
+        HalfFrame();
+
+      if (++frame_step == 5)
+        {
+          frame_step = 0;
+          frame_start += FIVE_STEP_PERIOD;
+        }
+    }
+  else
+    {
+      QuarterFrame();
+      if (frame_step == 1 || frame_step == 3)
+        HalfFrame();
+
+      if (frame_step == 3 && !irq_inhibit)
+        SetFrameIrq(true);
+
+      if (++frame_step == 4)
+        {
+          frame_step = 0;
+          frame_start += FOUR_STEP_PERIOD;
+        }
+    }
+}
+
+void Apu::QuarterFrame()
+{
+  pulse[0].envelope.Clock();
+  pulse[1].envelope.Clock();
+  noise.envelope.Clock();
+  triangle.ClockLinear();
+}
+
+void Apu::HalfFrame()
+{
+  for (Pulse& channel : pulse)
+    {
+      if (!channel.envelope.loop && channel.length > 0)
+        channel.length--;
+      channel.ClockSweep();
+    }
+
+  if (!triangle.control && triangle.length > 0)
+    triangle.length--;
+  if (!noise.envelope.loop && noise.length > 0)
+    noise.length--;
+}
+
+uint64_t Apu::NextFrameEvent() const
+{
+  return frame_start + (five_step ? FIVE_STEP_CYCLES[frame_step] : FOUR_STEP_CYCLES[frame_step]);
+}
+
+void Apu::ClockDmc()
+{
+  if (!dmc.silence)
+    {
+      if (dmc.shift & 0x01)
+        {
+          if (dmc.level <= 125)
+            dmc.level += 2;
+        }
+      else if (dmc.level >= 2)
+        {
+          dmc.level -= 2;
+        }
+      dmc.shift >>= 1;
+    }
+
+  if (--dmc.bits_remaining == 0)
+    {
+      dmc.bits_remaining = 8;
+      if (dmc.buffer_empty)
+        {
+          dmc.silence = true;
+        }
+      else
+        {
+          dmc.silence = false;
+          dmc.shift = dmc.buffer;
+          dmc.buffer_empty = true;
+          FetchDmc();
+        }
+    }
+
+  dmc.next_clock += dmc.period;
+}
+
+// The sample reader refills the one byte buffer straight from the CPU bus
+void Apu::FetchDmc()
+{
+  if (!dmc.buffer_empty || dmc.bytes_remaining == 0)
+    return;
+
+  dmc.buffer = cpu ? cpu->memory->GetMemory(dmc.current_addr) : 0;
+  dmc.buffer_empty = false;
+  dmc.current_addr = dmc.current_addr == 0xFFFF ? 0x8000 : dmc.current_addr + 1;
+
+  if (--dmc.bytes_remaining == 0)
+    {
+      if (dmc.loop)
+        {
+          RestartDmc();
+        }
+      else if (dmc.irq_enabled)
+        {
+          dmc.irq = true;
+          UpdateDmcIrq();
+        }
+    }
+}
+
+void Apu::RestartDmc()
+{
+  dmc.current_addr = dmc.sample_addr;
+  dmc.bytes_remaining = dmc.sample_length;
+}
+
+void Apu::SetFrameIrq(bool level)
+{
+  frame_irq = level;
+  if (cpu)
+    cpu->SetIrq(Cpu::IRQ_APU_FRAME, level);
+}
+
+void Apu::Reschedule()
+{
+  if (!scheduler)
+    return;
+
+  scheduler->Schedule(EventType::FrameIrq, NextFrameIrqCycle());
+  scheduler->Schedule(EventType::DmcIrq, NextDmcIrqCycle());
+}
+
+void Apu::UpdateDmcIrq()
+{
+  if (cpu)
+    cpu->SetIrq(Cpu::IRQ_DMC, dmc.irq);
+}
@@ -0,0 +1,195 @@
+#ifndef GOOGLETESTSEXAMPLE_APU_H
+#define GOOGLETESTSEXAMPLE_APU_H
+
+#include <cstdint>
+
+#include "blip_buffer.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "state.h"
+#include "utils/types.h"
+
+class Cpu;
+
+/*
+ *  2A03 audio: two pulse channels, triangle, noise and DMC, registers at
+ *  $4000-$4013, $4015 and $4017.
+ *
+ *  Like the PPU the APU is only caught up when the CPU touches it, when
+ *  one of its IRQ events comes due or when the host loop asks. Catching
+ *  up does not tick every CPU cycle: each channel keeps the cycle its
+ *  timer next expires on, and the channels are stepped from one expiry to
+ *  the next. Whenever the mixed level changes the difference goes into a
+ *  BlipBuffer, which does the band-limited resampling. Audio becomes
+ *  readable in blocks, one per frame counter step (about 4 ms).
+ */
+class Apu : public BusDevice, public EventSource
+{
+public:
+  static constexpr double CPU_CLOCK_NTSC = 1789773.0;
+  static constexpr uint64_t NEVER = UINT64_MAX;
+
+  explicit Apu(int sample_rate = 48000);
+
+  void Reset();
+
+  void ConnectCpu(Cpu* cpu);
+
+  // Keeps EventType::FrameIrq and EventType::DmcIrq on the scheduler current
+  void ConnectScheduler(Scheduler* scheduler);
+
+  byte Read(word addr) override;
+  void Write(word addr, byte data) override;
+
+  // Runs the channels up to the given CPU cycle
+  void CatchUp(uint64_t cpu_cycle);
+
+  void RunEvent(EventType type, uint64_t cycle) override;
+
+  // Earliest CPU cycle the APU may raise an IRQ on, NEVER if none is due
+  uint64_t NextIrqCycle() const;
+  uint64_t NextFrameIrqCycle() const;
+  uint64_t NextDmcIrqCycle() const; // a lower bound
+
+  // Channel and frame counter state. Audio not yet read is dropped on load
+  void SaveState(StateWriter& writer) const;
+  void LoadState(StateReader& reader);
+
+  // Everything of `other` but its wiring, audio not yet read included
+  void CopyState(const Apu& other);
+
+  int SamplesAvailable() const;
+  int ReadSamples(int16_t* out, int count);
+
+private:
+  struct Envelope
+  {
+    bool start = false;
+    bool loop = false; // doubles as the length counter halt flag
+    bool constant = false;
+    byte period = 0;
+    byte divider = 0;
+    byte decay = 0;
+
+    void Clock();
+    byte Volume() const;
+  };
+
+  struct Pulse
+  {
+    bool enabled = false;
+    bool ones_complement = false; // pulse 1 negates with one's complement
+    byte duty = 0;
+    byte step = 0;
+    byte length = 0;
+    word period = 0;
+    uint64_t next_clock = 0;
+    Envelope envelope;
+
+    bool sweep_enabled = false;
+    bool sweep_negate = false;
+    bool sweep_reload = false;
+    byte sweep_period = 0;
+    byte sweep_shift = 0;
+    byte sweep_divider = 0;
+
+    void Write(int reg, byte data);
+    void ClockTimer();
+    void ClockSweep();
+    word SweepTarget() const;
+    byte Output() const;
+  };
+
+  struct Triangle
+  {
+    bool enabled = false;
+    bool control = false;
+    bool linear_reload = false;
+    byte linear_period = 0;
+    byte linear = 0;
+    byte step = 0;
+    byte length = 0;
+    word period = 0;
+    uint64_t next_clock = NEVER;
+
+    void ClockTimer();
+    void ClockLinear();
+    byte Output() const;
+  };
+
+  struct Noise
+  {
+    bool enabled = false;
+    bool short_mode = false;
+    byte length = 0;
+    word period = 0;
+    word shift = 1;
+    uint64_t next_clock = 0;
+    Envelope envelope;
+
+    void ClockTimer();
+    byte Output() const;
+  };
+
+  struct Dmc
+  {
+    bool irq_enabled = false;
+    bool irq = false;
+    bool loop = false;
+    bool silence = true;
+    bool buffer_empty = true;
+    byte level = 0;
+    byte buffer = 0;
+    byte shift = 0;
+    byte bits_remaining = 8;
+    word period = 0;
+    word sample_addr = 0xC000;
+    word sample_length = 1;
+    word current_addr = 0xC000;
+    word bytes_remaining = 0;
+    uint64_t next_clock = 0;
+  };
+
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive);
+
+  void Run(uint64_t end);
+  void UpdateOutput(uint64_t cycle);
+  void EndBlock();
+
+  void ClockFrameCounter();
+  void QuarterFrame();
+  void HalfFrame();
+  uint64_t NextFrameEvent() const;
+
+  void ClockDmc();
+  void FetchDmc();
+  void RestartDmc();
+
+  void SetFrameIrq(bool level);
+  void UpdateDmcIrq();
+  void Reschedule();
+
+  Cpu* cpu = nullptr;
+  Scheduler* scheduler = nullptr;
+
+  Pulse pulse[2];
+  Triangle triangle;
+  Noise noise;
+  Dmc dmc;
+
+  // frame counter
+  bool five_step = false;
+  bool irq_inhibit = false;
+  bool frame_irq = false;
+  int frame_step = 0;
+  uint64_t frame_start = 0;
+
+  uint64_t cycle = 0; // CPU cycle the APU has been run to
+  uint64_t block_start = 0;
+  int output = 0;
+
+  BlipBuffer blip;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include <chrono>
+#include <memory>
+
+#include "batch_runner.h"
+
+namespace
+{
+BatchResult RunJob(const BatchJob& job)
+{
+  BatchResult result;
+  result.rom_path = job.rom_path;
+  result.frames = job.frames;
+
+  auto start = std::chrono::steady_clock::now();
+
+  // consoles are large, keep them off the worker stacks
+  auto nes = std::make_unique<Nes>();
+  if (!nes->LoadCartridge(job.rom_path))
+    {
+      result.error = nes->cartridge.GetError();
+      return result;
+    }
+
+  for (uint64_t frame = 0; frame < job.frames; frame++)
+    nes->RunFrame();
+
+  result.ok = true;
+  result.hash = HashState(*nes);
+  result.cycles = nes->cpu.cycles;
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+} // namespace
+
+std::vector<BatchResult> RunBatch(const std::vector<BatchJob>& jobs, ThreadPool& pool)
+{
+  std::vector<BatchResult> results(jobs.size());
+
+  for (size_t i = 0; i < jobs.size(); i++)
+    pool.Submit([&jobs, &results, i] { results[i] = RunJob(jobs[i]); });
+
+  pool.Wait();
+  return results;
+}
@@ -0,0 +1,34 @@
+#ifndef GOOGLETESTSEXAMPLE_BATCH_RUNNER_H
+#define GOOGLETESTSEXAMPLE_BATCH_RUNNER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "nes.h"
+#include "state_hash.h"
+#include "thread_pool.h"
+
+struct BatchJob
+{
+  std::string rom_path;
+  uint64_t frames = 0;
+};
+
+struct BatchResult
+{
+  std::string rom_path;
+  uint64_t frames = 0;
+
+  bool ok = false;
+  std::string error;
+
+  uint64_t hash = 0; // HashState after the last frame
+  uint64_t cycles = 0;
+  double seconds = 0;
+};
+
+// Runs every job as its own console on the pool, results in job order
+std::vector<BatchResult> RunBatch(const std::vector<BatchJob>& jobs, ThreadPool& pool);
+
+#endif
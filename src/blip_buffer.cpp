@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+
+#include "blip_buffer.h"
+
+namespace
+{
+using Kernel = std::array<std::array<int32_t, BlipBuffer::KERNEL_WIDTH>, BlipBuffer::PHASE_COUNT>;
+
+/*
+ *  One Blackman-windowed sinc impulse per sub-sample phase, each scaled so
+ *  its taps sum to exactly KERNEL_UNIT: a step then settles at precisely
+ *  `delta` once integrated, whatever its phase.
+ */
+Kernel MakeKernel()
+{
+  constexpr double CUTOFF = 0.9; // fraction of the output Nyquist rate
+  constexpr int HALF = BlipBuffer::KERNEL_WIDTH / 2;
+  constexpr int32_t UNIT = 1 << BlipBuffer::KERNEL_UNIT_BITS;
+
+  Kernel kernel{};
+  for (int phase = 0; phase < BlipBuffer::PHASE_COUNT; phase++)
+    {
+      double taps[BlipBuffer::KERNEL_WIDTH];
+      double sum = 0;
+
+      for (int i = 0; i < BlipBuffer::KERNEL_WIDTH; i++)
+        {
+          double x = i - (HALF - 1) - static_cast<double>(phase) / BlipBuffer::PHASE_COUNT;
+          double angle = std::numbers::pi * x / HALF;
+          double window = std::abs(x) >= HALF ? 0 : 0.42 + 0.5 * std::cos(angle) + 0.08 * std::cos(2 * angle);
+          double y = std::numbers::pi * CUTOFF * x;
+          double sinc = x == 0 ? 1 : std::sin(y) / y;
+
+          taps[i] = sinc * window;
+          sum += taps[i];
+        }
+
+      int32_t total = 0;
+      for (int i = 0; i < BlipBuffer::KERNEL_WIDTH; i++)
+        {
+          kernel[phase][i] = static_cast<int32_t>(std::lround(taps[i] * UNIT / sum));
+          total += kernel[phase][i];
+        }
+
+      // rounding leftovers go to the centre tap
+      kernel[phase][HALF - 1] += UNIT - total;
+    }
+  return kernel;
+}
+
+const Kernel KERNEL = MakeKernel();
+} // namespace
+
+BlipBuffer::BlipBuffer(double clock_rate, double sample_rate, int max_samples)
+  : factor(static_cast<uint64_t>(std::ceil(sample_rate / clock_rate * (uint64_t{1} << FRAC_BITS)))),
+    capacity(max_samples),
+    buffer(max_samples + KERNEL_WIDTH, 0)
+{
+}
+
+void BlipBuffer::Clear()
+{
+  offset = 0;
+  integrator = 0;
+  std::fill(buffer.begin(), buffer.end(), 0);
+}
+
+void BlipBuffer::AddDelta(uint64_t clock, int delta)
+{
+  uint64_t position = offset + clock * factor;
+  uint64_t index = position >> FRAC_BITS;
+  int phase = (position >> (FRAC_BITS - PHASE_BITS)) & (PHASE_COUNT - 1);
+
+  // past the end: the caller ran far ahead without ending a frame
+  if (index + KERNEL_WIDTH > buffer.size())
+    return;
+
+  int32_t* out = buffer.data() + index;
+  const auto& taps = KERNEL[phase];
+  for (int i = 0; i < KERNEL_WIDTH; i++)
+    out[i] += delta * taps[i];
+}
+
+void BlipBuffer::EndFrame(uint64_t clocks)
+{
+  offset += clocks * factor;
+
+  int excess = SamplesAvailable() - capacity;
+  if (excess > 0)
+    ReadSamples(nullptr, excess);
+}
+
+int BlipBuffer::SamplesAvailable() const
+{
+  return static_cast<int>(offset >> FRAC_BITS);
+}
+
+int BlipBuffer::ReadSamples(int16_t* out, int count)
+{
+  count = std::min(count, SamplesAvailable());
+  if (count <= 0)
+    return 0;
+
+  // only discarding can ask for more than the buffer holds; past its end
+  // there are no deltas and the high-pass has long decayed to silence
+  int buffered = std::min<int>(count, buffer.size());
+  int integrated = std::min(count, buffered + (1 << 16));
+
+  int32_t sum = integrator;
+  for (int i = 0; i < integrated; i++)
+    {
+      int32_t sample = sum >> KERNEL_UNIT_BITS;
+      if (i < buffered)
+        sum += buffer[i];
+      sum -= sample << (KERNEL_UNIT_BITS - BASS_SHIFT);
+
+      if (out)
+        out[i] = static_cast<int16_t>(std::clamp(sample, int32_t{INT16_MIN}, int32_t{INT16_MAX}));
+    }
+  integrator = integrated < count ? 0 : sum;
+
+  // shift what is left, including the tails of pending steps, to the front
+  std::copy(buffer.begin() + buffered, buffer.end(), buffer.begin());
+  std::fill(buffer.end() - buffered, buffer.end(), 0);
+  offset -= uint64_t(count) << FRAC_BITS;
+
+  return count;
+}
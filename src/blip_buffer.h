@@ -0,0 +1,53 @@
+#ifndef GOOGLETESTSEXAMPLE_BLIP_BUFFER_H
+#define GOOGLETESTSEXAMPLE_BLIP_BUFFER_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ *  Band-limited step synthesis. Instead of producing a sample for every
+ *  input clock, callers only report the clocks at which the signal changes
+ *  and by how much; each change is spread over a few output samples with a
+ *  windowed-sinc step. The output is then a plain running sum, so the cost
+ *  scales with the number of amplitude changes, not with the clock rate.
+ *
+ *  Time is measured in input clocks from the start of the current frame.
+ *  EndFrame() turns everything before the given clock into samples that
+ *  ReadSamples() hands out.
+ */
+class BlipBuffer
+{
+public:
+  static constexpr int PHASE_BITS = 5;
+  static constexpr int PHASE_COUNT = 1 << PHASE_BITS;
+  static constexpr int KERNEL_WIDTH = 16;
+  static constexpr int KERNEL_UNIT_BITS = 13;
+
+  // Keeps up to max_samples unread samples, older ones are dropped
+  BlipBuffer(double clock_rate, double sample_rate, int max_samples);
+
+  void Clear();
+
+  // Adds a step of `delta` at `clock` clocks into the current frame
+  void AddDelta(uint64_t clock, int delta);
+
+  void EndFrame(uint64_t clocks);
+
+  int SamplesAvailable() const;
+
+  // Copies out up to `count` samples, null just discards them
+  int ReadSamples(int16_t* out, int count);
+
+private:
+  static constexpr int FRAC_BITS = 32;
+  static constexpr int BASS_SHIFT = 9; // DC blocking high-pass
+
+  uint64_t factor; // output samples per input clock, 32.32 fixed point
+  uint64_t offset = 0; // start of the current frame, 32.32 samples
+  int capacity;
+  int32_t integrator = 0;
+
+  std::vector<int32_t> buffer;
+};
+
+#endif
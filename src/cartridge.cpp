@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cartridge.h"
+#include "mapper.h"
+
+namespace
+{
+constexpr uint32_t PRG_UNIT = 16 * 1024;
+constexpr uint32_t CHR_UNIT = 8 * 1024;
+constexpr uint32_t TRAINER_SIZE = 512;
+constexpr uint32_t TRAINER_ADDRESS = 0x1000; // $7000 in PRG RAM
+constexpr uint32_t DEFAULT_PRG_RAM_SIZE = 8 * 1024;
+
+// NES 2.0 ROM sizes: a 12-bit unit count, or 2^E * (MM * 2 + 1) bytes when
+// the high nibble is all ones
+uint32_t Nes2RomSize(byte lsb, byte msb_nibble, uint32_t unit)
+{
+  if (msb_nibble == 0x0F)
+    {
+      uint32_t exponent = lsb >> 2;
+      uint32_t multiplier = (lsb & 0x03) * 2 + 1;
+      return exponent < 32 ? (1u << exponent) * multiplier : 0;
+    }
+  return ((msb_nibble << 8) | lsb) * unit;
+}
+
+// NES 2.0 RAM sizes are stored as a shift count, 0 meaning none
+uint32_t Nes2RamSize(byte shift)
+{
+  return shift == 0 ? 0 : 64u << shift;
+}
+} // namespace
+
+bool ParseHeader(const byte* data, size_t size, CartridgeHeader& header)
+{
+  if (size < CartridgeHeader::SIZE || std::memcmp(data, "NES\x1A", 4) != 0)
+    return false;
+
+  byte flags6 = data[6];
+  byte flags7 = data[7];
+
+  header = CartridgeHeader{};
+  header.nes2 = (flags7 & 0x0C) == 0x08;
+  header.battery = flags6 & 0x02;
+  header.trainer = flags6 & 0x04;
+
+  if (flags6 & 0x08)
+    header.mirroring = Mirroring::FourScreen;
+  else
+    header.mirroring = (flags6 & 0x01) ? Mirroring::Vertical : Mirroring::Horizontal;
+
+  if (header.nes2)
+    {
+      header.mapper = (flags6 >> 4) | (flags7 & 0xF0) | ((data[8] & 0x0F) << 8);
+      header.submapper = data[8] >> 4;
+      header.prg_rom_size = Nes2RomSize(data[4], data[9] & 0x0F, PRG_UNIT);
+      header.chr_rom_size = Nes2RomSize(data[5], data[9] >> 4, CHR_UNIT);
+      header.prg_ram_size = Nes2RamSize(data[10] & 0x0F) + Nes2RamSize(data[10] >> 4);
+      header.chr_ram_size = Nes2RamSize(data[11] & 0x0F) + Nes2RamSize(data[11] >> 4);
+      header.region = static_cast<Region>(data[12] & 0x03);
+    }
+  else
+    {
+      // Old dumps ("DiskDude!") filled bytes 7-15 with garbage, in which
+      // case the upper mapper nibble cannot be trusted
+      bool dirty_tail = data[12] | data[13] | data[14] | data[15];
+
+      header.mapper = (flags6 >> 4) | (dirty_tail ? 0 : (flags7 & 0xF0));
+      header.prg_rom_size = data[4] * PRG_UNIT;
+      header.chr_rom_size = data[5] * CHR_UNIT;
+      header.prg_ram_size = data[8] ? data[8] * DEFAULT_PRG_RAM_SIZE : DEFAULT_PRG_RAM_SIZE;
+      header.chr_ram_size = header.chr_rom_size == 0 ? CHR_UNIT : 0;
+      header.region = (data[9] & 0x01) ? Region::PAL : Region::NTSC;
+    }
+
+  return true;
+}
+
+Cartridge::Cartridge() = default;
+
+Cartridge::~Cartridge()
+{
+  Unload();
+}
+
+bool Cartridge::Load(const std::string& path)
+{
+  Unload();
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return Fail("cannot open " + path);
+
+  struct stat info = {};
+  if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(CartridgeHeader::SIZE))
+    {
+      close(fd);
+      return Fail(path + " is too small to be a ROM");
+    }
+
+  // MAP_PRIVATE + PROT_READ: the page cache pages are shared by every
+  // process that maps the same file, nothing is ever copied
+  size_t size = info.st_size;
+  void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (address == MAP_FAILED)
+    return Fail("cannot map " + path);
+
+  madvise(address, size, MADV_WILLNEED);
+  mapping.reset(static_cast<const byte*>(address), [size](const byte* data) { munmap(const_cast<byte*>(data), size); });
+  mapping_size = size;
+
+  const byte* data = mapping.get();
+
+  if (!ParseHeader(data, mapping_size, header))
+    {
+      Unload();
+      return Fail(path + " has no iNES header");
+    }
+
+  size_t offset = CartridgeHeader::SIZE + (header.trainer ? TRAINER_SIZE : 0);
+  if (offset + header.prg_rom_size + header.chr_rom_size > mapping_size)
+    {
+      Unload();
+      return Fail(path + " is truncated");
+    }
+
+  if (header.prg_rom_size == 0 || header.prg_rom_size % Memory::PAGE_SIZE != 0)
+    {
+      Unload();
+      return Fail(path + " has an unusable PRG ROM size");
+    }
+
+  prg_rom = data + offset;
+  chr_rom = header.chr_rom_size ? prg_rom + header.prg_rom_size : nullptr;
+
+  // always back the whole $6000-$7FFF window, even for carts without RAM
+  prg_ram.assign(std::max(header.prg_ram_size, DEFAULT_PRG_RAM_SIZE), 0);
+
+  // the trainer is loaded at $7000, where the copier it was dumped with had it
+  if (header.trainer)
+    std::copy_n(data + CartridgeHeader::SIZE, TRAINER_SIZE, prg_ram.begin() + TRAINER_ADDRESS);
+
+  return true;
+}
+
+void Cartridge::Unload()
+{
+  mapper.reset();
+
+  mapping.reset();
+  mapping_size = 0;
+  prg_rom = nullptr;
+  chr_rom = nullptr;
+  prg_ram.clear();
+  bus = nullptr;
+  header = CartridgeHeader{};
+}
+
+void Cartridge::Share(const Cartridge& other)
+{
+  Unload();
+
+  header = other.header;
+  mapping = other.mapping;
+  mapping_size = other.mapping_size;
+  prg_rom = other.prg_rom;
+  chr_rom = other.chr_rom;
+  prg_ram = other.prg_ram;
+}
+
+bool Cartridge::IsLoaded() const
+{
+  return prg_rom != nullptr;
+}
+
+const std::string& Cartridge::GetError() const
+{
+  return error;
+}
+
+const CartridgeHeader& Cartridge::GetHeader() const
+{
+  return header;
+}
+
+const byte* Cartridge::GetPrgRom() const
+{
+  return prg_rom;
+}
+
+const byte* Cartridge::GetChrRom() const
+{
+  return chr_rom;
+}
+
+Mapper* Cartridge::GetMapper() const
+{
+  return mapper.get();
+}
+
+bool Cartridge::MapInto(Memory& memory, Ppu* ppu, Cpu* cpu, Scheduler* scheduler)
+{
+  if (!IsLoaded())
+    return Fail("no ROM loaded");
+
+  mapper.reset();
+  mapper = CreateMapper(*this);
+  if (!mapper)
+    return Fail("mapper " + std::to_string(header.mapper) + " is not supported");
+
+  memory.MapInternal(0x60, 0x7F, DEFAULT_PRG_RAM_SIZE);
+  StateReader reader({prg_ram.data(), DEFAULT_PRG_RAM_SIZE});
+  memory.LoadFrames(reader, 0x60, 0x7F);
+  bus = &memory;
+
+  mapper->Connect(&memory, ppu, cpu, scheduler);
+  mapper->Reset();
+
+  return true;
+}
+
+void Cartridge::SaveState(StateWriter& writer) const
+{
+  uint32_t size = prg_ram.size();
+  writer.Field(size);
+  if (bus)
+    {
+      bus->SaveFrames(writer, 0x60, 0x7F);
+      writer.Bytes(prg_ram.data() + DEFAULT_PRG_RAM_SIZE, size - DEFAULT_PRG_RAM_SIZE);
+    }
+  else
+    writer.Bytes(prg_ram.data(), size);
+
+  if (mapper)
+    mapper->SaveState(writer);
+}
+
+void Cartridge::LoadState(StateReader& reader)
+{
+  uint32_t size = 0;
+  reader.Field(size);
+  if (size != prg_ram.size())
+    {
+      reader.Fail();
+      return;
+    }
+  if (bus)
+    {
+      bus->LoadFrames(reader, 0x60, 0x7F);
+      reader.Bytes(prg_ram.data() + DEFAULT_PRG_RAM_SIZE, size - DEFAULT_PRG_RAM_SIZE);
+    }
+  else
+    reader.Bytes(prg_ram.data(), size);
+
+  if (mapper)
+    mapper->LoadState(reader);
+}
+
+bool Cartridge::Fail(const std::string& message)
+{
+  error = message;
+  return false;
+}
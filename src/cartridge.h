@@ -0,0 +1,125 @@
+#ifndef GOOGLETESTSEXAMPLE_CARTRIDGE_H
+#define GOOGLETESTSEXAMPLE_CARTRIDGE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "memory.h"
+#include "state.h"
+#include "utils/types.h"
+
+enum class Mirroring : byte
+{
+  Horizontal,
+  Vertical,
+  FourScreen,
+  SingleScreenLow, // set by mappers only (MMC1, AxROM)
+  SingleScreenHigh
+};
+
+enum class Region : byte
+{
+  NTSC,
+  PAL,
+  Multi,
+  Dendy
+};
+
+struct CartridgeHeader
+{
+  static constexpr size_t SIZE = 16;
+
+  uint16_t mapper = 0;
+  byte submapper = 0;
+  Mirroring mirroring = Mirroring::Horizontal;
+  Region region = Region::NTSC;
+  bool battery = false;
+  bool trainer = false; // 512 bytes for PRG RAM at $7000
+  bool nes2 = false;
+
+  uint32_t prg_rom_size = 0;
+  uint32_t chr_rom_size = 0;
+  uint32_t prg_ram_size = 0; // volatile + battery backed
+  uint32_t chr_ram_size = 0;
+};
+
+class Cpu;
+class Mapper;
+class Ppu;
+class Scheduler;
+
+// Decodes an iNES or NES 2.0 header, false if `data` is not one
+bool ParseHeader(const byte* data, size_t size, CartridgeHeader& header);
+
+/*
+ *  A ROM image mapped read-only into the address space with mmap. PRG and
+ *  CHR are never copied: the bus and the PPU point straight into the
+ *  mapping, so every emulator instance running the same ROM shares the
+ *  same physical pages.
+ */
+class Cartridge
+{
+public:
+  Cartridge();
+  ~Cartridge();
+
+  Cartridge(const Cartridge&) = delete;
+  Cartridge& operator=(const Cartridge&) = delete;
+
+  bool Load(const std::string& path);
+
+  // Loads the ROM `other` has loaded, sharing its mapping rather than
+  // opening the file again. Map it in as after Load, PRG RAM starts out
+  // as after Load too
+  void Share(const Cartridge& other);
+  void Unload();
+
+  bool IsLoaded() const;
+  const std::string& GetError() const;
+
+  const CartridgeHeader& GetHeader() const;
+
+  const byte* GetPrgRom() const;
+  const byte* GetChrRom() const;
+
+  // Null until MapInto
+  Mapper* GetMapper() const;
+
+  // PRG RAM and the mapper's registers; loading fails if the state was
+  // saved with another RAM size. $6000-$7FFF is read from the bus it was
+  // mapped into
+  void SaveState(StateWriter& writer) const;
+  void LoadState(StateReader& reader);
+
+  /*
+   *  Maps PRG RAM at $6000-$7FFF, on the bus' internal frames so that it
+   *  forks with the bus, and creates the board's mapper, which
+   *  maps PRG ROM at $8000-$FFFF and CHR into the PPU at its power-on
+   *  banks. The PPU, CPU and scheduler are optional, e.g. for a bare bus.
+   *  Fails for boards that have no mapper yet
+   */
+  bool MapInto(Memory& memory, Ppu* ppu = nullptr, Cpu* cpu = nullptr, Scheduler* scheduler = nullptr);
+
+private:
+  bool Fail(const std::string& message);
+
+  CartridgeHeader header;
+  std::string error;
+
+  std::shared_ptr<const byte> mapping; // unmapped with the last cartridge sharing it
+  size_t mapping_size = 0;
+
+  const byte* prg_rom = nullptr;
+  const byte* chr_rom = nullptr;
+
+  // PRG RAM as loaded, trainer included. Once mapped the first 8 KB live
+  // on the bus instead
+  std::vector<byte> prg_ram;
+  Memory* bus = nullptr;
+
+  std::unique_ptr<Mapper> mapper;
+};
+
+#endif
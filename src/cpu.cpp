@@ -1,22 +1,37 @@
-#include <iostream>
+#include <algorithm>
 
 #include "cpu.h"
+#include "jit.h"
+#include "scheduler.h"
 
+// Implied and immediate operands were already latched into `fetched` by
+// the addressing mode, everything else has to be read from memory
+template <AddrMode mode>
 byte Cpu::fetch()
 {
-  if (lookup[opcode].addr_mode != &Cpu::IMP)
+  if constexpr (mode != AddrMode::IMP && mode != AddrMode::IMM)
     fetched = memory->GetMemory(addr_abs);
   return fetched;
 }
 
+// Shift and rotate results go back to the accumulator when implied
+template <AddrMode mode>
+void Cpu::writeback(byte value)
+{
+  if constexpr (mode == AddrMode::IMP)
+    A = value;
+  else
+    memory->SetMemory(value, addr_abs);
+}
+
 bool Cpu::GetFlag(word flag)
 {
-  return (status & flag) > 0;
+  return status.Test(flag);
 }
 
 void Cpu::SetFlag(word flag, bool value)
 {
-  status = value ? (status | flag) : (status & ~flag);
+  status.Assign(flag, value);
 }
 
 /*
@@ -32,20 +47,20 @@ void Cpu::Reset()
   PC = (pc_hi << 8) | pc_lo;
   SP = 0xFD; // startup value
 
-  SetFlag(C, false);
+  // the 2A03 comes out of reset with IRQs masked, the game clears I when
+  // it is ready for them
+  status.SetCarry(false);
   SetFlag(Z, false);
-  SetFlag(I, false);
+  SetFlag(I, true);
   SetFlag(D, false);
   SetFlag(B, false);
-  // SetFlag(U, false);
-  SetFlag(V, false);
+  SetFlag(U, true);
+  status.SetOverflow(false);
   SetFlag(N, false);
 
   A = X = Y = 0;
 
-  memory->Setup();
-
-  cycles = 8; // the reset function consumes 8 cycles
+  cycles += 8; // the reset function consumes 8 cycles
 }
 
 // TODO: write tests
@@ -61,17 +76,17 @@ void Cpu::Irq()
 
       SetFlag(B, false);
       SetFlag(U, true);
-      SetFlag(I, true);
-
-      memory->SetMemory(0x0100 + SP, status);
+      memory->SetMemory(status, 0x0100 + SP);
       SP--;
 
+      SetFlag(I, true);
+
       word pc_lo = memory->GetMemory(0xFFFE);
       word pc_hi = memory->GetMemory(0xFFFF);
 
       PC = (pc_hi << 8) | pc_lo;
 
-      cycles = 7;
+      cycles += 7;
     }
 }
 
@@ -85,17 +100,17 @@ void Cpu::Nmi()
 
   SetFlag(B, false);
   SetFlag(U, true);
-  SetFlag(I, true);
-
-  memory->SetMemory(0x0100 + SP, status);
+  memory->SetMemory(status, 0x0100 + SP);
   SP--;
 
+  SetFlag(I, true);
+
   word pc_lo = memory->GetMemory(0xFFFA);
   word pc_hi = memory->GetMemory(0xFFFB);
 
   PC = (pc_hi << 8) | pc_lo;
 
-  cycles = 7;
+  cycles += 7;
 }
 
 byte Cpu::FetchByte()
@@ -104,7 +119,7 @@ byte Cpu::FetchByte()
   byte data = memory->GetMemory(program_counter_addr);
 
   PC++;
-  cycles--;
+  cycles++;
 
   return data;
 }
@@ -116,7 +131,7 @@ word Cpu::FetchWord()
   byte data_2 = memory->GetMemory(PC);
   PC++;
 
-  cycles -= 2;
+  cycles += 2;
 
   return (data_1 << 8) | data_2;
 }
@@ -124,181 +139,85 @@ word Cpu::FetchWord()
 byte Cpu::ReadByte(byte addr)
 {
   byte data = memory->GetMemory(addr);
-  cycles--;
+  cycles++;
   return data;
 }
 
-void Cpu::LDASetStatus()
-{
-  Z = (A == 0);
-  N = (A & 0b10000000) > 0;
-}
-
-void Cpu::Execute(byte _cycles)
-{
-  // std::cout << "Loaded" << lookupTable->table.size() << "instructions" << std::endl;
-  this->cycles = _cycles;
-  std::cout << "Calling execute, executing " << (int)this->cycles << " cycles" << std::endl;
-  while (this->cycles > 0)
-    {
-      Instruction fetched_byte = FetchByte();
-      auto instruction = static_cast<Instruction>(fetched_byte);
-
-      switch (instruction)
-        {
-          case Instruction::INS_LDA_ZP: {
-            std::cout << "INS_LDA_ZP" << std::endl;
-            byte zero_page_addr = FetchByte();
-            A = ReadByte(zero_page_addr);
-
-            LDASetStatus();
-          }
-          break;
-          case Instruction::INS_LDA_ZPX: {
-            std::cout << "INS_LDA_ZPX" << std::endl;
-
-            byte zero_page_addr = FetchByte();
-            zero_page_addr += X;
-
-            cycles--;
-
-            A = ReadByte(zero_page_addr);
-
-            LDASetStatus();
-          }
-          break;
-          case Instruction::INS_LDA_IM: {
-            std::cout << "INS_LDA_IM" << std::endl;
-
-            byte val = FetchByte();
-            A = val;
-
-            LDASetStatus();
-          }
-          break;
-          case Instruction::INS_JSR: {
-            std::cout << "INS_JSR" << std::endl;
-
-            word addr = FetchWord();
-            memory->WriteWord(PC - 1, SP);
-
-            PC = addr;
-
-            cycles--;
-          }
-          break;
-          default: {
-            std::cout << "instruction not found " << instruction << std::endl;
-          }
-          break;
-        }
-    }
-}
-
-byte Cpu::IMP()
+/*
+ *  The addressing modes receive the operand bytes that followed the
+ *  opcode (low byte first), already consumed from the program counter.
+ */
+byte Cpu::IMP(word)
 {
   fetched = A;
   return 0;
 }
 
-byte Cpu::IMM()
+byte Cpu::IMM(word operand)
 {
-  addr_abs = PC++;
+  fetched = operand & 0x00FF;
   return 0;
 }
 
-byte Cpu::ZP0()
+byte Cpu::ZP0(word operand)
 {
-  addr_abs = memory->GetMemory(PC);
-  PC++;
-  addr_abs &= 0x00FF;
+  addr_abs = operand & 0x00FF;
   return 0;
 }
 
-byte Cpu::ZPX()
+byte Cpu::ZPX(word operand)
 {
-  addr_abs = memory->GetMemory(PC);
-  addr_abs += X;
-  addr_abs &= 0x00FF;
+  addr_abs = (operand + X) & 0x00FF;
   return 0;
 }
 
-byte Cpu::ZPY()
+byte Cpu::ZPY(word operand)
 {
-  addr_abs = memory->GetMemory(PC);
-  addr_abs += Y;
-  addr_abs &= 0x00FF;
+  addr_abs = (operand + Y) & 0x00FF;
   return 0;
 }
 
-byte Cpu::REL()
+byte Cpu::REL(word operand)
 {
-  addr_rel = memory->GetMemory(PC);
-  PC++;
+  addr_rel = operand & 0x00FF;
   if (addr_rel & 0x80)
     addr_rel |= 0xFF00;
   return 0;
 }
 
-byte Cpu::ABS()
+byte Cpu::ABS(word operand)
 {
-  word addr_lo = memory->GetMemory(PC);
-  PC++;
-  word addr_hi = memory->GetMemory(PC);
-  PC++;
-  addr_abs = (addr_hi << 8) | addr_lo;
+  addr_abs = operand;
   return 0;
 }
 
-byte Cpu::ABX()
+byte Cpu::ABX(word operand)
 {
-  word addr_lo = memory->GetMemory(PC);
-  PC++;
-  word addr_hi = memory->GetMemory(PC);
-  PC++;
-  addr_abs = (addr_hi << 8) | addr_lo;
-  addr_abs += X;
-  return (addr_abs & 0xFF00) != (addr_hi << 8);
+  addr_abs = operand + X;
+  return (addr_abs & 0xFF00) != (operand & 0xFF00);
 }
 
-byte Cpu::ABY()
+byte Cpu::ABY(word operand)
 {
-  word addr_lo = memory->GetMemory(PC);
-  PC++;
-  word addr_hi = memory->GetMemory(PC);
-  PC++;
-  addr_abs = (addr_hi << 8) | addr_lo;
-  addr_abs += Y;
-  return (addr_abs & 0xFF00) != (addr_hi << 8);
+  addr_abs = operand + Y;
+  return (addr_abs & 0xFF00) != (operand & 0xFF00);
 }
 
-byte Cpu::IND()
+byte Cpu::IND(word operand)
 {
-  word ptr_lo = memory->GetMemory(PC);
-  PC++;
-  word ptr_hi = memory->GetMemory(PC);
-  PC++;
-  word ptr = (ptr_hi << 8) | ptr_lo;
+  // the 6502 never carries into the high byte of the pointer, so a
+  // pointer at $xxFF wraps around to $xx00 for its high byte
+  word ptr_hi_addr = (operand & 0xFF00) | ((operand + 1) & 0x00FF);
 
-  if (ptr_lo == 0x00FF)
-    {
-      addr_abs = (memory->GetMemory(ptr & 0xFF00) << 8) | memory->GetMemory(ptr);
-    }
-  else
-    {
-      addr_abs = (memory->GetMemory(ptr + 1) << 8) | memory->GetMemory(ptr);
-    }
+  addr_abs = (memory->GetMemory(ptr_hi_addr) << 8) | memory->GetMemory(operand);
   return 0;
 }
 
 // Indirect X
-byte Cpu::IZX()
+byte Cpu::IZX(word operand)
 {
-  word val = memory->GetMemory(PC);
-  PC++;
-
-  word read_addr_lo = (word)(val + (word)X) & 0x00FF;
-  word read_addr_hi = (word)(val + (word)X + 1) & 0x00FF;
+  word read_addr_lo = (operand + X) & 0x00FF;
+  word read_addr_hi = (operand + X + 1) & 0x00FF;
 
   word addr_lo = memory->GetMemory(read_addr_lo);
   word addr_hi = memory->GetMemory(read_addr_hi);
@@ -309,32 +228,30 @@ byte Cpu::IZX()
 }
 
 // Indirect Y
-byte Cpu::IZY()
+byte Cpu::IZY(word operand)
 {
-  word val = memory->GetMemory(PC);
-  PC++;
-
-  word read_addr_lo = val & 0x00FF;
-  word read_addr_hi = (val + 1) & 0x00FF;
+  word read_addr_lo = operand & 0x00FF;
+  word read_addr_hi = (operand + 1) & 0x00FF;
 
   word addr_lo = memory->GetMemory(read_addr_lo);
   word addr_hi = memory->GetMemory(read_addr_hi);
 
   addr_abs = (addr_hi << 8) | addr_lo;
+  addr_abs += Y;
 
   return (addr_abs & 0xFF00) != (addr_hi << 8);
-};
+}
 
+template <AddrMode mode>
 byte Cpu::ADC()
 {
-  fetch();
+  fetch<mode>();
 
-  temp = (word)a + (word)fetched + (word)GetFlag(C);
+  temp = (word)A + (word)fetched + (word)status.Carry();
 
-  SetFlag(C, temp > 255);
-  SetFlag(Z, (temp & 0x00FF) == 0);
-  SetFlag(V, (~((word)a ^ (word)fetched) & ((word)a ^ (word)temp)) & 0x0080);
-  SetFlag(N, temp & 0x80);
+  status.SetCarry(temp > 255);
+  status.SetOverflow((~((word)A ^ (word)fetched) & ((word)A ^ (word)temp)) & 0x0080);
+  status.SetNZ(temp & 0x00FF);
 
   A = temp & 0x00FF;
 
@@ -368,9 +285,10 @@ byte Cpu::ADC()
 // of M, the data(!) therfore we can simply add, exactly the same way we did
 // before.
 
+template <AddrMode mode>
 byte Cpu::SBC()
 {
-  fetch();
+  fetch<mode>();
 
   // Operating in 16-bit domain to capture carry out
 
@@ -378,12 +296,11 @@ byte Cpu::SBC()
   word value = ((word)fetched) ^ 0x00FF;
 
   // Notice this is exactly the same as addition from here!
-  temp = (word)a + value + (word)GetFlag(C);
-  SetFlag(C, temp & 0xFF00);
-  SetFlag(Z, ((temp & 0x00FF) == 0));
-  SetFlag(V, (temp ^ (word)a) & (temp ^ value) & 0x0080);
-  SetFlag(N, temp & 0x0080);
-  a = temp & 0x00FF;
+  temp = (word)A + value + (word)status.Carry();
+  status.SetCarry(temp & 0xFF00);
+  status.SetOverflow((temp ^ (word)A) & (temp ^ value) & 0x0080);
+  status.SetNZ(temp & 0x00FF);
+  A = temp & 0x00FF;
   return 1;
 }
 
@@ -400,12 +317,12 @@ byte Cpu::SBC()
 // Instruction: Bitwise Logic AND
 // Function:    A = A & M
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::AND()
 {
-  fetch();
-  a = a & fetched;
-  SetFlag(Z, a == 0x00);
-  SetFlag(N, a & 0x80);
+  fetch<mode>();
+  A = A & fetched;
+  status.SetNZ(A);
   return 1;
 }
 
@@ -413,34 +330,32 @@ byte Cpu::AND()
 // Instruction: Arithmetic Shift Left
 // Function:    A = C <- (A << 1) <- 0
 // Flags Out:   N, Z, C
+template <AddrMode mode>
 byte Cpu::ASL()
 {
-  fetch();
+  fetch<mode>();
   temp = (word)fetched << 1;
-  SetFlag(C, (temp & 0xFF00) > 0);
-  SetFlag(Z, (temp & 0x00FF) == 0x00);
-  SetFlag(N, temp & 0x80);
-  if (lookup[opcode].addrmode == &Cpu::IMP)
-    a = temp & 0x00FF;
-  else
-    write(addr_abs, temp & 0x00FF);
+  status.SetCarry((temp & 0xFF00) > 0);
+  status.SetNZ(temp & 0x00FF);
+  writeback<mode>(temp & 0x00FF);
   return 0;
 }
 
 
 // Instruction: Branch if Carry Clear
 // Function:    if(C == 0) pc = address
+template <AddrMode mode>
 byte Cpu::BCC()
 {
-  if (GetFlag(C) == 0)
+  if (!status.Carry())
     {
       cycles++;
-      addr_abs = pc + addr_rel;
+      addr_abs = PC + addr_rel;
 
-      if((addr_abs & 0xFF00) != (pc & 0xFF00))
+      if((addr_abs & 0xFF00) != (PC & 0xFF00))
         cycles++;
 
-      pc = addr_abs;
+      PC = addr_abs;
     }
   return 0;
 }
@@ -448,17 +363,18 @@ byte Cpu::BCC()
 
 // Instruction: Branch if Carry Set
 // Function:    if(C == 1) pc = address
+template <AddrMode mode>
 byte Cpu::BCS()
 {
-  if (GetFlag(C) == 1)
+  if (status.Carry())
     {
       cycles++;
-      addr_abs = pc + addr_rel;
+      addr_abs = PC + addr_rel;
 
-      if ((addr_abs & 0xFF00) != (pc & 0xFF00))
+      if ((addr_abs & 0xFF00) != (PC & 0xFF00))
         cycles++;
 
-      pc = addr_abs;
+      PC = addr_abs;
     }
   return 0;
 }
@@ -466,45 +382,47 @@ byte Cpu::BCS()
 
 // Instruction: Branch if Equal
 // Function:    if(Z == 1) pc = address
+template <AddrMode mode>
 byte Cpu::BEQ()
 {
-  if (GetFlag(Z) == 1)
+  if (status.Zero())
     {
       cycles++;
-      addr_abs = pc + addr_rel;
+      addr_abs = PC + addr_rel;
 
-      if ((addr_abs & 0xFF00) != (pc & 0xFF00))
+      if ((addr_abs & 0xFF00) != (PC & 0xFF00))
         cycles++;
 
-      pc = addr_abs;
+      PC = addr_abs;
     }
   return 0;
 }
 
+template <AddrMode mode>
 byte Cpu::BIT()
 {
-  fetch();
-  temp = a & fetched;
-  SetFlag(Z, (temp & 0x00FF) == 0x00);
-  SetFlag(N, fetched & (1 << 7));
-  SetFlag(V, fetched & (1 << 6));
+  fetch<mode>();
+  temp = A & fetched;
+  status.SetNZ(temp & 0x00FF, fetched);
+  status.SetOverflow(fetched & (1 << 6));
   return 0;
 }
 
 
 // Instruction: Branch if Negative
 // Function:    if(N == 1) pc = address
+template <AddrMode mode>
 byte Cpu::BMI()
 {
-  if (GetFlag(N) == 1)
+  if (status.Negative())
     {
       cycles++;
-      addr_abs = pc + addr_rel;
+      addr_abs = PC + addr_rel;
 
-      if ((addr_abs & 0xFF00) != (pc & 0xFF00))
+      if ((addr_abs & 0xFF00) != (PC & 0xFF00))
         cycles++;
 
-      pc = addr_abs;
+      PC = addr_abs;
     }
   return 0;
 }
@@ -512,17 +430,18 @@ byte Cpu::BMI()
 
 // Instruction: Branch if Not Equal
 // Function:    if(Z == 0) pc = address
+template <AddrMode mode>
 byte Cpu::BNE()
 {
-  if (GetFlag(Z) == 0)
+  if (!status.Zero())
     {
       cycles++;
-      addr_abs = pc + addr_rel;
+      addr_abs = PC + addr_rel;
 
-      if ((addr_abs & 0xFF00) != (pc & 0xFF00))
+      if ((addr_abs & 0xFF00) != (PC & 0xFF00))
         cycles++;
 
-      pc = addr_abs;
+      PC = addr_abs;
     }
   return 0;
 }
@@ -530,56 +449,56 @@ byte Cpu::BNE()
 
 // Instruction: Branch if Positive
 // Function:    if(N == 0) pc = address
+template <AddrMode mode>
 byte Cpu::BPL()
 {
-  if (GetFlag(N) == 0)
+  if (!status.Negative())
     {
       cycles++;
-      addr_abs = pc + addr_rel;
+      addr_abs = PC + addr_rel;
 
-      if ((addr_abs & 0xFF00) != (pc & 0xFF00))
+      if ((addr_abs & 0xFF00) != (PC & 0xFF00))
         cycles++;
 
-      pc = addr_abs;
+      PC = addr_abs;
     }
   return 0;
 }
 
 // Instruction: Break
 // Function:    Program Sourced Interrupt
+template <AddrMode mode>
 byte Cpu::BRK()
 {
-  pc++;
+  // the padding byte after BRK was already skipped by the IMM addressing
+  memory->SetMemory((PC >> 8) & 0x00FF, 0x0100 + SP);
+  SP--;
+  memory->SetMemory(PC & 0x00FF, 0x0100 + SP);
+  SP--;
 
+  memory->SetMemory(status | B | U, 0x0100 + SP);
+  SP--;
   SetFlag(I, 1);
-  write(0x0100 + stkp, (pc >> 8) & 0x00FF);
-  stkp--;
-  write(0x0100 + stkp, pc & 0x00FF);
-  stkp--;
-
-  SetFlag(B, 1);
-  write(0x0100 + stkp, status);
-  stkp--;
-  SetFlag(B, 0);
 
-  pc = (word)read(0xFFFE) | ((word)read(0xFFFF) << 8);
+  PC = (word)memory->GetMemory(0xFFFE) | ((word)memory->GetMemory(0xFFFF) << 8);
   return 0;
 }
 
 
 // Instruction: Branch if Overflow Clear
 // Function:    if(V == 0) pc = address
+template <AddrMode mode>
 byte Cpu::BVC()
 {
-  if (GetFlag(V) == 0)
+  if (!status.Overflow())
     {
       cycles++;
-      addr_abs = pc + addr_rel;
+      addr_abs = PC + addr_rel;
 
-      if ((addr_abs & 0xFF00) != (pc & 0xFF00))
+      if ((addr_abs & 0xFF00) != (PC & 0xFF00))
         cycles++;
 
-      pc = addr_abs;
+      PC = addr_abs;
     }
   return 0;
 }
@@ -587,17 +506,18 @@ byte Cpu::BVC()
 
 // Instruction: Branch if Overflow Set
 // Function:    if(V == 1) pc = address
+template <AddrMode mode>
 byte Cpu::BVS()
 {
-  if (GetFlag(V) == 1)
+  if (status.Overflow())
     {
       cycles++;
-      addr_abs = pc + addr_rel;
+      addr_abs = PC + addr_rel;
 
-      if ((addr_abs & 0xFF00) != (pc & 0xFF00))
+      if ((addr_abs & 0xFF00) != (PC & 0xFF00))
         cycles++;
 
-      pc = addr_abs;
+      PC = addr_abs;
     }
   return 0;
 }
@@ -605,15 +525,17 @@ byte Cpu::BVS()
 
 // Instruction: Clear Carry Flag
 // Function:    C = 0
+template <AddrMode mode>
 byte Cpu::CLC()
 {
-  SetFlag(C, false);
+  status.SetCarry(false);
   return 0;
 }
 
 
 // Instruction: Clear Decimal Flag
 // Function:    D = 0
+template <AddrMode mode>
 byte Cpu::CLD()
 {
   SetFlag(D, false);
@@ -623,31 +545,34 @@ byte Cpu::CLD()
 
 // Instruction: Disable Interrupts / Clear Interrupt Flag
 // Function:    I = 0
+template <AddrMode mode>
 byte Cpu::CLI()
 {
   SetFlag(I, false);
+  PollIrq();
   return 0;
 }
 
 
 // Instruction: Clear Overflow Flag
 // Function:    V = 0
+template <AddrMode mode>
 byte Cpu::CLV()
 {
-  SetFlag(V, false);
+  status.SetOverflow(false);
   return 0;
 }
 
 // Instruction: Compare Accumulator
 // Function:    C <- A >= M      Z <- (A - M) == 0
 // Flags Out:   N, C, Z
+template <AddrMode mode>
 byte Cpu::CMP()
 {
-  fetch();
-  temp = (word)a - (word)fetched;
-  SetFlag(C, a >= fetched);
-  SetFlag(Z, (temp & 0x00FF) == 0x0000);
-  SetFlag(N, temp & 0x0080);
+  fetch<mode>();
+  temp = (word)A - (word)fetched;
+  status.SetCarry(A >= fetched);
+  status.SetNZ(temp & 0x00FF);
   return 1;
 }
 
@@ -655,13 +580,13 @@ byte Cpu::CMP()
 // Instruction: Compare X Register
 // Function:    C <- X >= M      Z <- (X - M) == 0
 // Flags Out:   N, C, Z
+template <AddrMode mode>
 byte Cpu::CPX()
 {
-  fetch();
-  temp = (word)x - (word)fetched;
-  SetFlag(C, x >= fetched);
-  SetFlag(Z, (temp & 0x00FF) == 0x0000);
-  SetFlag(N, temp & 0x0080);
+  fetch<mode>();
+  temp = (word)X - (word)fetched;
+  status.SetCarry(X >= fetched);
+  status.SetNZ(temp & 0x00FF);
   return 0;
 }
 
@@ -669,13 +594,13 @@ byte Cpu::CPX()
 // Instruction: Compare Y Register
 // Function:    C <- Y >= M      Z <- (Y - M) == 0
 // Flags Out:   N, C, Z
+template <AddrMode mode>
 byte Cpu::CPY()
 {
-  fetch();
-  temp = (word)y - (word)fetched;
-  SetFlag(C, y >= fetched);
-  SetFlag(Z, (temp & 0x00FF) == 0x0000);
-  SetFlag(N, temp & 0x0080);
+  fetch<mode>();
+  temp = (word)Y - (word)fetched;
+  status.SetCarry(Y >= fetched);
+  status.SetNZ(temp & 0x00FF);
   return 0;
 }
 
@@ -683,13 +608,13 @@ byte Cpu::CPY()
 // Instruction: Decrement Value at Memory Location
 // Function:    M = M - 1
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::DEC()
 {
-  fetch();
+  fetch<mode>();
   temp = fetched - 1;
-  write(addr_abs, temp & 0x00FF);
-  SetFlag(Z, (temp & 0x00FF) == 0x0000);
-  SetFlag(N, temp & 0x0080);
+  memory->SetMemory(temp & 0x00FF, addr_abs);
+  status.SetNZ(temp & 0x00FF);
   return 0;
 }
 
@@ -697,11 +622,11 @@ byte Cpu::DEC()
 // Instruction: Decrement X Register
 // Function:    X = X - 1
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::DEX()
 {
-  x--;
-  SetFlag(Z, x == 0x00);
-  SetFlag(N, x & 0x80);
+  X--;
+  status.SetNZ(X);
   return 0;
 }
 
@@ -709,11 +634,11 @@ byte Cpu::DEX()
 // Instruction: Decrement Y Register
 // Function:    Y = Y - 1
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::DEY()
 {
-  y--;
-  SetFlag(Z, y == 0x00);
-  SetFlag(N, y & 0x80);
+  Y--;
+  status.SetNZ(Y);
   return 0;
 }
 
@@ -721,12 +646,12 @@ byte Cpu::DEY()
 // Instruction: Bitwise Logic XOR
 // Function:    A = A xor M
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::EOR()
 {
-  fetch();
-  a = a ^ fetched;
-  SetFlag(Z, a == 0x00);
-  SetFlag(N, a & 0x80);
+  fetch<mode>();
+  A = A ^ fetched;
+  status.SetNZ(A);
   return 1;
 }
 
@@ -734,13 +659,13 @@ byte Cpu::EOR()
 // Instruction: Increment Value at Memory Location
 // Function:    M = M + 1
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::INC()
 {
-  fetch();
+  fetch<mode>();
   temp = fetched + 1;
-  write(addr_abs, temp & 0x00FF);
-  SetFlag(Z, (temp & 0x00FF) == 0x0000);
-  SetFlag(N, temp & 0x0080);
+  memory->SetMemory(temp & 0x00FF, addr_abs);
+  status.SetNZ(temp & 0x00FF);
   return 0;
 }
 
@@ -748,11 +673,11 @@ byte Cpu::INC()
 // Instruction: Increment X Register
 // Function:    X = X + 1
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::INX()
 {
-  x++;
-  SetFlag(Z, x == 0x00);
-  SetFlag(N, x & 0x80);
+  X++;
+  status.SetNZ(X);
   return 0;
 }
 
@@ -760,36 +685,38 @@ byte Cpu::INX()
 // Instruction: Increment Y Register
 // Function:    Y = Y + 1
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::INY()
 {
-  y++;
-  SetFlag(Z, y == 0x00);
-  SetFlag(N, y & 0x80);
+  Y++;
+  status.SetNZ(Y);
   return 0;
 }
 
 
 // Instruction: Jump To Location
 // Function:    pc = address
+template <AddrMode mode>
 byte Cpu::JMP()
 {
-  pc = addr_abs;
+  PC = addr_abs;
   return 0;
 }
 
 
 // Instruction: Jump To Sub-Routine
 // Function:    Push current pc to stack, pc = address
+template <AddrMode mode>
 byte Cpu::JSR()
 {
-  pc--;
+  PC--;
 
-  write(0x0100 + stkp, (pc >> 8) & 0x00FF);
-  stkp--;
-  write(0x0100 + stkp, pc & 0x00FF);
-  stkp--;
+  memory->SetMemory((PC >> 8) & 0x00FF, 0x0100 + SP);
+  SP--;
+  memory->SetMemory(PC & 0x00FF, 0x0100 + SP);
+  SP--;
 
-  pc = addr_abs;
+  PC = addr_abs;
   return 0;
 }
 
@@ -797,12 +724,12 @@ byte Cpu::JSR()
 // Instruction: Load The Accumulator
 // Function:    A = M
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::LDA()
 {
-  fetch();
-  a = fetched;
-  SetFlag(Z, a == 0x00);
-  SetFlag(N, a & 0x80);
+  fetch<mode>();
+  A = fetched;
+  status.SetNZ(A);
   return 1;
 }
 
@@ -810,12 +737,12 @@ byte Cpu::LDA()
 // Instruction: Load The X Register
 // Function:    X = M
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::LDX()
 {
-  fetch();
-  x = fetched;
-  SetFlag(Z, x == 0x00);
-  SetFlag(N, x & 0x80);
+  fetch<mode>();
+  X = fetched;
+  status.SetNZ(X);
   return 1;
 }
 
@@ -823,68 +750,56 @@ byte Cpu::LDX()
 // Instruction: Load The Y Register
 // Function:    Y = M
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::LDY()
 {
-  fetch();
-  y = fetched;
-  SetFlag(Z, y == 0x00);
-  SetFlag(N, y & 0x80);
+  fetch<mode>();
+  Y = fetched;
+  status.SetNZ(Y);
   return 1;
 }
 
+template <AddrMode mode>
 byte Cpu::LSR()
 {
-  fetch();
-  SetFlag(C, fetched & 0x0001);
+  fetch<mode>();
+  status.SetCarry(fetched & 0x0001);
   temp = fetched >> 1;
-  SetFlag(Z, (temp & 0x00FF) == 0x0000);
-  SetFlag(N, temp & 0x0080);
-  if (lookup[opcode].addrmode == &Cpu::IMP)
-    a = temp & 0x00FF;
-  else
-    write(addr_abs, temp & 0x00FF);
+  status.SetNZ(temp & 0x00FF);
+  writeback<mode>(temp & 0x00FF);
   return 0;
 }
 
+template <AddrMode mode>
 byte Cpu::NOP()
 {
-  // Sadly not all NOPs are equal, Ive added a few here
-  // based on https://wiki.nesdev.com/w/index.php/CPU_unofficial_opcodes
-  // and will add more based on game compatibility, and ultimately
-  // I'd like to cover all illegal opcodes too
-  switch (opcode) {
-    case 0x1C:
-    case 0x3C:
-    case 0x5C:
-    case 0x7C:
-    case 0xDC:
-    case 0xFC:
-      return 1;
-      break;
-    }
-  return 0;
+  // Sadly not all NOPs are equal: the absolute,X ones (0x1C, 0x3C, 0x5C,
+  // 0x7C, 0xDC, 0xFC) pay the page crossing penalty like a real read, see
+  // https://wiki.nesdev.com/w/index.php/CPU_unofficial_opcodes
+  return mode == AddrMode::ABX;
 }
 
 
 // Instruction: Bitwise Logic OR
 // Function:    A = A | M
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::ORA()
 {
-  fetch();
-  a = a | fetched;
-  SetFlag(Z, a == 0x00);
-  SetFlag(N, a & 0x80);
+  fetch<mode>();
+  A = A | fetched;
+  status.SetNZ(A);
   return 1;
 }
 
 
 // Instruction: Push Accumulator to Stack
 // Function:    A -> stack
+template <AddrMode mode>
 byte Cpu::PHA()
 {
-  write(0x0100 + stkp, a);
-  stkp--;
+  memory->SetMemory(A, 0x0100 + SP);
+  SP--;
   return 0;
 }
 
@@ -892,12 +807,13 @@ byte Cpu::PHA()
 // Instruction: Push Status Register to Stack
 // Function:    status -> stack
 // Note:        Break flag is set to 1 before push
+template <AddrMode mode>
 byte Cpu::PHP()
 {
-  write(0x0100 + stkp, status | B | U);
+  memory->SetMemory(status | B | U, 0x0100 + SP);
   SetFlag(B, 0);
   SetFlag(U, 0);
-  stkp--;
+  SP--;
   return 0;
 }
 
@@ -905,76 +821,73 @@ byte Cpu::PHP()
 // Instruction: Pop Accumulator off Stack
 // Function:    A <- stack
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::PLA()
 {
-  stkp++;
-  a = read(0x0100 + stkp);
-  SetFlag(Z, a == 0x00);
-  SetFlag(N, a & 0x80);
+  SP++;
+  A = memory->GetMemory(0x0100 + SP);
+  status.SetNZ(A);
   return 0;
 }
 
 
 // Instruction: Pop Status Register off Stack
 // Function:    Status <- stack
+template <AddrMode mode>
 byte Cpu::PLP()
 {
-  stkp++;
-  status = read(0x0100 + stkp);
+  SP++;
+  status = memory->GetMemory(0x0100 + SP);
   SetFlag(U, 1);
+  PollIrq();
   return 0;
 }
 
+template <AddrMode mode>
 byte Cpu::ROL()
 {
-  fetch();
-  temp = (word)(fetched << 1) | GetFlag(C);
-  SetFlag(C, temp & 0xFF00);
-  SetFlag(Z, (temp & 0x00FF) == 0x0000);
-  SetFlag(N, temp & 0x0080);
-  if (lookup[opcode].addrmode == &Cpu::IMP)
-    a = temp & 0x00FF;
-  else
-    write(addr_abs, temp & 0x00FF);
+  fetch<mode>();
+  temp = (word)(fetched << 1) | status.Carry();
+  status.SetCarry(temp & 0xFF00);
+  status.SetNZ(temp & 0x00FF);
+  writeback<mode>(temp & 0x00FF);
   return 0;
 }
 
+template <AddrMode mode>
 byte Cpu::ROR()
 {
-  fetch();
-  temp = (word)(GetFlag(C) << 7) | (fetched >> 1);
-  SetFlag(C, fetched & 0x01);
-  SetFlag(Z, (temp & 0x00FF) == 0x00);
-  SetFlag(N, temp & 0x0080);
-  if (lookup[opcode].addrmode == &Cpu::IMP)
-    a = temp & 0x00FF;
-  else
-    write(addr_abs, temp & 0x00FF);
+  fetch<mode>();
+  temp = (word)(status.Carry() << 7) | (fetched >> 1);
+  status.SetCarry(fetched & 0x01);
+  status.SetNZ(temp & 0x00FF);
+  writeback<mode>(temp & 0x00FF);
   return 0;
 }
 
+template <AddrMode mode>
 byte Cpu::RTI()
 {
-  stkp++;
-  status = read(0x0100 + stkp);
-  status &= ~B;
-  status &= ~U;
+  SP++;
+  status = memory->GetMemory(0x0100 + SP) & ~(B | U);
 
-  stkp++;
-  pc = (word)read(0x0100 + stkp);
-  stkp++;
-  pc |= (word)read(0x0100 + stkp) << 8;
+  SP++;
+  PC = (word)memory->GetMemory(0x0100 + SP);
+  SP++;
+  PC |= (word)memory->GetMemory(0x0100 + SP) << 8;
+  PollIrq();
   return 0;
 }
 
+template <AddrMode mode>
 byte Cpu::RTS()
 {
-  stkp++;
-  pc = (word)read(0x0100 + stkp);
-  stkp++;
-  pc |= (word)read(0x0100 + stkp) << 8;
+  SP++;
+  PC = (word)memory->GetMemory(0x0100 + SP);
+  SP++;
+  PC |= (word)memory->GetMemory(0x0100 + SP) << 8;
 
-  pc++;
+  PC++;
   return 0;
 }
 
@@ -983,15 +896,17 @@ byte Cpu::RTS()
 
 // Instruction: Set Carry Flag
 // Function:    C = 1
+template <AddrMode mode>
 byte Cpu::SEC()
 {
-  SetFlag(C, true);
+  status.SetCarry(true);
   return 0;
 }
 
 
 // Instruction: Set Decimal Flag
 // Function:    D = 1
+template <AddrMode mode>
 byte Cpu::SED()
 {
   SetFlag(D, true);
@@ -1001,6 +916,7 @@ byte Cpu::SED()
 
 // Instruction: Set Interrupt Flag / Enable Interrupts
 // Function:    I = 1
+template <AddrMode mode>
 byte Cpu::SEI()
 {
   SetFlag(I, true);
@@ -1010,27 +926,30 @@ byte Cpu::SEI()
 
 // Instruction: Store Accumulator at Address
 // Function:    M = A
+template <AddrMode mode>
 byte Cpu::STA()
 {
-  write(addr_abs, a);
+  memory->SetMemory(A, addr_abs);
   return 0;
 }
 
 
 // Instruction: Store X Register at Address
 // Function:    M = X
+template <AddrMode mode>
 byte Cpu::STX()
 {
-  write(addr_abs, x);
+  memory->SetMemory(X, addr_abs);
   return 0;
 }
 
 
 // Instruction: Store Y Register at Address
 // Function:    M = Y
+template <AddrMode mode>
 byte Cpu::STY()
 {
-  write(addr_abs, y);
+  memory->SetMemory(Y, addr_abs);
   return 0;
 }
 
@@ -1038,11 +957,11 @@ byte Cpu::STY()
 // Instruction: Transfer Accumulator to X Register
 // Function:    X = A
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::TAX()
 {
-  x = a;
-  SetFlag(Z, x == 0x00);
-  SetFlag(N, x & 0x80);
+  X = A;
+  status.SetNZ(X);
   return 0;
 }
 
@@ -1050,11 +969,11 @@ byte Cpu::TAX()
 // Instruction: Transfer Accumulator to Y Register
 // Function:    Y = A
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::TAY()
 {
-  y = a;
-  SetFlag(Z, y == 0x00);
-  SetFlag(N, y & 0x80);
+  Y = A;
+  status.SetNZ(Y);
   return 0;
 }
 
@@ -1062,11 +981,11 @@ byte Cpu::TAY()
 // Instruction: Transfer Stack Pointer to X Register
 // Function:    X = stack pointer
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::TSX()
 {
-  x = stkp;
-  SetFlag(Z, x == 0x00);
-  SetFlag(N, x & 0x80);
+  X = SP;
+  status.SetNZ(X);
   return 0;
 }
 
@@ -1074,20 +993,21 @@ byte Cpu::TSX()
 // Instruction: Transfer X Register to Accumulator
 // Function:    A = X
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::TXA()
 {
-  a = x;
-  SetFlag(Z, a == 0x00);
-  SetFlag(N, a & 0x80);
+  A = X;
+  status.SetNZ(A);
   return 0;
 }
 
 
 // Instruction: Transfer X Register to Stack Pointer
 // Function:    stack pointer = X
+template <AddrMode mode>
 byte Cpu::TXS()
 {
-  stkp = x;
+  SP = X;
   return 0;
 }
 
@@ -1095,149 +1015,669 @@ byte Cpu::TXS()
 // Instruction: Transfer Y Register to Accumulator
 // Function:    A = Y
 // Flags Out:   N, Z
+template <AddrMode mode>
 byte Cpu::TYA()
 {
-  a = y;
-  SetFlag(Z, a == 0x00);
-  SetFlag(N, a & 0x80);
+  A = Y;
+  status.SetNZ(A);
   return 0;
 }
 
 
 // This function captures illegal opcodes
+template <AddrMode mode>
 byte Cpu::XXX()
 {
   return 0;
 }
 
+template <AddrMode mode>
+byte Cpu::Address(word operand)
+{
+  if constexpr (mode == AddrMode::IMP) return IMP(operand);
+  else if constexpr (mode == AddrMode::IMM) return IMM(operand);
+  else if constexpr (mode == AddrMode::ZP0) return ZP0(operand);
+  else if constexpr (mode == AddrMode::ZPX) return ZPX(operand);
+  else if constexpr (mode == AddrMode::ZPY) return ZPY(operand);
+  else if constexpr (mode == AddrMode::REL) return REL(operand);
+  else if constexpr (mode == AddrMode::ABS) return ABS(operand);
+  else if constexpr (mode == AddrMode::ABX) return ABX(operand);
+  else if constexpr (mode == AddrMode::ABY) return ABY(operand);
+  else if constexpr (mode == AddrMode::IND) return IND(operand);
+  else if constexpr (mode == AddrMode::IZX) return IZX(operand);
+  else return IZY(operand);
+}
+
+template <Op op, AddrMode mode>
+byte Cpu::Operate()
+{
+  if constexpr (op == Op::ADC) return ADC<mode>();
+  else if constexpr (op == Op::AND) return AND<mode>();
+  else if constexpr (op == Op::ASL) return ASL<mode>();
+  else if constexpr (op == Op::BCC) return BCC<mode>();
+  else if constexpr (op == Op::BCS) return BCS<mode>();
+  else if constexpr (op == Op::BEQ) return BEQ<mode>();
+  else if constexpr (op == Op::BIT) return BIT<mode>();
+  else if constexpr (op == Op::BMI) return BMI<mode>();
+  else if constexpr (op == Op::BNE) return BNE<mode>();
+  else if constexpr (op == Op::BPL) return BPL<mode>();
+  else if constexpr (op == Op::BRK) return BRK<mode>();
+  else if constexpr (op == Op::BVC) return BVC<mode>();
+  else if constexpr (op == Op::BVS) return BVS<mode>();
+  else if constexpr (op == Op::CLC) return CLC<mode>();
+  else if constexpr (op == Op::CLD) return CLD<mode>();
+  else if constexpr (op == Op::CLI) return CLI<mode>();
+  else if constexpr (op == Op::CLV) return CLV<mode>();
+  else if constexpr (op == Op::CMP) return CMP<mode>();
+  else if constexpr (op == Op::CPX) return CPX<mode>();
+  else if constexpr (op == Op::CPY) return CPY<mode>();
+  else if constexpr (op == Op::DEC) return DEC<mode>();
+  else if constexpr (op == Op::DEX) return DEX<mode>();
+  else if constexpr (op == Op::DEY) return DEY<mode>();
+  else if constexpr (op == Op::EOR) return EOR<mode>();
+  else if constexpr (op == Op::INC) return INC<mode>();
+  else if constexpr (op == Op::INX) return INX<mode>();
+  else if constexpr (op == Op::INY) return INY<mode>();
+  else if constexpr (op == Op::JMP) return JMP<mode>();
+  else if constexpr (op == Op::JSR) return JSR<mode>();
+  else if constexpr (op == Op::LDA) return LDA<mode>();
+  else if constexpr (op == Op::LDX) return LDX<mode>();
+  else if constexpr (op == Op::LDY) return LDY<mode>();
+  else if constexpr (op == Op::LSR) return LSR<mode>();
+  else if constexpr (op == Op::NOP) return NOP<mode>();
+  else if constexpr (op == Op::ORA) return ORA<mode>();
+  else if constexpr (op == Op::PHA) return PHA<mode>();
+  else if constexpr (op == Op::PHP) return PHP<mode>();
+  else if constexpr (op == Op::PLA) return PLA<mode>();
+  else if constexpr (op == Op::PLP) return PLP<mode>();
+  else if constexpr (op == Op::ROL) return ROL<mode>();
+  else if constexpr (op == Op::ROR) return ROR<mode>();
+  else if constexpr (op == Op::RTI) return RTI<mode>();
+  else if constexpr (op == Op::RTS) return RTS<mode>();
+  else if constexpr (op == Op::SBC) return SBC<mode>();
+  else if constexpr (op == Op::SEC) return SEC<mode>();
+  else if constexpr (op == Op::SED) return SED<mode>();
+  else if constexpr (op == Op::SEI) return SEI<mode>();
+  else if constexpr (op == Op::STA) return STA<mode>();
+  else if constexpr (op == Op::STX) return STX<mode>();
+  else if constexpr (op == Op::STY) return STY<mode>();
+  else if constexpr (op == Op::TAX) return TAX<mode>();
+  else if constexpr (op == Op::TAY) return TAY<mode>();
+  else if constexpr (op == Op::TSX) return TSX<mode>();
+  else if constexpr (op == Op::TXA) return TXA<mode>();
+  else if constexpr (op == Op::TXS) return TXS<mode>();
+  else if constexpr (op == Op::TYA) return TYA<mode>();
+  else return XXX<mode>();
+}
+
+template <byte opcode>
+word Cpu::FetchOperand()
+{
+  constexpr byte length = OPCODE_TABLE[opcode].length;
+
+  word operand = 0;
+  if constexpr (length > 1)
+    operand = memory->GetMemory(PC++);
+  if constexpr (length > 2)
+    operand |= memory->GetMemory(PC++) << 8;
+  return operand;
+}
 
+/*
+ *  One fused handler per opcode: the addressing mode and the operation are
+ *  both known at compile time, so they inline into a single straight-line
+ *  body with no indirect calls.
+ */
+template <byte opcode>
+void Cpu::Step(word operand)
+{
+  constexpr OpcodeEntry entry = OPCODE_TABLE[opcode];
 
+  // Both the addressing mode and the operation may ask for an extra
+  // cycle, but it is only spent when both of them agree
+  byte additional_cycle_1 = Address<entry.mode>(operand);
+  byte additional_cycle_2 = Operate<entry.op, entry.mode>();
 
+  cycles += entry.cycles + (additional_cycle_1 & additional_cycle_2);
+}
 
+// X-macro over every opcode as a (high nibble, low nibble) pair
+#define NES_OPCODE_ROW(X, hi) \
+  X(hi, 0) X(hi, 1) X(hi, 2) X(hi, 3) X(hi, 4) X(hi, 5) X(hi, 6) X(hi, 7) \
+  X(hi, 8) X(hi, 9) X(hi, A) X(hi, B) X(hi, C) X(hi, D) X(hi, E) X(hi, F)
 
-/*
-// This is the disassembly function. Its workings are not required for emulation.
-// It is merely a convenience function to turn the binary instruction code into
-// human readable form. Its included as part of the emulator because it can take
-// advantage of many of the CPUs internal operations to do this.
-std::map<word, std::string> Cpu::disassemble(word nStart, word nStop)
-{
-  uint32_t addr = nStart;
-  byte value = 0x00, lo = 0x00, hi = 0x00;
-  std::map<word, std::string> mapLines;
-  word line_addr = 0;
-
-  // A convenient utility to convert variables into
-  // hex strings because "modern C++"'s method with
-  // streams is atrocious
-  auto hex = [](uint32_t n, byte d)
-  {
-    std::string s(d, '0');
-    for (int i = d - 1; i >= 0; i--, n >>= 4)
-      s[i] = "0123456789ABCDEF"[n & 0xF];
-    return s;
-  };
+#define NES_OPCODES(X) \
+  NES_OPCODE_ROW(X, 0) NES_OPCODE_ROW(X, 1) NES_OPCODE_ROW(X, 2) NES_OPCODE_ROW(X, 3) \
+  NES_OPCODE_ROW(X, 4) NES_OPCODE_ROW(X, 5) NES_OPCODE_ROW(X, 6) NES_OPCODE_ROW(X, 7) \
+  NES_OPCODE_ROW(X, 8) NES_OPCODE_ROW(X, 9) NES_OPCODE_ROW(X, A) NES_OPCODE_ROW(X, B) \
+  NES_OPCODE_ROW(X, C) NES_OPCODE_ROW(X, D) NES_OPCODE_ROW(X, E) NES_OPCODE_ROW(X, F)
 
-  // Starting at the specified address we read an instruction
-  // byte, which in turn yields information from the lookup table
-  // as to how many additional bytes we need to read and what the
-  // addressing mode is. I need this info to assemble human readable
-  // syntax, which is different depending upon the addressing mode
+#if defined(__GNUC__) || defined(__clang__)
+#  define NES_COMPUTED_GOTO 1
+#else
+#  define NES_COMPUTED_GOTO 0
+#endif
 
-  // As the instruction is decoded, a std::string is assembled
-  // with the readable output
-  while (addr <= (uint32_t)nStop)
-    {
-      line_addr = addr;
+// out of line, JitCompiler is only complete here
+Cpu::Cpu(Memory* memory) : memory(memory) {}
 
-      // Prefix line with instruction address
-      std::string sInst = "$" + hex(addr, 4) + ": ";
+Cpu::~Cpu() = default;
 
-      // Read instruction, and get its readable name
-      byte opcode = bus->read(addr, true); addr++;
-      sInst += lookup[opcode].name + " ";
+void Cpu::Execute(byte _cycles)
+{
+  RunUntil(cycles + _cycles);
+}
 
-      // Get oprands from desired locations, and form the
-      // instruction based upon its addressing mode. These
-      // routines mimmick the actual fetch routine of the
-      // 6502 in order to get accurate data as part of the
-      // instruction
-      if (lookup[opcode].addrmode == &Cpu::IMP)
-        {
-          sInst += " {IMP}";
-        }
-      else if (lookup[opcode].addrmode == &Cpu::IMM)
-        {
-          value = bus->read(addr, true); addr++;
-          sInst += "#$" + hex(value, 2) + " {IMM}";
-        }
-      else if (lookup[opcode].addrmode == &Cpu::ZP0)
+template <typename Trace>
+void Cpu::Execute(byte _cycles, Trace& trace)
+{
+  RunUntil(cycles + _cycles, trace);
+}
+
+template void Cpu::Execute<NoTrace>(byte, NoTrace&);
+template void Cpu::Execute<RingTrace>(byte, RingTrace&);
+template void Cpu::Execute<NestestTrace>(byte, NestestTrace&);
+
+uint64_t Cpu::RunUntil(uint64_t target_cycle)
+{
+  NoTrace trace;
+  return RunUntil(target_cycle, trace);
+}
+
+/*
+ *  Runs whole instructions until the master cycle count reaches
+ *  target_cycle. The last instruction may overshoot the target by a few
+ *  cycles; callers that keep a timeline simply continue from `cycles`.
+ */
+template <typename Trace>
+uint64_t Cpu::RunUntil(uint64_t target_cycle, Trace& trace)
+{
+  const uint64_t start_cycle = cycles;
+
+  while (true)
+    {
+      // events first, they may raise the interrupts serviced below
+      if (scheduler)
+        scheduler->RunDue(cycles);
+
+      if (nmi_pending)
         {
-          lo = bus->read(addr, true); addr++;
-          hi = 0x00;
-          sInst += "$" + hex(lo, 2) + " {ZP0}";
+          nmi_pending = false;
+          Nmi();
         }
-      else if (lookup[opcode].addrmode == &Cpu::ZPX)
+      else if (irq_lines && !GetFlag(I))
         {
-          lo = bus->read(addr, true); addr++;
-          hi = 0x00;
-          sInst += "$" + hex(lo, 2) + ", X {ZPX}";
+          Irq();
         }
-      else if (lookup[opcode].addrmode == &Cpu::ZPY)
+
+      if (cycles >= target_cycle)
+        break;
+
+      stop_cycle = target_cycle;
+      if (scheduler)
+        stop_cycle = std::min(stop_cycle, std::max(scheduler->NextCycle(), cycles + 1));
+
+      if (engine == CpuEngine::Jit)
+        RunBlocks<Trace, CpuEngine::Jit>(trace);
+      else if (engine == CpuEngine::Blocks)
+        RunBlocks<Trace, CpuEngine::Blocks>(trace);
+      else if (engine == CpuEngine::Cached)
+        Interpret<Trace, CpuEngine::Cached>(trace);
+      else
+        Interpret<Trace, CpuEngine::Interpreter>(trace);
+    }
+
+  return cycles - start_cycle;
+}
+
+template uint64_t Cpu::RunUntil<NoTrace>(uint64_t, NoTrace&);
+template uint64_t Cpu::RunUntil<RingTrace>(uint64_t, RingTrace&);
+template uint64_t Cpu::RunUntil<NestestTrace>(uint64_t, NestestTrace&);
+
+/*
+ *  The dispatch loop proper. It only ever compares the cycle count against
+ *  stop_cycle, so interrupts cost nothing per instruction: raising one just
+ *  pulls stop_cycle in and lets RunUntil service it between instructions.
+ */
+template <typename Trace, CpuEngine selected>
+void Cpu::Interpret(Trace& trace)
+{
+  // the Cached engine decodes the operand together with the opcode
+  constexpr bool cached = selected == CpuEngine::Cached;
+  word operand = 0;
+
+#if NES_COMPUTED_GOTO
+  // Direct threading: every handler jumps straight to the next one, so the
+  // branch predictor gets one indirect jump per opcode instead of a single
+  // shared one at the top of a loop
+#  define NES_LABEL_ADDRESS(hi, lo) &&op_##hi##lo,
+  static const void* const dispatch_table[256] = {NES_OPCODES(NES_LABEL_ADDRESS)};
+#  undef NES_LABEL_ADDRESS
+
+#  define NES_DISPATCH() \
+    do \
+      { \
+        if (cycles >= stop_cycle) \
+          return; \
+        if constexpr (Trace::enabled) \
+          trace.Record(TraceState()); \
+        if constexpr (cached) \
+          { \
+            DecodedInstruction decoded = Lookup(PC); \
+            opcode = decoded.opcode; \
+            operand = decoded.operand; \
+            PC += decoded.length; \
+          } \
+        else \
+          { \
+            opcode = memory->GetMemory(PC++); \
+          } \
+        goto* dispatch_table[opcode]; \
+      } \
+    while (0)
+
+#  define NES_HANDLER(hi, lo) \
+    op_##hi##lo: \
+      Step<0x##hi##lo>(cached ? operand : FetchOperand<0x##hi##lo>()); \
+      NES_DISPATCH();
+
+  NES_DISPATCH();
+  NES_OPCODES(NES_HANDLER)
+
+#  undef NES_HANDLER
+#  undef NES_DISPATCH
+#else
+#  define NES_CASE(hi, lo) \
+    case 0x##hi##lo: Step<0x##hi##lo>(cached ? operand : FetchOperand<0x##hi##lo>()); break;
+
+  while (cycles < stop_cycle)
+    {
+      if constexpr (Trace::enabled)
+        trace.Record(TraceState());
+
+      if constexpr (cached)
         {
-          lo = bus->read(addr, true); addr++;
-          hi = 0x00;
-          sInst += "$" + hex(lo, 2) + ", Y {ZPY}";
+          DecodedInstruction decoded = Lookup(PC);
+          opcode = decoded.opcode;
+          operand = decoded.operand;
+          PC += decoded.length;
         }
-      else if (lookup[opcode].addrmode == &Cpu::IZX)
+      else
         {
-          lo = bus->read(addr, true); addr++;
-          hi = 0x00;
-          sInst += "($" + hex(lo, 2) + ", X) {IZX}";
+          opcode = memory->GetMemory(PC++);
         }
-      else if (lookup[opcode].addrmode == &Cpu::IZY)
+
+      switch (opcode)
         {
-          lo = bus->read(addr, true); addr++;
-          hi = 0x00;
-          sInst += "($" + hex(lo, 2) + "), Y {IZY}";
+          NES_OPCODES(NES_CASE)
         }
-      else if (lookup[opcode].addrmode == &Cpu::ABS)
+    }
+
+#  undef NES_CASE
+#endif
+}
+
+namespace
+{
+// Handlers a translated block calls, one per opcode
+using BlockHandler = void (*)(Cpu& cpu, word operand);
+
+#define NES_BLOCK_HANDLER(hi, lo) \
+  [](Cpu& cpu, word operand) { cpu.Step<0x##hi##lo>(operand); },
+
+constexpr BlockHandler BLOCK_HANDLERS[256] = {NES_OPCODES(NES_BLOCK_HANDLER)};
+
+#undef NES_BLOCK_HANDLER
+
+constexpr bool EndsBlock(Op op)
+{
+  switch (op)
+    {
+      case Op::BCC: case Op::BCS: case Op::BEQ: case Op::BMI:
+      case Op::BNE: case Op::BPL: case Op::BVC: case Op::BVS:
+      case Op::JMP: case Op::JSR: case Op::RTS: case Op::RTI:
+      case Op::BRK:
+        return true;
+      default:
+        return false;
+    }
+}
+
+// Whether an instruction can pull stop_cycle in: any bus access beyond its
+// own operand may reach a device that signals an interrupt, and CLI / PLP
+// may unmask a pending IRQ
+constexpr bool NeedsCheck(const OpcodeEntry& entry)
+{
+  switch (entry.op)
+    {
+      case Op::CLI: case Op::PLP: case Op::PHA: case Op::PHP: case Op::PLA:
+        return true;
+      default:
+        return entry.mode != AddrMode::IMP && entry.mode != AddrMode::IMM && entry.mode != AddrMode::REL;
+    }
+}
+} // namespace
+
+/*
+ *  Block engine: runs translated blocks through their pre-bound handlers.
+ *  When a block fits before stop_cycle only the instructions that can move
+ *  stop_cycle (or modify code) are followed by a check; otherwise every
+ *  instruction is, exactly like Interpret. Code that cannot be translated
+ *  is run one instruction at a time from the bus.
+ */
+template <typename Trace, CpuEngine selected>
+void Cpu::RunBlocks(Trace& trace)
+{
+  // traced runs stay on the handlers, which record every instruction
+  constexpr bool compile = NES_JIT && selected == CpuEngine::Jit && !Trace::enabled;
+
+  while (cycles < stop_cycle)
+    {
+      Block* block = LookupBlock(PC);
+      if (!block)
         {
-          lo = bus->read(addr, true); addr++;
-          hi = bus->read(addr, true); addr++;
-          sInst += "$" + hex((word)(hi << 8) | lo, 4) + " {ABS}";
+          if constexpr (Trace::enabled)
+            trace.Record(TraceState());
+
+          opcode = memory->GetMemory(PC++);
+          word operand = 0;
+          if (OPCODE_TABLE[opcode].length > 1)
+            operand = memory->GetMemory(PC++);
+          if (OPCODE_TABLE[opcode].length > 2)
+            operand |= memory->GetMemory(PC++) << 8;
+          BLOCK_HANDLERS[opcode](*this, operand);
+          continue;
         }
-      else if (lookup[opcode].addrmode == &Cpu::ABX)
+
+      const BlockOp* op = block_pages[PC >> 8]->ops.data() + block->first_op;
+      const BlockOp* end = op + block->op_count;
+      const bool fits = cycles + block->worst_cycles < stop_cycle;
+
+      if constexpr (compile)
         {
-          lo = bus->read(addr, true); addr++;
-          hi = bus->read(addr, true); addr++;
-          sInst += "$" + hex((word)(hi << 8) | lo, 4) + ", X {ABX}";
+          // native code leaves at the same boundaries as the checks below,
+          // but only knows the case where the whole block fits
+          if (block->native && fits)
+            {
+              block->native(this);
+              continue;
+            }
+
+          if (++block->hits == jit_threshold)
+            CompileBlock(*block, PC);
         }
-      else if (lookup[opcode].addrmode == &Cpu::ABY)
+
+      for (; op != end; ++op)
         {
-          lo = bus->read(addr, true); addr++;
-          hi = bus->read(addr, true); addr++;
-          sInst += "$" + hex((word)(hi << 8) | lo, 4) + ", Y {ABY}";
+          if constexpr (Trace::enabled)
+            trace.Record(TraceState());
+
+          opcode = op->opcode;
+          PC += op->length;
+          op->handler(*this, op->operand);
+
+          if ((!fits || op->check) && (cycles >= stop_cycle || memory->GetChangeCount() != decoded_change_count))
+            break;
         }
-      else if (lookup[opcode].addrmode == &Cpu::IND)
+    }
+}
+
+Cpu::Block* Cpu::LookupBlock(word addr)
+{
+  if (memory->GetChangeCount() != decoded_change_count) [[unlikely]]
+    RevalidateDecoded();
+
+  BlockPage* page = block_pages[addr >> 8].get();
+  if (page && page->block_at[addr & 0xFF]) [[likely]]
+    return &page->blocks[page->block_at[addr & 0xFF] - 1];
+
+  return TranslateBlock(addr);
+}
+
+Cpu::Block* Cpu::TranslateBlock(word addr)
+{
+  byte index = addr >> 8;
+  const byte* code = memory->GetReadPage(index);
+  if (!code)
+    return nullptr;
+
+  std::unique_ptr<BlockPage>& page = block_pages[index];
+  if (!page)
+    {
+      page = std::make_unique<BlockPage>();
+      page->version = memory->GetPageVersion(index);
+    }
+
+  Block block;
+  block.first_op = page->ops.size();
+
+  for (uint32_t offset = addr & 0xFF; block.op_count < BlockPage::MAX_BLOCK_OPS;)
+    {
+      byte instruction = code[offset];
+      const OpcodeEntry& entry = OPCODE_TABLE[instruction];
+      if (offset + entry.length > Memory::PAGE_SIZE)
+        break;
+
+      word operand = 0;
+      if (entry.length > 1)
+        operand = code[offset + 1];
+      if (entry.length > 2)
+        operand |= code[offset + 2] << 8;
+
+      // the last instruction's penalty cycles happen after its boundary
+      if (block.op_count > 0)
+        block.worst_cycles += OPCODE_TABLE[page->ops.back().opcode].cycles + 1;
+
+      page->ops.push_back(BlockOp{BLOCK_HANDLERS[instruction], operand, instruction, entry.length, NeedsCheck(entry)});
+      block.op_count++;
+      offset += entry.length;
+
+      if (EndsBlock(entry.op))
+        break;
+    }
+
+  // a first instruction straddling the page end is left to the bus
+  if (block.op_count == 0)
+    return nullptr;
+
+  memory->GuardPage(index);
+
+  page->blocks.push_back(block);
+  page->block_at[addr & 0xFF] = page->blocks.size();
+  return &page->blocks.back();
+}
+
+void Cpu::CompileBlock(Block& block, word addr)
+{
+#if NES_JIT
+  if (!jit)
+    jit = std::make_unique<JitCompiler>();
+
+  const BlockOp* ops = block_pages[addr >> 8]->ops.data() + block.first_op;
+  block.native = jit->Compile(*this, ops, block.op_count, addr);
+
+  // the buffer is full, or lost: no block handed out so far may run again
+  if (!block.native)
+    {
+      jit->Flush();
+      for (std::unique_ptr<BlockPage>& page : block_pages)
+        if (page)
+          for (Block& other : page->blocks)
+            other.native = nullptr;
+
+      if (jit->IsAvailable())
+        block.native = jit->Compile(*this, ops, block.op_count, addr);
+    }
+#else
+  (void)block;
+  (void)addr;
+#endif
+}
+
+Cpu::DecodedInstruction Cpu::Decode(word addr)
+{
+  DecodedInstruction decoded;
+  decoded.opcode = memory->GetMemory(addr);
+  decoded.length = OPCODE_TABLE[decoded.opcode].length;
+  if (decoded.length > 1)
+    decoded.operand = memory->GetMemory(addr + 1);
+  if (decoded.length > 2)
+    decoded.operand |= memory->GetMemory(addr + 2) << 8;
+
+  // only instructions wholly inside one storage page are cached, so that
+  // page's version covers every byte they were decoded from
+  byte index = addr >> 8;
+  if (!memory->GetReadPage(index) || (addr & 0xFFu) + decoded.length > Memory::PAGE_SIZE)
+    return decoded;
+
+  memory->GuardPage(index);
+
+  std::unique_ptr<DecodedPage>& page = decoded_pages[index];
+  if (!page)
+    {
+      page = std::make_unique<DecodedPage>();
+      page->version = memory->GetPageVersion(index);
+    }
+
+  // reading the instruction may have touched a device that remapped
+  if (memory->GetChangeCount() != decoded_change_count)
+    RevalidateDecoded();
+  page->entries[addr & 0xFF] = decoded;
+  return decoded;
+}
+
+void Cpu::RevalidateDecoded()
+{
+  for (uint32_t index = 0; index < Memory::PAGE_COUNT; index++)
+    {
+      DecodedPage* page = decoded_pages[index].get();
+      if (page && page->version != memory->GetPageVersion(index))
         {
-          lo = bus->read(addr, true); addr++;
-          hi = bus->read(addr, true); addr++;
-          sInst += "($" + hex((word)(hi << 8) | lo, 4) + ") {IND}";
+          page->entries.fill(DecodedInstruction{});
+          page->version = memory->GetPageVersion(index);
         }
-      else if (lookup[opcode].addrmode == &Cpu::REL)
+
+      BlockPage* blocks = block_pages[index].get();
+      if (blocks && blocks->version != memory->GetPageVersion(index))
         {
-          value = bus->read(addr, true); addr++;
-          sInst += "$" + hex(value, 2) + " [$" + hex(addr + value, 4) + "] {REL}";
+          blocks->block_at.fill(0);
+          blocks->blocks.clear();
+          blocks->ops.clear();
+          blocks->version = memory->GetPageVersion(index);
         }
-
-      // Add the formed string to a std::map, using the instruction's
-      // address as the key. This makes it convenient to look for later
-      // as the instructions are variable in length, so a straight up
-      // incremental index is not sufficient.
-      mapLines[line_addr] = sInst;
     }
 
-  return mapLines;
+  decoded_change_count = memory->GetChangeCount();
+}
+
+void Cpu::SignalNmi()
+{
+  nmi_pending = true;
+  stop_cycle = 0;
+}
+
+void Cpu::SetIrq(byte source, bool level)
+{
+  if (level)
+    irq_lines |= source;
+  else
+    irq_lines &= ~source;
+
+  PollIrq();
+}
+
+void Cpu::PollIrq()
+{
+  if (irq_lines && !GetFlag(I))
+    stop_cycle = 0;
+}
+
+uint64_t Cpu::BusCycle() const
+{
+  // register accesses land on the last cycle of an instruction, which is
+  // still being executed while `cycles` points at its first one
+  return cycles + OPCODE_TABLE[opcode].cycles - 1;
+}
+
+template <typename Self, typename Archive>
+void Cpu::Serialize(Self& self, Archive& archive)
+{
+  archive.Field(self.PC);
+  archive.Field(self.SP);
+  archive.Field(self.A);
+  archive.Field(self.X);
+  archive.Field(self.Y);
+  StatusRegister::Serialize(self.status, archive);
+  archive.Field(self.cycles);
+  archive.Field(self.frames);
+  archive.Field(self.nmi_pending);
+  archive.Field(self.irq_lines);
+}
+
+std::unique_ptr<Cpu> Cpu::Fork(Memory* _memory) const
+{
+  auto child = std::make_unique<Cpu>(_memory);
+  child->CopyState(*this);
+  child->engine = engine;
+  child->jit_threshold = jit_threshold;
+
+  return child;
+}
+
+void Cpu::CopyState(const Cpu& other)
+{
+  PC = other.PC;
+  SP = other.SP;
+  A = other.A;
+  X = other.X;
+  Y = other.Y;
+  status = other.status;
+  cycles = other.cycles;
+  frames = other.frames;
+  nmi_pending = other.nmi_pending;
+  irq_lines = other.irq_lines;
+}
+
+void Cpu::SaveState(StateWriter& writer) const
+{
+  Serialize(*this, writer);
+}
+
+void Cpu::LoadState(StateReader& reader)
+{
+  Serialize(*this, reader);
+}
+
+uint64_t Cpu::RunFrames(uint64_t count)
+{
+  frames += count;
+
+  // frames are laid out on the master timeline from cycle 0, rounding each
+  // boundary down so the fractional cycle never accumulates drift
+  return RunUntil(frames * PPU_DOTS_PER_FRAME / PPU_DOTS_PER_CPU_CYCLE);
+}
+
+TraceRecord Cpu::TraceState()
+{
+  // through the page table only, a device read could have side effects;
+  // device pages read as FF the way NestestTrace::Peek has them
+  auto peek = [this](word addr) -> byte {
+    const byte* page = memory->GetReadPage(addr >> 8);
+    return page ? page[addr & 0xFF] : 0xFF;
+  };
+
+  byte trace_opcode = peek(PC);
+  byte length = OPCODE_TABLE[trace_opcode].length;
+
+  return TraceRecord{
+    PC,
+    trace_opcode,
+    length > 1 ? peek(PC + 1) : byte{0},
+    length > 2 ? peek(PC + 2) : byte{0},
+    A,
+    X,
+    Y,
+    static_cast<byte>(status),
+    SP,
+    cycles};
 }
-*/
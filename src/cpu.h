@@ -1,38 +1,66 @@
 #ifndef GOOGLETESTSEXAMPLE_CPU_H
 #define GOOGLETESTSEXAMPLE_CPU_H
 
+#include <array>
+#include <memory>
 #include <vector>
 
 #include "memory.h"
+#include "state.h"
+#include "status_register.h"
 #include "utils/types.h"
 #include "instruction.h"
+#include "trace.h"
 
-class Cpu
-{
-  class Instruction
-  {
-  public:
-    std::string name;
-    byte (Cpu::*op)();
-    byte (Cpu::*addr_mode)();
-    byte cycles;
+class JitCompiler;
+class Scheduler;
 
-    Instruction();
+// For helpers on the dispatch path, which GCC stops inlining once the
+// 256 fused handlers have used up its budget
+#if defined(__GNUC__) || defined(__clang__)
+#  define NES_ALWAYS_INLINE [[gnu::always_inline]] inline
+#else
+#  define NES_ALWAYS_INLINE inline
+#endif
 
-    Instruction(std::string name, byte (Cpu::*op)(), byte (Cpu::*addr_mode)(), byte cycles)
-    : name(std::move(name)), op(op), addr_mode(addr_mode), cycles(cycles) {}
-  };
+// How Cpu::RunUntil executes code, switchable between any two calls
+enum class CpuEngine : byte
+{
+  Interpreter, // fetch and decode every instruction from the bus
+  Cached, // decoded instructions are cached per PC, see Cpu::Lookup
+  Blocks, // straight-line code translated to handler arrays, see Cpu::RunBlocks
+  Jit // Blocks, with hot blocks compiled to x86-64 (see jit.h) where available
+};
+
+class Cpu
+{
 public:
-  explicit Cpu(Memory* memory) : memory(memory) {}
+  // NTSC timing: 341 dots x 262 scanlines, three PPU dots per CPU cycle
+  static constexpr uint64_t PPU_DOTS_PER_FRAME = 341 * 262;
+  static constexpr uint64_t PPU_DOTS_PER_CPU_CYCLE = 3;
+
+  explicit Cpu(Memory* memory);
+  ~Cpu();
 
   word PC = 0; // Program Counter
   byte SP = 0; // Stack Pointer
 
   byte A = 0, X = 0, Y = 0; // Registers
 
-  byte cycles = 0;
+  uint64_t cycles = 0; // master cycle count, only ever increases
+  uint64_t frames = 0; // frames completed by RunFrames
+  uint64_t stop_cycle = 0; // the dispatch loop returns once cycles reach it
+
+  bool nmi_pending = false;
+
+  // IRQ sources, OR-ed together onto the level-triggered IRQ line
+  static constexpr byte IRQ_APU_FRAME = 1 << 0;
+  static constexpr byte IRQ_DMC = 1 << 1;
+  static constexpr byte IRQ_MAPPER = 1 << 2;
 
-  word status = 0x0;
+  byte irq_lines = 0;
+
+  StatusRegister status;
 
   byte opcode = 0x0;
   byte fetched = 0x0;
@@ -50,6 +78,66 @@ public:
     N = (1 << 7); // negative
 
   Memory* memory; // Internal memory
+  Scheduler* scheduler = nullptr; // console events, see Scheduler::ConnectCpu
+
+  CpuEngine engine = CpuEngine::Interpreter;
+
+  // An instruction as the Cached engine runs it: length 0 = not decoded
+  struct DecodedInstruction
+  {
+    word operand = 0;
+    byte opcode = 0;
+    byte length = 0;
+  };
+
+  // Decoded instructions of one page, valid while the page version matches
+  struct DecodedPage
+  {
+    uint32_t version = 0;
+    std::array<DecodedInstruction, Memory::PAGE_SIZE> entries{};
+  };
+
+  std::array<std::unique_ptr<DecodedPage>, Memory::PAGE_COUNT> decoded_pages;
+
+  // One instruction of a translated block, bound to its fused handler
+  struct BlockOp
+  {
+    void (*handler)(Cpu& cpu, word operand);
+    word operand;
+    byte opcode;
+    byte length;
+    bool check; // may touch the bus or unmask IRQs, i.e. move stop_cycle
+  };
+
+  // Straight-line code up to the next jump, branch or return. Running the
+  // whole block cannot cross stop_cycle at an inner instruction boundary
+  // while cycles + worst_cycles < stop_cycle
+  struct Block
+  {
+    uint32_t first_op = 0;
+    uint16_t op_count = 0;
+    uint16_t worst_cycles = 0;
+    uint32_t hits = 0; // runs so far, the Jit engine compiles at jit_threshold
+    void (*native)(Cpu* cpu) = nullptr;
+  };
+
+  // Translated blocks starting in one page, valid while the page version
+  // matches. Blocks never leave their page, so that version covers them
+  struct BlockPage
+  {
+    static constexpr uint32_t MAX_BLOCK_OPS = 64;
+
+    uint32_t version = 0;
+    std::array<uint16_t, Memory::PAGE_SIZE> block_at{}; // index + 1, 0 = none
+    std::vector<Block> blocks;
+    std::vector<BlockOp> ops;
+  };
+
+  std::array<std::unique_ptr<BlockPage>, Memory::PAGE_COUNT> block_pages;
+
+  uint32_t jit_threshold = 32;
+  std::unique_ptr<JitCompiler> jit; // created on the first compile
+  uint32_t decoded_change_count = 0; // Memory::GetChangeCount() last checked
 
   bool GetFlag(word flag);
   void SetFlag(word flag, bool value);
@@ -58,92 +146,186 @@ public:
   void Irq();
   void Nmi(); // non-maskable interrupt
 
-  void LDASetStatus();
-
   byte FetchByte();
   word FetchWord();
 
   byte ReadByte(byte add);
 
+  void Execute(uint8_t cycles);
+
+  // Same interpreter, instantiated per trace policy (see trace.h)
+  template <typename Trace>
+  void Execute(uint8_t cycles, Trace& trace);
+
+  // Runs until `cycles` reaches target_cycle, returns the cycles executed.
+  // With a scheduler, slices also end at and run every event on the way
+  uint64_t RunUntil(uint64_t target_cycle);
+
+  template <typename Trace>
+  uint64_t RunUntil(uint64_t target_cycle, Trace& trace);
+
+  // Runs `count` NTSC frames (~29780.67 CPU cycles each)
+  uint64_t RunFrames(uint64_t count);
+
+  template <typename Trace, CpuEngine selected>
+  void Interpret(Trace& trace);
+
+  // The decoded instruction at addr, from the cache when it is current
+  NES_ALWAYS_INLINE DecodedInstruction Lookup(word addr)
+  {
+    if (memory->GetChangeCount() != decoded_change_count) [[unlikely]]
+      RevalidateDecoded();
+
+    const DecodedPage* page = decoded_pages[addr >> 8].get();
+    if (page) [[likely]]
+      {
+        DecodedInstruction decoded = page->entries[addr & 0xFF];
+        if (decoded.length) [[likely]]
+          return decoded;
+      }
+    return Decode(addr);
+  }
+
+  // Forgets the decoded and translated pages whose memory version moved on
+  void RevalidateDecoded();
+
+  // Block engine loop, the counterpart of Interpret for CpuEngine::Blocks
+  // and CpuEngine::Jit
+  template <typename Trace, CpuEngine selected>
+  void RunBlocks(Trace& trace);
+
+  // The block starting at addr, translated on first use. Null where code
+  // cannot be translated, e.g. on device pages
+  Block* LookupBlock(word addr);
+  Block* TranslateBlock(word addr);
+
+  // Gives a hot block native code, flushing all of it when the code
+  // buffer is full
+  void CompileBlock(Block& block, word addr);
+
+  // Slow path of Lookup: decodes from the bus and caches the result
+  DecodedInstruction Decode(word addr);
+
+  // Edge-triggered NMI, taken at the next instruction boundary
+  void SignalNmi();
+
+  // Raises or drops one source of the IRQ line
+  void SetIrq(byte source, bool level);
+
+  // Leaves the dispatch loop if an IRQ is asserted and no longer masked
+  void PollIrq();
+
+  // Best estimate of the cycle a device access in flight happens on
+  uint64_t BusCycle() const;
+
+  // Registers and the instruction at PC, peeked without touching devices
+  TraceRecord TraceState();
+
+  // A CPU in the same state on `memory`, e.g. a Memory::Fork of ours.
+  // The engine comes along, caches and the scheduler do not
+  std::unique_ptr<Cpu> Fork(Memory* memory) const;
+
+  // What SaveState holds, copied straight from `other`
+  void CopyState(const Cpu& other);
+
+  // Registers, cycle counters and interrupt lines (see state.h)
+  void SaveState(StateWriter& writer) const;
+  void LoadState(StateReader& reader);
+
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive);
+
+  // Fused per-opcode handler, operand bytes already fetched
+  template <byte opcode>
+  void Step(word operand);
+
+  template <byte opcode>
+  word FetchOperand();
+
+  template <AddrMode mode>
+  byte Address(word operand);
+
+  template <Op op, AddrMode mode>
+  byte Operate();
+
+  template <AddrMode mode>
   byte fetch();
 
-  void Execute(uint8_t cycles);
+  template <AddrMode mode>
+  void writeback(byte value);
 
   // Addressing modes
-  byte IMP();
-  byte IMM();
-  byte ZPX();
-  byte ZPY();
-  byte ZP0();
-  byte REL();
-  byte ABS();
-  byte ABX();
-  byte ABY();
-  byte IND();
-  byte IZX();
-  byte IZY();
-
-  // Instructions
-  byte ADC();
-  byte AND();
-  byte ASL();
-  byte BCC();
-  byte BCS();
-  byte BEQ();
-  byte BIT();
-  byte BMI();
-  byte BNE();
-  byte BPL();
-  byte BRK();
-  byte BVC();
-  byte BVS();
-  byte CLC();
-  byte CLD();
-  byte CLI();
-  byte CLV();
-  byte CMP();
-  byte CPX();
-  byte CPY();
-  byte DEC();
-  byte DEX();
-  byte DEY();
-  byte EOR();
-  byte INC();
-  byte INX();
-  byte INY();
-  byte JMP();
-  byte JSR();
-  byte LDA();
-  byte LDX();
-  byte LDY();
-  byte LSR();
-  byte NOP();
-  byte ORA();
-  byte PHA();
-  byte PHP();
-  byte PLA();
-  byte PLP();
-  byte ROL();
-  byte ROR();
-  byte RTI();
-  byte RTS();
-  byte SBC();
-  byte SEC();
-  byte SED();
-  byte SEI();
-  byte STA();
-  byte STX();
-  byte STY();
-  byte TAX();
-  byte TAY();
-  byte TSX();
-  byte TXA();
-  byte TXS();
-  byte TYA();
-  byte XXX();
-
-private:
-   std::vector<Instruction> lookup;
+  byte IMP(word operand);
+  byte IMM(word operand);
+  byte ZPX(word operand);
+  byte ZPY(word operand);
+  byte ZP0(word operand);
+  byte REL(word operand);
+  byte ABS(word operand);
+  byte ABX(word operand);
+  byte ABY(word operand);
+  byte IND(word operand);
+  byte IZX(word operand);
+  byte IZY(word operand);
+
+  // Instructions, specialised by addressing mode
+  template <AddrMode mode> byte ADC();
+  template <AddrMode mode> byte AND();
+  template <AddrMode mode> byte ASL();
+  template <AddrMode mode> byte BCC();
+  template <AddrMode mode> byte BCS();
+  template <AddrMode mode> byte BEQ();
+  template <AddrMode mode> byte BIT();
+  template <AddrMode mode> byte BMI();
+  template <AddrMode mode> byte BNE();
+  template <AddrMode mode> byte BPL();
+  template <AddrMode mode> byte BRK();
+  template <AddrMode mode> byte BVC();
+  template <AddrMode mode> byte BVS();
+  template <AddrMode mode> byte CLC();
+  template <AddrMode mode> byte CLD();
+  template <AddrMode mode> byte CLI();
+  template <AddrMode mode> byte CLV();
+  template <AddrMode mode> byte CMP();
+  template <AddrMode mode> byte CPX();
+  template <AddrMode mode> byte CPY();
+  template <AddrMode mode> byte DEC();
+  template <AddrMode mode> byte DEX();
+  template <AddrMode mode> byte DEY();
+  template <AddrMode mode> byte EOR();
+  template <AddrMode mode> byte INC();
+  template <AddrMode mode> byte INX();
+  template <AddrMode mode> byte INY();
+  template <AddrMode mode> byte JMP();
+  template <AddrMode mode> byte JSR();
+  template <AddrMode mode> byte LDA();
+  template <AddrMode mode> byte LDX();
+  template <AddrMode mode> byte LDY();
+  template <AddrMode mode> byte LSR();
+  template <AddrMode mode> byte NOP();
+  template <AddrMode mode> byte ORA();
+  template <AddrMode mode> byte PHA();
+  template <AddrMode mode> byte PHP();
+  template <AddrMode mode> byte PLA();
+  template <AddrMode mode> byte PLP();
+  template <AddrMode mode> byte ROL();
+  template <AddrMode mode> byte ROR();
+  template <AddrMode mode> byte RTI();
+  template <AddrMode mode> byte RTS();
+  template <AddrMode mode> byte SBC();
+  template <AddrMode mode> byte SEC();
+  template <AddrMode mode> byte SED();
+  template <AddrMode mode> byte SEI();
+  template <AddrMode mode> byte STA();
+  template <AddrMode mode> byte STX();
+  template <AddrMode mode> byte STY();
+  template <AddrMode mode> byte TAX();
+  template <AddrMode mode> byte TAY();
+  template <AddrMode mode> byte TSX();
+  template <AddrMode mode> byte TXA();
+  template <AddrMode mode> byte TXS();
+  template <AddrMode mode> byte TYA();
+  template <AddrMode mode> byte XXX();
 };
 
 #endif
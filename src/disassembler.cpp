@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "disassembler.h"
+
+static_assert(sizeof(Disassembler::Instruction) == 8);
+
+Disassembler::Disassembler(Memory& memory) : memory(memory)
+{
+}
+
+std::span<const Disassembler::Instruction> Disassembler::Disassemble(word first, word last)
+{
+  result.clear();
+
+  uint32_t addr = first;
+  while (addr <= last)
+    {
+      const DecodedPage& page = Decode(addr);
+      auto end = std::find_if(page.instructions.begin(), page.instructions.end(),
+                              [last](const Instruction& instruction) { return instruction.addr > last; });
+      result.insert(result.end(), page.instructions.begin(), end);
+
+      if (end != page.instructions.end())
+        break;
+      addr = page.end;
+    }
+
+  return result;
+}
+
+bool Disassembler::IsCurrent(const DecodedPage& page, byte index, byte entry) const
+{
+  return page.read && page.entry == entry && page.read == memory.GetReadPage(index) &&
+         page.version == memory.GetPageVersion(index) &&
+         (!page.spills || page.next_version == memory.GetPageVersion(byte(index + 1)));
+}
+
+const Disassembler::DecodedPage& Disassembler::Decode(uint32_t addr)
+{
+  byte index = addr >> 8;
+  byte entry = addr & 0xFF;
+  DecodedPage& page = pages[index];
+  if (IsCurrent(page, index, entry))
+    return page;
+
+  // from here on a write to the page moves the version recorded below
+  memory.GuardPage(index);
+
+  page.read = memory.GetReadPage(index);
+  page.version = memory.GetPageVersion(index);
+  page.entry = entry;
+  page.instructions.clear();
+
+  uint32_t offset = entry;
+  while (offset < Memory::PAGE_SIZE)
+    {
+      word at = (index << 8) | offset;
+      Instruction instruction{};
+      instruction.addr = at;
+      instruction.opcode = Peek(at);
+      instruction.length = OPCODE_TABLE[instruction.opcode].length;
+      instruction.mode = OPCODE_TABLE[instruction.opcode].mode;
+      if (instruction.length > 1)
+        instruction.operand = Peek(at + 1);
+      if (instruction.length > 2)
+        instruction.operand |= Peek(at + 2) << 8;
+
+      page.instructions.push_back(instruction);
+      offset += instruction.length;
+    }
+
+  page.spills = offset > Memory::PAGE_SIZE;
+  if (page.spills)
+    {
+      byte next = index + 1;
+      memory.GuardPage(next);
+      page.next_version = memory.GetPageVersion(next);
+    }
+
+  page.end = (index << 8) + offset;
+  return page;
+}
+
+byte Disassembler::Peek(word addr) const
+{
+  const byte* page = memory.GetReadPage(addr >> 8);
+  return page ? page[addr & 0xFF] : 0xFF;
+}
+
+size_t Disassembler::Format(const Instruction& instruction, char* out)
+{
+  std::string_view mnemonic = GetMnemonic(instruction.opcode);
+  int name_length = static_cast<int>(mnemonic.size());
+  const char* name = mnemonic.data();
+  word operand = instruction.operand;
+  int length = 0;
+
+  switch (instruction.mode)
+    {
+      case AddrMode::IMP: {
+        bool accumulator = (instruction.opcode & 0x9F) == 0x0A; // ASL, ROL, LSR, ROR
+        length = std::snprintf(out, MAX_TEXT, accumulator ? "%.*s A" : "%.*s", name_length, name);
+      }
+      break;
+      case AddrMode::IMM: length = std::snprintf(out, MAX_TEXT, "%.*s #$%02X", name_length, name, operand); break;
+      case AddrMode::ZP0: length = std::snprintf(out, MAX_TEXT, "%.*s $%02X", name_length, name, operand); break;
+      case AddrMode::ZPX: length = std::snprintf(out, MAX_TEXT, "%.*s $%02X,X", name_length, name, operand); break;
+      case AddrMode::ZPY: length = std::snprintf(out, MAX_TEXT, "%.*s $%02X,Y", name_length, name, operand); break;
+      case AddrMode::REL: {
+        word target = instruction.addr + 2 + static_cast<int8_t>(operand);
+        length = std::snprintf(out, MAX_TEXT, "%.*s $%04X", name_length, name, target);
+      }
+      break;
+      case AddrMode::ABS: length = std::snprintf(out, MAX_TEXT, "%.*s $%04X", name_length, name, operand); break;
+      case AddrMode::ABX: length = std::snprintf(out, MAX_TEXT, "%.*s $%04X,X", name_length, name, operand); break;
+      case AddrMode::ABY: length = std::snprintf(out, MAX_TEXT, "%.*s $%04X,Y", name_length, name, operand); break;
+      case AddrMode::IND: length = std::snprintf(out, MAX_TEXT, "%.*s ($%04X)", name_length, name, operand); break;
+      case AddrMode::IZX: length = std::snprintf(out, MAX_TEXT, "%.*s ($%02X,X)", name_length, name, operand); break;
+      case AddrMode::IZY: length = std::snprintf(out, MAX_TEXT, "%.*s ($%02X),Y", name_length, name, operand); break;
+    }
+
+  return static_cast<size_t>(length);
+}
+
+std::string Disassembler::Format(const Instruction& instruction)
+{
+  char text[MAX_TEXT];
+  return std::string(text, Format(instruction, text));
+}
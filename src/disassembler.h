@@ -0,0 +1,76 @@
+#ifndef GOOGLETESTSEXAMPLE_DISASSEMBLER_H
+#define GOOGLETESTSEXAMPLE_DISASSEMBLER_H
+
+#include <array>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "instruction.h"
+#include "memory.h"
+#include "utils/types.h"
+
+/*
+ *  Linear-sweep disassembler for debugger views.
+ *
+ *  Instructions decode into 8 byte records; text is only made when a line
+ *  is actually shown, by Format. Decoded pages are kept together with the
+ *  page version they were decoded at, and the pages are guarded the way
+ *  the Cached engine guards code, so a refresh re-decodes only pages that
+ *  were written to or had another bank mapped in since. Everything else
+ *  is a copy out of the cache.
+ *
+ *  Bytes are read through the page table only, device pages read as FF
+ *  and are decoded afresh every time.
+ */
+class Disassembler
+{
+public:
+  static constexpr size_t MAX_TEXT = 32;
+
+  struct Instruction
+  {
+    word addr;
+    word operand; // 0, a byte or a little-endian word, by length
+    byte opcode;
+    byte length;
+    AddrMode mode;
+  };
+
+  explicit Disassembler(Memory& memory);
+
+  Disassembler(const Disassembler&) = delete;
+  Disassembler& operator=(const Disassembler&) = delete;
+
+  // The instructions starting in first..last, decoding from `first` on.
+  // Valid until the next call
+  std::span<const Instruction> Disassemble(word first, word last);
+
+  // "LDA ($89),Y", "BNE $C00A" (branch targets resolved), at most
+  // MAX_TEXT bytes with the terminating NUL. Returns the length
+  static size_t Format(const Instruction& instruction, char* out);
+  static std::string Format(const Instruction& instruction);
+
+private:
+  // Instructions starting in one page when the sweep enters it at `entry`
+  struct DecodedPage
+  {
+    const byte* read = nullptr; // storage decoded from, null = device page
+    uint32_t version = 0;
+    uint32_t next_version = 0; // of the following page, when spilled into
+    uint16_t entry = 0xFFFF;
+    bool spills = false; // the last instruction ends in the next page
+    uint32_t end = 0; // address after the last instruction
+    std::vector<Instruction> instructions;
+  };
+
+  const DecodedPage& Decode(uint32_t addr);
+  bool IsCurrent(const DecodedPage& page, byte index, byte entry) const;
+  byte Peek(word addr) const;
+
+  Memory& memory;
+  std::array<DecodedPage, Memory::PAGE_COUNT> pages;
+  std::vector<Instruction> result;
+};
+
+#endif
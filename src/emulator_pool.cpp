@@ -0,0 +1,161 @@
+#include "emulator_pool.h"
+
+#include <algorithm>
+
+#include "mapper.h"
+
+bool EmulatorPool::Load(const std::string& path, size_t instances)
+{
+  count = 0;
+  frame = 0;
+
+  if (!console.LoadCartridge(path))
+    return false;
+
+  count = instances;
+  PC.assign(count, 0);
+  SP.assign(count, 0);
+  A.assign(count, 0);
+  X.assign(count, 0);
+  Y.assign(count, 0);
+  P.assign(count, 0);
+  cycles.assign(count, 0);
+
+  ram.resize(count * RAM_SIZE);
+  prg_ram.resize(count * PRG_RAM_SIZE);
+
+  // every instance starts from the console just powered on
+  StateWriter measure({});
+  SaveConsole(measure);
+  console_state_size = measure.Size();
+  console_state.resize(count * console_state_size);
+  for (size_t i = 0; i < count; i++)
+    SwapOut(i);
+
+  // with cleared RAM, whatever an earlier Load left in the working console
+  std::fill(ram.begin(), ram.end(), 0);
+  std::fill(prg_ram.begin(), prg_ram.end(), 0);
+  return true;
+}
+
+const std::string& EmulatorPool::GetError() const
+{
+  return console.cartridge.GetError();
+}
+
+size_t EmulatorPool::Size() const
+{
+  return count;
+}
+
+void EmulatorPool::SetEngine(CpuEngine engine)
+{
+  console.cpu.engine = engine;
+}
+
+void EmulatorPool::Reset()
+{
+  for (size_t i = 0; i < count; i++)
+    {
+      SwapIn(i);
+      console.Reset();
+      SwapOut(i);
+    }
+}
+
+void EmulatorPool::StepFrame()
+{
+  frame++;
+  uint64_t target = frame * Cpu::PPU_DOTS_PER_FRAME / Cpu::PPU_DOTS_PER_CPU_CYCLE;
+
+  for (size_t i = 0; i < count; i++)
+    {
+      SwapIn(i);
+      console.RunUntil(target);
+      SwapOut(i);
+    }
+}
+
+uint64_t EmulatorPool::GetFrame() const
+{
+  return frame;
+}
+
+byte* EmulatorPool::GetRam(size_t instance)
+{
+  return ram.data() + instance * RAM_SIZE;
+}
+
+byte* EmulatorPool::GetPrgRam(size_t instance)
+{
+  return prg_ram.data() + instance * PRG_RAM_SIZE;
+}
+
+std::span<byte> EmulatorPool::GetConsoleState(size_t instance)
+{
+  return {console_state.data() + instance * console_state_size, console_state_size};
+}
+
+void EmulatorPool::SwapIn(size_t instance)
+{
+  StateReader reader(GetConsoleState(instance));
+  LoadConsole(reader);
+
+  Cpu& cpu = console.cpu;
+  cpu.PC = PC[instance];
+  cpu.SP = SP[instance];
+  cpu.A = A[instance];
+  cpu.X = X[instance];
+  cpu.Y = Y[instance];
+  cpu.status = P[instance];
+  cpu.cycles = cycles[instance];
+
+  // cheap unless the game runs code from RAM
+  StateReader ram_reader({GetRam(instance), RAM_SIZE});
+  console.memory.LoadFrames(ram_reader, 0x00, 0x07);
+  StateReader prg_ram_reader({GetPrgRam(instance), PRG_RAM_SIZE});
+  console.memory.LoadFrames(prg_ram_reader, 0x60, 0x7F);
+}
+
+void EmulatorPool::SwapOut(size_t instance)
+{
+  const Cpu& cpu = console.cpu;
+  PC[instance] = cpu.PC;
+  SP[instance] = cpu.SP;
+  A[instance] = cpu.A;
+  X[instance] = cpu.X;
+  Y[instance] = cpu.Y;
+  P[instance] = cpu.status;
+  cycles[instance] = cpu.cycles;
+
+  StateWriter ram_writer({GetRam(instance), RAM_SIZE});
+  console.memory.SaveFrames(ram_writer, 0x00, 0x07);
+  StateWriter prg_ram_writer({GetPrgRam(instance), PRG_RAM_SIZE});
+  console.memory.SaveFrames(prg_ram_writer, 0x60, 0x7F);
+
+  StateWriter writer(GetConsoleState(instance));
+  SaveConsole(writer);
+}
+
+// Nes::SaveState without the RAM, which the pool keeps in its own arenas
+void EmulatorPool::SaveConsole(StateWriter& writer) const
+{
+  console.cpu.SaveState(writer);
+  console.ppu.SaveState(writer);
+  console.apu.SaveState(writer);
+  writer.Field(console.buttons);
+  writer.Field(console.shifters);
+  writer.Field(console.strobe);
+  console.cartridge.GetMapper()->SaveState(writer);
+}
+
+void EmulatorPool::LoadConsole(StateReader& reader)
+{
+  console.cpu.LoadState(reader);
+  console.ppu.LoadState(reader);
+  console.apu.LoadState(reader);
+  reader.Field(console.buttons);
+  reader.Field(console.shifters);
+  reader.Field(console.strobe);
+  console.cartridge.GetMapper()->LoadState(reader);
+}
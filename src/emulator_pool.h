@@ -0,0 +1,88 @@
+#ifndef GOOGLETESTSEXAMPLE_EMULATOR_POOL_H
+#define GOOGLETESTSEXAMPLE_EMULATOR_POOL_H
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "nes.h"
+#include "state.h"
+#include "utils/types.h"
+
+/*
+ *  Thousands of copies of one ROM stepped in lockstep, e.g. for
+ *  reinforcement learning rollouts. Nothing per instance is an object:
+ *  the CPU registers of all instances are struct-of-arrays, and work RAM,
+ *  PRG RAM and the rest of the console (interrupt lines, PPU, APU,
+ *  controllers and mapper registers) are fixed-size slots in one arena
+ *  each. PRG and CHR ROM are the cartridge's single read-only mapping.
+ *
+ *  One working console runs the instances in turn. Swapping one in loads
+ *  its slots and copies its RAM into place; no RAM page is remapped, and
+ *  only the pages code was decoded from lose their cached code. ROM pages
+ *  only move where its banks differ, so what the Cached and Blocks engines
+ *  decode from ROM is shared by every instance instead of rebuilt.
+ *
+ *  The frame buffer and audio output are the working console's, written
+ *  by whichever instance ran last.
+ */
+class EmulatorPool
+{
+public:
+  static constexpr uint32_t RAM_SIZE = 0x800;
+  static constexpr uint32_t PRG_RAM_SIZE = 0x2000;
+
+  EmulatorPool() = default;
+
+  EmulatorPool(const EmulatorPool&) = delete;
+  EmulatorPool& operator=(const EmulatorPool&) = delete;
+
+  // Loads the ROM and powers on `count` instances. On failure see GetError()
+  bool Load(const std::string& path, size_t count);
+
+  const std::string& GetError() const;
+
+  size_t Size() const;
+
+  void SetEngine(CpuEngine engine);
+
+  // Presses reset on every instance, RAM and timing are left as they are
+  void Reset();
+
+  // Runs every instance to the end of the next frame (Cpu::RunFrames timing)
+  void StepFrame();
+
+  uint64_t GetFrame() const;
+
+  byte* GetRam(size_t instance);
+  byte* GetPrgRam(size_t instance);
+
+  // CPU registers, one entry per instance
+  std::vector<word> PC;
+  std::vector<byte> SP;
+  std::vector<byte> A, X, Y;
+  std::vector<byte> P; // packed status
+  std::vector<uint64_t> cycles;
+
+private:
+  void SwapIn(size_t instance);
+  void SwapOut(size_t instance);
+
+  std::span<byte> GetConsoleState(size_t instance);
+  void SaveConsole(StateWriter& writer) const;
+  void LoadConsole(StateReader& reader);
+
+  Nes console;
+
+  size_t count = 0;
+  uint64_t frame = 0;
+
+  std::vector<byte> ram; // RAM_SIZE per instance
+  std::vector<byte> prg_ram; // PRG_RAM_SIZE per instance
+  std::vector<byte> console_state; // console_state_size per instance
+  size_t console_state_size = 0;
+};
+
+#endif
@@ -1,11 +1,134 @@
 #ifndef GOOGLETESTSEXAMPLE_INSTRUCTION_H
 #define GOOGLETESTSEXAMPLE_INSTRUCTION_H
 
-#include <string>
-#include <utility>
+#include <array>
+#include <string_view>
 
-#include "cpu.h"
 #include "utils/types.h"
 
+// Operation performed by an opcode, independent of how its operand is addressed
+enum class Op : byte
+{
+  ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC,
+  CLD, CLI, CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP,
+  JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTI,
+  RTS, SBC, SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA,
+  XXX, // illegal / unimplemented opcodes
+  COUNT
+};
+
+enum class AddrMode : byte
+{
+  IMP, IMM, ZP0, ZPX, ZPY, REL, ABS, ABX, ABY, IND, IZX, IZY
+};
+
+// Plain decode entry: 4 bytes, so the whole table fits in 1 KB and a decode
+// only ever touches a single cache line
+struct OpcodeEntry
+{
+  Op op;
+  AddrMode mode;
+  byte cycles; // base cycles, before page-cross / branch penalties
+  byte length; // opcode byte + operand bytes
+};
+
+constexpr byte OperandLength(AddrMode mode)
+{
+  switch (mode)
+    {
+      case AddrMode::IMP: return 0;
+      case AddrMode::ABS:
+      case AddrMode::ABX:
+      case AddrMode::ABY:
+      case AddrMode::IND: return 2;
+      default: return 1;
+    }
+}
+
+namespace detail
+{
+constexpr OpcodeEntry E(Op op, AddrMode mode, byte cycles)
+{
+  return OpcodeEntry{op, mode, cycles, static_cast<byte>(1 + OperandLength(mode))};
+}
+} // namespace detail
+
+/*
+ *  Indexed by opcode. Illegal opcodes are decoded as XXX (or NOP for the
+ *  harmless ones) but keep the addressing mode of their column, so the
+ *  program counter still advances over the right number of operand bytes.
+ */
+constexpr std::array<OpcodeEntry, 256> OPCODE_TABLE = []() {
+  using enum Op;
+  using enum AddrMode;
+  using detail::E;
+
+  return std::array<OpcodeEntry, 256>{
+    // 0x00
+    E(BRK, IMM, 7), E(ORA, IZX, 6), E(XXX, IMP, 2), E(XXX, IZX, 8), E(NOP, ZP0, 3), E(ORA, ZP0, 3), E(ASL, ZP0, 5), E(XXX, ZP0, 5),
+    E(PHP, IMP, 3), E(ORA, IMM, 2), E(ASL, IMP, 2), E(XXX, IMM, 2), E(NOP, ABS, 4), E(ORA, ABS, 4), E(ASL, ABS, 6), E(XXX, ABS, 6),
+    // 0x10
+    E(BPL, REL, 2), E(ORA, IZY, 5), E(XXX, IMP, 2), E(XXX, IZY, 8), E(NOP, ZPX, 4), E(ORA, ZPX, 4), E(ASL, ZPX, 6), E(XXX, ZPX, 6),
+    E(CLC, IMP, 2), E(ORA, ABY, 4), E(NOP, IMP, 2), E(XXX, ABY, 7), E(NOP, ABX, 4), E(ORA, ABX, 4), E(ASL, ABX, 7), E(XXX, ABX, 7),
+    // 0x20
+    E(JSR, ABS, 6), E(AND, IZX, 6), E(XXX, IMP, 2), E(XXX, IZX, 8), E(BIT, ZP0, 3), E(AND, ZP0, 3), E(ROL, ZP0, 5), E(XXX, ZP0, 5),
+    E(PLP, IMP, 4), E(AND, IMM, 2), E(ROL, IMP, 2), E(XXX, IMM, 2), E(BIT, ABS, 4), E(AND, ABS, 4), E(ROL, ABS, 6), E(XXX, ABS, 6),
+    // 0x30
+    E(BMI, REL, 2), E(AND, IZY, 5), E(XXX, IMP, 2), E(XXX, IZY, 8), E(NOP, ZPX, 4), E(AND, ZPX, 4), E(ROL, ZPX, 6), E(XXX, ZPX, 6),
+    E(SEC, IMP, 2), E(AND, ABY, 4), E(NOP, IMP, 2), E(XXX, ABY, 7), E(NOP, ABX, 4), E(AND, ABX, 4), E(ROL, ABX, 7), E(XXX, ABX, 7),
+    // 0x40
+    E(RTI, IMP, 6), E(EOR, IZX, 6), E(XXX, IMP, 2), E(XXX, IZX, 8), E(NOP, ZP0, 3), E(EOR, ZP0, 3), E(LSR, ZP0, 5), E(XXX, ZP0, 5),
+    E(PHA, IMP, 3), E(EOR, IMM, 2), E(LSR, IMP, 2), E(XXX, IMM, 2), E(JMP, ABS, 3), E(EOR, ABS, 4), E(LSR, ABS, 6), E(XXX, ABS, 6),
+    // 0x50
+    E(BVC, REL, 2), E(EOR, IZY, 5), E(XXX, IMP, 2), E(XXX, IZY, 8), E(NOP, ZPX, 4), E(EOR, ZPX, 4), E(LSR, ZPX, 6), E(XXX, ZPX, 6),
+    E(CLI, IMP, 2), E(EOR, ABY, 4), E(NOP, IMP, 2), E(XXX, ABY, 7), E(NOP, ABX, 4), E(EOR, ABX, 4), E(LSR, ABX, 7), E(XXX, ABX, 7),
+    // 0x60
+    E(RTS, IMP, 6), E(ADC, IZX, 6), E(XXX, IMP, 2), E(XXX, IZX, 8), E(NOP, ZP0, 3), E(ADC, ZP0, 3), E(ROR, ZP0, 5), E(XXX, ZP0, 5),
+    E(PLA, IMP, 4), E(ADC, IMM, 2), E(ROR, IMP, 2), E(XXX, IMM, 2), E(JMP, IND, 5), E(ADC, ABS, 4), E(ROR, ABS, 6), E(XXX, ABS, 6),
+    // 0x70
+    E(BVS, REL, 2), E(ADC, IZY, 5), E(XXX, IMP, 2), E(XXX, IZY, 8), E(NOP, ZPX, 4), E(ADC, ZPX, 4), E(ROR, ZPX, 6), E(XXX, ZPX, 6),
+    E(SEI, IMP, 2), E(ADC, ABY, 4), E(NOP, IMP, 2), E(XXX, ABY, 7), E(NOP, ABX, 4), E(ADC, ABX, 4), E(ROR, ABX, 7), E(XXX, ABX, 7),
+    // 0x80
+    E(NOP, IMM, 2), E(STA, IZX, 6), E(NOP, IMM, 2), E(XXX, IZX, 6), E(STY, ZP0, 3), E(STA, ZP0, 3), E(STX, ZP0, 3), E(XXX, ZP0, 3),
+    E(DEY, IMP, 2), E(NOP, IMM, 2), E(TXA, IMP, 2), E(XXX, IMM, 2), E(STY, ABS, 4), E(STA, ABS, 4), E(STX, ABS, 4), E(XXX, ABS, 4),
+    // 0x90
+    E(BCC, REL, 2), E(STA, IZY, 6), E(XXX, IMP, 2), E(XXX, IZY, 6), E(STY, ZPX, 4), E(STA, ZPX, 4), E(STX, ZPY, 4), E(XXX, ZPY, 4),
+    E(TYA, IMP, 2), E(STA, ABY, 5), E(TXS, IMP, 2), E(XXX, ABY, 5), E(XXX, ABX, 5), E(STA, ABX, 5), E(XXX, ABY, 5), E(XXX, ABY, 5),
+    // 0xA0
+    E(LDY, IMM, 2), E(LDA, IZX, 6), E(LDX, IMM, 2), E(XXX, IZX, 6), E(LDY, ZP0, 3), E(LDA, ZP0, 3), E(LDX, ZP0, 3), E(XXX, ZP0, 3),
+    E(TAY, IMP, 2), E(LDA, IMM, 2), E(TAX, IMP, 2), E(XXX, IMM, 2), E(LDY, ABS, 4), E(LDA, ABS, 4), E(LDX, ABS, 4), E(XXX, ABS, 4),
+    // 0xB0
+    E(BCS, REL, 2), E(LDA, IZY, 5), E(XXX, IMP, 2), E(XXX, IZY, 5), E(LDY, ZPX, 4), E(LDA, ZPX, 4), E(LDX, ZPY, 4), E(XXX, ZPY, 4),
+    E(CLV, IMP, 2), E(LDA, ABY, 4), E(TSX, IMP, 2), E(XXX, ABY, 4), E(LDY, ABX, 4), E(LDA, ABX, 4), E(LDX, ABY, 4), E(XXX, ABY, 4),
+    // 0xC0
+    E(CPY, IMM, 2), E(CMP, IZX, 6), E(NOP, IMM, 2), E(XXX, IZX, 8), E(CPY, ZP0, 3), E(CMP, ZP0, 3), E(DEC, ZP0, 5), E(XXX, ZP0, 5),
+    E(INY, IMP, 2), E(CMP, IMM, 2), E(DEX, IMP, 2), E(XXX, IMM, 2), E(CPY, ABS, 4), E(CMP, ABS, 4), E(DEC, ABS, 6), E(XXX, ABS, 6),
+    // 0xD0
+    E(BNE, REL, 2), E(CMP, IZY, 5), E(XXX, IMP, 2), E(XXX, IZY, 8), E(NOP, ZPX, 4), E(CMP, ZPX, 4), E(DEC, ZPX, 6), E(XXX, ZPX, 6),
+    E(CLD, IMP, 2), E(CMP, ABY, 4), E(NOP, IMP, 2), E(XXX, ABY, 7), E(NOP, ABX, 4), E(CMP, ABX, 4), E(DEC, ABX, 7), E(XXX, ABX, 7),
+    // 0xE0
+    E(CPX, IMM, 2), E(SBC, IZX, 6), E(NOP, IMM, 2), E(XXX, IZX, 8), E(CPX, ZP0, 3), E(SBC, ZP0, 3), E(INC, ZP0, 5), E(XXX, ZP0, 5),
+    E(INX, IMP, 2), E(SBC, IMM, 2), E(NOP, IMP, 2), E(SBC, IMM, 2), E(CPX, ABS, 4), E(SBC, ABS, 4), E(INC, ABS, 6), E(XXX, ABS, 6),
+    // 0xF0
+    E(BEQ, REL, 2), E(SBC, IZY, 5), E(XXX, IMP, 2), E(XXX, IZY, 8), E(NOP, ZPX, 4), E(SBC, ZPX, 4), E(INC, ZPX, 6), E(XXX, ZPX, 6),
+    E(SED, IMP, 2), E(SBC, ABY, 4), E(NOP, IMP, 2), E(XXX, ABY, 7), E(NOP, ABX, 4), E(SBC, ABX, 4), E(INC, ABX, 7), E(XXX, ABX, 7),
+  };
+}();
+
+static_assert(sizeof(OpcodeEntry) == 4);
+
+// Cold data: only the disassembler and the tracers ever look at names
+constexpr std::array<std::string_view, static_cast<size_t>(Op::COUNT)> MNEMONICS = {
+  "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BRK", "BVC", "BVS", "CLC",
+  "CLD", "CLI", "CLV", "CMP", "CPX", "CPY", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP",
+  "JSR", "LDA", "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA", "PLP", "ROL", "ROR", "RTI",
+  "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY", "TAX", "TAY", "TSX", "TXA", "TXS", "TYA",
+  "???",
+};
+
+constexpr std::string_view GetMnemonic(byte opcode)
+{
+  return MNEMONICS[static_cast<size_t>(OPCODE_TABLE[opcode].op)];
+}
 
 #endif
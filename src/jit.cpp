@@ -0,0 +1,626 @@
+#include "jit.h"
+
+#if NES_JIT
+
+#include <algorithm>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace
+{
+enum Reg : byte
+{
+  RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+  R12 = 12, R13 = 13, R14 = 14
+};
+
+// Condition codes, as in Jcc / SETcc
+enum Cond : byte
+{
+  ABOVE_EQUAL = 0x3, EQUAL = 0x4, NOT_EQUAL = 0x5, ABOVE = 0x7
+};
+
+// Group 1 ALU operations, the /digit of 81 /n and 00-39 opcodes
+enum Alu : byte
+{
+  ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7
+};
+
+// The Cpu stays in rbx, A, X and Y in r12-r14 and rbp flags a slow bus
+// access that asks to leave after the current instruction. Flags are
+// written straight into the lazy fields of Cpu::status
+constexpr Reg CPU = RBX;
+constexpr Reg REG_A = R12;
+constexpr Reg REG_X = R13;
+constexpr Reg REG_Y = R14;
+constexpr Reg EXIT = RBP;
+
+constexpr byte FLAG_D = 1 << 3;
+
+constexpr size_t HOST_PAGE_SIZE = 4096;
+
+byte JitRead(Cpu* cpu, word addr)
+{
+  return cpu->memory->GetMemory(addr);
+}
+
+void JitWrite(Cpu* cpu, word addr, byte data)
+{
+  cpu->memory->SetMemory(data, addr);
+}
+
+// Byte emitter over the free part of the code buffer. Running out of room
+// is only noticed at the end, by Overflowed()
+class Assembler
+{
+public:
+  Assembler(byte* code, size_t capacity) : code(code), capacity(capacity) {}
+
+  size_t Size() const { return size; }
+  bool Overflowed() const { return size > capacity; }
+
+  void Byte(byte value)
+  {
+    if (size < capacity)
+      code[size] = value;
+    size++;
+  }
+
+  void Word(uint16_t value)
+  {
+    Byte(value);
+    Byte(value >> 8);
+  }
+
+  void Dword(uint32_t value)
+  {
+    for (int i = 0; i < 4; i++)
+      Byte(value >> (i * 8));
+  }
+
+  void Qword(uint64_t value)
+  {
+    for (int i = 0; i < 8; i++)
+      Byte(value >> (i * 8));
+  }
+
+  // [rbx + disp32], i.e. a field of the Cpu
+  void LoadByte(Reg dst, int32_t disp) { Rex(false, dst, CPU); Byte(0x0F); Byte(0xB6); Field(dst, disp); }
+  void StoreByte(int32_t disp, Reg src) { Rex(false, src, CPU, true); Byte(0x88); Field(src, disp); }
+  void StoreWord(int32_t disp, Reg src) { Byte(0x66); Rex(false, src, CPU); Byte(0x89); Field(src, disp); }
+  void StoreByteImm(int32_t disp, byte value) { Byte(0xC6); Field(RAX, disp); Byte(value); }
+  void StoreWordImm(int32_t disp, uint16_t value) { Byte(0x66); Byte(0xC7); Field(RAX, disp); Word(value); }
+  void OpWordImm(Alu op, int32_t disp, uint16_t value) { Byte(0x66); Byte(0x81); Field(static_cast<Reg>(op), disp); Word(value); }
+  void AddQwordImm(int32_t disp, int32_t value) { Rex(true, RAX, CPU); Byte(0x81); Field(RAX, disp); Dword(value); }
+  void LoadQword(Reg dst, int32_t disp) { Rex(true, dst, CPU); Byte(0x8B); Field(dst, disp); }
+  void CmpQword(Reg reg, int32_t disp) { Rex(true, reg, CPU); Byte(0x3B); Field(reg, disp); }
+  void CmpDword(Reg reg, int32_t disp) { Rex(false, reg, CPU); Byte(0x3B); Field(reg, disp); }
+
+  // movzx dst, byte [rax + disp32] / mov byte [rax + disp32], src
+  void LoadByteRax(Reg dst, int32_t disp) { Rex(false, dst, RAX); Byte(0x0F); Byte(0xB6); Indexed(dst, disp); }
+  void StoreByteRax(int32_t disp, Reg src) { Rex(false, src, RAX, true); Byte(0x88); Indexed(src, disp); }
+
+  // mov rax, [rax] / mov eax, [rax]
+  void LoadPointerRax() { Byte(0x48); Byte(0x8B); Byte(0x00); }
+  void LoadDwordRax() { Byte(0x8B); Byte(0x00); }
+
+  void TestRax() { Byte(0x48); Byte(0x85); Byte(0xC0); }
+  void AddRaxImm(int32_t value) { Byte(0x48); Byte(0x05); Dword(value); }
+
+  void MovImm64(Reg dst, uint64_t value) { Rex(true, RAX, dst); Byte(0xB8 + (dst & 7)); Qword(value); }
+  void MovImm32(Reg dst, uint32_t value) { Rex(false, RAX, dst); Byte(0xB8 + (dst & 7)); Dword(value); }
+  void Mov64(Reg dst, Reg src) { Rex(true, src, dst); Byte(0x89); Direct(src, dst); }
+
+  // 32-bit register forms
+  void Mov(Reg dst, Reg src) { Rex(false, src, dst); Byte(0x89); Direct(src, dst); }
+  void Test(Reg dst, Reg src) { Rex(false, src, dst); Byte(0x85); Direct(src, dst); }
+  void Op(Alu op, Reg dst, Reg src) { Rex(false, src, dst); Byte(op * 8 + 1); Direct(src, dst); }
+  void OpImm(Alu op, Reg dst, uint32_t value) { Rex(false, RAX, dst); Byte(0x81); Direct(static_cast<Reg>(op), dst); Dword(value); }
+  void Inc(Reg reg) { Rex(false, RAX, reg); Byte(0xFF); Direct(RAX, reg); }
+  void Dec(Reg reg) { Rex(false, RAX, reg); Byte(0xFF); Direct(RCX, reg); }
+  void Not(Reg reg) { Rex(false, RAX, reg); Byte(0xF7); Direct(RDX, reg); }
+  void Shr(Reg reg, byte count) { Rex(false, RAX, reg); Byte(0xC1); Direct(RBP, reg); Byte(count); }
+
+  // eax = condition ? 1 : 0
+  void SetEax(Cond cond) { Byte(0x0F); Byte(0x90 + cond); Byte(0xC0); Byte(0x0F); Byte(0xB6); Byte(0xC0); }
+
+  void Push(Reg reg) { Rex(false, RAX, reg); Byte(0x50 + (reg & 7)); }
+  void Pop(Reg reg) { Rex(false, RAX, reg); Byte(0x58 + (reg & 7)); }
+  void Ret() { Byte(0xC3); }
+
+  void Call(const void* function)
+  {
+    MovImm64(RAX, reinterpret_cast<uint64_t>(function));
+    Byte(0xFF);
+    Byte(0xD0);
+  }
+
+  // Jumps with a rel32 to be bound later, returning where it sits
+  size_t Jump(Cond cond)
+  {
+    Byte(0x0F);
+    Byte(0x80 + cond);
+    Dword(0);
+    return size - 4;
+  }
+
+  size_t Jump()
+  {
+    Byte(0xE9);
+    Dword(0);
+    return size - 4;
+  }
+
+  void Bind(size_t fixup, size_t target)
+  {
+    uint32_t rel = static_cast<uint32_t>(target - (fixup + 4));
+    for (int i = 0; i < 4; i++)
+      if (fixup + i < capacity)
+        code[fixup + i] = rel >> (i * 8);
+  }
+
+  void Bind(size_t fixup) { Bind(fixup, size); }
+
+private:
+  void Rex(bool wide, Reg reg, Reg rm, bool force = false)
+  {
+    byte rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40 || force)
+      Byte(rex);
+  }
+
+  void Field(Reg reg, int32_t disp)
+  {
+    Byte(0x80 | ((reg & 7) << 3) | CPU);
+    Dword(disp);
+  }
+
+  void Indexed(Reg reg, int32_t disp)
+  {
+    Byte(0x80 | ((reg & 7) << 3) | RAX);
+    Dword(disp);
+  }
+
+  void Direct(Reg reg, Reg rm) { Byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+  byte* code;
+  size_t capacity;
+  size_t size = 0;
+};
+
+// Instructions compiled to native code, the rest call their handler
+bool IsNative(const OpcodeEntry& entry)
+{
+  bool memory = entry.mode == AddrMode::ZP0 || entry.mode == AddrMode::ABS;
+
+  switch (entry.op)
+    {
+      case Op::LDA: case Op::LDX: case Op::LDY:
+      case Op::AND: case Op::ORA: case Op::EOR: case Op::ADC: case Op::SBC:
+      case Op::CMP: case Op::CPX: case Op::CPY:
+        return memory || entry.mode == AddrMode::IMM;
+      case Op::STA: case Op::STX: case Op::STY:
+        return memory;
+      case Op::TAX: case Op::TAY: case Op::TXA: case Op::TYA:
+      case Op::INX: case Op::INY: case Op::DEX: case Op::DEY:
+      case Op::CLC: case Op::SEC: case Op::CLD: case Op::SED: case Op::CLV:
+      case Op::NOP:
+        return entry.mode == AddrMode::IMP;
+      default:
+        return false;
+    }
+}
+
+Reg RegisterOf(Op op)
+{
+  switch (op)
+    {
+      case Op::LDX: case Op::STX: case Op::CPX: return REG_X;
+      case Op::LDY: case Op::STY: case Op::CPY: return REG_Y;
+      default: return REG_A;
+    }
+}
+
+/*
+ *  One block's worth of code generation. Cycles of native instructions
+ *  are summed up at compile time and only added to Cpu::cycles before a
+ *  call or an exit.
+ */
+class BlockCompiler
+{
+public:
+  BlockCompiler(Cpu& cpu, byte* code, size_t capacity) : cpu(cpu), as(code, capacity) {}
+
+  size_t Compile(const Cpu::BlockOp* ops, uint32_t count, word pc)
+  {
+    Prologue();
+
+    bool last_native = false;
+    for (uint32_t i = 0; i < count; i++)
+      {
+        const Cpu::BlockOp& op = ops[i];
+        const OpcodeEntry& entry = OPCODE_TABLE[op.opcode];
+        word next = pc + op.length;
+
+        last_native = IsNative(entry);
+        if (last_native)
+          Native(op, entry, next);
+        else
+          Handler(op, next, i + 1 == count);
+
+        pc = next;
+      }
+
+    if (last_native)
+      {
+        FlushCycles();
+        as.StoreWordImm(Offset(&cpu.PC), pc);
+      }
+
+    size_t epilogue = as.Size();
+    Epilogue();
+
+    for (const Exit& exit : exits)
+      {
+        for (size_t fixup : exit.fixups)
+          as.Bind(fixup);
+        if (exit.pending)
+          as.AddQwordImm(Offset(&cpu.cycles), exit.pending);
+        as.StoreWordImm(Offset(&cpu.PC), exit.pc);
+        as.Bind(as.Jump(), epilogue);
+      }
+
+    for (const SlowAccess& slow : slow_accesses)
+      SlowPath(slow);
+
+    return as.Overflowed() ? 0 : as.Size();
+  }
+
+private:
+  struct Exit
+  {
+    std::vector<size_t> fixups;
+    word pc;
+    uint32_t pending;
+  };
+
+  // Bus access that missed the page table fast path, emitted out of line
+  struct SlowAccess
+  {
+    size_t fixup;
+    size_t resume;
+    word addr;
+    byte opcode;
+    bool write;
+    Reg data;
+    uint32_t pending; // cycles not in Cpu::cycles yet, before the instruction
+    uint32_t pending_after; // and after it
+  };
+
+  int32_t Offset(const void* field) const
+  {
+    return static_cast<int32_t>(static_cast<const byte*>(field) - reinterpret_cast<const byte*>(&cpu));
+  }
+
+  void Prologue()
+  {
+    // five pushes on top of the return address keep calls 16 byte aligned
+    for (Reg reg : {RBX, RBP, R12, R13, R14})
+      as.Push(reg);
+    as.Mov64(CPU, RDI);
+    as.Op(XOR, EXIT, EXIT);
+    LoadRegisters();
+  }
+
+  void Epilogue()
+  {
+    StoreRegisters();
+    for (Reg reg : {R14, R13, R12, RBP, RBX})
+      as.Pop(reg);
+    as.Ret();
+  }
+
+  void LoadRegisters()
+  {
+    as.LoadByte(REG_A, Offset(&cpu.A));
+    as.LoadByte(REG_X, Offset(&cpu.X));
+    as.LoadByte(REG_Y, Offset(&cpu.Y));
+  }
+
+  void StoreRegisters()
+  {
+    as.StoreByte(Offset(&cpu.A), REG_A);
+    as.StoreByte(Offset(&cpu.X), REG_X);
+    as.StoreByte(Offset(&cpu.Y), REG_Y);
+  }
+
+
+  void FlushCycles()
+  {
+    if (pending)
+      as.AddQwordImm(Offset(&cpu.cycles), pending);
+    pending = 0;
+  }
+
+  // Leaves the block, resuming at pc, when the condition of the last
+  // compare holds
+  void ExitIf(Cond cond, word pc)
+  {
+    if (exits.empty() || exits.back().pc != pc || exits.back().pending != pending)
+      exits.push_back(Exit{{}, pc, pending});
+    exits.back().fixups.push_back(as.Jump(cond));
+  }
+
+  // value holds an 8-bit result, zero extended
+  void SetNZ(Reg value)
+  {
+    as.StoreWord(Offset(&cpu.status.nz), value);
+  }
+
+  // ecx = the byte at addr, inlining the page table fast path
+  void Read(word addr, byte opcode, uint32_t cycles)
+  {
+    as.MovImm64(RAX, reinterpret_cast<uint64_t>(cpu.memory->GetReadSlot(addr >> 8)));
+    as.LoadPointerRax();
+    as.TestRax();
+    size_t fixup = as.Jump(EQUAL);
+    as.LoadByteRax(RCX, addr & 0xFF);
+    slow_accesses.push_back(SlowAccess{fixup, as.Size(), addr, opcode, false, RAX, pending, pending + cycles});
+  }
+
+  void Write(word addr, Reg data, byte opcode, uint32_t cycles)
+  {
+    as.MovImm64(RAX, reinterpret_cast<uint64_t>(cpu.memory->GetWriteSlot(addr >> 8)));
+    as.LoadPointerRax();
+    as.TestRax();
+    size_t fixup = as.Jump(EQUAL);
+    as.StoreByteRax(addr & 0xFF, data);
+    slow_accesses.push_back(SlowAccess{fixup, as.Size(), addr, opcode, true, data, pending, pending + cycles});
+  }
+
+  void SlowPath(const SlowAccess& slow)
+  {
+    as.Bind(slow.fixup);
+
+    // the device sees the same cycle count and opcode as from a handler
+    as.StoreByteImm(Offset(&cpu.opcode), slow.opcode);
+    if (slow.pending)
+      as.AddQwordImm(Offset(&cpu.cycles), slow.pending);
+
+    as.Mov64(RDI, CPU);
+    as.MovImm32(RSI, slow.addr);
+    if (slow.write)
+      {
+        as.Mov(RDX, slow.data);
+        as.Call(reinterpret_cast<const void*>(&JitWrite));
+      }
+    else
+      {
+        as.Call(reinterpret_cast<const void*>(&JitRead));
+        as.Mov(RCX, RAX);
+        as.OpImm(AND, RCX, 0xFF);
+      }
+
+    if (slow.pending)
+      as.AddQwordImm(Offset(&cpu.cycles), -static_cast<int32_t>(slow.pending));
+
+    // the instruction still has to finish, so only flag the exit here
+    as.LoadQword(RAX, Offset(&cpu.cycles));
+    as.AddRaxImm(slow.pending_after);
+    as.CmpQword(RAX, Offset(&cpu.stop_cycle));
+    size_t stop = as.Jump(ABOVE_EQUAL);
+    as.MovImm64(RAX, reinterpret_cast<uint64_t>(cpu.memory->GetChangeCountSlot()));
+    as.LoadDwordRax();
+    as.CmpDword(RAX, Offset(&cpu.decoded_change_count));
+    size_t unchanged = as.Jump(EQUAL);
+    as.Bind(stop);
+    as.MovImm32(EXIT, 1);
+    as.Bind(unchanged);
+    as.Bind(as.Jump(), slow.resume);
+  }
+
+  void Native(const Cpu::BlockOp& op, const OpcodeEntry& entry, word next)
+  {
+    Reg reg = RegisterOf(entry.op);
+    bool memory = entry.mode == AddrMode::ZP0 || entry.mode == AddrMode::ABS;
+    word addr = entry.mode == AddrMode::ZP0 ? op.operand & 0xFF : op.operand;
+
+    // the operand of loads and ALU ops goes to ecx
+    if (entry.mode == AddrMode::IMM)
+      as.MovImm32(RCX, op.operand & 0xFF);
+    else if (memory && entry.op != Op::STA && entry.op != Op::STX && entry.op != Op::STY)
+      Read(addr, op.opcode, entry.cycles);
+
+    switch (entry.op)
+      {
+        case Op::LDA: case Op::LDX: case Op::LDY:
+          as.Mov(reg, RCX);
+          SetNZ(reg);
+          break;
+
+        case Op::STA: case Op::STX: case Op::STY:
+          Write(addr, reg, op.opcode, entry.cycles);
+          break;
+
+        case Op::AND: as.Op(AND, REG_A, RCX); SetNZ(REG_A); break;
+        case Op::ORA: as.Op(OR, REG_A, RCX); SetNZ(REG_A); break;
+        case Op::EOR: as.Op(XOR, REG_A, RCX); SetNZ(REG_A); break;
+
+        case Op::SBC:
+          as.OpImm(XOR, RCX, 0xFF);
+          [[fallthrough]];
+        case Op::ADC:
+          // edx = A + M + C, then C, V, N, Z as in Cpu::ADC
+          as.LoadByte(RDX, Offset(&cpu.status.carry));
+          as.Op(ADD, RDX, REG_A);
+          as.Op(ADD, RDX, RCX);
+          as.OpImm(CMP, RDX, 0xFF);
+          as.SetEax(ABOVE);
+          as.StoreByte(Offset(&cpu.status.carry), RAX);
+          as.Mov(RAX, REG_A);
+          as.Op(XOR, RAX, RCX);
+          as.Not(RAX);
+          as.Mov(RSI, REG_A);
+          as.Op(XOR, RSI, RDX);
+          as.Op(AND, RAX, RSI);
+          as.OpImm(AND, RAX, 0x80);
+          as.Shr(RAX, 1);
+          as.StoreByte(Offset(&cpu.status.overflow), RAX);
+          as.Mov(REG_A, RDX);
+          as.OpImm(AND, REG_A, 0xFF);
+          SetNZ(REG_A);
+          break;
+
+        case Op::CMP: case Op::CPX: case Op::CPY:
+          as.Op(CMP, reg, RCX);
+          as.SetEax(ABOVE_EQUAL);
+          as.StoreByte(Offset(&cpu.status.carry), RAX);
+          as.Mov(RDX, reg);
+          as.Op(SUB, RDX, RCX);
+          as.OpImm(AND, RDX, 0xFF);
+          SetNZ(RDX);
+          break;
+
+        case Op::TAX: as.Mov(REG_X, REG_A); SetNZ(REG_X); break;
+        case Op::TAY: as.Mov(REG_Y, REG_A); SetNZ(REG_Y); break;
+        case Op::TXA: as.Mov(REG_A, REG_X); SetNZ(REG_A); break;
+        case Op::TYA: as.Mov(REG_A, REG_Y); SetNZ(REG_A); break;
+
+        case Op::INX: case Op::INY: case Op::DEX: case Op::DEY:
+          {
+            Reg target = entry.op == Op::INX || entry.op == Op::DEX ? REG_X : REG_Y;
+            if (entry.op == Op::INX || entry.op == Op::INY)
+              as.Inc(target);
+            else
+              as.Dec(target);
+            as.OpImm(AND, target, 0xFF);
+            SetNZ(target);
+            break;
+          }
+
+        case Op::CLC: as.StoreByteImm(Offset(&cpu.status.carry), 0); break;
+        case Op::SEC: as.StoreByteImm(Offset(&cpu.status.carry), StatusRegister::C); break;
+        case Op::CLV: as.StoreByteImm(Offset(&cpu.status.overflow), 0); break;
+        case Op::CLD: as.OpWordImm(AND, Offset(&cpu.status.other), ~FLAG_D & 0xFFFF); break;
+        case Op::SED: as.OpWordImm(OR, Offset(&cpu.status.other), FLAG_D); break;
+
+        default: // NOP
+          break;
+      }
+
+    pending += entry.cycles;
+
+    // a slow access may have signalled an interrupt or written to code
+    if (memory)
+      {
+        as.Test(EXIT, EXIT);
+        ExitIf(NOT_EQUAL, next);
+      }
+  }
+
+  void Handler(const Cpu::BlockOp& op, word next, bool last)
+  {
+    FlushCycles();
+    StoreRegisters();
+    as.StoreWordImm(Offset(&cpu.PC), next);
+    as.StoreByteImm(Offset(&cpu.opcode), op.opcode);
+    as.Mov64(RDI, CPU);
+    as.MovImm32(RSI, op.operand);
+    as.Call(reinterpret_cast<const void*>(op.handler));
+    LoadRegisters();
+
+    if (last || !op.check)
+      return;
+
+    as.LoadQword(RAX, Offset(&cpu.cycles));
+    as.CmpQword(RAX, Offset(&cpu.stop_cycle));
+    ExitIf(ABOVE_EQUAL, next);
+    as.MovImm64(RAX, reinterpret_cast<uint64_t>(cpu.memory->GetChangeCountSlot()));
+    as.LoadDwordRax();
+    as.CmpDword(RAX, Offset(&cpu.decoded_change_count));
+    ExitIf(NOT_EQUAL, next);
+  }
+
+  Cpu& cpu;
+  Assembler as;
+  uint32_t pending = 0;
+  std::vector<Exit> exits;
+  std::vector<SlowAccess> slow_accesses;
+};
+} // namespace
+
+// The buffer is never writable and executable at once: it is executable
+// between compiles and made writable only while one block is emitted
+JitCompiler::JitCompiler()
+{
+  void* memory = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory != MAP_FAILED)
+    code = static_cast<byte*>(memory);
+}
+
+JitCompiler::~JitCompiler()
+{
+  if (code)
+    munmap(code, CODE_SIZE);
+}
+
+bool JitCompiler::IsAvailable() const
+{
+  return code != nullptr;
+}
+
+JitCompiler::NativeBlock JitCompiler::Compile(Cpu& cpu, const Cpu::BlockOp* ops, uint32_t count, word pc)
+{
+  if (!code || used >= CODE_SIZE)
+    return nullptr;
+
+  // only the pages from here to the end of the buffer can be written to
+  byte* start = code + used;
+  byte* first_page = code + (used & ~(HOST_PAGE_SIZE - 1));
+  size_t length = code + CODE_SIZE - first_page;
+  if (mprotect(first_page, length, PROT_READ | PROT_WRITE) != 0)
+    return nullptr;
+
+  size_t size = BlockCompiler(cpu, start, CODE_SIZE - used).Compile(ops, count, pc);
+
+  if (mprotect(first_page, length, PROT_READ | PROT_EXEC) != 0)
+    {
+      // the code cannot be run, and must not stay writable either
+      munmap(code, CODE_SIZE);
+      code = nullptr;
+      return nullptr;
+    }
+  if (size == 0)
+    return nullptr;
+
+  // keep blocks on their own cache lines
+  used = std::min(CODE_SIZE, (used + size + 63) & ~size_t{63});
+  return reinterpret_cast<NativeBlock>(start);
+}
+
+void JitCompiler::Flush()
+{
+  used = 0;
+}
+
+#else
+
+JitCompiler::JitCompiler() = default;
+JitCompiler::~JitCompiler() = default;
+
+bool JitCompiler::IsAvailable() const
+{
+  return false;
+}
+
+JitCompiler::NativeBlock JitCompiler::Compile(Cpu&, const Cpu::BlockOp*, uint32_t, word)
+{
+  return nullptr;
+}
+
+void JitCompiler::Flush()
+{
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef GOOGLETESTSEXAMPLE_JIT_H
+#define GOOGLETESTSEXAMPLE_JIT_H
+
+#include <cstddef>
+
+#include "cpu.h"
+#include "utils/types.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#  define NES_JIT 1
+#else
+#  define NES_JIT 0
+#endif
+
+/*
+ *  x86-64 code generator for hot translated blocks (CpuEngine::Jit).
+ *
+ *  A, X and Y live in callee-saved host registers for the whole block,
+ *  flags are written straight into the lazy fields of Cpu::status.
+ *  Loads, stores, transfers, increments, flag operations and the ALU ops
+ *  with immediate, zero page or absolute operands are emitted natively;
+ *  their bus accesses inline the page table fast path and only call out
+ *  for devices, unmapped pages and guarded (code) pages. Everything else
+ *  calls the instruction's fused handler, with the registers written back
+ *  around the call.
+ *
+ *  Native code is only entered when the whole block fits before
+ *  stop_cycle, and leaves after any instruction that moved stop_cycle or
+ *  wrote to code, exactly where the Blocks engine would stop.
+ */
+class JitCompiler
+{
+public:
+  using NativeBlock = void (*)(Cpu* cpu);
+
+  static constexpr size_t CODE_SIZE = 1024 * 1024;
+
+  JitCompiler();
+  ~JitCompiler();
+
+  JitCompiler(const JitCompiler&) = delete;
+  JitCompiler& operator=(const JitCompiler&) = delete;
+
+  // False if no executable memory could be had, every Compile then fails
+  bool IsAvailable() const;
+
+  // Native code for `count` ops starting at `pc`, bound to `cpu` and its
+  // Memory. Null when the code buffer is full, or when it could not be
+  // made executable again, after which IsAvailable() is false and every
+  // block handed out so far is gone
+  NativeBlock Compile(Cpu& cpu, const Cpu::BlockOp* ops, uint32_t count, word pc);
+
+  // Drops all code, every NativeBlock handed out so far becomes invalid
+  void Flush();
+
+private:
+  byte* code = nullptr;
+  size_t used = 0;
+};
+
+#endif
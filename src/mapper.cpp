@@ -0,0 +1,528 @@
+#include <array>
+
+#include "cpu.h"
+#include "mapper.h"
+
+Mapper::Mapper(const Cartridge& cartridge)
+  : header(cartridge.GetHeader()), prg_rom(cartridge.GetPrgRom()), chr_rom(cartridge.GetChrRom())
+{
+}
+
+Mapper::~Mapper()
+{
+  if (scheduler)
+    {
+      scheduler->Schedule(EventType::MapperIrq, Scheduler::NEVER);
+      scheduler->SetSource(EventType::MapperIrq, nullptr);
+    }
+  if (cpu)
+    cpu->SetIrq(Cpu::IRQ_MAPPER, false);
+}
+
+void Mapper::Connect(Memory* _memory, Ppu* _ppu, Cpu* _cpu, Scheduler* _scheduler)
+{
+  memory = _memory;
+  ppu = _ppu;
+  cpu = _cpu;
+  scheduler = _scheduler;
+  prg_pages.fill(nullptr);
+
+  if (ppu)
+    {
+      if (!chr_rom)
+        ppu->MapChr(0, 8, nullptr, true);
+      ppu->SetMirroring(header.mirroring);
+    }
+}
+
+byte Mapper::Read(word)
+{
+  return 0;
+}
+
+void Mapper::RunEvent(EventType, uint64_t)
+{
+}
+
+uint32_t Mapper::PrgBank(int bank, uint32_t size) const
+{
+  int count = header.prg_rom_size / size;
+  if (count == 0)
+    return 0;
+
+  bank %= count;
+  return (bank < 0 ? bank + count : bank) * size;
+}
+
+uint32_t Mapper::ChrBank(int bank, uint32_t size) const
+{
+  int count = header.chr_rom_size / size;
+  if (count == 0)
+    return 0;
+
+  bank %= count;
+  return (bank < 0 ? bank + count : bank) * size;
+}
+
+void Mapper::MapPrg(byte first_page, uint32_t size, uint32_t offset)
+{
+  if (!memory)
+    return;
+
+  // only pages that really change are remapped, a page version bump
+  // throws away whatever the CPU has decoded or compiled from it
+  for (uint32_t i = 0; i < size / Memory::PAGE_SIZE; i++)
+    {
+      uint32_t page = first_page + i;
+      const byte* storage = prg_rom + (offset + i * Memory::PAGE_SIZE) % header.prg_rom_size;
+      if (prg_pages[page - FIRST_PRG_PAGE] == storage)
+        continue;
+
+      memory->MapReadOnly(page, page, storage, Memory::PAGE_SIZE, this);
+      prg_pages[page - FIRST_PRG_PAGE] = storage;
+    }
+}
+
+void Mapper::MapChr(int first_bank, int bank_count, uint32_t offset)
+{
+  if (ppu && chr_rom)
+    ppu->MapChr(first_bank, bank_count, chr_rom + offset, false);
+}
+
+void Mapper::SetMirroring(Mirroring mirroring)
+{
+  if (ppu && header.mirroring != Mirroring::FourScreen)
+    ppu->SetMirroring(mirroring);
+}
+
+namespace
+{
+constexpr uint32_t KB = 1024;
+
+// A board is a specialisation on its iNES mapper number
+template <uint16_t number>
+class Board;
+
+// Save states of a board: its Serialize fields, then the banks they select
+template <typename Self>
+class BoardBase : public Mapper
+{
+public:
+  using Mapper::Mapper;
+
+  void SaveState(StateWriter& writer) const override
+  {
+    Self::Serialize(static_cast<const Self&>(*this), writer);
+  }
+
+  void LoadState(StateReader& reader) override
+  {
+    Self::Serialize(static_cast<Self&>(*this), reader);
+    static_cast<Self&>(*this).Apply();
+  }
+};
+
+// NROM: 16 or 32 KB PRG, 8 KB CHR, nothing to switch
+template <>
+class Board<0> final : public BoardBase<Board<0>>
+{
+public:
+  using BoardBase::BoardBase;
+
+  void Reset() override { Apply(); }
+
+  void Write(word, byte) override {}
+
+  void Apply()
+  {
+    MapPrg(0x80, 32 * KB, 0);
+    MapChr(0, 8, 0);
+  }
+
+  template <typename Self, typename Archive>
+  static void Serialize(Self&, Archive&)
+  {
+  }
+};
+
+// MMC1 (SxROM): five serial writes load one of four internal registers
+template <>
+class Board<1> final : public BoardBase<Board<1>>
+{
+public:
+  using BoardBase::BoardBase;
+
+  void Reset() override
+  {
+    shift = SHIFT_EMPTY;
+    control = 0x0C;
+    chr_bank0 = 0;
+    chr_bank1 = 0;
+    prg_bank = 0;
+    Apply();
+  }
+
+  void Write(word addr, byte data) override
+  {
+    if (data & 0x80)
+      {
+        shift = SHIFT_EMPTY;
+        control |= 0x0C;
+        Apply();
+        return;
+      }
+
+    // the marker bit reaches bit 0 once four bits have been shifted in
+    bool full = shift & 1;
+    shift = (shift >> 1) | ((data & 1) << 4);
+    if (!full)
+      return;
+
+    switch ((addr >> 13) & 0x03)
+      {
+        case 0: control = shift; break;
+        case 1: chr_bank0 = shift; break;
+        case 2: chr_bank1 = shift; break;
+        case 3: prg_bank = shift & 0x0F; break;
+      }
+    shift = SHIFT_EMPTY;
+    Apply();
+  }
+
+  void Apply()
+  {
+    static constexpr Mirroring MIRRORING[] = {
+      Mirroring::SingleScreenLow, Mirroring::SingleScreenHigh, Mirroring::Vertical, Mirroring::Horizontal};
+    SetMirroring(MIRRORING[control & 0x03]);
+
+    switch ((control >> 2) & 0x03)
+      {
+        case 0:
+        case 1: MapPrg(0x80, 32 * KB, PrgBank(prg_bank >> 1, 32 * KB)); break;
+        case 2:
+          MapPrg(0x80, 16 * KB, PrgBank(0, 16 * KB));
+          MapPrg(0xC0, 16 * KB, PrgBank(prg_bank, 16 * KB));
+          break;
+        case 3:
+          MapPrg(0x80, 16 * KB, PrgBank(prg_bank, 16 * KB));
+          MapPrg(0xC0, 16 * KB, PrgBank(-1, 16 * KB));
+          break;
+      }
+
+    if (control & 0x10)
+      {
+        MapChr(0, 4, ChrBank(chr_bank0, 4 * KB));
+        MapChr(4, 4, ChrBank(chr_bank1, 4 * KB));
+      }
+    else
+      {
+        MapChr(0, 8, ChrBank(chr_bank0 >> 1, 8 * KB));
+      }
+  }
+
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive)
+  {
+    archive.Field(self.shift);
+    archive.Field(self.control);
+    archive.Field(self.chr_bank0);
+    archive.Field(self.chr_bank1);
+    archive.Field(self.prg_bank);
+  }
+
+private:
+  static constexpr byte SHIFT_EMPTY = 0x10;
+
+  byte shift = SHIFT_EMPTY;
+  byte control = 0x0C;
+  byte chr_bank0 = 0;
+  byte chr_bank1 = 0;
+  byte prg_bank = 0;
+};
+
+// UxROM: switchable 16 KB at $8000, last bank fixed at $C000
+template <>
+class Board<2> final : public BoardBase<Board<2>>
+{
+public:
+  using BoardBase::BoardBase;
+
+  void Reset() override
+  {
+    bank = 0;
+    MapChr(0, 8, 0);
+    Apply();
+  }
+
+  void Write(word, byte data) override
+  {
+    bank = data;
+    Apply();
+  }
+
+  void Apply()
+  {
+    MapPrg(0x80, 16 * KB, PrgBank(bank, 16 * KB));
+    MapPrg(0xC0, 16 * KB, PrgBank(-1, 16 * KB));
+  }
+
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive)
+  {
+    archive.Field(self.bank);
+  }
+
+private:
+  byte bank = 0;
+};
+
+// CNROM: NROM PRG, switchable 8 KB CHR
+template <>
+class Board<3> final : public BoardBase<Board<3>>
+{
+public:
+  using BoardBase::BoardBase;
+
+  void Reset() override
+  {
+    bank = 0;
+    MapPrg(0x80, 32 * KB, 0);
+    Apply();
+  }
+
+  void Write(word, byte data) override
+  {
+    bank = data;
+    Apply();
+  }
+
+  void Apply()
+  {
+    MapChr(0, 8, ChrBank(bank, 8 * KB));
+  }
+
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive)
+  {
+    archive.Field(self.bank);
+  }
+
+private:
+  byte bank = 0;
+};
+
+/*
+ *  MMC3 (TxROM): 8 KB PRG and 1 / 2 KB CHR banks, plus a scanline counter
+ *  the PPU clocks. The counter is exact whenever the PPU is caught up, and
+ *  the cycle it reaches zero on is worked out ahead of time and put on the
+ *  scheduler, so the IRQ is raised there without anyone polling for it.
+ */
+template <>
+class Board<4> final : public BoardBase<Board<4>>, public ScanlineCounter
+{
+public:
+  using BoardBase::BoardBase;
+
+  ~Board() override
+  {
+    if (ppu)
+      ppu->ConnectScanlineCounter(nullptr);
+  }
+
+  void Reset() override
+  {
+    if (ppu)
+      ppu->ConnectScanlineCounter(this);
+    if (scheduler)
+      scheduler->SetSource(EventType::MapperIrq, this);
+
+    bank_select = 0;
+    registers = {0, 2, 4, 5, 6, 7, 0, 1};
+    mirroring = header.mirroring == Mirroring::Horizontal ? 1 : 0;
+    irq_latch = 0;
+    irq_counter = 0;
+    irq_reload = false;
+    irq_enabled = false;
+    if (cpu)
+      cpu->SetIrq(Cpu::IRQ_MAPPER, false);
+
+    Apply();
+    Reschedule();
+  }
+
+  void Write(word addr, byte data) override
+  {
+    switch (addr & 0xE001)
+      {
+        case 0x8000:
+          bank_select = data;
+          Apply();
+          return;
+        case 0x8001:
+          registers[bank_select & 0x07] = data;
+          Apply();
+          return;
+        case 0xA000:
+          mirroring = data;
+          Apply();
+          return;
+        case 0xA001: return; // PRG RAM protect, RAM is always enabled
+        default: break;
+      }
+
+    // IRQ registers: bring the counter up to the write first
+    if (ppu && cpu)
+      ppu->CatchUp(cpu->BusCycle());
+
+    switch (addr & 0xE001)
+      {
+        case 0xC000: irq_latch = data; break;
+        case 0xC001:
+          irq_counter = 0;
+          irq_reload = true;
+          break;
+        case 0xE000:
+          irq_enabled = false;
+          if (cpu)
+            cpu->SetIrq(Cpu::IRQ_MAPPER, false);
+          break;
+        case 0xE001: irq_enabled = true; break;
+      }
+    Reschedule();
+  }
+
+  void LoadState(StateReader& reader) override
+  {
+    BoardBase::LoadState(reader);
+    Reschedule();
+  }
+
+  void RunEvent(EventType, uint64_t cycle) override
+  {
+    // catching the PPU up clocks the counter to zero and raises the IRQ
+    ppu->CatchUp(cycle);
+    Reschedule();
+  }
+
+  void ClockScanline() override
+  {
+    if (irq_counter == 0 || irq_reload)
+      {
+        irq_counter = irq_latch;
+        irq_reload = false;
+      }
+    else
+      {
+        irq_counter--;
+      }
+
+    if (irq_counter == 0 && irq_enabled && cpu)
+      cpu->SetIrq(Cpu::IRQ_MAPPER, true);
+  }
+
+  void RenderingChanged() override { Reschedule(); }
+
+  void Apply()
+  {
+    bool prg_swap = bank_select & 0x40;
+    MapPrg(0x80, 8 * KB, PrgBank(prg_swap ? -2 : registers[6], 8 * KB));
+    MapPrg(0xA0, 8 * KB, PrgBank(registers[7], 8 * KB));
+    MapPrg(0xC0, 8 * KB, PrgBank(prg_swap ? registers[6] : -2, 8 * KB));
+    MapPrg(0xE0, 8 * KB, PrgBank(-1, 8 * KB));
+
+    // A12 inversion swaps the 2 KB and the 1 KB halves
+    int invert = (bank_select & 0x80) ? 4 : 0;
+    MapChr(0 ^ invert, 2, ChrBank(registers[0] >> 1, 2 * KB));
+    MapChr(2 ^ invert, 2, ChrBank(registers[1] >> 1, 2 * KB));
+    for (int i = 0; i < 4; i++)
+      MapChr((4 + i) ^ invert, 1, ChrBank(registers[2 + i], KB));
+
+    SetMirroring((mirroring & 1) ? Mirroring::Horizontal : Mirroring::Vertical);
+  }
+
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive)
+  {
+    archive.Field(self.bank_select);
+    archive.Field(self.registers);
+    archive.Field(self.mirroring);
+    archive.Field(self.irq_latch);
+    archive.Field(self.irq_counter);
+    archive.Field(self.irq_reload);
+    archive.Field(self.irq_enabled);
+  }
+
+private:
+  void Reschedule()
+  {
+    if (!scheduler)
+      return;
+
+    uint64_t deadline = Scheduler::NEVER;
+    if (irq_enabled && ppu)
+      {
+        // clocks until the counter next reads zero after a clock
+        uint32_t clocks = (irq_reload || irq_counter == 0) ? irq_latch + 1 : irq_counter;
+        deadline = ppu->ScanlineClockCycle(clocks);
+      }
+    scheduler->Schedule(EventType::MapperIrq, deadline);
+  }
+
+  byte bank_select = 0;
+  std::array<byte, 8> registers{};
+  byte mirroring = 0;
+  byte irq_latch = 0;
+  byte irq_counter = 0;
+  bool irq_reload = false;
+  bool irq_enabled = false;
+};
+
+// AxROM: switchable 32 KB PRG, one-screen mirroring, CHR RAM
+template <>
+class Board<7> final : public BoardBase<Board<7>>
+{
+public:
+  using BoardBase::BoardBase;
+
+  void Reset() override
+  {
+    bank = 0;
+    Apply();
+  }
+
+  void Write(word, byte data) override
+  {
+    bank = data;
+    Apply();
+  }
+
+  void Apply()
+  {
+    MapPrg(0x80, 32 * KB, PrgBank(bank & 0x07, 32 * KB));
+    SetMirroring((bank & 0x10) ? Mirroring::SingleScreenHigh : Mirroring::SingleScreenLow);
+  }
+
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive)
+  {
+    archive.Field(self.bank);
+  }
+
+private:
+  byte bank = 0;
+};
+} // namespace
+
+std::unique_ptr<Mapper> CreateMapper(const Cartridge& cartridge)
+{
+  switch (cartridge.GetHeader().mapper)
+    {
+      case 0: return std::make_unique<Board<0>>(cartridge);
+      case 1: return std::make_unique<Board<1>>(cartridge);
+      case 2: return std::make_unique<Board<2>>(cartridge);
+      case 3: return std::make_unique<Board<3>>(cartridge);
+      case 4: return std::make_unique<Board<4>>(cartridge);
+      case 7: return std::make_unique<Board<7>>(cartridge);
+      default: return nullptr;
+    }
+}
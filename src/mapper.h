@@ -0,0 +1,85 @@
+#ifndef GOOGLETESTSEXAMPLE_MAPPER_H
+#define GOOGLETESTSEXAMPLE_MAPPER_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include "cartridge.h"
+#include "memory.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "state.h"
+#include "utils/types.h"
+
+class Cpu;
+
+/*
+ *  The bank switching hardware of a cartridge. PRG banks are mapped into
+ *  the bus page table and CHR banks into the PPU's 1 KB bank table at the
+ *  moment a bank register is written, so reads never see the mapper: they
+ *  go straight through the page pointers. The mapper only sits behind the
+ *  write side of $8000-$FFFF, where its registers are.
+ *
+ *  Each supported board is its own specialisation (see mapper.cpp), with
+ *  no virtual calls between its register decoding and its bank layout.
+ */
+class Mapper : public BusDevice, public EventSource
+{
+public:
+  explicit Mapper(const Cartridge& cartridge);
+  ~Mapper() override;
+
+  Mapper(const Mapper&) = delete;
+  Mapper& operator=(const Mapper&) = delete;
+
+  // Any of ppu, cpu and scheduler may be null, e.g. for a bare bus
+  void Connect(Memory* memory, Ppu* ppu, Cpu* cpu, Scheduler* scheduler);
+
+  // Power-on registers and bank layout
+  virtual void Reset() = 0;
+
+  // Only reachable on pages the mapper left unmapped: open bus
+  byte Read(word addr) override;
+
+  void RunEvent(EventType type, uint64_t cycle) override;
+
+  // Bank registers; loading maps the banks they select back in
+  virtual void SaveState(StateWriter& writer) const = 0;
+  virtual void LoadState(StateReader& reader) = 0;
+
+protected:
+  // Offset of PRG / CHR bank `bank` of `size` bytes, negative banks
+  // counting back from the end of the ROM
+  uint32_t PrgBank(int bank, uint32_t size) const;
+  uint32_t ChrBank(int bank, uint32_t size) const;
+
+  // Maps `size` bytes of PRG ROM from `offset` to the pages from first_page
+  void MapPrg(byte first_page, uint32_t size, uint32_t offset);
+
+  // Maps CHR ROM from `offset` to 1 KB PPU banks. Carts with CHR RAM keep
+  // the PPU's own 8 KB in place, their boards do not bank it
+  void MapChr(int first_bank, int bank_count, uint32_t offset);
+
+  void SetMirroring(Mirroring mirroring);
+
+  static constexpr byte FIRST_PRG_PAGE = 0x80;
+
+  const CartridgeHeader& header;
+  const byte* prg_rom;
+  const byte* chr_rom;
+
+  Memory* memory = nullptr;
+  Ppu* ppu = nullptr;
+  Cpu* cpu = nullptr;
+  Scheduler* scheduler = nullptr;
+
+private:
+  // what MapPrg last put at $8000-$FFFF, by page
+  std::array<const byte*, Memory::PAGE_COUNT - FIRST_PRG_PAGE> prg_pages{};
+};
+
+// Null for boards that are not supported
+std::unique_ptr<Mapper> CreateMapper(const Cartridge& cartridge);
+
+#endif
@@ -1,25 +1,35 @@
 #include <algorithm>
+#include <cstring>
 
 #include "memory.h"
 
-void Memory::Setup()
+Memory::Memory()
 {
-  byte initial_memory_value = 0x0;
-  std::fill(
-    std::begin(memory),
-    std::end(memory),
-    initial_memory_value
-    );
+  // one allocation, the frames point into it
+  std::shared_ptr<byte[]> block = std::make_shared_for_overwrite<byte[]>(MEM_SIZE);
+  for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    frames[page] = std::shared_ptr<byte[]>(block, block.get() + page * PAGE_SIZE);
+
+  MapInternal(0x00, 0xFF, MEM_SIZE);
+  Setup();
 }
 
-byte Memory::GetMemory(word addr) const
+Memory::Memory(Unmapped)
 {
-  return memory[addr];
 }
 
-void Memory::SetMemory(byte data, word addr)
+void Memory::Setup()
 {
-  memory[addr] = data;
+  byte initial_memory_value = 0x0;
+  for (uint32_t frame = 0; frame < PAGE_COUNT; frame++)
+    {
+      if (!frames[frame])
+        continue;
+      if (shared_frames[frame])
+        Unshare(frame, false);
+      std::fill_n(frames[frame].get(), PAGE_SIZE, initial_memory_value);
+    }
+  MarkChanged(0x00, 0xFF);
 }
 
 void Memory::WriteWord(word value, uint16_t addr)
@@ -27,11 +37,270 @@ void Memory::WriteWord(word value, uint16_t addr)
   byte p1 = value >> 8;
   byte p2 = (value << 8) >> 8;
 
-  memory[addr] = p1;
-  memory[addr+1] = p2;
+  SetMemory(p1, addr);
+  SetMemory(p2, addr + 1);
+}
+
+void Memory::MapStorage(byte first_page, byte last_page, byte* storage, uint32_t size)
+{
+  for (uint32_t page = first_page; page <= last_page; page++)
+    {
+      byte* base = storage + ((page - first_page) * PAGE_SIZE) % size;
+      SetPage(page, Page{base, base, nullptr});
+    }
+}
+
+void Memory::MapInternal(byte first_page, byte last_page, uint32_t size)
+{
+  uint32_t count = size / PAGE_SIZE;
+  for (uint32_t frame = first_page; frame < first_page + count; frame++)
+    if (!frames[frame])
+      frames[frame] = std::make_shared<byte[]>(PAGE_SIZE);
+
+  for (uint32_t page = first_page; page <= last_page; page++)
+    SetPage(page, InternalPage(first_page + (page - first_page) % count));
+}
+
+void Memory::MapReadOnly(byte first_page, byte last_page, const byte* storage, uint32_t size, BusDevice* device)
+{
+  for (uint32_t page = first_page; page <= last_page; page++)
+    {
+      const byte* base = storage + ((page - first_page) * PAGE_SIZE) % size;
+      SetPage(page, Page{base, nullptr, device});
+    }
+}
+
+void Memory::MapDevice(byte first_page, byte last_page, BusDevice* device)
+{
+  for (uint32_t page = first_page; page <= last_page; page++)
+    SetPage(page, Page{nullptr, nullptr, device});
+}
+
+void Memory::Unmap(byte first_page, byte last_page)
+{
+  for (uint32_t page = first_page; page <= last_page; page++)
+    SetPage(page, Page{});
+}
+
+const byte* Memory::GetReadPage(byte page) const
+{
+  return pages[page].read;
+}
+
+byte* Memory::GetWritePage(byte page) const
+{
+  const Page& mapping = pages[page];
+  if (mapping.write)
+    return mapping.write;
+  return mapping.guarded ? mapping.guarded : mapping.clean;
+}
+
+void Memory::GuardPage(byte page)
+{
+  byte* storage = pages[page].write ? pages[page].write : pages[page].clean;
+  if (!storage)
+    return;
+
+  for (Page& other : pages)
+    if (other.write == storage || other.clean == storage)
+      {
+        other.guarded = storage;
+        other.write = nullptr;
+      }
+}
+
+void Memory::MarkChanged(byte first_page, byte last_page)
+{
+  bool changed = false;
+  for (uint32_t page = first_page; page <= last_page; page++)
+    {
+      dirty.set(page);
+
+      // nothing was decoded from a page that can still be written directly,
+      // GuardPage would have taken its write pointer
+      const Page& mapping = pages[page];
+      if (!mapping.guarded && (mapping.write || mapping.clean))
+        continue;
+
+      versions[page]++;
+      changed = true;
+    }
+
+  if (changed)
+    change_count++;
+}
+
+uint32_t Memory::CleanPages()
+{
+  for (Page& page : pages)
+    if (page.write)
+      {
+        page.clean = page.write;
+        page.write = nullptr;
+      }
+
+  dirty.reset();
+  return ++clean_epoch;
+}
+
+void Memory::WriteGuarded(byte data, word addr)
+{
+  byte* storage = pages[addr >> 8].guarded;
+  storage[addr & 0xFF] = data;
+
+  for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    if (pages[page].guarded == storage)
+      {
+        pages[page].write = storage;
+        pages[page].guarded = nullptr;
+        pages[page].clean = nullptr;
+        versions[page]++;
+        dirty.set(page);
+      }
+  change_count++;
+}
+
+void Memory::WriteClean(byte data, word addr)
+{
+  byte* storage = pages[addr >> 8].clean;
+  storage[addr & 0xFF] = data;
+
+  // every mirror shows the change
+  for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    if (pages[page].clean == storage)
+      {
+        pages[page].write = storage;
+        pages[page].clean = nullptr;
+        dirty.set(page);
+      }
+}
+
+void Memory::WriteShared(byte data, word addr)
+{
+  Unshare(pages[addr >> 8].frame, true);
+  pages[addr >> 8].write[addr & 0xFF] = data;
+}
+
+Memory::Page Memory::InternalPage(uint32_t frame) const
+{
+  byte* storage = frames[frame].get();
+
+  Page page{storage, shared_frames[frame] ? nullptr : storage, nullptr};
+  page.shared = shared_frames[frame];
+  page.frame = frame;
+  return page;
+}
+
+void Memory::Unshare(uint32_t frame, bool copy)
+{
+  std::shared_ptr<byte[]> storage = std::make_shared_for_overwrite<byte[]>(PAGE_SIZE);
+  if (copy)
+    std::memcpy(storage.get(), frames[frame].get(), PAGE_SIZE);
+  frames[frame] = std::move(storage);
+  shared_frames.reset(frame);
+
+  // every mirror moves along
+  for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    if (pages[page].frame == int(frame))
+      SetPage(page, InternalPage(frame));
+}
+
+bool Memory::IsInternal(uint32_t page) const
+{
+  return pages[page].frame >= 0;
+}
+
+std::unique_ptr<Memory> Memory::Fork()
+{
+  for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    {
+      const Page& mapping = pages[page];
+      bool writable = mapping.write || mapping.guarded || mapping.clean;
+      if (mapping.device || (writable && !IsInternal(page)))
+        return nullptr;
+    }
+
+  // what is left besides internal pages is read-only, never guarded
+  auto child = std::make_unique<Memory>(Unmapped{});
+  child->pages = pages;
+  child->versions = versions;
+  child->change_count = change_count;
+  ShareFrames(*child);
+  child->dirty.set();
+
+  return child;
+}
+
+void Memory::ShareFrames(Memory& other)
+{
+  for (uint32_t frame = 0; frame < PAGE_COUNT; frame++)
+    if (frames[frame])
+      {
+        shared_frames.set(frame);
+        other.frames[frame] = frames[frame];
+        other.shared_frames.set(frame);
+      }
+
+  for (Page& mapping : pages)
+    if (mapping.frame >= 0)
+      {
+        // same contents at the same address, cached code stays valid
+        mapping.write = nullptr;
+        mapping.guarded = nullptr;
+        mapping.clean = nullptr;
+        mapping.shared = true;
+      }
+
+  for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    if (other.pages[page].frame >= 0)
+      other.SetPage(page, other.InternalPage(other.pages[page].frame));
+}
+
+uint32_t Memory::CountSharedPages() const
+{
+  return std::count_if(pages.begin(), pages.end(), [](const Page& page) { return page.shared; });
+}
+
+void Memory::SetPage(uint32_t page, const Page& mapping)
+{
+  pages[page] = mapping;
+  versions[page]++;
+  dirty.set(page);
+  change_count++;
 }
 
 uint32_t Memory::GetMemorySize()
 {
   return MEM_SIZE;
-}
\ No newline at end of file
+}
+
+void Memory::SaveState(StateWriter& writer) const
+{
+  SaveFrames(writer, 0x00, 0xFF);
+}
+
+void Memory::LoadState(StateReader& reader)
+{
+  LoadFrames(reader, 0x00, 0xFF);
+}
+
+void Memory::SaveFrames(StateWriter& writer, byte first_frame, byte last_frame) const
+{
+  for (uint32_t frame = first_frame; frame <= last_frame; frame++)
+    writer.Bytes(frames[frame].get(), PAGE_SIZE);
+}
+
+void Memory::LoadFrames(StateReader& reader, byte first_frame, byte last_frame)
+{
+  for (uint32_t frame = first_frame; frame <= last_frame; frame++)
+    {
+      if (shared_frames[frame])
+        Unshare(frame, false);
+      reader.Bytes(frames[frame].get(), PAGE_SIZE);
+    }
+
+  // rewritten behind the bus' back, mirrors included
+  for (uint32_t page = 0; page < PAGE_COUNT; page++)
+    if (pages[page].frame >= first_frame && pages[page].frame <= last_frame)
+      MarkChanged(page, page);
+}
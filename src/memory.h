@@ -1,22 +1,245 @@
 #ifndef GOOGLETESTSEXAMPLE_MEMORY_H
 #define GOOGLETESTSEXAMPLE_MEMORY_H
 
+#include <array>
+#include <bitset>
+#include <memory>
+
+#include "state.h"
 #include "utils/types.h"
 
+// Anything on the bus that is not plain storage: PPU/APU registers, mapper
+// bank registers, controllers...
+class BusDevice
+{
+public:
+  virtual ~BusDevice() = default;
+
+  virtual byte Read(word addr) = 0;
+  virtual void Write(word addr, byte data) = 0;
+};
+
+/*
+ *  The CPU address space, split into 256 pages of 256 bytes. A page either
+ *  points straight at its backing storage, so an access is one table load
+ *  plus an offset, or hands the access to a BusDevice.
+ *
+ *  By default every page is mapped onto the internal 64 KB array, which is
+ *  what a bare 6502 with flat RAM looks like.
+ *
+ *  Every page also carries a version that changes whenever what the page
+ *  shows may have changed: it is remapped, or a write lands on a page that
+ *  was guarded because decoded code was cached from it. Guarding costs
+ *  nothing on the write fast path, a guarded page simply has no write
+ *  pointer until the first write lifts the guard.
+ *
+ *  Dirty tracking for state hashing works the same way: CleanPages takes
+ *  the write pointers away, and the first write to a page marks it dirty
+ *  and hands the pointer back.
+ *
+ *  The internal array is held as 256 refcounted page frames so Fork can
+ *  share them between instances copy-on-write, the same way: a shared
+ *  page has no write pointer, and the first write through SetMemory
+ *  copies its frame. A machine with RAM of its own maps it onto frames
+ *  with MapInternal, mirrors included, so that it forks the same way.
+ */
 class Memory {
 public:
+    static constexpr uint32_t PAGE_SIZE = 256;
+    static constexpr uint32_t PAGE_COUNT = 256;
+
+    Memory();
+
+    // A bus with nothing mapped and no internal array allocated yet,
+    // MapInternal allocates the frames it maps
+    struct Unmapped
+    {
+    };
+    explicit Memory(Unmapped);
+
+    // the page table points into this object, it cannot be copied around
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
+
     void Setup();
 
-    byte GetMemory(word addr) const;
-    void SetMemory(byte data, word addr);
+    byte GetMemory(word addr) const
+    {
+      const Page& page = pages[addr >> 8];
+      if (page.read) [[likely]]
+        return page.read[addr & 0xFF];
+      return page.device ? page.device->Read(addr) : 0;
+    }
+
+    void SetMemory(byte data, word addr)
+    {
+      const Page& page = pages[addr >> 8];
+      if (page.write) [[likely]]
+        page.write[addr & 0xFF] = data;
+      else if (page.guarded)
+        WriteGuarded(data, addr);
+      else if (page.clean)
+        WriteClean(data, addr);
+      else if (page.shared)
+        WriteShared(data, addr);
+      else if (page.device)
+        page.device->Write(addr, data);
+    }
 
     void WriteWord(word value, uint16_t addr);
 
+    /*
+     *  Maps pages first_page..last_page onto `storage`, repeating it every
+     *  `size` bytes, e.g. the NES 2 KB work RAM over $0000-$1FFF. `size`
+     *  must be a multiple of PAGE_SIZE.
+     */
+    void MapStorage(byte first_page, byte last_page, byte* storage, uint32_t size);
+
+    // Same, onto the internal frames from first_page's own on, e.g. the
+    // 2 KB work RAM on frames $00-$07, mirrored over $0000-$1FFF. This is
+    // storage Fork and ShareFrames share copy-on-write
+    void MapInternal(byte first_page, byte last_page, uint32_t size);
+
+    // Same, but writes to these pages are dropped (ROM), or handed to
+    // `device` when there is one, e.g. a mapper's bank registers
+    void MapReadOnly(byte first_page, byte last_page, const byte* storage, uint32_t size, BusDevice* device = nullptr);
+
+    // Every access to these pages goes through `device`
+    void MapDevice(byte first_page, byte last_page, BusDevice* device);
+
+    // Reads return 0 and writes are dropped (open bus)
+    void Unmap(byte first_page, byte last_page);
+
+    // Direct pointer to a page's storage, or nullptr when it is handled by
+    // a device or unmapped
+    const byte* GetReadPage(byte page) const;
+    byte* GetWritePage(byte page) const;
+
     static uint32_t GetMemorySize();
 
+    // Where a page's read / write pointers live, for generated code that
+    // inlines the fast paths of GetMemory / SetMemory. Stable for the
+    // lifetime of the Memory, whatever gets mapped
+    const byte* const* GetReadSlot(byte page) const
+    {
+      return &pages[page].read;
+    }
+
+    byte* const* GetWriteSlot(byte page) const
+    {
+      return &pages[page].write;
+    }
+
+    const uint32_t* GetChangeCountSlot() const
+    {
+      return &change_count;
+    }
+
+    uint32_t GetPageVersion(byte page) const
+    {
+      return versions[page];
+    }
+
+    // Bumped together with any page version, one compare tells a cache
+    // whether it needs to look at the versions at all
+    uint32_t GetChangeCount() const
+    {
+      return change_count;
+    }
+
+    // Takes the write pointer away from a storage page and every page
+    // mirroring it, so the next write bumps their versions
+    void GuardPage(byte page);
+
+    // For storage changed behind the bus' back, e.g. by loading a state.
+    // Only pages code may have been decoded from change version
+    void MarkChanged(byte first_page, byte last_page);
+
+    // Marks every page clean and returns the new clean epoch. A page is
+    // dirty again once written, remapped or marked changed
+    uint32_t CleanPages();
+
+    bool IsDirty(byte page) const
+    {
+      return dirty[page];
+    }
+
+    // Moves on with every CleanPages, so a hasher can tell whether the
+    // dirty pages are still relative to its own last call
+    uint32_t GetCleanEpoch() const
+    {
+      return clean_epoch;
+    }
+
+    /*
+     *  A copy of this bus in O(pages): pages of the internal array become
+     *  shared copy-on-write on both sides, read-only storage is mapped the
+     *  same. Decoded code cached from here stays valid.
+     *
+     *  Null if writable storage or devices from elsewhere are mapped: both
+     *  buses would write to them. Whoever owns them forks instead, e.g.
+     *  Nes::Fork
+     */
+    std::unique_ptr<Memory> Fork();
+
+    // Hands our internal frames to `other`, shared copy-on-write on both
+    // sides from now on. Its page table stays its own, the pages it maps
+    // internal just show our frames, e.g. two consoles' RAM
+    void ShareFrames(Memory& other);
+
+    // Internal pages still shared with a fork, i.e. not yet written
+    uint32_t CountSharedPages() const;
+
+    // The internal 64 KB array, i.e. everything a flat RAM setup holds.
+    // Storage mapped in from elsewhere is saved by whoever owns it
+    void SaveState(StateWriter& writer) const;
+    void LoadState(StateReader& reader);
+
+    // Just frames first_frame..last_frame, which must have been mapped
+    void SaveFrames(StateWriter& writer, byte first_frame, byte last_frame) const;
+    void LoadFrames(StateReader& reader, byte first_frame, byte last_frame);
+
   private:
+    struct Page
+    {
+      const byte* read = nullptr;
+      byte* write = nullptr;
+      BusDevice* device = nullptr;
+      byte* guarded = nullptr; // write pointer while guarded
+      byte* clean = nullptr; // write pointer while clean
+      bool shared = false; // internal page shared with a fork
+      int16_t frame = -1; // internal frame shown, if any
+    };
+
+    void WriteGuarded(byte data, word addr);
+    void WriteClean(byte data, word addr);
+    void WriteShared(byte data, word addr);
+    void SetPage(uint32_t page, const Page& mapping);
+
+    // A page showing `frame`, writable unless the frame is shared
+    Page InternalPage(uint32_t frame) const;
+
+    // Gives `frame` storage of its own, `copy` keeping the contents.
+    // Pages showing it are pointed at the new storage
+    void Unshare(uint32_t frame, bool copy);
+
+    // Whether slot `page` shows an internal frame
+    bool IsInternal(uint32_t page) const;
+
     static constexpr uint32_t MEM_SIZE = 1024 * 64;
-    byte memory[MEM_SIZE];
+
+    std::array<Page, PAGE_COUNT> pages;
+    std::array<uint32_t, PAGE_COUNT> versions{};
+    uint32_t change_count = 0;
+
+    std::bitset<PAGE_COUNT> dirty;
+    uint32_t clean_epoch = 0;
+
+    // the internal array, by page, null where never mapped. After a fork
+    // every frame is shared and either side copies it on its first write,
+    // even if the other side already let go of it
+    std::array<std::shared_ptr<byte[]>, PAGE_COUNT> frames;
+    std::bitset<PAGE_COUNT> shared_frames;
 };
 
 #endif
@@ -0,0 +1,183 @@
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
+#include "movie.h"
+#include "state.h"
+
+namespace
+{
+struct Run
+{
+  std::array<byte, 2> buttons;
+  uint16_t length;
+};
+
+constexpr size_t RUN_SIZE = 4;
+constexpr size_t HASH_SIZE = 8;
+
+std::vector<Run> EncodeRuns(const std::vector<Movie::Frame>& frames)
+{
+  std::vector<Run> runs;
+  for (const Movie::Frame& frame : frames)
+    {
+      if (runs.empty() || runs.back().buttons != frame.buttons || runs.back().length == UINT16_MAX)
+        runs.push_back(Run{frame.buttons, 0});
+      runs.back().length++;
+    }
+  return runs;
+}
+
+template <typename Archive>
+void WriteMovie(Archive& archive, const std::vector<Movie::Frame>& frames, const std::vector<Run>& runs)
+{
+  uint32_t frame_count = frames.size();
+  uint32_t run_count = runs.size();
+
+  archive.Field(Movie::MAGIC);
+  archive.Field(Movie::VERSION);
+  archive.Field(frame_count);
+  archive.Field(run_count);
+
+  for (const Run& run : runs)
+    {
+      archive.Field(run.buttons);
+      archive.Field(run.length);
+    }
+  for (const Movie::Frame& frame : frames)
+    archive.Field(frame.hash);
+}
+} // namespace
+
+void Movie::Clear()
+{
+  frames.clear();
+}
+
+void Movie::Append(std::array<byte, 2> buttons, uint64_t hash)
+{
+  frames.push_back(Frame{buttons, hash});
+}
+
+size_t Movie::GetFrameCount() const
+{
+  return frames.size();
+}
+
+const Movie::Frame& Movie::GetFrame(size_t frame) const
+{
+  return frames[frame];
+}
+
+bool Movie::Save(const std::string& path)
+{
+  std::vector<Run> runs = EncodeRuns(frames);
+
+  StateWriter measure({});
+  WriteMovie(measure, frames, runs);
+  std::vector<byte> buffer(measure.Size());
+  StateWriter writer(buffer);
+  WriteMovie(writer, frames, runs);
+
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  if (!out)
+    return Fail("cannot write " + path);
+  return true;
+}
+
+bool Movie::Load(const std::string& path)
+{
+  frames.clear();
+
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return Fail("cannot open " + path);
+  std::vector<byte> buffer(std::istreambuf_iterator<char>(in), {});
+
+  StateReader reader(buffer);
+  uint32_t magic = 0, version = 0, frame_count = 0, run_count = 0;
+  reader.Field(magic);
+  reader.Field(version);
+  reader.Field(frame_count);
+  reader.Field(run_count);
+  if (!reader.Ok() || magic != MAGIC)
+    return Fail(path + " is not a movie");
+  if (version != VERSION)
+    return Fail(path + " has movie version " + std::to_string(version));
+
+  // the sizes are known up front, a short file fails before allocating
+  uint64_t expected = reader.Size() + uint64_t(run_count) * RUN_SIZE + uint64_t(frame_count) * HASH_SIZE;
+  if (buffer.size() != expected)
+    return Fail(path + " is truncated");
+
+  frames.resize(frame_count);
+  size_t frame = 0;
+  for (uint32_t i = 0; i < run_count; i++)
+    {
+      Run run{};
+      reader.Field(run.buttons);
+      reader.Field(run.length);
+      if (frame + run.length > frame_count)
+        break;
+      for (uint16_t j = 0; j < run.length; j++)
+        frames[frame++].buttons = run.buttons;
+    }
+  if (frame != frame_count)
+    {
+      frames.clear();
+      return Fail(path + " has runs that do not add up to its frames");
+    }
+
+  for (Frame& entry : frames)
+    reader.Field(entry.hash);
+
+  return true;
+}
+
+const std::string& Movie::GetError() const
+{
+  return error;
+}
+
+bool Movie::Fail(const std::string& message)
+{
+  error = message;
+  return false;
+}
+
+void RecordFrame(Nes& nes, StateHasher& hasher, Movie& movie, std::array<byte, 2> buttons)
+{
+  nes.SetButtons(0, buttons[0]);
+  nes.SetButtons(1, buttons[1]);
+  nes.RunFrame();
+  movie.Append(buttons, hasher.Hash(nes));
+}
+
+PlaybackResult PlayMovie(Nes& nes, const Movie& movie)
+{
+  PlaybackResult result;
+  StateHasher hasher;
+  auto start = std::chrono::steady_clock::now();
+
+  result.ok = true;
+  for (size_t i = 0; i < movie.GetFrameCount(); i++)
+    {
+      const Movie::Frame& frame = movie.GetFrame(i);
+      nes.SetButtons(0, frame.buttons[0]);
+      nes.SetButtons(1, frame.buttons[1]);
+      nes.RunFrame();
+
+      result.frames++;
+      result.expected_hash = frame.hash;
+      result.hash = hasher.Hash(nes);
+      if (result.hash != frame.hash)
+        {
+          result.ok = false;
+          break;
+        }
+    }
+
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
@@ -0,0 +1,72 @@
+#ifndef GOOGLETESTSEXAMPLE_MOVIE_H
+#define GOOGLETESTSEXAMPLE_MOVIE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "nes.h"
+#include "state_hash.h"
+#include "utils/types.h"
+
+/*
+ *  A recorded run: the buttons held on both pads for every frame from
+ *  power-on, and the state hash after each frame. Replaying it has to
+ *  reproduce every hash, which makes a movie the regression check for
+ *  changes that are meant to leave emulation alone.
+ *
+ *  Pads are held for many frames at a time, so the file stores inputs as
+ *  runs, all fields little endian:
+ *      magic, version, frame count, run count    uint32 each
+ *      per run: pad 1, pad 2, length             byte, byte, uint16
+ *      per frame: state hash                     uint64
+ */
+class Movie
+{
+public:
+  static constexpr uint32_t MAGIC = 0x4D53454E; // "NESM"
+  static constexpr uint32_t VERSION = 2;
+
+  struct Frame
+  {
+    std::array<byte, 2> buttons{};
+    uint64_t hash = 0;
+  };
+
+  void Clear();
+  void Append(std::array<byte, 2> buttons, uint64_t hash);
+
+  size_t GetFrameCount() const;
+  const Frame& GetFrame(size_t frame) const;
+
+  bool Save(const std::string& path);
+  bool Load(const std::string& path);
+  const std::string& GetError() const;
+
+private:
+  bool Fail(const std::string& message);
+
+  std::vector<Frame> frames;
+  std::string error;
+};
+
+struct PlaybackResult
+{
+  bool ok = false; // every frame matched
+  uint64_t frames = 0; // frames played, the mismatching one included
+  uint64_t expected_hash = 0; // of the last frame played
+  uint64_t hash = 0;
+  double seconds = 0;
+};
+
+// Runs one frame with `buttons` held and appends it to the movie. The
+// hasher carries page hashes from frame to frame, use one per recording
+void RecordFrame(Nes& nes, StateHasher& hasher, Movie& movie, std::array<byte, 2> buttons);
+
+// Replays the movie from the console's current state, normally straight
+// after LoadCartridge, with nothing pacing the frames. Stops at the first
+// frame whose hash differs
+PlaybackResult PlayMovie(Nes& nes, const Movie& movie);
+
+#endif
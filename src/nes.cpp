@@ -0,0 +1,196 @@
+#include "nes.h"
+
+#include "mapper.h"
+
+Nes::Nes()
+{
+  // 2 KB of RAM mirrored four times over $0000-$1FFF
+  memory.MapInternal(0x00, 0x1F, 0x800);
+  memory.MapDevice(0x20, 0x3F, &ppu);
+  memory.MapDevice(0x40, 0x40, &io);
+  memory.Unmap(0x41, 0xFF);
+
+  ppu.ConnectCpu(&cpu);
+  apu.ConnectCpu(&cpu);
+
+  scheduler.ConnectCpu(&cpu);
+  ppu.ConnectScheduler(&scheduler);
+  apu.ConnectScheduler(&scheduler);
+}
+
+bool Nes::LoadCartridge(const std::string& path)
+{
+  if (!cartridge.Load(path) || !cartridge.MapInto(memory, &ppu, &cpu, &scheduler))
+    return false;
+
+  Reset();
+  return true;
+}
+
+void Nes::Reset()
+{
+  cpu.Reset();
+  ppu.Reset();
+  apu.Reset();
+}
+
+void Nes::RunUntil(uint64_t target_cycle)
+{
+  // the CPU stops at every scheduled event on the way by itself
+  cpu.RunUntil(target_cycle);
+
+  ppu.CatchUp(cpu.cycles);
+  apu.CatchUp(cpu.cycles);
+}
+
+void Nes::RunFrame()
+{
+  RunUntil(ppu.NextVblankCycle());
+}
+
+void Nes::SetButtons(int pad, byte _buttons)
+{
+  buttons[pad] = _buttons;
+  if (strobe)
+    shifters[pad] = _buttons;
+}
+
+byte Nes::GetButtons(int pad) const
+{
+  return buttons[pad];
+}
+
+size_t Nes::SaveState(std::span<byte> buffer) const
+{
+  StateWriter measure({});
+  WriteState(measure);
+  if (buffer.size() < measure.Size())
+    return measure.Size();
+
+  StateWriter writer(buffer);
+  WriteState(writer);
+  return writer.Size();
+}
+
+bool Nes::LoadState(std::span<const byte> buffer)
+{
+  // every field has a fixed size for a given cartridge, so a size check
+  // up front means the reader cannot run dry half way through
+  if (buffer.size() != SaveState({}))
+    return false;
+
+  StateReader reader(buffer);
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  reader.Field(magic);
+  reader.Field(version);
+  if (magic != STATE_MAGIC || version != STATE_VERSION)
+    return false;
+
+  cpu.LoadState(reader);
+  ppu.LoadState(reader);
+  apu.LoadState(reader);
+  memory.LoadFrames(reader, 0x00, 0x07);
+  reader.Field(buttons);
+  reader.Field(shifters);
+  reader.Field(strobe);
+  cartridge.LoadState(reader);
+
+  return reader.Ok();
+}
+
+std::unique_ptr<Nes> Nes::Fork()
+{
+  auto child = std::make_unique<Nes>();
+  if (cartridge.IsLoaded())
+    {
+      child->cartridge.Share(cartridge);
+      child->cartridge.MapInto(child->memory, &child->ppu, &child->cpu, &child->scheduler);
+    }
+
+  // RAM and PRG RAM are not copied at all, pages are as they are written
+  memory.ShareFrames(child->memory);
+
+  child->cpu.CopyState(cpu);
+  child->ppu.CopyState(ppu);
+  child->apu.CopyState(apu);
+  child->buttons = buttons;
+  child->shifters = shifters;
+  child->strobe = strobe;
+  child->cpu.engine = cpu.engine;
+  child->cpu.jit_threshold = cpu.jit_threshold;
+
+  // the mapper's registers are a few bytes, its bank pointers are set up
+  // again from them, the PPU's CHR banks and nametables included
+  if (Mapper* mapper = cartridge.GetMapper())
+    {
+      StateWriter measure({});
+      mapper->SaveState(measure);
+      std::vector<byte> registers(measure.Size());
+      StateWriter writer(registers);
+      mapper->SaveState(writer);
+      StateReader reader(registers);
+      child->cartridge.GetMapper()->LoadState(reader);
+    }
+
+  return child;
+}
+
+void Nes::WriteState(StateWriter& writer) const
+{
+  writer.Field(STATE_MAGIC);
+  writer.Field(STATE_VERSION);
+
+  cpu.SaveState(writer);
+  ppu.SaveState(writer);
+  apu.SaveState(writer);
+  memory.SaveFrames(writer, 0x00, 0x07);
+  writer.Field(buttons);
+  writer.Field(shifters);
+  writer.Field(strobe);
+  cartridge.SaveState(writer);
+}
+
+byte Nes::IoPort::Read(word addr)
+{
+  if (addr == 0x4015)
+    return nes.apu.Read(addr);
+
+  if (addr == JOYPAD1 || addr == JOYPAD2)
+    {
+      int pad = addr - JOYPAD1;
+      if (nes.strobe)
+        nes.shifters[pad] = nes.buttons[pad];
+
+      // ones once all eight buttons are out, bits 5-7 are open bus ($40)
+      byte bit = nes.shifters[pad] & 1;
+      nes.shifters[pad] = (nes.shifters[pad] >> 1) | 0x80;
+      return 0x40 | bit;
+    }
+
+  return 0;
+}
+
+void Nes::IoPort::Write(word addr, byte data)
+{
+  if (addr <= 0x4013 || addr == 0x4015 || addr == 0x4017)
+    {
+      nes.apu.Write(addr, data);
+    }
+  else if (addr == JOYPAD1)
+    {
+      // the pads reload continuously while the strobe is high
+      nes.strobe = data & 1;
+      if (nes.strobe)
+        nes.shifters = nes.buttons;
+    }
+  else if (addr == OAM_DMA)
+    {
+      word source = data << 8;
+      for (word i = 0; i < 256; i++)
+        nes.ppu.WriteOam(nes.memory.GetMemory(source + i));
+
+      // the CPU is halted for the copy, one more cycle on odd cycles
+      nes.cpu.cycles += 513 + (nes.cpu.cycles & 1);
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef GOOGLETESTSEXAMPLE_NES_H
+#define GOOGLETESTSEXAMPLE_NES_H
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "apu.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "memory.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "utils/types.h"
+
+/*
+ *  The console: CPU, PPU, APU, 2 KB of work RAM and the cartridge wired
+ *  onto one bus. The CPU runs ahead in long slices and the PPU and APU are
+ *  caught up behind it, either when the CPU touches one of their registers
+ *  or at the next point where they could interrupt it, as kept by the
+ *  scheduler.
+ */
+class Nes
+{
+public:
+  static constexpr word OAM_DMA = 0x4014;
+  static constexpr word JOYPAD1 = 0x4016; // read: pad 1, write: strobe both
+  static constexpr word JOYPAD2 = 0x4017; // read: pad 2, write: APU frame counter
+
+  // Standard controller buttons, in the order the pads shift them out
+  static constexpr byte BUTTON_A = 1 << 0;
+  static constexpr byte BUTTON_B = 1 << 1;
+  static constexpr byte BUTTON_SELECT = 1 << 2;
+  static constexpr byte BUTTON_START = 1 << 3;
+  static constexpr byte BUTTON_UP = 1 << 4;
+  static constexpr byte BUTTON_DOWN = 1 << 5;
+  static constexpr byte BUTTON_LEFT = 1 << 6;
+  static constexpr byte BUTTON_RIGHT = 1 << 7;
+
+  static constexpr uint32_t STATE_MAGIC = 0x5353454E; // "NESS"
+  static constexpr uint32_t STATE_VERSION = 3;
+
+  Nes();
+
+  Nes(const Nes&) = delete;
+  Nes& operator=(const Nes&) = delete;
+
+  // Loads and maps a ROM, then resets. On failure see cartridge.GetError()
+  bool LoadCartridge(const std::string& path);
+
+  void Reset();
+
+  // Runs the CPU to target_cycle, keeping the PPU in step
+  void RunUntil(uint64_t target_cycle);
+
+  // Runs up to the start of the next vblank, i.e. one rendered frame
+  void RunFrame();
+
+  // Buttons held on pad 0 or 1, latched by the game's next strobe
+  void SetButtons(int pad, byte buttons);
+  byte GetButtons(int pad) const;
+
+  /*
+   *  Snapshots the whole console into `buffer` and returns the state size.
+   *  Nothing is written unless the buffer is at least that large; an
+   *  empty span just measures. The size only depends on the cartridge,
+   *  so one buffer can be reused for every snapshot of a run.
+   */
+  size_t SaveState(std::span<byte> buffer) const;
+
+  // False, with the console untouched, if the state is not one of ours
+  bool LoadState(std::span<const byte> buffer);
+
+  /*
+   *  A second console in the same state, frame buffer and CPU engine
+   *  included. It has its own bus, PPU, APU and mapper; the mapped ROM
+   *  image is shared, and so are RAM and PRG RAM, copy-on-write by page
+   *  on both sides. Its CPU starts with empty code caches
+   */
+  std::unique_ptr<Nes> Fork();
+
+  // RAM and PRG RAM are its internal frames, see Memory::MapInternal
+  Memory memory{Memory::Unmapped{}};
+  Scheduler scheduler;
+  Cpu cpu{&memory};
+  Ppu ppu;
+  Apu apu;
+  Cartridge cartridge;
+
+private:
+  // swaps its instances in and out of one console field by field
+  friend class EmulatorPool;
+
+  // $4000-$40FF: APU registers, OAM DMA and the controllers
+  class IoPort : public BusDevice
+  {
+  public:
+    explicit IoPort(Nes& nes) : nes(nes) {}
+
+    byte Read(word addr) override;
+    void Write(word addr, byte data) override;
+
+  private:
+    Nes& nes;
+  };
+
+  void WriteState(StateWriter& writer) const;
+
+  IoPort io{*this};
+
+  // controllers: held buttons and the shift registers the game reads
+  std::array<byte, 2> buttons{};
+  std::array<byte, 2> shifters{};
+  bool strobe = false;
+};
+
+#endif
@@ -0,0 +1,914 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "cpu.h"
+#include "ppu.h"
+#include "state_hash.h"
+
+namespace
+{
+static_assert(std::endian::native == std::endian::little, "tile rows are stored with one pixel per byte, LSB first");
+
+/*
+ *  Spreads one bitplane byte over 8 pixel bytes: bit 7 (the leftmost
+ *  pixel) lands in the lowest byte. A whole tile row is then
+ *      SPREAD[lo] | SPREAD[hi] << 1
+ *  8 pixels in one 64-bit OR instead of 8 rounds of shifts and masks.
+ */
+constexpr std::array<uint64_t, 256> MakeBitplaneSpread(bool flipped)
+{
+  std::array<uint64_t, 256> table{};
+  for (int value = 0; value < 256; value++)
+    for (int pixel = 0; pixel < 8; pixel++)
+      {
+        int bit = flipped ? pixel : 7 - pixel;
+        if (value & (1 << bit))
+          table[value] |= uint64_t{1} << (pixel * 8);
+      }
+  return table;
+}
+
+constexpr std::array<uint64_t, 256> BITPLANE_SPREAD = MakeBitplaneSpread(false);
+constexpr std::array<uint64_t, 256> BITPLANE_SPREAD_FLIPPED = MakeBitplaneSpread(true);
+
+// the attribute palette repeated in bits 2-3 of all 8 pixel bytes
+constexpr uint64_t PALETTE_BROADCAST = 0x0404040404040404;
+
+constexpr word CHR_BANK_SIZE = 0x400;
+} // namespace
+
+Ppu::Ppu()
+{
+  MapChr(0, 8, nullptr, true);
+  SetMirroring(Mirroring::Horizontal);
+}
+
+void Ppu::Reset()
+{
+  ctrl = 0;
+  mask = 0;
+  w = false;
+  read_buffer = 0;
+}
+
+void Ppu::ConnectCpu(Cpu* _cpu)
+{
+  cpu = _cpu;
+}
+
+void Ppu::ConnectScheduler(Scheduler* _scheduler)
+{
+  scheduler = _scheduler;
+  if (scheduler)
+    scheduler->SetSource(EventType::Vblank, this);
+  Reschedule();
+}
+
+void Ppu::ConnectScanlineCounter(ScanlineCounter* counter)
+{
+  scanline_counter = counter;
+}
+
+void Ppu::MapChr(int first_bank, int bank_count, const byte* data, bool writable)
+{
+  // no data: fall back to the 8 KB of CHR RAM the PPU carries for carts
+  // without CHR ROM
+  if (!data)
+    data = chr_ram.data() + first_bank * CHR_BANK_SIZE;
+
+  for (int i = 0; i < bank_count; i++)
+    {
+      const byte* bank = data + i * CHR_BANK_SIZE;
+      chr_read[first_bank + i] = bank;
+      chr_write[first_bank + i] = writable ? const_cast<byte*>(bank) : nullptr;
+    }
+}
+
+void Ppu::SetMirroring(Mirroring mirroring)
+{
+  switch (mirroring)
+    {
+      case Mirroring::Horizontal:
+        nametables[0] = nametables[1] = &vram[0x000];
+        nametables[2] = nametables[3] = &vram[0x400];
+        break;
+      case Mirroring::Vertical:
+        nametables[0] = nametables[2] = &vram[0x000];
+        nametables[1] = nametables[3] = &vram[0x400];
+        break;
+      case Mirroring::FourScreen:
+        for (int i = 0; i < 4; i++)
+          nametables[i] = &vram[i * 0x400];
+        break;
+      case Mirroring::SingleScreenLow:
+      case Mirroring::SingleScreenHigh: {
+        byte* nametable = &vram[mirroring == Mirroring::SingleScreenLow ? 0x000 : 0x400];
+        for (byte*& entry : nametables)
+          entry = nametable;
+      }
+      break;
+    }
+}
+
+void Ppu::SetRenderMode(RenderMode mode)
+{
+  render_mode = mode;
+}
+
+Ppu::RenderMode Ppu::GetRenderMode() const
+{
+  return render_mode;
+}
+
+byte Ppu::Read(word addr)
+{
+  if (cpu)
+    CatchUp(cpu->BusCycle());
+
+  switch (addr & 0x0007)
+    {
+      case 0x0002: {
+        byte result = (status & 0xE0) | (data_bus & 0x1F);
+        status &= ~0x80;
+        w = false;
+        data_bus = result;
+      }
+      break;
+      case 0x0004: {
+        data_bus = oam[oam_addr];
+      }
+      break;
+      case 0x0007: {
+        // reads are delayed through a buffer, except for palette reads
+        // which return at once (and refill the buffer from the nametable
+        // underneath)
+        word ppu_addr = v & 0x3FFF;
+        if (ppu_addr >= 0x3F00)
+          {
+            data_bus = ReadPalette(ppu_addr);
+            read_buffer = PpuRead(ppu_addr - 0x1000);
+          }
+        else
+          {
+            data_bus = read_buffer;
+            read_buffer = PpuRead(ppu_addr);
+          }
+        v += (ctrl & 0x04) ? 32 : 1;
+      }
+      break;
+      default: break;
+    }
+
+  return data_bus;
+}
+
+void Ppu::Write(word addr, byte data)
+{
+  if (cpu)
+    CatchUp(cpu->BusCycle());
+
+  data_bus = data;
+
+  switch (addr & 0x0007)
+    {
+      case 0x0000: {
+        bool nmi_was_enabled = ctrl & 0x80;
+        ctrl = data;
+        t = (t & 0xF3FF) | ((data & 0x03) << 10);
+
+        // enabling NMI while the vblank flag is up fires it immediately
+        if (!nmi_was_enabled && (ctrl & 0x80) && (status & 0x80) && cpu)
+          cpu->SignalNmi();
+      }
+      break;
+      case 0x0001: {
+        // rendering decides whether the odd frame skips a dot
+        bool was_rendering = IsRendering();
+        mask = data;
+        Reschedule();
+
+        if (scanline_counter && was_rendering != IsRendering())
+          scanline_counter->RenderingChanged();
+      }
+      break;
+      case 0x0003: oam_addr = data; break;
+      case 0x0004: oam[oam_addr++] = data; break;
+      case 0x0005: {
+        if (!w)
+          {
+            t = (t & 0xFFE0) | (data >> 3);
+            fine_x = data & 0x07;
+          }
+        else
+          {
+            t = (t & 0x8C1F) | ((data & 0xF8) << 2) | ((data & 0x07) << 12);
+          }
+        w = !w;
+      }
+      break;
+      case 0x0006: {
+        if (!w)
+          {
+            t = (t & 0x00FF) | ((data & 0x3F) << 8);
+          }
+        else
+          {
+            t = (t & 0xFF00) | data;
+            v = t;
+          }
+        w = !w;
+      }
+      break;
+      case 0x0007: {
+        PpuWrite(v & 0x3FFF, data);
+        v += (ctrl & 0x04) ? 32 : 1;
+      }
+      break;
+      default: break;
+    }
+}
+
+void Ppu::WriteOam(byte data)
+{
+  oam[oam_addr++] = data;
+}
+
+void Ppu::CatchUp(uint64_t cpu_cycle)
+{
+  uint64_t target = cpu_cycle * 3;
+  if (target > dot_clock)
+    Advance(target - dot_clock);
+
+  Reschedule();
+}
+
+void Ppu::RunEvent(EventType, uint64_t cycle)
+{
+  CatchUp(cycle);
+}
+
+void Ppu::Reschedule()
+{
+  if (scheduler)
+    scheduler->Schedule(EventType::Vblank, NextVblankCycle());
+}
+
+uint64_t Ppu::NextVblankCycle() const
+{
+  constexpr int FRAME_DOTS = DOTS_PER_SCANLINE * SCANLINES_PER_FRAME;
+  constexpr int VBLANK_DOT = VBLANK_SCANLINE * DOTS_PER_SCANLINE + 1;
+  constexpr int SKIP_DOT = PRE_RENDER_SCANLINE * DOTS_PER_SCANLINE + 339;
+
+  int position = scanline * DOTS_PER_SCANLINE + dot;
+  uint64_t distance = VBLANK_DOT - position;
+
+  if (position > VBLANK_DOT)
+    {
+      distance = FRAME_DOTS - position + VBLANK_DOT;
+      if (position <= SKIP_DOT && (frame & 1) && IsRendering())
+        distance--;
+    }
+
+  // the vblank dot is processed once the PPU has run past it
+  return (dot_clock + distance + 1 + 2) / 3;
+}
+
+uint64_t Ppu::ScanlineClockCycle(uint32_t count) const
+{
+  constexpr int CLOCK_DOT = 260;
+
+  if (!IsRendering() || count == 0)
+    return Scheduler::NEVER;
+
+  // walk the lines ahead, at most a frame's worth for a full 8-bit count
+  uint64_t line_start = dot_clock - dot;
+  int line = scanline;
+  bool odd = frame & 1;
+  bool pending = dot <= CLOCK_DOT;
+
+  for (;;)
+    {
+      bool counted = line < HEIGHT || line == PRE_RENDER_SCANLINE;
+      if (counted && pending && --count == 0)
+        return (line_start + CLOCK_DOT + 1 + 2) / 3;
+
+      uint64_t length = DOTS_PER_SCANLINE;
+      if (line == PRE_RENDER_SCANLINE)
+        {
+          if (odd)
+            length--;
+          odd = !odd;
+          line = 0;
+        }
+      else
+        {
+          line++;
+        }
+
+      line_start += length;
+      pending = true;
+    }
+}
+
+const byte* Ppu::GetFrameBuffer() const
+{
+  return frame_buffer.data();
+}
+
+uint64_t Ppu::HashMemory() const
+{
+  const uint64_t parts[] = {
+    HashBytes(vram.data(), vram.size()),
+    HashBytes(chr_ram.data(), chr_ram.size()),
+    HashBytes(palette.data(), palette.size()),
+    HashBytes(oam.data(), oam.size()),
+  };
+  return HashBytes(parts, sizeof(parts));
+}
+
+void Ppu::CopyState(const Ppu& other)
+{
+  Cpu* own_cpu = cpu;
+  Scheduler* own_scheduler = scheduler;
+  ScanlineCounter* own_counter = scanline_counter;
+  std::array<const byte*, 8> own_chr_read;
+  std::array<byte*, 8> own_chr_write;
+  std::array<byte*, 4> own_nametables;
+  std::copy(std::begin(chr_read), std::end(chr_read), own_chr_read.begin());
+  std::copy(std::begin(chr_write), std::end(chr_write), own_chr_write.begin());
+  std::copy(std::begin(nametables), std::end(nametables), own_nametables.begin());
+
+  *this = other;
+
+  cpu = own_cpu;
+  scheduler = own_scheduler;
+  scanline_counter = own_counter;
+  std::copy(own_chr_read.begin(), own_chr_read.end(), chr_read);
+  std::copy(own_chr_write.begin(), own_chr_write.end(), chr_write);
+  std::copy(own_nametables.begin(), own_nametables.end(), nametables);
+
+  Reschedule();
+}
+
+uint64_t Ppu::GetFrame() const
+{
+  return frame;
+}
+
+int Ppu::GetScanline() const
+{
+  return scanline;
+}
+
+int Ppu::GetDot() const
+{
+  return dot;
+}
+
+template <typename Self, typename Archive>
+void Ppu::Serialize(Self& self, Archive& archive)
+{
+  archive.Field(self.ctrl);
+  archive.Field(self.mask);
+  archive.Field(self.status);
+  archive.Field(self.oam_addr);
+  archive.Field(self.read_buffer);
+  archive.Field(self.data_bus);
+  archive.Field(self.v);
+  archive.Field(self.t);
+  archive.Field(self.fine_x);
+  archive.Field(self.w);
+  archive.Field(self.scanline);
+  archive.Field(self.dot);
+  archive.Field(self.frame);
+  archive.Field(self.dot_clock);
+  archive.Field(self.sprite0_hit_dot);
+  archive.Field(self.bg_pattern_lo);
+  archive.Field(self.bg_pattern_hi);
+  archive.Field(self.bg_attrib_lo);
+  archive.Field(self.bg_attrib_hi);
+  archive.Field(self.next_tile_id);
+  archive.Field(self.next_tile_attrib);
+  archive.Field(self.next_tile_lo);
+  archive.Field(self.next_tile_hi);
+  archive.Field(self.sprite_line);
+  archive.Field(self.chr_ram);
+  archive.Field(self.vram);
+  archive.Field(self.palette);
+  archive.Field(self.oam);
+}
+
+void Ppu::SaveState(StateWriter& writer) const
+{
+  Serialize(*this, writer);
+}
+
+void Ppu::LoadState(StateReader& reader)
+{
+  Serialize(*this, reader);
+  Reschedule();
+}
+
+byte Ppu::PpuRead(word addr) const
+{
+  addr &= 0x3FFF;
+
+  if (addr < 0x2000)
+    return chr_read[addr >> 10][addr & 0x03FF];
+  if (addr < 0x3F00)
+    return nametables[(addr >> 10) & 0x03][addr & 0x03FF];
+  return ReadPalette(addr);
+}
+
+void Ppu::PpuWrite(word addr, byte data)
+{
+  addr &= 0x3FFF;
+
+  if (addr < 0x2000)
+    {
+      byte* bank = chr_write[addr >> 10];
+      if (bank)
+        bank[addr & 0x03FF] = data;
+    }
+  else if (addr < 0x3F00)
+    {
+      nametables[(addr >> 10) & 0x03][addr & 0x03FF] = data;
+    }
+  else
+    {
+      byte index = addr & 0x1F;
+      if ((index & 0x13) == 0x10)
+        index &= 0x0F;
+      palette[index] = data & 0x3F;
+    }
+}
+
+bool Ppu::IsRendering() const
+{
+  return mask & 0x18;
+}
+
+byte Ppu::ReadPalette(word addr) const
+{
+  // $3F10/$3F14/$3F18/$3F1C mirror the background entries
+  byte index = addr & 0x1F;
+  if ((index & 0x13) == 0x10)
+    index &= 0x0F;
+  return palette[index];
+}
+
+void Ppu::Advance(uint64_t dots)
+{
+  while (dots > 0)
+    {
+      bool rendering_line = scanline < HEIGHT || scanline == PRE_RENDER_SCANLINE;
+
+      if (render_mode == RenderMode::Dot && rendering_line && IsRendering())
+        {
+          ClockDot();
+          dots--;
+          continue;
+        }
+
+      // nothing happens between events, skip straight to the next one
+      uint64_t idle = NextEventDot() - dot;
+      if (idle >= dots)
+        {
+          dot += dots;
+          dot_clock += dots;
+          if (dot == DOTS_PER_SCANLINE)
+            EndScanline();
+          return;
+        }
+
+      dot += idle;
+      dot_clock += idle;
+      dots -= idle;
+
+      if (dot == DOTS_PER_SCANLINE)
+        {
+          EndScanline();
+          continue;
+        }
+
+      ProcessDot();
+
+      dot++;
+      dot_clock++;
+      dots--;
+
+      if (dot == DOTS_PER_SCANLINE)
+        EndScanline();
+    }
+}
+
+int Ppu::NextEventDot() const
+{
+  int next = DOTS_PER_SCANLINE;
+  auto consider = [&](int event_dot) {
+    if (event_dot >= dot && event_dot < next)
+      next = event_dot;
+  };
+
+  if (scanline == VBLANK_SCANLINE || scanline == PRE_RENDER_SCANLINE)
+    consider(1);
+
+  if (IsRendering())
+    {
+      if (scanline < HEIGHT)
+        {
+          consider(1);
+          consider(sprite0_hit_dot);
+        }
+
+      if (scanline < HEIGHT || scanline == PRE_RENDER_SCANLINE)
+        {
+          consider(256);
+          consider(257);
+          if (scanline_counter)
+            consider(260);
+        }
+
+      if (scanline == PRE_RENDER_SCANLINE)
+        {
+          consider(280);
+          consider(339);
+        }
+    }
+
+  return next;
+}
+
+// Scanline mode: the work attached to the current dot, if any
+void Ppu::ProcessDot()
+{
+  if (scanline == VBLANK_SCANLINE && dot == 1)
+    {
+      status |= 0x80;
+      if ((ctrl & 0x80) && cpu)
+        cpu->SignalNmi();
+    }
+
+  if (scanline == PRE_RENDER_SCANLINE && dot == 1)
+    {
+      status &= ~0xE0;
+      sprite0_hit_dot = -1;
+    }
+
+  if (!IsRendering())
+    return;
+
+  if (scanline < HEIGHT)
+    {
+      if (dot == 1)
+        {
+          EvaluateSprites();
+          RenderBackgroundLine();
+        }
+
+      if (dot == sprite0_hit_dot)
+        {
+          status |= 0x40;
+          sprite0_hit_dot = -1;
+        }
+    }
+
+  if (scanline < HEIGHT || scanline == PRE_RENDER_SCANLINE)
+    {
+      if (dot == 256)
+        IncrementY();
+      if (dot == 257)
+        CopyHorizontal();
+      if (dot == 260 && scanline_counter)
+        scanline_counter->ClockScanline();
+    }
+
+  if (scanline == PRE_RENDER_SCANLINE)
+    {
+      if (dot == 280)
+        CopyVertical();
+
+      // odd frames skip the last dot of the pre-render line
+      if (dot == 339 && (frame & 1))
+        dot = 340;
+    }
+}
+
+// Dot mode: one dot of the real fetch / shift pipeline
+void Ppu::ClockDot()
+{
+  bool visible = scanline < HEIGHT;
+
+  if (scanline == PRE_RENDER_SCANLINE && dot == 1)
+    {
+      status &= ~0xE0;
+      sprite0_hit_dot = -1;
+    }
+
+  if (visible && dot == 0)
+    EvaluateSprites();
+
+  if ((dot >= 2 && dot <= 257) || (dot >= 321 && dot <= 337))
+    {
+      if (mask & 0x08)
+        {
+          bg_pattern_lo <<= 1;
+          bg_pattern_hi <<= 1;
+          bg_attrib_lo <<= 1;
+          bg_attrib_hi <<= 1;
+        }
+
+      FetchTile((dot - 1) % 8);
+    }
+
+  if (dot == 256)
+    IncrementY();
+
+  if (dot == 257)
+    {
+      LoadShifters();
+      CopyHorizontal();
+    }
+
+  if (dot == 260 && scanline_counter)
+    scanline_counter->ClockScanline();
+
+  if (dot == 338 || dot == 340)
+    next_tile_id = PpuRead(0x2000 | (v & 0x0FFF));
+
+  if (scanline == PRE_RENDER_SCANLINE && dot >= 280 && dot <= 304)
+    CopyVertical();
+
+  if (visible && dot >= 1 && dot <= WIDTH)
+    {
+      word bit_mux = 0x8000 >> fine_x;
+
+      byte pixel = ((bg_pattern_lo & bit_mux) ? 1 : 0) | ((bg_pattern_hi & bit_mux) ? 2 : 0);
+      byte pal = ((bg_attrib_lo & bit_mux) ? 1 : 0) | ((bg_attrib_hi & bit_mux) ? 2 : 0);
+
+      ComposePixel(dot - 1, (pal << 2) | pixel);
+
+      if (sprite0_hit_dot >= 0)
+        {
+          status |= 0x40;
+          sprite0_hit_dot = -1;
+        }
+    }
+
+  if (scanline == PRE_RENDER_SCANLINE && dot == 339 && (frame & 1))
+    dot = 340;
+
+  dot++;
+  dot_clock++;
+
+  if (dot == DOTS_PER_SCANLINE)
+    EndScanline();
+}
+
+void Ppu::EndScanline()
+{
+  dot = 0;
+  scanline++;
+
+  if (scanline == SCANLINES_PER_FRAME)
+    {
+      scanline = 0;
+      frame++;
+    }
+}
+
+void Ppu::IncrementX()
+{
+  if ((v & 0x001F) == 31)
+    {
+      v &= ~0x001F;
+      v ^= 0x0400; // next horizontal nametable
+    }
+  else
+    {
+      v++;
+    }
+}
+
+void Ppu::IncrementY()
+{
+  if ((v & 0x7000) != 0x7000)
+    {
+      v += 0x1000; // fine Y
+      return;
+    }
+
+  v &= ~0x7000;
+  int coarse_y = (v & 0x03E0) >> 5;
+
+  if (coarse_y == 29)
+    {
+      coarse_y = 0;
+      v ^= 0x0800; // next vertical nametable
+    }
+  else if (coarse_y == 31)
+    {
+      coarse_y = 0; // attribute rows wrap without switching nametable
+    }
+  else
+    {
+      coarse_y++;
+    }
+
+  v = (v & ~0x03E0) | (coarse_y << 5);
+}
+
+void Ppu::CopyHorizontal()
+{
+  v = (v & ~0x041F) | (t & 0x041F);
+}
+
+void Ppu::CopyVertical()
+{
+  v = (v & ~0x7BE0) | (t & 0x7BE0);
+}
+
+void Ppu::EvaluateSprites()
+{
+  sprite_line.fill(0);
+
+  int height = (ctrl & 0x20) ? 16 : 8;
+  int selected[8];
+  int found = 0;
+
+  for (int i = 0; i < 64; i++)
+    {
+      // sprites show up one line below their OAM Y
+      int row = scanline - 1 - oam[i * 4];
+      if (row < 0 || row >= height)
+        continue;
+
+      if (found == 8)
+        {
+          status |= 0x20; // overflow
+          break;
+        }
+      selected[found++] = i;
+    }
+
+  if (!(mask & 0x10))
+    return;
+
+  // lowest OAM index is drawn last so it ends up in front
+  for (int k = found - 1; k >= 0; k--)
+    {
+      int i = selected[k];
+      byte tile = oam[i * 4 + 1];
+      byte attrib = oam[i * 4 + 2];
+      int x = oam[i * 4 + 3];
+
+      int row = scanline - 1 - oam[i * 4];
+      if (attrib & 0x80)
+        row = height - 1 - row;
+
+      word pattern_addr;
+      if (height == 8)
+        pattern_addr = ((ctrl & 0x08) ? 0x1000 : 0) + tile * 16 + row;
+      else
+        pattern_addr = ((tile & 0x01) ? 0x1000 : 0) + (tile & 0xFE) * 16 + ((row & 0x08) ? 16 : 0) + (row & 0x07);
+
+      const auto& spread = (attrib & 0x40) ? BITPLANE_SPREAD_FLIPPED : BITPLANE_SPREAD;
+      uint64_t pixels = spread[PpuRead(pattern_addr)] | (spread[PpuRead(pattern_addr + 8)] << 1);
+
+      byte sprite = 0x10 | ((attrib & 0x03) << 2) | ((attrib & 0x20) ? 0x20 : 0) | (i == 0 ? 0x40 : 0);
+
+      for (int p = 0; p < 8 && x + p < WIDTH; p++)
+        {
+          byte pixel = (pixels >> (p * 8)) & 0x03;
+          if (pixel)
+            sprite_line[x + p] = sprite | pixel;
+        }
+    }
+}
+
+/*
+ *  Fetches the 33 tiles a line can touch and decodes each into 8 pixel
+ *  bytes at once, then composes the line shifted by fine X. This is what
+ *  the per-dot pipeline produces as long as nothing changes mid-line.
+ */
+void Ppu::RenderBackgroundLine()
+{
+  alignas(8) byte line[WIDTH + 16];
+
+  if (!(mask & 0x08))
+    {
+      std::memset(line, 0, sizeof(line));
+      ComposeLine(line);
+      return;
+    }
+
+  word addr = v;
+  word pattern_base = ((ctrl & 0x10) ? 0x1000 : 0) + ((v >> 12) & 0x07);
+
+  for (int tile = 0; tile < 33; tile++)
+    {
+      const byte* nametable = nametables[(addr >> 10) & 0x03];
+
+      byte tile_id = nametable[addr & 0x03FF];
+      byte attrib = nametable[0x03C0 | ((addr >> 4) & 0x38) | ((addr >> 2) & 0x07)];
+
+      if (addr & 0x0040)
+        attrib >>= 4;
+      if (addr & 0x0002)
+        attrib >>= 2;
+
+      word pattern_addr = pattern_base + tile_id * 16;
+      byte lo = chr_read[pattern_addr >> 10][pattern_addr & 0x03FF];
+      pattern_addr += 8;
+      byte hi = chr_read[pattern_addr >> 10][pattern_addr & 0x03FF];
+
+      uint64_t pixels = BITPLANE_SPREAD[lo] | (BITPLANE_SPREAD[hi] << 1) | ((attrib & 0x03) * PALETTE_BROADCAST);
+      std::memcpy(line + tile * 8, &pixels, sizeof(pixels));
+
+      if ((addr & 0x001F) == 31)
+        {
+          addr &= ~0x001F;
+          addr ^= 0x0400;
+        }
+      else
+        {
+          addr++;
+        }
+    }
+
+  ComposeLine(line + fine_x);
+}
+
+void Ppu::ComposeLine(const byte* background)
+{
+  for (int x = 0; x < WIDTH; x++)
+    ComposePixel(x, background[x]);
+}
+
+void Ppu::ComposePixel(int x, byte background)
+{
+  byte sprite = sprite_line[x];
+
+  bool show_background = (mask & 0x08) && (x >= 8 || (mask & 0x02));
+  bool show_sprites = (mask & 0x10) && (x >= 8 || (mask & 0x04));
+
+  if (!show_background || (background & 0x03) == 0)
+    background = 0;
+  if (!show_sprites)
+    sprite = 0;
+
+  byte color = background;
+  if (sprite)
+    {
+      if (background)
+        {
+          if ((sprite & 0x40) && x != 255 && sprite0_hit_dot < 0 && !(status & 0x40))
+            sprite0_hit_dot = x + 1;
+          if (!(sprite & 0x20))
+            color = sprite & 0x1F;
+        }
+      else
+        {
+          color = sprite & 0x1F;
+        }
+    }
+
+  byte grey_mask = (mask & 0x01) ? 0x30 : 0x3F;
+  frame_buffer[scanline * WIDTH + x] = ReadPalette(color) & grey_mask;
+}
+
+void Ppu::LoadShifters()
+{
+  bg_pattern_lo = (bg_pattern_lo & 0xFF00) | next_tile_lo;
+  bg_pattern_hi = (bg_pattern_hi & 0xFF00) | next_tile_hi;
+  bg_attrib_lo = (bg_attrib_lo & 0xFF00) | ((next_tile_attrib & 0x01) ? 0xFF : 0x00);
+  bg_attrib_hi = (bg_attrib_hi & 0xFF00) | ((next_tile_attrib & 0x02) ? 0xFF : 0x00);
+}
+
+void Ppu::FetchTile(int step)
+{
+  word pattern_base = ((ctrl & 0x10) ? 0x1000 : 0) + ((v >> 12) & 0x07);
+
+  switch (step)
+    {
+      case 0: {
+        LoadShifters();
+        next_tile_id = PpuRead(0x2000 | (v & 0x0FFF));
+      }
+      break;
+      case 2: {
+        next_tile_attrib = PpuRead(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+        if (v & 0x0040)
+          next_tile_attrib >>= 4;
+        if (v & 0x0002)
+          next_tile_attrib >>= 2;
+        next_tile_attrib &= 0x03;
+      }
+      break;
+      case 4: next_tile_lo = PpuRead(pattern_base + next_tile_id * 16); break;
+      case 6: next_tile_hi = PpuRead(pattern_base + next_tile_id * 16 + 8); break;
+      case 7: IncrementX(); break;
+      default: break;
+    }
+}
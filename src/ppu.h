@@ -0,0 +1,200 @@
+#ifndef GOOGLETESTSEXAMPLE_PPU_H
+#define GOOGLETESTSEXAMPLE_PPU_H
+
+#include <array>
+
+#include "cartridge.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "state.h"
+#include "utils/types.h"
+
+class Cpu;
+
+/*
+ *  Cartridge hardware that counts scanlines by watching the PPU address
+ *  bus (MMC3). It is clocked at dot 260 of every rendered line, where A12
+ *  rises for games with the background at $0000 and sprites at $1000,
+ *  which is how nearly every MMC3 game is set up.
+ */
+class ScanlineCounter
+{
+public:
+  virtual ~ScanlineCounter() = default;
+
+  virtual void ClockScanline() = 0;
+
+  // Rendering was switched on or off, which moves every upcoming clock
+  virtual void RenderingChanged() = 0;
+};
+
+/*
+ *  2C02 picture processing unit, mapped over $2000-$3FFF.
+ *
+ *  The PPU runs three dots per CPU cycle but is only ever caught up lazily:
+ *  register accesses bring it up to the CPU's current cycle, and the
+ *  scheduler catches it up at vblank. Between those points it jumps from event
+ *  to event (render line, scroll copies, vblank) instead of walking dots.
+ *
+ *  Scanline mode renders a whole background line at dot 1 from the scroll
+ *  state at that point, decoding 8 pixels per tile with the bitplane
+ *  tables. Dot mode runs the real fetch/shift pipeline for games that
+ *  change scroll or pattern tables in the middle of a line.
+ */
+class Ppu : public BusDevice, public EventSource
+{
+public:
+  static constexpr int WIDTH = 256;
+  static constexpr int HEIGHT = 240;
+  static constexpr int DOTS_PER_SCANLINE = 341;
+  static constexpr int SCANLINES_PER_FRAME = 262;
+  static constexpr int VBLANK_SCANLINE = 241;
+  static constexpr int PRE_RENDER_SCANLINE = 261;
+
+  enum class RenderMode : byte
+  {
+    Scanline,
+    Dot
+  };
+
+  Ppu();
+
+  void Reset();
+
+  void ConnectCpu(Cpu* cpu);
+
+  // Keeps EventType::Vblank on the scheduler current
+  void ConnectScheduler(Scheduler* scheduler);
+
+  void ConnectScanlineCounter(ScanlineCounter* counter);
+
+  // CHR is addressed in 1 KB banks so mappers can switch them by pointer,
+  // null data selects the PPU's own 8 KB of CHR RAM
+  void MapChr(int first_bank, int bank_count, const byte* data, bool writable);
+  void SetMirroring(Mirroring mirroring);
+
+  void SetRenderMode(RenderMode mode);
+  RenderMode GetRenderMode() const;
+
+  // CPU side registers, $2000-$2007 mirrored every 8 bytes
+  byte Read(word addr) override;
+  void Write(word addr, byte data) override;
+
+  // OAM DMA ($4014) writes straight into OAM
+  void WriteOam(byte data);
+
+  void RunEvent(EventType type, uint64_t cycle) override;
+
+  // Brings the PPU up to the given CPU cycle
+  void CatchUp(uint64_t cpu_cycle);
+
+  // First CPU cycle at or after which the next vblank starts
+  uint64_t NextVblankCycle() const;
+
+  // First CPU cycle at or after which the scanline counter has been
+  // clocked `count` more times, provided rendering stays as it is.
+  // Scheduler::NEVER while rendering is off
+  uint64_t ScanlineClockCycle(uint32_t count) const;
+
+  // 256x240 NES palette indices (0-63)
+  const byte* GetFrameBuffer() const;
+
+  // VRAM, CHR RAM, palette and OAM, for StateHasher
+  uint64_t HashMemory() const;
+
+  // Everything of `other` but its wiring, frame buffer included, e.g. for
+  // a fork. The CHR banks and nametables stay ours, the mapper puts them
+  // in place from its own registers
+  void CopyState(const Ppu& other);
+
+  uint64_t GetFrame() const;
+  int GetScanline() const;
+  int GetDot() const;
+
+  // Registers, timing, VRAM, OAM and CHR RAM. The frame buffer is left
+  // out, it is redrawn within a frame anyway
+  void SaveState(StateWriter& writer) const;
+  void LoadState(StateReader& reader);
+
+  // PPU bus, $0000-$3FFF
+  byte PpuRead(word addr) const;
+  void PpuWrite(word addr, byte data);
+
+private:
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive);
+
+  bool IsRendering() const;
+
+  void Reschedule();
+
+  void Advance(uint64_t dots);
+  int NextEventDot() const;
+  void ProcessDot();
+  void ClockDot();
+  void EndScanline();
+
+  void IncrementX();
+  void IncrementY();
+  void CopyHorizontal();
+  void CopyVertical();
+
+  void EvaluateSprites();
+  void RenderBackgroundLine();
+  void ComposeLine(const byte* background);
+  void ComposePixel(int x, byte background);
+
+  void LoadShifters();
+  void FetchTile(int step);
+
+  byte ReadPalette(word addr) const;
+
+  Cpu* cpu = nullptr;
+  Scheduler* scheduler = nullptr;
+  ScanlineCounter* scanline_counter = nullptr;
+  RenderMode render_mode = RenderMode::Scanline;
+
+  // registers
+  byte ctrl = 0;
+  byte mask = 0;
+  byte status = 0;
+  byte oam_addr = 0;
+  byte read_buffer = 0;
+  byte data_bus = 0;
+
+  // loopy scroll registers
+  word v = 0;
+  word t = 0;
+  byte fine_x = 0;
+  bool w = false;
+
+  // timing
+  int scanline = 0;
+  int dot = 0;
+  uint64_t frame = 0;
+  uint64_t dot_clock = 0; // dots since power on
+  int sprite0_hit_dot = -1;
+
+  // dot mode background pipeline
+  word bg_pattern_lo = 0, bg_pattern_hi = 0;
+  word bg_attrib_lo = 0, bg_attrib_hi = 0;
+  byte next_tile_id = 0, next_tile_attrib = 0;
+  byte next_tile_lo = 0, next_tile_hi = 0;
+
+  // sprites on the current line, 0 = transparent, otherwise
+  // bits 0-4 palette index, bit 5 behind background, bit 6 sprite 0
+  std::array<byte, WIDTH> sprite_line{};
+
+  const byte* chr_read[8] = {};
+  byte* chr_write[8] = {};
+  byte* nametables[4] = {};
+
+  std::array<byte, 8192> chr_ram{};
+  std::array<byte, 4096> vram{}; // 2 KB on the console, 4 KB for four-screen carts
+  std::array<byte, 32> palette{};
+  std::array<byte, 256> oam{};
+
+  std::array<byte, WIDTH * HEIGHT> frame_buffer{};
+};
+
+#endif
@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <cstring>
+
+#include "rewind.h"
+
+/*
+ *  Encoding: a sequence of runs, each a tag byte and a varint length
+ *      ZERO n        n bytes equal to the reference
+ *      REPEAT n b    n bytes equal to reference ^ b
+ *      LITERAL n ... n bytes to XOR into the reference
+ */
+namespace
+{
+constexpr byte ZERO = 0;
+constexpr byte REPEAT = 1;
+constexpr byte LITERAL = 2;
+constexpr size_t MIN_RUN = 8;
+
+byte* PutRun(byte* out, byte tag, size_t length)
+{
+  *out++ = tag;
+  while (length >= 0x80)
+    {
+      *out++ = byte(length) | 0x80;
+      length >>= 7;
+    }
+  *out++ = byte(length);
+  return out;
+}
+
+bool GetLength(const byte*& in, const byte* end, size_t& length)
+{
+  length = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7)
+    {
+      byte value = *in++;
+      length |= size_t(value & 0x7F) << shift;
+      if (!(value & 0x80))
+        return true;
+    }
+  return false;
+}
+
+inline byte Delta(const byte* data, const byte* reference, size_t i)
+{
+  return reference ? data[i] ^ reference[i] : data[i];
+}
+
+// Length of the run of equal delta bytes starting at i, zero runs are
+// scanned eight bytes at a time since they make up most of a delta
+size_t RunLength(const byte* data, const byte* reference, size_t i, size_t size)
+{
+  byte value = Delta(data, reference, i);
+  size_t j = i + 1;
+
+  if (value == 0 && reference)
+    {
+      while (j + 8 <= size)
+        {
+          uint64_t a, b;
+          std::memcpy(&a, data + j, 8);
+          std::memcpy(&b, reference + j, 8);
+          if (a != b)
+            break;
+          j += 8;
+        }
+    }
+
+  while (j < size && Delta(data, reference, j) == value)
+    j++;
+  return j - i;
+}
+} // namespace
+
+size_t EncodeDelta(const byte* data, const byte* reference, size_t size, byte* out)
+{
+  byte* start = out;
+  size_t literal_start = 0;
+  size_t i = 0;
+
+  auto flush_literal = [&](size_t end) {
+    if (end == literal_start)
+      return;
+    out = PutRun(out, LITERAL, end - literal_start);
+    for (size_t k = literal_start; k < end; k++)
+      *out++ = Delta(data, reference, k);
+  };
+
+  while (i < size)
+    {
+      size_t run = RunLength(data, reference, i, size);
+      if (run < MIN_RUN)
+        {
+          i += run;
+          continue;
+        }
+
+      flush_literal(i);
+
+      byte value = Delta(data, reference, i);
+      if (value == 0)
+        {
+          out = PutRun(out, ZERO, run);
+        }
+      else
+        {
+          out = PutRun(out, REPEAT, run);
+          *out++ = value;
+        }
+
+      i += run;
+      literal_start = i;
+    }
+
+  flush_literal(size);
+  return out - start;
+}
+
+bool DecodeDelta(const byte* in, size_t in_size, const byte* reference, byte* out, size_t size)
+{
+  const byte* end = in + in_size;
+  size_t i = 0;
+
+  while (in < end)
+    {
+      byte tag = *in++;
+      size_t length = 0;
+      if (!GetLength(in, end, length) || length > size - i)
+        return false;
+
+      switch (tag)
+        {
+          case ZERO: {
+            if (reference)
+              std::memcpy(out + i, reference + i, length);
+            else
+              std::memset(out + i, 0, length);
+          }
+          break;
+          case REPEAT: {
+            if (in == end)
+              return false;
+            byte value = *in++;
+            for (size_t k = 0; k < length; k++)
+              out[i + k] = (reference ? reference[i + k] : 0) ^ value;
+          }
+          break;
+          case LITERAL: {
+            if (size_t(end - in) < length)
+              return false;
+            for (size_t k = 0; k < length; k++)
+              out[i + k] = (reference ? reference[i + k] : 0) ^ in[k];
+            in += length;
+          }
+          break;
+          default: return false;
+        }
+
+      i += length;
+    }
+
+  return i == size;
+}
+
+RewindBuffer::RewindBuffer(size_t state_size, size_t max_frames, size_t storage_size, size_t keyframe_interval)
+  : state_size(state_size),
+    keyframe_interval(std::max<size_t>(keyframe_interval, 1)),
+    storage(storage_size),
+    entries(std::max<size_t>(max_frames, 1)),
+    keyframe(state_size),
+    scratch(MaxEncodedSize(state_size))
+{
+}
+
+bool RewindBuffer::Push(std::span<const byte> state)
+{
+  if (state.size() != state_size)
+    return false;
+
+  // a delta as long as the newest frame's keyframe is recent enough
+  bool delta = false;
+  if (count > 0)
+    {
+      const Entry& newest = At(count - 1);
+      delta = next_sequence - newest.keyframe < keyframe_interval && LoadKeyframe(newest.keyframe);
+    }
+
+  uint64_t sequence = next_sequence++;
+  uint64_t key = delta ? keyframe_sequence : sequence;
+
+  size_t size = EncodeDelta(state.data(), delta ? keyframe.data() : nullptr, state_size, scratch.data());
+
+  if (count == entries.size())
+    DropOldest();
+
+  size_t offset = 0;
+  while (!Allocate(size, offset))
+    {
+      if (count == 0)
+        return false;
+      DropOldest();
+    }
+
+  // dropping may have taken this delta's keyframe with it
+  if (delta && (count == 0 || At(0).keyframe > key))
+    {
+      size = EncodeDelta(state.data(), nullptr, state_size, scratch.data());
+      key = sequence;
+      while (!Allocate(size, offset))
+        {
+          if (count == 0)
+            return false;
+          DropOldest();
+        }
+    }
+
+  std::memcpy(storage.data() + offset, scratch.data(), size);
+  head = offset + size;
+  used += size;
+
+  At(count) = Entry{offset, size, sequence, key};
+  count++;
+
+  if (key == sequence)
+    {
+      std::memcpy(keyframe.data(), state.data(), state_size);
+      keyframe_sequence = sequence;
+    }
+  return true;
+}
+
+bool RewindBuffer::Pop(std::span<byte> state)
+{
+  if (count == 0 || state.size() != state_size)
+    return false;
+
+  Entry entry = At(count - 1);
+  bool is_keyframe = entry.keyframe == entry.sequence;
+  if (!is_keyframe && !LoadKeyframe(entry.keyframe))
+    return false;
+
+  const byte* in = storage.data() + entry.offset;
+  if (!DecodeDelta(in, entry.size, is_keyframe ? nullptr : keyframe.data(), state.data(), state_size))
+    return false;
+
+  count--;
+  used -= entry.size;
+  head = entry.offset;
+  next_sequence = entry.sequence;
+  if (keyframe_sequence == entry.sequence)
+    keyframe_sequence = NONE;
+  if (count == 0)
+    head = 0;
+
+  return true;
+}
+
+void RewindBuffer::Clear()
+{
+  first = 0;
+  count = 0;
+  head = 0;
+  used = 0;
+  keyframe_sequence = NONE;
+}
+
+size_t RewindBuffer::Frames() const
+{
+  return count;
+}
+
+size_t RewindBuffer::StorageUsed() const
+{
+  return used;
+}
+
+RewindBuffer::Entry& RewindBuffer::At(size_t index)
+{
+  return entries[(first + index) % entries.size()];
+}
+
+// Entries sit back to back in storage, wrapping to the start when the
+// tail end is too short. head never quite catches up with the oldest
+// entry, so head == tail always means empty
+bool RewindBuffer::Allocate(size_t size, size_t& offset)
+{
+  if (count == 0)
+    {
+      head = 0;
+      offset = 0;
+      return size <= storage.size();
+    }
+
+  size_t tail = At(0).offset;
+  if (head >= tail)
+    {
+      if (storage.size() - head >= size)
+        {
+          offset = head;
+          return true;
+        }
+      if (size < tail)
+        {
+          offset = 0;
+          return true;
+        }
+      return false;
+    }
+
+  if (tail - head > size)
+    {
+      offset = head;
+      return true;
+    }
+  return false;
+}
+
+void RewindBuffer::DropOldest()
+{
+  // a keyframe takes the deltas that depend on it along
+  uint64_t key = At(0).sequence;
+  do
+    {
+      used -= At(0).size;
+      first = (first + 1) % entries.size();
+      count--;
+    }
+  while (count > 0 && At(0).keyframe == key);
+
+  if (keyframe_sequence == key)
+    keyframe_sequence = NONE;
+}
+
+bool RewindBuffer::LoadKeyframe(uint64_t sequence)
+{
+  if (keyframe_sequence == sequence)
+    return true;
+
+  for (size_t i = 0; i < count; i++)
+    {
+      const Entry& entry = At(i);
+      if (entry.sequence != sequence)
+        continue;
+
+      if (!DecodeDelta(storage.data() + entry.offset, entry.size, nullptr, keyframe.data(), state_size))
+        return false;
+      keyframe_sequence = sequence;
+      return true;
+    }
+  return false;
+}
@@ -0,0 +1,84 @@
+#ifndef GOOGLETESTSEXAMPLE_REWIND_H
+#define GOOGLETESTSEXAMPLE_REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "utils/types.h"
+
+// Run-length codes `data` XOR `reference` (plain `data` when reference is
+// null) into `out`, which must hold MaxEncodedSize(size). Returns the
+// encoded size
+size_t EncodeDelta(const byte* data, const byte* reference, size_t size, byte* out);
+
+// Inverse of EncodeDelta, false if `in` does not decode to exactly `size`
+bool DecodeDelta(const byte* in, size_t in_size, const byte* reference, byte* out, size_t size);
+
+constexpr size_t MaxEncodedSize(size_t size)
+{
+  return size + size / 2 + 16;
+}
+
+/*
+ *  The last few seconds of save states (see Nes::SaveState), compressed
+ *  into fixed-size storage that is allocated once.
+ *
+ *  Every `keyframe_interval` frames a full state is stored; the frames in
+ *  between are XOR deltas against that keyframe, which are mostly zeros
+ *  and shrink to a few hundred bytes after run-length coding. Deltas never
+ *  chain, so restoring any frame decodes at most two entries. When the
+ *  storage fills up the oldest keyframe goes, together with its deltas.
+ */
+class RewindBuffer
+{
+public:
+  RewindBuffer(size_t state_size, size_t max_frames, size_t storage_size, size_t keyframe_interval = 60);
+
+  // False if the state is the wrong size or could not fit at all
+  bool Push(std::span<const byte> state);
+
+  // Restores the newest frame and drops it, false when empty
+  bool Pop(std::span<byte> state);
+
+  void Clear();
+
+  size_t Frames() const;
+  size_t StorageUsed() const;
+
+private:
+  struct Entry
+  {
+    size_t offset = 0;
+    size_t size = 0;
+    uint64_t sequence = 0;
+    uint64_t keyframe = 0; // sequence of the keyframe it is a delta of
+  };
+
+  static constexpr uint64_t NONE = UINT64_MAX;
+
+  Entry& At(size_t index);
+  bool Allocate(size_t size, size_t& offset);
+  void DropOldest();
+  bool LoadKeyframe(uint64_t sequence);
+
+  size_t state_size;
+  size_t keyframe_interval;
+
+  std::vector<byte> storage;
+  size_t head = 0; // where the next entry goes
+  size_t used = 0;
+
+  std::vector<Entry> entries; // ring, oldest at `first`
+  size_t first = 0;
+  size_t count = 0;
+  uint64_t next_sequence = 0;
+
+  std::vector<byte> keyframe; // decoded keyframe the newest deltas refer to
+  uint64_t keyframe_sequence = NONE;
+
+  std::vector<byte> scratch;
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include <utility>
+
+#include "cpu.h"
+#include "scheduler.h"
+
+Scheduler::Scheduler()
+{
+  Clear();
+}
+
+void Scheduler::ConnectCpu(Cpu* _cpu)
+{
+  cpu = _cpu;
+  if (cpu)
+    cpu->scheduler = this;
+}
+
+void Scheduler::SetSource(EventType type, EventSource* source)
+{
+  sources[size_t(type)] = source;
+}
+
+void Scheduler::Schedule(EventType type, uint64_t cycle)
+{
+  size_t index = size_t(type);
+  uint64_t previous = cycles[index];
+  if (cycle == previous)
+    return;
+
+  cycles[index] = cycle;
+  if (cycle < previous)
+    SiftUp(position[index]);
+  else
+    SiftDown(position[index]);
+
+  // due before the CPU's current slice ends: have it stop there
+  if (cpu && cycle < cpu->stop_cycle)
+    cpu->stop_cycle = cycle;
+}
+
+uint64_t Scheduler::GetCycle(EventType type) const
+{
+  return cycles[size_t(type)];
+}
+
+void Scheduler::RunDue(uint64_t cycle)
+{
+  for (size_t i = 0; i < EVENT_COUNT && NextCycle() <= cycle; i++)
+    {
+      byte type = heap[0];
+      cycles[type] = NEVER;
+      SiftDown(0);
+
+      if (sources[type])
+        sources[type]->RunEvent(EventType(type), cycle);
+    }
+}
+
+void Scheduler::Clear()
+{
+  for (size_t i = 0; i < EVENT_COUNT; i++)
+    {
+      cycles[i] = NEVER;
+      heap[i] = byte(i);
+      position[i] = byte(i);
+    }
+}
+
+void Scheduler::Swap(size_t a, size_t b)
+{
+  std::swap(heap[a], heap[b]);
+  position[heap[a]] = byte(a);
+  position[heap[b]] = byte(b);
+}
+
+void Scheduler::SiftUp(size_t index)
+{
+  while (index > 0)
+    {
+      size_t parent = (index - 1) / 2;
+      if (cycles[heap[parent]] <= cycles[heap[index]])
+        break;
+      Swap(parent, index);
+      index = parent;
+    }
+}
+
+void Scheduler::SiftDown(size_t index)
+{
+  while (true)
+    {
+      size_t smallest = index;
+      size_t left = index * 2 + 1;
+      size_t right = left + 1;
+
+      if (left < EVENT_COUNT && cycles[heap[left]] < cycles[heap[smallest]])
+        smallest = left;
+      if (right < EVENT_COUNT && cycles[heap[right]] < cycles[heap[smallest]])
+        smallest = right;
+      if (smallest == index)
+        break;
+
+      Swap(smallest, index);
+      index = smallest;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef GOOGLETESTSEXAMPLE_SCHEDULER_H
+#define GOOGLETESTSEXAMPLE_SCHEDULER_H
+
+#include <array>
+#include <cstdint>
+
+#include "utils/types.h"
+
+class Cpu;
+
+// Points on the CPU timeline where a component has to be caught up because
+// it may interrupt the CPU. Each one is pending at most once
+enum class EventType : byte
+{
+  Vblank, // PPU enters vblank, may raise NMI
+  FrameIrq, // APU frame counter IRQ
+  DmcIrq, // DMC sample end IRQ
+  MapperIrq, // cartridge IRQ counters
+  Count
+};
+
+// Owner of one or more event types, run once the CPU reaches them
+class EventSource
+{
+public:
+  virtual ~EventSource() = default;
+
+  virtual void RunEvent(EventType type, uint64_t cycle) = 0;
+};
+
+/*
+ *  The upcoming events of the console, kept in a min-heap on the CPU cycle
+ *  they are due at. The CPU runs uninterrupted up to the earliest one, its
+ *  owner is caught up there and schedules the next.
+ *
+ *  Components reschedule whenever their state changes the deadline, which
+ *  can be in the middle of a CPU slice (a register write that starts a DMC
+ *  sample, say). An event that lands before the slice's end pulls the
+ *  CPU's stop_cycle in, the same way SignalNmi does, so the dispatch loop
+ *  never checks for events itself.
+ *
+ *  With four event types a heap is hardly faster than a scan, but it keeps
+ *  NextCycle a single load, and that is asked for after every slice.
+ */
+class Scheduler
+{
+public:
+  static constexpr uint64_t NEVER = UINT64_MAX;
+  static constexpr size_t EVENT_COUNT = size_t(EventType::Count);
+
+  Scheduler();
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  // Also makes the CPU's RunUntil stop at and run due events
+  void ConnectCpu(Cpu* cpu);
+
+  void SetSource(EventType type, EventSource* source);
+
+  // Moves `type` to `cycle`, NEVER cancels it
+  void Schedule(EventType type, uint64_t cycle);
+
+  uint64_t GetCycle(EventType type) const;
+
+  // Earliest pending event, NEVER if there is none
+  uint64_t NextCycle() const { return cycles[heap[0]]; }
+
+  // Runs the events due at or before `cycle`, earliest first. At most one
+  // pass over the event types, so a source that keeps rescheduling into
+  // the past cannot stall the caller
+  void RunDue(uint64_t cycle);
+
+  // Cancels every event
+  void Clear();
+
+private:
+  void Swap(size_t a, size_t b);
+  void SiftUp(size_t index);
+  void SiftDown(size_t index);
+
+  Cpu* cpu = nullptr;
+
+  std::array<EventSource*, EVENT_COUNT> sources{};
+  std::array<uint64_t, EVENT_COUNT> cycles{}; // by event type
+
+  // every type is always in the heap, cancelled ones sink to the bottom
+  std::array<byte, EVENT_COUNT> heap{}; // event types
+  std::array<byte, EVENT_COUNT> position{}; // heap index by event type
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef GOOGLETESTSEXAMPLE_STATE_H
+#define GOOGLETESTSEXAMPLE_STATE_H
+
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+#include "utils/types.h"
+
+/*
+ *  Save states are a flat run of fields, each component writing its own in
+ *  a fixed order. Components list their fields once, in a
+ *      template <typename Self, typename Archive>
+ *      static void Serialize(Self& self, Archive& archive);
+ *  that both archives walk: StateWriter copies fields out of a const
+ *  object, StateReader copies them back in. Either way a field is a single
+ *  memcpy into or out of a caller-owned buffer, nothing is allocated.
+ */
+class StateWriter
+{
+public:
+  explicit StateWriter(std::span<byte> buffer) : buffer(buffer) {}
+
+  template <typename T>
+  void Field(const T& value)
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Bytes(&value, sizeof(T));
+  }
+
+  // Keeps counting past the end of the buffer, so a writer over an empty
+  // span measures how large a state is
+  void Bytes(const void* data, size_t size)
+  {
+    if (offset + size <= buffer.size())
+      std::memcpy(buffer.data() + offset, data, size);
+    offset += size;
+  }
+
+  size_t Size() const { return offset; }
+  bool Ok() const { return offset <= buffer.size(); }
+
+private:
+  std::span<byte> buffer;
+  size_t offset = 0;
+};
+
+class StateReader
+{
+public:
+  explicit StateReader(std::span<const byte> buffer) : buffer(buffer) {}
+
+  template <typename T>
+  void Field(T& value)
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Bytes(&value, sizeof(T));
+  }
+
+  void Bytes(void* data, size_t size)
+  {
+    if (failed || offset + size > buffer.size())
+      {
+        failed = true;
+        return;
+      }
+    std::memcpy(data, buffer.data() + offset, size);
+    offset += size;
+  }
+
+  // For fields that turn out not to fit this console (wrong ROM, version)
+  void Fail() { failed = true; }
+
+  size_t Size() const { return offset; }
+  bool Ok() const { return !failed; }
+
+private:
+  std::span<const byte> buffer;
+  size_t offset = 0;
+  bool failed = false;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include <bit>
+#include <cstring>
+
+#include "state_hash.h"
+
+namespace
+{
+static_assert(std::endian::native == std::endian::little, "words are hashed as stored");
+
+constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87;
+constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4F;
+constexpr uint64_t PRIME_3 = 0x165667B19E3779F9;
+
+constexpr size_t LANES = 8;
+constexpr size_t STRIPE_SIZE = LANES * sizeof(uint64_t);
+
+uint64_t Load(const byte* data)
+{
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+uint64_t Avalanche(uint64_t hash)
+{
+  hash ^= hash >> 37;
+  hash *= PRIME_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+void Accumulate(std::array<uint64_t, LANES>& lanes, const byte* stripe)
+{
+  // independent lanes, the compiler keeps them in vector registers
+  for (size_t lane = 0; lane < LANES; lane++)
+    {
+      uint64_t value = Load(stripe + lane * sizeof(uint64_t));
+      lanes[lane] += (value ^ PRIME_2) * (value >> 32 | 1);
+      lanes[lane] = std::rotl(lanes[lane], 31) * PRIME_1;
+    }
+}
+
+struct Registers
+{
+  uint64_t cycles;
+  word PC;
+  byte SP, A, X, Y, P;
+  byte pad;
+};
+static_assert(sizeof(Registers) == 16, "hashed as raw bytes, no padding left undefined");
+} // namespace
+
+uint64_t HashBytes(const void* data, size_t size)
+{
+  const byte* bytes = static_cast<const byte*>(data);
+  std::array<uint64_t, LANES> lanes = {PRIME_1, PRIME_2, PRIME_3, PRIME_1 ^ PRIME_2,
+                                       PRIME_2 ^ PRIME_3, PRIME_3 ^ PRIME_1, ~PRIME_1, ~PRIME_2};
+
+  size_t offset = 0;
+  for (; offset + STRIPE_SIZE <= size; offset += STRIPE_SIZE)
+    Accumulate(lanes, bytes + offset);
+
+  if (offset < size)
+    {
+      byte tail[STRIPE_SIZE] = {};
+      std::memcpy(tail, bytes + offset, size - offset);
+      Accumulate(lanes, tail);
+    }
+
+  uint64_t hash = size * PRIME_1;
+  for (uint64_t lane : lanes)
+    hash = Avalanche(hash ^ lane) + PRIME_2;
+  return Avalanche(hash);
+}
+
+uint64_t StateHasher::Hash(Nes& nes)
+{
+  Memory& bus = nes.memory;
+  bool everything = memory != &bus || clean_epoch != bus.GetCleanEpoch();
+
+  rehashed_pages = 0;
+  for (uint32_t page = 0; page < Memory::PAGE_COUNT; page++)
+    if (everything || bus.IsDirty(page))
+      {
+        // I/O pages have nothing to read without side effects
+        const byte* storage = bus.GetReadPage(page);
+        page_hashes[page] = storage ? HashBytes(storage, Memory::PAGE_SIZE) : 0;
+        rehashed_pages++;
+      }
+
+  memory = &bus;
+  clean_epoch = bus.CleanPages();
+
+  const Cpu& cpu = nes.cpu;
+  Registers registers = {cpu.cycles, cpu.PC, cpu.SP, cpu.A, cpu.X, cpu.Y, byte(cpu.status), 0};
+
+  const uint64_t parts[] = {
+    HashBytes(&registers, sizeof(registers)),
+    HashBytes(page_hashes.data(), sizeof(page_hashes)),
+    nes.ppu.HashMemory(),
+    HashBytes(nes.ppu.GetFrameBuffer(), Ppu::WIDTH * Ppu::HEIGHT),
+  };
+  return HashBytes(parts, sizeof(parts));
+}
+
+uint32_t StateHasher::GetRehashedPages() const
+{
+  return rehashed_pages;
+}
+
+uint64_t HashState(Nes& nes)
+{
+  StateHasher hasher;
+  return hasher.Hash(nes);
+}
@@ -0,0 +1,45 @@
+#ifndef GOOGLETESTSEXAMPLE_STATE_HASH_H
+#define GOOGLETESTSEXAMPLE_STATE_HASH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "memory.h"
+#include "nes.h"
+
+// 64-bit hash of a byte run, 8 lanes of multiply-accumulate over 64 byte
+// stripes in the manner of XXH3. Stable across runs and hosts, but not
+// bit compatible with xxHash
+uint64_t HashBytes(const void* data, size_t size);
+
+/*
+ *  Hashes a console after every frame without reading all of it again.
+ *  Each bus page keeps its hash from the last call, and only the pages
+ *  written since (Memory::IsDirty) are hashed again. The CPU registers,
+ *  PPU memory and the frame buffer are small or always change, they are
+ *  hashed in full.
+ *
+ *  The hasher cleans the bus pages it has hashed, so one console should
+ *  have one hasher. If anything else cleans them in between, the next call
+ *  notices the clean epoch moved and hashes every page.
+ */
+class StateHasher
+{
+public:
+  uint64_t Hash(Nes& nes);
+
+  // Pages hashed again by the last call
+  uint32_t GetRehashedPages() const;
+
+private:
+  std::array<uint64_t, Memory::PAGE_COUNT> page_hashes{};
+  const Memory* memory = nullptr;
+  uint32_t clean_epoch = 0;
+  uint32_t rehashed_pages = 0;
+};
+
+// The hash of the console as StateHasher computes it, all from scratch
+uint64_t HashState(Nes& nes);
+
+#endif
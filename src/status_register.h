@@ -0,0 +1,94 @@
+#ifndef GOOGLETESTSEXAMPLE_STATUS_REGISTER_H
+#define GOOGLETESTSEXAMPLE_STATUS_REGISTER_H
+
+#include <type_traits>
+
+#include "utils/types.h"
+
+/*
+ *  The P register with N, Z, C and V evaluated lazily. ALU handlers store
+ *  the result byte N and Z come from and the carry / overflow outcomes as
+ *  plain bytes; the packed value is only put together when something
+ *  reads P as a whole: PHP, BRK, interrupts, the tracer and save states.
+ *
+ *  It converts to and from the packed value, so `cpu.status = 0x24` and
+ *  `byte(cpu.status)` keep working. The fields are public for generated
+ *  code, which packs and unpacks them itself.
+ */
+class StatusRegister
+{
+public:
+  static constexpr byte C = 1 << 0;
+  static constexpr byte Z = 1 << 1;
+  static constexpr byte V = 1 << 6;
+  static constexpr byte N = 1 << 7;
+  static constexpr word LAZY = C | Z | V | N;
+
+  StatusRegister() = default;
+  StatusRegister(word value) { Set(value); }
+
+  StatusRegister& operator=(word value)
+  {
+    Set(value);
+    return *this;
+  }
+
+  operator word() const { return Get(); }
+
+  word Get() const
+  {
+    return other | carry | overflow | ((nz | nz >> 8) & N) | ((nz & 0xFF) == 0 ? Z : 0);
+  }
+
+  void Set(word value)
+  {
+    other = value & ~LAZY;
+    carry = value & C;
+    overflow = value & V;
+    nz = ((value & N) << 8) | ((value & Z) ? 0 : 1);
+  }
+
+  bool Test(word flag) const
+  {
+    return flag & LAZY ? (Get() & flag) != 0 : (other & flag) != 0;
+  }
+
+  void Assign(word flag, bool value)
+  {
+    if (flag & LAZY)
+      Set(value ? (Get() | flag) : (Get() & ~flag));
+    else
+      other = value ? (other | flag) : (other & ~flag);
+  }
+
+  bool Carry() const { return carry; }
+  bool Zero() const { return (nz & 0xFF) == 0; }
+  bool Overflow() const { return overflow; }
+  bool Negative() const { return (nz | nz >> 8) & N; }
+
+  void SetCarry(bool value) { carry = value; }
+  void SetOverflow(bool value) { overflow = value ? V : 0; }
+
+  // N and Z of an 8-bit result
+  void SetNZ(byte result) { nz = result; }
+
+  // BIT takes Z from A & M but N from M itself
+  void SetNZ(byte zero_result, byte negative_source) { nz = ((negative_source & N) << 8) | zero_result; }
+
+  // Save states hold the packed value
+  template <typename Self, typename Archive>
+  static void Serialize(Self& self, Archive& archive)
+  {
+    word packed = self.Get();
+    archive.Field(packed);
+    if constexpr (!std::is_const_v<Self>)
+      self.Set(packed);
+  }
+
+  word other = 0; // I, D, B, U, stored as is
+  word nz = 1; // Z: low byte is 0, N: bit 7 of either byte
+  byte carry = 0; // 0 or C
+  byte overflow = 0; // 0 or V
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cassert>
+
+#include "thread_pool.h"
+
+namespace
+{
+// index of the pool worker running on this thread, if any
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local unsigned current_worker = 0;
+} // namespace
+
+ThreadPool::ThreadPool(unsigned thread_count)
+{
+  if (thread_count == 0)
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned i = 0; i < thread_count; i++)
+    queues.push_back(std::make_unique<Queue>());
+
+  for (unsigned i = 0; i < thread_count; i++)
+    workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+  Wait();
+
+  {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    stopping = true;
+  }
+  work_available.notify_all();
+
+  for (std::thread& worker : workers)
+    worker.join();
+}
+
+void ThreadPool::Submit(Task task)
+{
+  unsigned index = current_pool == this ? current_worker : next_queue++ % queues.size();
+
+  {
+    // counted before the push: a worker may pop the task the moment it is
+    // in the deque, and its queued-- must not find the count still at 0.
+    // Taken so a worker between its last check and its wait cannot miss it
+    std::lock_guard<std::mutex> lock(state_mutex);
+    pending++;
+    queued++;
+
+    std::lock_guard<std::mutex> queue_lock(queues[index]->mutex);
+    queues[index]->tasks.push_back(std::move(task));
+  }
+  work_available.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+  // the calling task counts as pending, it would wait for itself
+  assert(current_pool != this);
+
+  std::unique_lock<std::mutex> lock(state_mutex);
+  all_done.wait(lock, [this] { return pending == 0; });
+}
+
+unsigned ThreadPool::Size() const
+{
+  return workers.size();
+}
+
+void ThreadPool::WorkerLoop(unsigned index)
+{
+  current_pool = this;
+  current_worker = index;
+
+  while (true)
+    {
+      Task task;
+      if (PopLocal(index, task) || Steal(index, task))
+        {
+          queued--;
+          task();
+          Finish();
+          continue;
+        }
+
+      std::unique_lock<std::mutex> lock(state_mutex);
+      work_available.wait(lock, [this] { return stopping || queued > 0; });
+      if (stopping && queued == 0)
+        return;
+    }
+}
+
+bool ThreadPool::PopLocal(unsigned index, Task& task)
+{
+  Queue& queue = *queues[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty())
+    return false;
+
+  task = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  return true;
+}
+
+bool ThreadPool::Steal(unsigned thief, Task& task)
+{
+  for (size_t offset = 1; offset < queues.size(); offset++)
+    {
+      Queue& queue = *queues[(thief + offset) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty())
+        continue;
+
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      return true;
+    }
+  return false;
+}
+
+void ThreadPool::Finish()
+{
+  std::lock_guard<std::mutex> lock(state_mutex);
+  if (--pending == 0)
+    all_done.notify_all();
+}
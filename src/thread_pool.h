@@ -0,0 +1,67 @@
+#ifndef GOOGLETESTSEXAMPLE_THREAD_POOL_H
+#define GOOGLETESTSEXAMPLE_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ *  Fixed set of workers, one task deque each. A worker takes its own work
+ *  from the back of its deque and, when that runs dry, steals from the
+ *  front of the others, so long and short jobs even out without a central
+ *  queue everyone contends on.
+ */
+class ThreadPool
+{
+public:
+  using Task = std::function<void()>;
+
+  // 0 threads: one per hardware thread
+  explicit ThreadPool(unsigned thread_count = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // From a worker the task goes on that worker's own deque, otherwise
+  // the deques are filled round robin
+  void Submit(Task task);
+
+  // Blocks until every submitted task has finished. Not from inside a
+  // task: that task is still pending, so Wait would never return
+  void Wait();
+
+  unsigned Size() const;
+
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void WorkerLoop(unsigned index);
+  bool PopLocal(unsigned index, Task& task);
+  bool Steal(unsigned thief, Task& task);
+  void Finish();
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex state_mutex;
+  std::condition_variable work_available;
+  std::condition_variable all_done;
+
+  std::atomic<size_t> queued{0}; // sitting in a deque
+  size_t pending = 0; // queued or running, guarded by state_mutex
+  std::atomic<unsigned> next_queue{0};
+  bool stopping = false;
+};
+
+#endif
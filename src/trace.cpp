@@ -0,0 +1,330 @@
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "instruction.h"
+#include "memory.h"
+#include "trace.h"
+
+RingTrace::RingTrace(size_t capacity)
+{
+  // a power of two lets Record wrap with a mask instead of a division
+  size_t size = std::bit_ceil(capacity < 1 ? size_t{1} : capacity);
+
+  records.resize(size);
+  mask = size - 1;
+}
+
+size_t RingTrace::Size() const
+{
+  return count < records.size() ? count : records.size();
+}
+
+size_t RingTrace::Capacity() const
+{
+  return records.size();
+}
+
+uint64_t RingTrace::Count() const
+{
+  return count;
+}
+
+const TraceRecord& RingTrace::operator[](size_t index) const
+{
+  size_t oldest = (head - Size()) & mask;
+  return records[(oldest + index) & mask];
+}
+
+void RingTrace::Clear()
+{
+  head = 0;
+  count = 0;
+}
+
+void RingTrace::Dump(std::ostream& out) const
+{
+  char line[64];
+
+  for (size_t i = 0; i < Size(); i++)
+    {
+      const TraceRecord& record = (*this)[i];
+      std::string_view mnemonic = GetMnemonic(record.opcode);
+
+      int length = std::snprintf(
+        line,
+        sizeof(line),
+        "%04X  %02X  %.*s  A:%02X X:%02X Y:%02X P:%02X SP:%02X\n",
+        record.pc,
+        record.opcode,
+        static_cast<int>(mnemonic.size()),
+        mnemonic.data(),
+        record.a,
+        record.x,
+        record.y,
+        record.p,
+        record.sp);
+
+      out.write(line, length);
+    }
+}
+
+namespace
+{
+constexpr char HEX[] = "0123456789ABCDEF";
+
+char* Hex2(char* out, byte value)
+{
+  *out++ = HEX[value >> 4];
+  *out++ = HEX[value & 0x0F];
+  return out;
+}
+
+char* Hex4(char* out, word value)
+{
+  return Hex2(Hex2(out, value >> 8), value & 0xFF);
+}
+
+char* Text(char* out, std::string_view text)
+{
+  std::memcpy(out, text.data(), text.size());
+  return out + text.size();
+}
+
+char* PadTo(char* out, const char* start, size_t width)
+{
+  while (size_t(out - start) < width)
+    *out++ = ' ';
+  return out;
+}
+
+// Right-aligned in `width` columns, like %3d
+char* Decimal(char* out, uint64_t value, size_t width)
+{
+  char digits[20];
+  size_t count = 0;
+  do
+    {
+      digits[count++] = char('0' + value % 10);
+      value /= 10;
+    }
+  while (value);
+
+  for (size_t i = count; i < width; i++)
+    *out++ = ' ';
+  while (count)
+    *out++ = digits[--count];
+  return out;
+}
+
+// Annotation for an operand that reads or writes memory
+char* Value(char* out, byte value)
+{
+  return Hex2(Text(out, " = "), value);
+}
+
+bool WriteAll(int fd, const char* data, size_t size)
+{
+  while (size > 0)
+    {
+      ssize_t written = ::write(fd, data, size);
+      if (written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return false;
+        }
+      data += written;
+      size -= written;
+    }
+  return true;
+}
+} // namespace
+
+NestestTrace::NestestTrace(const Memory& memory, int fd, Format format, size_t buffer_size)
+    : memory(memory), fd(fd), format(format), buffer(std::max(buffer_size, MAX_LINE))
+{
+}
+
+NestestTrace::~NestestTrace()
+{
+  Flush();
+}
+
+void NestestTrace::Flush()
+{
+  if (ok && used)
+    ok = WriteAll(fd, buffer.data(), used);
+  used = 0;
+}
+
+bool NestestTrace::Ok() const
+{
+  return ok;
+}
+
+byte NestestTrace::Peek(word addr) const
+{
+  const byte* page = memory.GetReadPage(addr >> 8);
+  return page ? page[addr & 0xFF] : 0xFF;
+}
+
+word NestestTrace::PeekWord(word lo_addr, word hi_addr) const
+{
+  return Peek(lo_addr) | (Peek(hi_addr) << 8);
+}
+
+NestestTrace::Entry NestestTrace::Capture(const TraceRecord& record) const
+{
+  Entry entry{};
+  entry.cycles = record.cycles;
+  entry.pc = record.pc;
+  entry.opcode = record.opcode;
+  entry.operand_lo = record.operand_lo;
+  entry.operand_hi = record.operand_hi;
+  entry.a = record.a;
+  entry.x = record.x;
+  entry.y = record.y;
+  entry.p = record.p;
+  entry.sp = record.sp;
+
+  // the same wrap-arounds as the addressing modes in cpu.cpp
+  const OpcodeEntry& decoded = OPCODE_TABLE[record.opcode];
+  byte zp = record.operand_lo;
+  word abs = record.operand_lo | (record.operand_hi << 8);
+
+  switch (decoded.mode)
+    {
+      case AddrMode::ZP0: entry.value = Peek(zp); break;
+      case AddrMode::ZPX: entry.value = Peek(byte(zp + record.x)); break;
+      case AddrMode::ZPY: entry.value = Peek(byte(zp + record.y)); break;
+      case AddrMode::ABS: entry.value = Peek(abs); break;
+      case AddrMode::ABX: entry.value = Peek(abs + record.x); break;
+      case AddrMode::ABY: entry.value = Peek(abs + record.y); break;
+      case AddrMode::IND: entry.target = PeekWord(abs, (abs & 0xFF00) | ((abs + 1) & 0x00FF)); break;
+      case AddrMode::IZX: {
+        byte pointer = zp + record.x;
+        entry.target = PeekWord(pointer, byte(pointer + 1));
+        entry.value = Peek(entry.target);
+      }
+      break;
+      case AddrMode::IZY: {
+        entry.target = PeekWord(zp, byte(zp + 1));
+        entry.value = Peek(entry.target + record.y);
+      }
+      break;
+      default: break;
+    }
+
+  return entry;
+}
+
+size_t NestestTrace::FormatLine(const Entry& entry, char* out)
+{
+  char* start = out;
+  const OpcodeEntry& decoded = OPCODE_TABLE[entry.opcode];
+  // BRK skips a padding byte, but reads as a one byte instruction
+  byte length = decoded.op == Op::BRK ? 1 : decoded.length;
+  AddrMode mode = decoded.op == Op::BRK ? AddrMode::IMP : decoded.mode;
+  byte lo = entry.operand_lo;
+  word abs = entry.operand_lo | (entry.operand_hi << 8);
+
+  out = Text(Hex4(out, entry.pc), "  ");
+  out = Hex2(out, entry.opcode);
+  if (length > 1)
+    out = Hex2(Text(out, " "), entry.operand_lo);
+  if (length > 2)
+    out = Hex2(Text(out, " "), entry.operand_hi);
+  out = PadTo(out, start, 15);
+
+  // nestest marks unofficial opcodes, which this core runs as NOP or XXX
+  bool official = decoded.op != Op::XXX && (decoded.op != Op::NOP || entry.opcode == 0xEA);
+  *out++ = official ? ' ' : '*';
+
+  char* disassembly = out;
+  out = Text(out, GetMnemonic(entry.opcode));
+
+  switch (mode)
+    {
+      case AddrMode::IMP: {
+        bool accumulator = (entry.opcode & 0x9F) == 0x0A; // ASL, ROL, LSR, ROR
+        if (accumulator)
+          out = Text(out, " A");
+      }
+      break;
+      case AddrMode::IMM: out = Hex2(Text(out, " #$"), lo); break;
+      case AddrMode::ZP0: out = Value(Hex2(Text(out, " $"), lo), entry.value); break;
+      case AddrMode::ZPX: out = Value(Hex2(Text(Hex2(Text(out, " $"), lo), ",X @ "), byte(lo + entry.x)), entry.value); break;
+      case AddrMode::ZPY: out = Value(Hex2(Text(Hex2(Text(out, " $"), lo), ",Y @ "), byte(lo + entry.y)), entry.value); break;
+      case AddrMode::REL: out = Hex4(Text(out, " $"), word(entry.pc + 2 + int8_t(lo))); break;
+      case AddrMode::ABS: {
+        out = Hex4(Text(out, " $"), abs);
+        if (decoded.op != Op::JMP && decoded.op != Op::JSR)
+          out = Value(out, entry.value);
+      }
+      break;
+      case AddrMode::ABX: out = Value(Hex4(Text(Hex4(Text(out, " $"), abs), ",X @ "), word(abs + entry.x)), entry.value); break;
+      case AddrMode::ABY: out = Value(Hex4(Text(Hex4(Text(out, " $"), abs), ",Y @ "), word(abs + entry.y)), entry.value); break;
+      case AddrMode::IND: out = Hex4(Text(Hex4(Text(out, " ($"), abs), ") = "), entry.target); break;
+      case AddrMode::IZX: {
+        out = Hex2(Text(Hex2(Text(out, " ($"), lo), ",X) @ "), byte(lo + entry.x));
+        out = Value(Hex4(Text(out, " = "), entry.target), entry.value);
+      }
+      break;
+      case AddrMode::IZY: {
+        out = Hex4(Text(Hex2(Text(out, " ($"), lo), "),Y = "), entry.target);
+        out = Value(Hex4(Text(out, " @ "), word(entry.target + entry.y)), entry.value);
+      }
+      break;
+    }
+
+  out = PadTo(out, disassembly, 32);
+
+  // rendering is off for the whole of nestest, so no dot is ever skipped
+  uint64_t dots = entry.cycles * 3;
+  out = Hex2(Text(out, "A:"), entry.a);
+  out = Hex2(Text(out, " X:"), entry.x);
+  out = Hex2(Text(out, " Y:"), entry.y);
+  out = Hex2(Text(out, " P:"), entry.p);
+  out = Hex2(Text(out, " SP:"), entry.sp);
+  out = Decimal(Text(out, " PPU:"), dots / 341 % 262, 3);
+  out = Decimal(Text(out, ","), dots % 341, 3);
+  out = Decimal(Text(out, " CYC:"), entry.cycles, 0);
+  *out++ = '\n';
+
+  return out - start;
+}
+
+bool NestestTrace::ConvertToText(int in_fd, int out_fd)
+{
+  std::vector<Entry> entries(4096);
+  std::vector<char> text(entries.size() * MAX_LINE);
+  size_t pending = 0; // bytes of a partly read entry
+
+  while (true)
+    {
+      ssize_t got = ::read(in_fd, reinterpret_cast<char*>(entries.data()) + pending,
+                           entries.size() * sizeof(Entry) - pending);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got < 0)
+        return false;
+      if (got == 0)
+        return pending == 0; // a truncated entry at the end is an error
+
+      size_t bytes = pending + got;
+      size_t count = bytes / sizeof(Entry);
+      size_t length = 0;
+      for (size_t i = 0; i < count; i++)
+        length += FormatLine(entries[i], text.data() + length);
+
+      if (!WriteAll(out_fd, text.data(), length))
+        return false;
+
+      pending = bytes % sizeof(Entry);
+      std::memmove(entries.data(), entries.data() + count, pending);
+    }
+}
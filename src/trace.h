@@ -0,0 +1,176 @@
+#ifndef GOOGLETESTSEXAMPLE_TRACE_H
+#define GOOGLETESTSEXAMPLE_TRACE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+#include "utils/types.h"
+
+class Memory;
+
+// CPU state right before an instruction executes
+struct TraceRecord
+{
+  word pc;
+  byte opcode;
+  byte operand_lo;
+  byte operand_hi;
+  byte a, x, y;
+  byte p;
+  byte sp;
+  uint64_t cycles; // before the instruction, nestest.log's CYC
+};
+
+/*
+ *  Trace policies are passed to Cpu::Execute. Their `enabled` flag is
+ *  checked with `if constexpr`, so the NoTrace instantiation of the
+ *  interpreter carries no tracing code at all.
+ */
+struct NoTrace
+{
+  static constexpr bool enabled = false;
+
+  void Record(const TraceRecord&) {}
+};
+
+/*
+ *  Keeps the last `capacity` records in a buffer allocated once up front.
+ *  Recording is a single struct store; turning records into text is left
+ *  to Dump, which only runs when somebody actually looks at the trace.
+ */
+class RingTrace
+{
+public:
+  static constexpr bool enabled = true;
+
+  explicit RingTrace(size_t capacity);
+
+  void Record(const TraceRecord& record)
+  {
+    records[head] = record;
+    head = (head + 1) & mask;
+    count++;
+  }
+
+  // Number of records currently held, at most the capacity
+  size_t Size() const;
+  size_t Capacity() const;
+
+  // Total records seen, including the ones already overwritten
+  uint64_t Count() const;
+
+  // Oldest record first
+  const TraceRecord& operator[](size_t index) const;
+
+  void Clear();
+
+  void Dump(std::ostream& out) const;
+
+private:
+  std::vector<TraceRecord> records;
+  size_t mask;
+  size_t head = 0;
+  uint64_t count = 0;
+};
+
+/*
+ *  Streams one nestest.log line per instruction to a file descriptor:
+ *
+ *    C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+ *
+ *  including the `= value` / `@ address` annotations, so a run can be
+ *  diffed line by line against a reference log. The PPU column is derived
+ *  from CYC the way nestest.log has it (rendering off, no skipped dots).
+ *
+ *  Lines are formatted by hand into a large buffer that goes out with one
+ *  write(2) per chunk. Binary mode stores fixed-size Entry records
+ *  instead, which is cheaper still; ConvertToText turns them into the
+ *  same text later.
+ *
+ *  Annotations peek at memory through the page table only, never through
+ *  a device, so tracing has no side effects; device pages read as FF.
+ */
+class NestestTrace
+{
+public:
+  static constexpr bool enabled = true;
+  static constexpr size_t DEFAULT_BUFFER_SIZE = 1 << 20;
+  static constexpr size_t MAX_LINE = 128;
+
+  enum class Format : byte
+  {
+    Text,
+    Binary
+  };
+
+  // Everything a line needs, as stored by the binary format (host endian)
+  struct Entry
+  {
+    uint64_t cycles;
+    word pc;
+    word target; // pointer read by (zp,X), (zp),Y and (abs)
+    byte opcode;
+    byte operand_lo;
+    byte operand_hi;
+    byte a, x, y;
+    byte p;
+    byte sp;
+    byte value; // byte at the effective address
+    byte reserved[3];
+  };
+
+  // `fd` stays owned by the caller, it is written to but never closed
+  NestestTrace(const Memory& memory, int fd, Format format = Format::Text,
+               size_t buffer_size = DEFAULT_BUFFER_SIZE);
+  ~NestestTrace();
+
+  NestestTrace(const NestestTrace&) = delete;
+  NestestTrace& operator=(const NestestTrace&) = delete;
+
+  void Record(const TraceRecord& record)
+  {
+    if (used + MAX_LINE > buffer.size()) [[unlikely]]
+      Flush();
+
+    Entry entry = Capture(record);
+    if (format == Format::Binary)
+      {
+        std::copy_n(reinterpret_cast<const char*>(&entry), sizeof(entry), buffer.data() + used);
+        used += sizeof(entry);
+      }
+    else
+      {
+        used += FormatLine(entry, buffer.data() + used);
+      }
+  }
+
+  // Writes out whatever is buffered
+  void Flush();
+
+  // False once a write failed, nothing more is written after that
+  bool Ok() const;
+
+  // One line with its newline into `out`, at most MAX_LINE bytes
+  static size_t FormatLine(const Entry& entry, char* out);
+
+  // Reads binary entries from in_fd until EOF, writes text to out_fd
+  static bool ConvertToText(int in_fd, int out_fd);
+
+private:
+  Entry Capture(const TraceRecord& record) const;
+  byte Peek(word addr) const;
+  word PeekWord(word lo_addr, word hi_addr) const;
+
+  const Memory& memory;
+  int fd;
+  Format format;
+  bool ok = true;
+  std::vector<char> buffer;
+  size_t used = 0;
+};
+
+static_assert(sizeof(NestestTrace::Entry) == 24);
+
+#endif
@@ -0,0 +1,92 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "apu.h"
+#include "blip_buffer.h"
+
+TEST(BlipBufferTest, ShouldSettleOnTheStepAmplitude)
+{
+  BlipBuffer blip(1000000, 50000, 1000);
+
+  blip.AddDelta(100, 8000);
+  blip.EndFrame(10000);
+
+  std::vector<int16_t> samples(blip.SamplesAvailable());
+  ASSERT_EQ(blip.ReadSamples(samples.data(), samples.size()), 500);
+
+  // silent before the step, then within the high-pass droop of 8000
+  ASSERT_EQ(samples[0], 0);
+  ASSERT_NEAR(samples[30], 8000, 8000 / 16);
+  ASSERT_LT(*std::max_element(samples.begin(), samples.end()), 8000 * 11 / 10);
+}
+
+TEST(BlipBufferTest, ShouldDropSamplesNobodyReads)
+{
+  BlipBuffer blip(1000000, 50000, 100);
+
+  blip.EndFrame(100000);
+
+  ASSERT_EQ(blip.SamplesAvailable(), 100);
+}
+
+TEST(ApuTest, ShouldReportLengthCounters)
+{
+  Apu apu;
+
+  apu.Write(0x4015, 0x01);
+  apu.Write(0x4003, 0x08);
+  ASSERT_EQ(apu.Read(0x4015) & 0x01, 0x01);
+
+  apu.Write(0x4015, 0x00);
+  ASSERT_EQ(apu.Read(0x4015) & 0x01, 0x00);
+}
+
+TEST(ApuTest, ShouldRaiseFrameIrqOnceEverySequence)
+{
+  Apu apu;
+
+  ASSERT_EQ(apu.NextIrqCycle(), 29829u);
+
+  apu.CatchUp(29830);
+  ASSERT_EQ(apu.Read(0x4015) & 0x40, 0x40);
+  ASSERT_EQ(apu.Read(0x4015) & 0x40, 0x00);
+}
+
+TEST(ApuTest, ShouldNotRaiseFrameIrqWhenInhibited)
+{
+  Apu apu;
+
+  apu.Write(0x4017, 0x40);
+  apu.CatchUp(100000);
+
+  ASSERT_EQ(apu.NextIrqCycle(), Apu::NEVER);
+  ASSERT_EQ(apu.Read(0x4015) & 0x40, 0x00);
+}
+
+TEST(ApuTest, ShouldSynthesizeASquareWave)
+{
+  Apu apu(48000);
+
+  // pulse 1, 50% duty, constant volume 15, ~440 Hz, no length halt
+  apu.Write(0x4015, 0x01);
+  apu.Write(0x4000, 0xBF);
+  apu.Write(0x4002, 0xFD);
+  apu.Write(0x4003, 0x00);
+
+  apu.CatchUp(static_cast<uint64_t>(Apu::CPU_CLOCK_NTSC / 10));
+
+  std::vector<int16_t> samples(apu.SamplesAvailable());
+  ASSERT_NEAR(static_cast<int>(samples.size()), 4800, 200);
+  apu.ReadSamples(samples.data(), samples.size());
+
+  // skip the first 1000 samples while the DC blocker settles
+  int rising_edges = 0;
+  for (size_t i = 1001; i < samples.size(); i++)
+    if (samples[i - 1] < 0 && samples[i] >= 0)
+      rising_edges++;
+
+  // 440 Hz, the length counter (254 half frames) never runs out
+  ASSERT_NEAR(rising_edges, 440 * (samples.size() - 1000) / 48000, 1);
+}
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "batch_runner.h"
+#include "test_rom.h"
+#include "thread_pool.h"
+
+namespace
+{
+// NROM-128 image that keeps writing an incrementing counter to RAM
+std::string WriteCounterRom()
+{
+  // INX; STX $10; JMP $8000
+  return WriteTemp(MakeNrom({0xE8, 0x86, 0x10, 0x4C, 0x00, 0x80}), "batch_counter.nes");
+}
+} // namespace
+
+TEST(ThreadPoolTest, ShouldRunEveryTask)
+{
+  ThreadPool pool(4);
+  std::atomic<int> count{0};
+
+  for (int i = 0; i < 1000; i++)
+    pool.Submit([&count] { count++; });
+  pool.Wait();
+
+  ASSERT_EQ(count, 1000);
+}
+
+TEST(ThreadPoolTest, ShouldRunTasksSubmittedFromWorkers)
+{
+  ThreadPool pool(3);
+  std::atomic<int> count{0};
+
+  for (int i = 0; i < 10; i++)
+    pool.Submit([&pool, &count] {
+      for (int j = 0; j < 10; j++)
+        pool.Submit([&count] { count++; });
+    });
+  pool.Wait();
+
+  ASSERT_EQ(count, 100);
+}
+
+TEST(BatchRunnerTest, ShouldGiveIdenticalRunsIdenticalHashes)
+{
+  std::string rom = WriteCounterRom();
+  ThreadPool pool(2);
+
+  std::vector<BatchResult> results = RunBatch({{rom, 3}, {rom, 3}, {rom, 4}}, pool);
+
+  ASSERT_EQ(results.size(), 3u);
+  for (const BatchResult& result : results)
+    ASSERT_TRUE(result.ok) << result.error;
+
+  ASSERT_EQ(results[0].hash, results[1].hash);
+  ASSERT_EQ(results[0].cycles, results[1].cycles);
+  ASSERT_NE(results[0].hash, results[2].hash);
+  ASSERT_GT(results[2].cycles, results[0].cycles);
+}
+
+TEST(BatchRunnerTest, ShouldReportRomsThatFailToLoad)
+{
+  ThreadPool pool(1);
+
+  std::vector<BatchResult> results = RunBatch({{::testing::TempDir() + "missing.nes", 1}}, pool);
+
+  ASSERT_FALSE(results[0].ok);
+  ASSERT_FALSE(results[0].error.empty());
+}
@@ -0,0 +1,124 @@
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cartridge.h"
+#include "memory.h"
+#include "test_rom.h"
+
+TEST(CartridgeTest, ShouldParseINesHeader)
+{
+  std::vector<byte> rom = MakeINes(2, 1, 0x13, 0x40); // vertical, battery, mapper 0x41
+  CartridgeHeader header;
+
+  ASSERT_TRUE(ParseHeader(rom.data(), rom.size(), header));
+
+  EXPECT_FALSE(header.nes2);
+  EXPECT_EQ(header.mapper, 0x41);
+  EXPECT_EQ(header.mirroring, Mirroring::Vertical);
+  EXPECT_TRUE(header.battery);
+  EXPECT_EQ(header.prg_rom_size, 32768);
+  EXPECT_EQ(header.chr_rom_size, 8192);
+  EXPECT_EQ(header.region, Region::NTSC);
+}
+
+TEST(CartridgeTest, ShouldParseNes2Header)
+{
+  std::vector<byte> rom = MakeINes(1, 0, 0x08, 0x08);
+  rom[8] = 0x21; // submapper 2, mapper bits 8-11 = 1
+  rom[10] = 0x70; // 8 KB battery backed PRG RAM
+  rom[11] = 0x07; // 8 KB CHR RAM
+  rom[12] = 0x01; // PAL
+  CartridgeHeader header;
+
+  ASSERT_TRUE(ParseHeader(rom.data(), rom.size(), header));
+
+  EXPECT_TRUE(header.nes2);
+  EXPECT_EQ(header.mapper, 0x100);
+  EXPECT_EQ(header.submapper, 2);
+  EXPECT_EQ(header.mirroring, Mirroring::FourScreen);
+  EXPECT_EQ(header.prg_ram_size, 8192);
+  EXPECT_EQ(header.chr_ram_size, 8192);
+  EXPECT_EQ(header.region, Region::PAL);
+}
+
+TEST(CartridgeTest, ShouldRejectMissingMagic)
+{
+  std::vector<byte> rom(32, 0);
+  CartridgeHeader header;
+
+  EXPECT_FALSE(ParseHeader(rom.data(), rom.size(), header));
+}
+
+TEST(CartridgeTest, ShouldMapNromPrgIntoBus)
+{
+  std::vector<byte> rom = MakeINes(1, 1);
+  PlaceCode(rom, 0xC000, {0xEA});
+  SetVectors(rom, 0xC000);
+  std::string path = WriteTemp(rom, "nrom_test.nes");
+
+  Cartridge cartridge;
+  Memory memory;
+
+  ASSERT_TRUE(cartridge.Load(path)) << cartridge.GetError();
+  ASSERT_TRUE(cartridge.MapInto(memory)) << cartridge.GetError();
+
+  // 16 KB PRG mirrored at $8000 and $C000, read straight from the mapping
+  EXPECT_EQ(memory.GetMemory(0x8000), 0xEA);
+  EXPECT_EQ(memory.GetMemory(0xC000), 0xEA);
+  EXPECT_EQ(memory.GetMemory(0xFFFD), 0xC0);
+  EXPECT_EQ(memory.GetReadPage(0x80), cartridge.GetPrgRom());
+
+  // PRG RAM is writable, ROM is not
+  memory.SetMemory(0x55, 0x6000);
+  memory.SetMemory(0x55, 0x8000);
+  EXPECT_EQ(memory.GetMemory(0x6000), 0x55);
+  EXPECT_EQ(memory.GetMemory(0x8000), 0xEA);
+
+  std::remove(path.c_str());
+}
+
+TEST(CartridgeTest, ShouldLoadTrainerAt7000)
+{
+  std::vector<byte> rom = MakeINes(1, 1, 0x04);
+  PlaceCode(rom, 0xC000, {0xEA});
+
+  // the trainer sits between the header and PRG ROM
+  std::vector<byte> trainer(512);
+  for (size_t i = 0; i < trainer.size(); i++)
+    trainer[i] = i;
+  rom.insert(rom.begin() + 16, trainer.begin(), trainer.end());
+  std::string path = WriteTemp(rom, "trainer_test.nes");
+
+  Cartridge cartridge;
+  Memory memory;
+
+  ASSERT_TRUE(cartridge.Load(path)) << cartridge.GetError();
+  ASSERT_TRUE(cartridge.MapInto(memory)) << cartridge.GetError();
+
+  EXPECT_EQ(memory.GetMemory(0x6FFF), 0x00);
+  EXPECT_EQ(memory.GetMemory(0x7000), 0x00);
+  EXPECT_EQ(memory.GetMemory(0x7001), 0x01);
+  EXPECT_EQ(memory.GetMemory(0x71FF), 0xFF);
+  EXPECT_EQ(memory.GetMemory(0x7200), 0x00);
+  EXPECT_EQ(memory.GetMemory(0x8000), 0xEA);
+
+  std::remove(path.c_str());
+}
+
+TEST(CartridgeTest, ShouldReportTruncatedRom)
+{
+  std::vector<byte> rom = MakeINes(2, 0);
+  rom.resize(1000);
+  std::string path = WriteTemp(rom, "truncated_test.nes");
+
+  Cartridge cartridge;
+
+  EXPECT_FALSE(cartridge.Load(path));
+  EXPECT_FALSE(cartridge.IsLoaded());
+  EXPECT_NE(cartridge.GetError().find("truncated"), std::string::npos);
+
+  std::remove(path.c_str());
+}
@@ -34,11 +34,13 @@ TEST(TestCpu, ResetShouldSetFlagZ)
 {
   TestStub *stub = setup_test_stub();
 
+  stub->cpu->Reset();
+
   stub->cpu->SetFlag(stub->cpu->Z, true);
 
   std::cout << "status: " << stub->cpu->status << std::endl;
 
-  ASSERT_EQ(stub->cpu->status, 0b00000010);
+  ASSERT_EQ(stub->cpu->status, 0b00100110);
 }
 
 TEST(TestCpu, ResetShouldSetFlagI)
@@ -49,7 +51,7 @@ TEST(TestCpu, ResetShouldSetFlagI)
 
   stub->cpu->SetFlag(stub->cpu->I, true);
 
-  ASSERT_EQ(stub->cpu->status, 0b00000100);
+  ASSERT_EQ(stub->cpu->status, 0b00100100);
 }
 
 TEST(TestCpu, ResetShouldSetFlagD)
@@ -60,7 +62,7 @@ TEST(TestCpu, ResetShouldSetFlagD)
 
   stub->cpu->SetFlag(stub->cpu->D, true);
 
-  ASSERT_EQ(stub->cpu->status, 0b00001000);
+  ASSERT_EQ(stub->cpu->status, 0b00101100);
 }
 
 TEST(TestCpu, ResetShouldSetFlagB)
@@ -71,7 +73,7 @@ TEST(TestCpu, ResetShouldSetFlagB)
 
   stub->cpu->SetFlag(stub->cpu->B, true);
 
-  ASSERT_EQ(stub->cpu->status, 0b00010000);
+  ASSERT_EQ(stub->cpu->status, 0b00110100);
 }
 
 TEST(TestCpu, ResetShouldSetFlagU)
@@ -82,7 +84,7 @@ TEST(TestCpu, ResetShouldSetFlagU)
 
   stub->cpu->SetFlag(stub->cpu->U, true);
 
-  ASSERT_EQ(stub->cpu->status, 0b00100000);
+  ASSERT_EQ(stub->cpu->status, 0b00100100);
 }
 
 TEST(TestCpu, ResetShouldSetFlagV)
@@ -93,7 +95,7 @@ TEST(TestCpu, ResetShouldSetFlagV)
 
   stub->cpu->SetFlag(stub->cpu->V, true);
 
-  ASSERT_EQ(stub->cpu->status, 0b01000000);
+  ASSERT_EQ(stub->cpu->status, 0b01100100);
 }
 
 TEST(TestCpu, ResetShouldSetFlagN)
@@ -104,7 +106,7 @@ TEST(TestCpu, ResetShouldSetFlagN)
 
   stub->cpu->SetFlag(stub->cpu->N, true);
 
-  ASSERT_EQ(stub->cpu->status, 0b10000000);
+  ASSERT_EQ(stub->cpu->status, 0b10100100);
 }
 
 TEST(TestCpu, ResetShouldReadFlagCOn)
@@ -325,7 +327,7 @@ TEST(TestCpu, ResetShouldSetRegisters)
   ASSERT_EQ(stub->cpu->PC, 0x00);
   ASSERT_EQ(stub->cpu->SP, 0xFD);
 
-  ASSERT_EQ(stub->cpu->status, 0x0);
+  ASSERT_EQ(stub->cpu->status, stub->cpu->I | stub->cpu->U);
 
   ASSERT_EQ(stub->cpu->A, 0x0);
   ASSERT_EQ(stub->cpu->X, 0x0);
@@ -338,7 +340,7 @@ TEST(TestCpu, ShouldFetchDataFromMemory)
 
   byte data = 0x7F;
 
-  stub->memory->SetMemory(data, stub->cpu->SP);
+  stub->memory->SetMemory(data, stub->cpu->PC);
 
   byte fetched_data = stub->cpu->FetchByte();
 
@@ -351,7 +353,7 @@ TEST(TestCpu, ShouldFetchWordFromMemory)
 
   word data = 0xFFFE;
 
-  stub->memory->WriteWord(data, stub->cpu->SP);
+  stub->memory->WriteWord(data, stub->cpu->PC);
 
   word fetched_data = stub->cpu->FetchWord();
 
@@ -0,0 +1,221 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <initializer_list>
+#include <string>
+
+#include "cpu.h"
+#include "jit.h"
+#include "memory.h"
+#include "trace.h"
+
+namespace
+{
+struct EngineRun
+{
+  RingTrace trace{8192};
+  uint64_t cycles = 0;
+  byte a = 0, x = 0, y = 0, status = 0;
+  byte result[16] = {};
+  byte nmi_count = 0;
+};
+
+void Load(Memory& memory, std::initializer_list<byte> program, word addr)
+{
+  for (byte data : program)
+    memory.SetMemory(data, addr++);
+}
+
+/*
+ *  Calls a subroutine that reads across a page boundary and patches its
+ *  own ADC immediate, 16 times, while NMIs arrive between odd sized
+ *  RunUntil slices that end in the middle of blocks.
+ */
+void RunProgram(CpuEngine engine, EngineRun& run)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+
+  Load(memory, {0xA2, 0x00, // $8000 LDX #$00
+                0x20, 0x20, 0x80, // $8002 JSR $8020
+                0xE8, // $8005 INX
+                0xE0, 0x10, // $8006 CPX #$10
+                0xD0, 0xF8, // $8008 BNE $8002
+                0x4C, 0x0A, 0x80}, // $800A JMP $800A
+       0x8000);
+  Load(memory, {0xBD, 0xFF, 0x90, // $8020 LDA $90FF,X
+                0x69, 0x03, // $8023 ADC #$03
+                0x8D, 0x24, 0x80, // $8025 STA $8024
+                0x9D, 0x00, 0x03, // $8028 STA $0300,X
+                0x60}, // $802B RTS
+       0x8020);
+  Load(memory, {0xE6, 0x20, 0x40}, 0x8040); // NMI: INC $20; RTI
+  Load(memory, {0x40, 0x80}, 0xFFFA);
+
+  for (word i = 0; i < 0x20; i++)
+    memory.SetMemory(i * 7, 0x90FF + i);
+
+  cpu.Reset();
+  cpu.PC = 0x8000;
+  cpu.engine = engine;
+  cpu.jit_threshold = 2;
+
+  for (int slice = 0; slice < 60; slice++)
+    {
+      cpu.RunUntil(cpu.cycles + 37, run.trace);
+      if (slice % 5 == 4)
+        cpu.SignalNmi();
+    }
+
+  run.cycles = cpu.cycles;
+  run.a = cpu.A;
+  run.x = cpu.X;
+  run.y = cpu.Y;
+  run.status = cpu.status;
+  run.nmi_count = memory.GetMemory(0x20);
+  for (word i = 0; i < 16; i++)
+    run.result[i] = memory.GetMemory(0x0300 + i);
+}
+
+void ExpectSameRun(const EngineRun& expected, const EngineRun& actual)
+{
+  ASSERT_EQ(actual.trace.Count(), expected.trace.Count());
+  for (size_t i = 0; i < expected.trace.Size(); i++)
+    {
+      SCOPED_TRACE(i);
+      EXPECT_EQ(actual.trace[i].pc, expected.trace[i].pc);
+      EXPECT_EQ(actual.trace[i].opcode, expected.trace[i].opcode);
+      EXPECT_EQ(actual.trace[i].a, expected.trace[i].a);
+      EXPECT_EQ(actual.trace[i].x, expected.trace[i].x);
+      EXPECT_EQ(actual.trace[i].p, expected.trace[i].p);
+      EXPECT_EQ(actual.trace[i].sp, expected.trace[i].sp);
+    }
+
+  EXPECT_EQ(actual.cycles, expected.cycles);
+  EXPECT_EQ(actual.a, expected.a);
+  EXPECT_EQ(actual.x, expected.x);
+  EXPECT_EQ(actual.status, expected.status);
+  EXPECT_EQ(actual.nmi_count, expected.nmi_count);
+  for (int i = 0; i < 16; i++)
+    EXPECT_EQ(actual.result[i], expected.result[i]) << "at $03" << i;
+}
+} // namespace
+
+class CpuEngineTest : public ::testing::TestWithParam<CpuEngine>
+{
+};
+
+TEST_P(CpuEngineTest, ShouldMatchInterpreter)
+{
+  EngineRun expected;
+  EngineRun actual;
+
+  RunProgram(CpuEngine::Interpreter, expected);
+  RunProgram(GetParam(), actual);
+
+  // the program has finished its loop and taken every NMI
+  ASSERT_EQ(expected.x, 0x10);
+  ASSERT_EQ(expected.nmi_count, 11); // the 12th is still pending
+  ASSERT_GT(expected.trace.Count(), 200);
+
+  ExpectSameRun(expected, actual);
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, CpuEngineTest, ::testing::Values(CpuEngine::Cached, CpuEngine::Blocks, CpuEngine::Jit));
+
+TEST(CpuBlocksTest, ShouldStopAtTargetCycleInsideBlock)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+  cpu.Reset();
+  cpu.PC = 0x8000;
+  cpu.engine = CpuEngine::Blocks;
+
+  // INX x 8; JMP $8000, one block of 18 cycles
+  Load(memory, {0xE8, 0xE8, 0xE8, 0xE8, 0xE8, 0xE8, 0xE8, 0xE8, 0x4C, 0x00, 0x80}, 0x8000);
+  uint64_t start = cpu.cycles;
+
+  cpu.RunUntil(start + 5);
+
+  ASSERT_EQ(cpu.cycles, start + 6);
+  ASSERT_EQ(cpu.X, 3);
+  ASSERT_EQ(cpu.PC, 0x8003);
+}
+
+TEST(CpuJitTest, ShouldCompileHotBlocksAndDropThemOnWrite)
+{
+  if (!NES_JIT)
+    GTEST_SKIP() << "no JIT for this host";
+
+  Memory memory;
+  Cpu cpu(&memory);
+  cpu.Reset();
+  cpu.PC = 0x8000;
+  cpu.engine = CpuEngine::Jit;
+  cpu.jit_threshold = 4;
+
+  // loop: LDA #$01; CLC; ADC $10; STA $10; JMP loop
+  Load(memory, {0xA9, 0x01, 0x18, 0x65, 0x10, 0x85, 0x10, 0x4C, 0x00, 0x80}, 0x8000);
+  cpu.RunUntil(cpu.cycles + 13 * 100);
+
+  ASSERT_NE(cpu.block_pages[0x80], nullptr);
+  ASSERT_NE(cpu.block_pages[0x80]->blocks.front().native, nullptr);
+  EXPECT_EQ(memory.GetMemory(0x10), 100);
+
+  // patching the immediate throws the native code away
+  memory.SetMemory(0x02, 0x8001);
+  cpu.RunUntil(cpu.cycles + 13 * 10);
+
+  EXPECT_EQ(memory.GetMemory(0x10), 120);
+}
+
+TEST(CpuJitTest, ShouldNeverMapCodeWritableAndExecutable)
+{
+  if (!NES_JIT)
+    GTEST_SKIP() << "no JIT for this host";
+
+  Memory memory;
+  Cpu cpu(&memory);
+  cpu.Reset();
+  cpu.PC = 0x8000;
+  cpu.engine = CpuEngine::Jit;
+  cpu.jit_threshold = 4;
+
+  // loop: INC $10; JMP loop
+  Load(memory, {0xE6, 0x10, 0x4C, 0x00, 0x80}, 0x8000);
+  cpu.RunUntil(cpu.cycles + 8 * 100);
+  ASSERT_NE(cpu.block_pages[0x80]->blocks.front().native, nullptr);
+
+  std::ifstream maps("/proc/self/maps");
+  std::string line;
+  while (std::getline(maps, line))
+    EXPECT_EQ(line.find(" rwx"), std::string::npos) << line;
+}
+
+TEST(CpuForkTest, ShouldForkRunningCpu)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+
+  Load(memory, {0xE6, 0x10, // $8000 INC $10
+                0x4C, 0x00, 0x80}, // $8002 JMP $8000
+       0x8000);
+  cpu.Reset();
+  cpu.PC = 0x8000;
+  cpu.engine = CpuEngine::Cached;
+  cpu.RunUntil(1000);
+
+  std::unique_ptr<Memory> forked_memory = memory.Fork();
+  std::unique_ptr<Cpu> fork = cpu.Fork(forked_memory.get());
+
+  // both carry on from the same point, neither sees the other's writes
+  cpu.RunUntil(2000);
+  fork->RunUntil(2000);
+
+  EXPECT_EQ(fork->PC, cpu.PC);
+  EXPECT_EQ(fork->cycles, cpu.cycles);
+  EXPECT_EQ(forked_memory->GetMemory(0x0010), memory.GetMemory(0x0010));
+
+  fork->RunUntil(3000);
+  EXPECT_NE(forked_memory->GetMemory(0x0010), memory.GetMemory(0x0010));
+}
@@ -0,0 +1,183 @@
+#include "gtest/gtest.h"
+
+#include <initializer_list>
+
+#include "cpu.h"
+#include "memory.h"
+
+class CpuInstructionsTest : public ::testing::Test
+{
+protected:
+  Memory memory;
+  Cpu cpu{&memory};
+
+  static constexpr word PROGRAM_START = 0x8000;
+
+  void SetUp() override
+  {
+    cpu.Reset();
+    cpu.PC = PROGRAM_START;
+  }
+
+  void Load(std::initializer_list<byte> program, word addr = PROGRAM_START)
+  {
+    for (byte data : program)
+      memory.SetMemory(data, addr++);
+  }
+};
+
+TEST_F(CpuInstructionsTest, ShouldLoadAndStoreAccumulator)
+{
+  Load({0xA9, 0x42, 0x85, 0x10}); // LDA #$42; STA $10
+
+  cpu.Execute(5);
+
+  ASSERT_EQ(cpu.A, 0x42);
+  ASSERT_EQ(memory.GetMemory(0x10), 0x42);
+  ASSERT_FALSE(cpu.GetFlag(cpu.Z));
+  ASSERT_FALSE(cpu.GetFlag(cpu.N));
+  ASSERT_EQ(cpu.PC, PROGRAM_START + 4);
+}
+
+TEST_F(CpuInstructionsTest, ShouldLoopWithBranch)
+{
+  Load({0xA2, 0x05, 0xCA, 0xD0, 0xFD}); // LDX #$05; loop: DEX; BNE loop
+
+  cpu.Execute(26);
+
+  ASSERT_EQ(cpu.X, 0x00);
+  ASSERT_TRUE(cpu.GetFlag(cpu.Z));
+  ASSERT_EQ(cpu.PC, PROGRAM_START + 5);
+}
+
+TEST_F(CpuInstructionsTest, ShouldReturnFromSubroutine)
+{
+  Load({0x20, 0x00, 0x90}); // JSR $9000
+  Load({0xA0, 0x07, 0x60}, 0x9000); // LDY #$07; RTS
+
+  cpu.Execute(14);
+
+  ASSERT_EQ(cpu.Y, 0x07);
+  ASSERT_EQ(cpu.SP, 0xFD);
+  ASSERT_EQ(cpu.PC, PROGRAM_START + 3);
+}
+
+TEST_F(CpuInstructionsTest, ShouldSetOverflowOnSignedAdd)
+{
+  Load({0xA9, 0x50, 0x69, 0x50}); // LDA #$50; ADC #$50
+
+  cpu.Execute(4);
+
+  ASSERT_EQ(cpu.A, 0xA0);
+  ASSERT_TRUE(cpu.GetFlag(cpu.V));
+  ASSERT_TRUE(cpu.GetFlag(cpu.N));
+  ASSERT_FALSE(cpu.GetFlag(cpu.C));
+}
+
+TEST_F(CpuInstructionsTest, ShouldIndexIndirectYAddressing)
+{
+  memory.SetMemory(0x00, 0x20);
+  memory.SetMemory(0x03, 0x21);
+  memory.SetMemory(0x99, 0x0304);
+  Load({0xA0, 0x04, 0xB1, 0x20}); // LDY #$04; LDA ($20),Y
+
+  cpu.Execute(7);
+
+  ASSERT_EQ(cpu.A, 0x99);
+}
+
+TEST_F(CpuInstructionsTest, ShouldSpendExtraCycleOnPageCross)
+{
+  Load({0xA2, 0x01, 0xBD, 0xFF, 0x80}); // LDX #$01; LDA $80FF,X
+  uint64_t start = cpu.cycles;
+
+  cpu.Execute(7);
+
+  ASSERT_EQ(cpu.cycles, start + 7);
+  ASSERT_EQ(cpu.PC, PROGRAM_START + 5);
+}
+
+TEST_F(CpuInstructionsTest, ShouldRunUntilTargetCycle)
+{
+  Load({0x4C, 0x00, 0x80}); // loop: JMP loop
+  uint64_t start = cpu.cycles;
+
+  uint64_t executed = cpu.RunUntil(start + 1000);
+
+  ASSERT_EQ(executed, 1002); // 334 JMPs of 3 cycles
+  ASSERT_EQ(cpu.cycles, start + 1002);
+  ASSERT_EQ(cpu.PC, PROGRAM_START);
+}
+
+TEST_F(CpuInstructionsTest, ShouldRunWholeFramesBeyondByteBudget)
+{
+  Load({0x4C, 0x00, 0x80}); // loop: JMP loop
+
+  cpu.RunFrames(3);
+
+  // 3 * 89342 / 3 = 89342 cycles, reached on a JMP boundary
+  ASSERT_EQ(cpu.frames, 3);
+  ASSERT_GE(cpu.cycles, 89342);
+  ASSERT_LT(cpu.cycles, 89342 + 3);
+}
+
+TEST_F(CpuInstructionsTest, ShouldRunSameProgramOnBothEngines)
+{
+  // LDX #0; loop: TXA; STA $0200,X; INX; BNE loop; BRK
+  std::initializer_list<byte> program = {0xA2, 0x00, 0x8A, 0x9D, 0x00, 0x02, 0xE8, 0xD0, 0xF9, 0x00};
+  Load(program);
+  uint64_t cycles = cpu.RunUntil(cpu.cycles + 4000);
+  word pc = cpu.PC;
+  byte x = cpu.X;
+
+  SetUp();
+  memory.Setup();
+  Load(program);
+  cpu.engine = CpuEngine::Cached;
+
+  ASSERT_EQ(cpu.RunUntil(cpu.cycles + 4000), cycles);
+  ASSERT_EQ(cpu.PC, pc);
+  ASSERT_EQ(cpu.X, x);
+  ASSERT_EQ(memory.GetMemory(0x02FF), 0xFF);
+}
+
+TEST_F(CpuInstructionsTest, ShouldSeeSelfModifyingCodeWhenCached)
+{
+  cpu.engine = CpuEngine::Cached;
+  Load({0xA9, 0x01, 0x4C, 0x00, 0x80}); // loop: LDA #$01; JMP loop
+  cpu.RunUntil(cpu.cycles + 50);
+  ASSERT_EQ(cpu.A, 0x01);
+
+  // patch the immediate through a write, as code running in RAM would
+  memory.SetMemory(0x02, PROGRAM_START + 1);
+  cpu.RunUntil(cpu.cycles + 50);
+
+  ASSERT_EQ(cpu.A, 0x02);
+}
+
+TEST_F(CpuInstructionsTest, ShouldKeepNegativeAndZeroTogetherThroughPlp)
+{
+  // N and Z can only both be set by loading P as a whole
+  Load({0xA9, 0x82, 0x48, 0x28, 0x08}); // LDA #$82; PHA; PLP; PHP
+
+  cpu.Execute(2 + 3 + 4 + 3);
+
+  ASSERT_TRUE(cpu.GetFlag(cpu.N));
+  ASSERT_TRUE(cpu.GetFlag(cpu.Z));
+  ASSERT_FALSE(cpu.GetFlag(cpu.C));
+  ASSERT_EQ(memory.GetMemory(0x01FD), 0x82 | cpu.B | cpu.U);
+}
+
+TEST_F(CpuInstructionsTest, ShouldTakeBitFlagsFromDifferentSources)
+{
+  Load({0xA9, 0x01, 0x24, 0x10}); // LDA #$01; BIT $10
+  memory.SetMemory(0xC0, 0x10);
+
+  cpu.Execute(2 + 3);
+
+  // Z from A & M, N and V from M
+  ASSERT_TRUE(cpu.GetFlag(cpu.Z));
+  ASSERT_TRUE(cpu.GetFlag(cpu.N));
+  ASSERT_TRUE(cpu.GetFlag(cpu.V));
+  ASSERT_EQ(byte(cpu.status), cpu.N | cpu.V | cpu.Z | cpu.I | cpu.U);
+}
@@ -0,0 +1,89 @@
+#include "gtest/gtest.h"
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "disassembler.h"
+#include "memory.h"
+
+namespace
+{
+void Load(Memory& memory, std::initializer_list<byte> program, word addr)
+{
+  for (byte data : program)
+    memory.SetMemory(data, addr++);
+}
+
+std::vector<std::string> Text(std::span<const Disassembler::Instruction> instructions)
+{
+  std::vector<std::string> lines;
+  for (const Disassembler::Instruction& instruction : instructions)
+    lines.push_back(Disassembler::Format(instruction));
+  return lines;
+}
+} // namespace
+
+TEST(DisassemblerTest, ShouldDecodeEveryAddressingMode)
+{
+  Memory memory;
+  Load(memory,
+       {0xA9, 0x10, // LDA #$10
+        0xB1, 0x89, // LDA ($89),Y
+        0xA1, 0x80, // LDA ($80,X)
+        0xBD, 0x00, 0x03, // LDA $0300,X
+        0x6C, 0x00, 0x02, // JMP ($0200)
+        0x4A, // LSR A
+        0xD0, 0xF1, // BNE $C000
+        0x96, 0x10}, // STX $10,Y
+       0xC000);
+
+  Disassembler disassembler(memory);
+  std::span<const Disassembler::Instruction> instructions = disassembler.Disassemble(0xC000, 0xC010);
+
+  ASSERT_EQ(Text(instructions), (std::vector<std::string>{"LDA #$10", "LDA ($89),Y", "LDA ($80,X)", "LDA $0300,X",
+                                                          "JMP ($0200)", "LSR A", "BNE $C000", "STX $10,Y"}));
+  ASSERT_EQ(instructions[3].addr, 0xC006);
+  ASSERT_EQ(instructions[3].operand, 0x0300);
+  ASSERT_EQ(instructions[3].mode, AddrMode::ABX);
+}
+
+TEST(DisassemblerTest, ShouldFollowInstructionsAcrossPages)
+{
+  Memory memory;
+  Load(memory, {0xAD, 0x34, 0x12, 0xE8}, 0x80FE); // LDA $1234 over the page boundary; INX
+
+  Disassembler disassembler(memory);
+  std::span<const Disassembler::Instruction> instructions = disassembler.Disassemble(0x80FE, 0x8101);
+
+  ASSERT_EQ(instructions.size(), 2u);
+  ASSERT_EQ(Disassembler::Format(instructions[0]), "LDA $1234");
+  ASSERT_EQ(instructions[1].addr, 0x8101);
+  ASSERT_EQ(Disassembler::Format(instructions[1]), "INX");
+}
+
+TEST(DisassemblerTest, ShouldRedecodeOnlyAfterWritesToCoveredPages)
+{
+  Memory memory;
+  Load(memory, {0xE8, 0xC8}, 0x8000); // INX; INY
+  Load(memory, {0xAD, 0x34}, 0x80FE); // LDA $xx34, high byte in the next page
+
+  Disassembler disassembler(memory);
+  disassembler.Disassemble(0x8000, 0x80FF);
+
+  memory.SetMemory(0xCA, 0x8001); // DEX
+  ASSERT_EQ(Disassembler::Format(disassembler.Disassemble(0x8000, 0x80FF)[1]), "DEX");
+
+  memory.SetMemory(0x56, 0x8100);
+  ASSERT_EQ(Disassembler::Format(disassembler.Disassemble(0x8000, 0x80FF).back()), "LDA $5634");
+}
+
+TEST(DisassemblerTest, ShouldCoverWholeAddressSpace)
+{
+  Memory memory;
+  Disassembler disassembler(memory);
+
+  // all zeroes: BRK and its padding byte, 32768 times
+  ASSERT_EQ(disassembler.Disassemble(0x0000, 0xFFFF).size(), 0x8000u);
+  ASSERT_EQ(disassembler.Disassemble(0x0000, 0xFFFF).back().addr, 0xFFFE);
+}
@@ -0,0 +1,126 @@
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "cartridge.h"
+#include "cpu.h"
+#include "emulator_pool.h"
+#include "memory.h"
+#include "nes.h"
+#include "test_rom.h"
+
+namespace
+{
+// 32 KB image of `mapper` running `code` from the last 16 KB bank, the
+// first byte of every 16 KB bank holding its number
+std::string WriteRom(const std::string& name, byte mapper, std::initializer_list<byte> code)
+{
+  std::vector<byte> rom = MakeBankedRom(mapper, 4, 1);
+  PlaceCode(rom, 0xC010, code);
+  SetVectors(rom, 0xC010);
+  return WriteTemp(rom, name);
+}
+} // namespace
+
+TEST(EmulatorPoolTest, ShouldKeepInstancesApartAndInLockstep)
+{
+  // loop: LDA $00; STA $10; INC $11; JMP loop
+  std::string path = WriteRom("pool_test.nes", 2, {0xA5, 0x00, 0x85, 0x10, 0xE6, 0x11, 0x4C, 0x10, 0xC0});
+
+  EmulatorPool pool;
+  ASSERT_TRUE(pool.Load(path, 64)) << pool.GetError();
+  ASSERT_EQ(pool.Size(), 64u);
+
+  for (size_t i = 0; i < pool.Size(); i++)
+    pool.GetRam(i)[0x00] = i;
+
+  pool.StepFrame();
+  pool.StepFrame();
+
+  // the same program alone on a flat bus
+  Cartridge cartridge;
+  Memory memory;
+  Cpu cpu(&memory);
+  ASSERT_TRUE(cartridge.Load(path));
+  ASSERT_TRUE(cartridge.MapInto(memory));
+  cpu.Reset();
+  cpu.RunFrames(2);
+
+  for (size_t i = 0; i < pool.Size(); i++)
+    {
+      EXPECT_EQ(pool.GetRam(i)[0x10], i);
+      EXPECT_EQ(pool.GetRam(i)[0x11], memory.GetMemory(0x0011));
+      EXPECT_EQ(pool.PC[i], cpu.PC);
+      EXPECT_EQ(pool.cycles[i], cpu.cycles);
+    }
+
+  std::remove(path.c_str());
+}
+
+TEST(EmulatorPoolTest, ShouldKeepMapperBanksPerInstance)
+{
+  // loop: LDA $00; STA $8000; LDA $8000; STA $10; JMP loop
+  std::string path =
+    WriteRom("pool_banks_test.nes", 2, {0xA5, 0x00, 0x8D, 0x00, 0x80, 0xAD, 0x00, 0x80, 0x85, 0x10, 0x4C, 0x10, 0xC0});
+
+  EmulatorPool pool;
+  ASSERT_TRUE(pool.Load(path, 8)) << pool.GetError();
+  pool.SetEngine(CpuEngine::Cached);
+
+  for (size_t i = 0; i < pool.Size(); i++)
+    pool.GetRam(i)[0x00] = i % 3;
+
+  pool.StepFrame();
+
+  // each instance read $8000 through the bank it selected itself
+  for (size_t i = 0; i < pool.Size(); i++)
+    EXPECT_EQ(pool.GetRam(i)[0x10], i % 3);
+
+  std::remove(path.c_str());
+}
+
+TEST(EmulatorPoolTest, ShouldGiveEveryInstanceItsOwnPpuAndInterrupts)
+{
+  // odd instances enable the NMI, all of them wait for vblank on $2002:
+  //        LDA $00; AND #$01; BEQ wait; LDA #$80; STA $2000
+  // wait:  BIT $2002; BPL wait; INC $11; JMP wait
+  // nmi:   INC $10; RTI
+  std::vector<byte> rom = MakeBankedRom(2, 4, 1);
+  PlaceCode(rom, 0xC010, {0xA5, 0x00, 0x29, 0x01, 0xF0, 0x05, 0xA9, 0x80, 0x8D, 0x00, 0x20,
+                          0x2C, 0x02, 0x20, 0x10, 0xFB, 0xE6, 0x11, 0x4C, 0x1B, 0xC0});
+  PlaceCode(rom, 0xC030, {0xE6, 0x10, 0x40});
+  SetVectors(rom, 0xC010, 0xC030);
+  std::string path = WriteTemp(rom, "pool_ppu_test.nes");
+
+  EmulatorPool pool;
+  ASSERT_TRUE(pool.Load(path, 6)) << pool.GetError();
+  pool.SetEngine(CpuEngine::Cached);
+
+  for (size_t i = 0; i < pool.Size(); i++)
+    pool.GetRam(i)[0x00] = i;
+
+  for (int frame = 0; frame < 4; frame++)
+    pool.StepFrame();
+
+  for (size_t i = 0; i < pool.Size(); i++)
+    {
+      // the same program alone on a whole console
+      Nes nes;
+      ASSERT_TRUE(nes.LoadCartridge(path));
+      nes.memory.SetMemory(i, 0x0000);
+      for (uint64_t frame = 1; frame <= pool.GetFrame(); frame++)
+        nes.RunUntil(frame * Cpu::PPU_DOTS_PER_FRAME / Cpu::PPU_DOTS_PER_CPU_CYCLE);
+
+      EXPECT_GT(pool.GetRam(i)[0x11], 0);
+      EXPECT_EQ(pool.GetRam(i)[0x10] > 0, i % 2 == 1);
+      EXPECT_EQ(pool.GetRam(i)[0x10], nes.memory.GetMemory(0x0010));
+      EXPECT_EQ(pool.GetRam(i)[0x11], nes.memory.GetMemory(0x0011));
+      EXPECT_EQ(pool.PC[i], nes.cpu.PC);
+      EXPECT_EQ(pool.cycles[i], nes.cpu.cycles);
+    }
+
+  std::remove(path.c_str());
+}
@@ -0,0 +1,599 @@
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "memory.h"
+
+/*
+ *  End-to-end CPU check in the manner of Klaus Dormann's
+ *  6502_functional_test: a self-checking program that runs every
+ *  documented opcode in every addressing mode, compares registers, flags
+ *  and memory after each one and ends in a `JMP *` trap. A failing check
+ *  jumps to a trap of its own instead, with the number of the check at
+ *  $0200.
+ *
+ *  The program is generated below, the expected results coming from a
+ *  small reference model rather than from the core under test. The
+ *  operands are random but seeded, edge values weighted up. Decimal mode
+ *  is set at random too: the 2A03 has no BCD, ADC and SBC stay binary.
+ *  The checks are run PASSES times over, every pass the same code, so
+ *  that the run is about as long as Klaus' and the cycles and MHz it
+ *  records are a throughput figure for each engine.
+ *
+ *  Klaus' own image can be run instead: point NES_6502_FUNCTIONAL_TEST at
+ *  a build with disable_decimal = 1 and NES_6502_FUNCTIONAL_SUCCESS at its
+ *  `success` label (hex, from the listing). It is loaded at $0000 and
+ *  started at $0400, its test number is at $0200 as well.
+ */
+namespace
+{
+constexpr uint64_t MAX_CYCLES = 200'000'000;
+constexpr uint64_t SLICE = 10'000; // how far past the trap the cycle count can be
+
+constexpr word KLAUS_LOAD_ADDRESS = 0x0000;
+constexpr word KLAUS_START_ADDRESS = 0x0400;
+
+constexpr word CHECK_NUMBER = 0x0200;
+constexpr word PASS_COUNT = 0x0204; // passes left, counted down
+constexpr word BRK_STATUS = 0x02F0; // status the BRK handler found on the stack
+constexpr word DATA_START = 0x0300; // operands of the absolute and indirect modes
+constexpr word DATA_END = 0x0800;
+constexpr word FAIL_TRAP = 0x0800;
+constexpr word BRK_HANDLER = 0x0803;
+constexpr word CODE_START = 0x0810;
+constexpr word CODE_END = 0xFFF0;
+constexpr int CHECKS_PER_OPCODE = 5;
+constexpr word PASSES = 1700; // about 56k cycles each, as long as Klaus' run
+
+constexpr byte C = 0x01, Z = 0x02, V = 0x40, N = 0x80;
+constexpr byte PUSHED = 0x30; // B and the unused bit, as PHP and BRK push them
+
+enum class Mode
+{
+  Implied, Immediate, ZeroPage, ZeroPageX, ZeroPageY, Absolute, AbsoluteX, AbsoluteY, IndirectX, IndirectY
+};
+
+enum class Kind
+{
+  ADC, SBC, AND, ORA, EOR, CMP, CPX, CPY, BIT, LDA, LDX, LDY, ASL, LSR, ROL, ROR, INC, DEC, STA, STX, STY,
+  INX, INY, DEX, DEY, TAX, TAY, TXA, TYA, TSX, TXS, CLC, SEC, CLI, SEI, CLV, CLD, SED, NOP
+};
+
+struct Opcode
+{
+  byte code;
+  Kind kind;
+  Mode mode;
+  const char* name;
+};
+
+using enum Mode;
+
+// every documented opcode but the branches, jumps, stack and interrupt
+// ones, which get checks of their own
+constexpr Opcode OPCODES[] = {
+  {0x69, Kind::ADC, Immediate, "ADC #"}, {0x65, Kind::ADC, ZeroPage, "ADC zp"}, {0x75, Kind::ADC, ZeroPageX, "ADC zp,X"},
+  {0x6D, Kind::ADC, Absolute, "ADC abs"}, {0x7D, Kind::ADC, AbsoluteX, "ADC abs,X"}, {0x79, Kind::ADC, AbsoluteY, "ADC abs,Y"},
+  {0x61, Kind::ADC, IndirectX, "ADC (zp,X)"}, {0x71, Kind::ADC, IndirectY, "ADC (zp),Y"},
+  {0xE9, Kind::SBC, Immediate, "SBC #"}, {0xE5, Kind::SBC, ZeroPage, "SBC zp"}, {0xF5, Kind::SBC, ZeroPageX, "SBC zp,X"},
+  {0xED, Kind::SBC, Absolute, "SBC abs"}, {0xFD, Kind::SBC, AbsoluteX, "SBC abs,X"}, {0xF9, Kind::SBC, AbsoluteY, "SBC abs,Y"},
+  {0xE1, Kind::SBC, IndirectX, "SBC (zp,X)"}, {0xF1, Kind::SBC, IndirectY, "SBC (zp),Y"},
+  {0x29, Kind::AND, Immediate, "AND #"}, {0x25, Kind::AND, ZeroPage, "AND zp"}, {0x35, Kind::AND, ZeroPageX, "AND zp,X"},
+  {0x2D, Kind::AND, Absolute, "AND abs"}, {0x3D, Kind::AND, AbsoluteX, "AND abs,X"}, {0x39, Kind::AND, AbsoluteY, "AND abs,Y"},
+  {0x21, Kind::AND, IndirectX, "AND (zp,X)"}, {0x31, Kind::AND, IndirectY, "AND (zp),Y"},
+  {0x09, Kind::ORA, Immediate, "ORA #"}, {0x05, Kind::ORA, ZeroPage, "ORA zp"}, {0x15, Kind::ORA, ZeroPageX, "ORA zp,X"},
+  {0x0D, Kind::ORA, Absolute, "ORA abs"}, {0x1D, Kind::ORA, AbsoluteX, "ORA abs,X"}, {0x19, Kind::ORA, AbsoluteY, "ORA abs,Y"},
+  {0x01, Kind::ORA, IndirectX, "ORA (zp,X)"}, {0x11, Kind::ORA, IndirectY, "ORA (zp),Y"},
+  {0x49, Kind::EOR, Immediate, "EOR #"}, {0x45, Kind::EOR, ZeroPage, "EOR zp"}, {0x55, Kind::EOR, ZeroPageX, "EOR zp,X"},
+  {0x4D, Kind::EOR, Absolute, "EOR abs"}, {0x5D, Kind::EOR, AbsoluteX, "EOR abs,X"}, {0x59, Kind::EOR, AbsoluteY, "EOR abs,Y"},
+  {0x41, Kind::EOR, IndirectX, "EOR (zp,X)"}, {0x51, Kind::EOR, IndirectY, "EOR (zp),Y"},
+  {0xC9, Kind::CMP, Immediate, "CMP #"}, {0xC5, Kind::CMP, ZeroPage, "CMP zp"}, {0xD5, Kind::CMP, ZeroPageX, "CMP zp,X"},
+  {0xCD, Kind::CMP, Absolute, "CMP abs"}, {0xDD, Kind::CMP, AbsoluteX, "CMP abs,X"}, {0xD9, Kind::CMP, AbsoluteY, "CMP abs,Y"},
+  {0xC1, Kind::CMP, IndirectX, "CMP (zp,X)"}, {0xD1, Kind::CMP, IndirectY, "CMP (zp),Y"},
+  {0xA9, Kind::LDA, Immediate, "LDA #"}, {0xA5, Kind::LDA, ZeroPage, "LDA zp"}, {0xB5, Kind::LDA, ZeroPageX, "LDA zp,X"},
+  {0xAD, Kind::LDA, Absolute, "LDA abs"}, {0xBD, Kind::LDA, AbsoluteX, "LDA abs,X"}, {0xB9, Kind::LDA, AbsoluteY, "LDA abs,Y"},
+  {0xA1, Kind::LDA, IndirectX, "LDA (zp,X)"}, {0xB1, Kind::LDA, IndirectY, "LDA (zp),Y"},
+  {0xA2, Kind::LDX, Immediate, "LDX #"}, {0xA6, Kind::LDX, ZeroPage, "LDX zp"}, {0xB6, Kind::LDX, ZeroPageY, "LDX zp,Y"},
+  {0xAE, Kind::LDX, Absolute, "LDX abs"}, {0xBE, Kind::LDX, AbsoluteY, "LDX abs,Y"},
+  {0xA0, Kind::LDY, Immediate, "LDY #"}, {0xA4, Kind::LDY, ZeroPage, "LDY zp"}, {0xB4, Kind::LDY, ZeroPageX, "LDY zp,X"},
+  {0xAC, Kind::LDY, Absolute, "LDY abs"}, {0xBC, Kind::LDY, AbsoluteX, "LDY abs,X"},
+  {0xE0, Kind::CPX, Immediate, "CPX #"}, {0xE4, Kind::CPX, ZeroPage, "CPX zp"}, {0xEC, Kind::CPX, Absolute, "CPX abs"},
+  {0xC0, Kind::CPY, Immediate, "CPY #"}, {0xC4, Kind::CPY, ZeroPage, "CPY zp"}, {0xCC, Kind::CPY, Absolute, "CPY abs"},
+  {0x24, Kind::BIT, ZeroPage, "BIT zp"}, {0x2C, Kind::BIT, Absolute, "BIT abs"},
+  {0x0A, Kind::ASL, Implied, "ASL A"}, {0x06, Kind::ASL, ZeroPage, "ASL zp"}, {0x16, Kind::ASL, ZeroPageX, "ASL zp,X"},
+  {0x0E, Kind::ASL, Absolute, "ASL abs"}, {0x1E, Kind::ASL, AbsoluteX, "ASL abs,X"},
+  {0x4A, Kind::LSR, Implied, "LSR A"}, {0x46, Kind::LSR, ZeroPage, "LSR zp"}, {0x56, Kind::LSR, ZeroPageX, "LSR zp,X"},
+  {0x4E, Kind::LSR, Absolute, "LSR abs"}, {0x5E, Kind::LSR, AbsoluteX, "LSR abs,X"},
+  {0x2A, Kind::ROL, Implied, "ROL A"}, {0x26, Kind::ROL, ZeroPage, "ROL zp"}, {0x36, Kind::ROL, ZeroPageX, "ROL zp,X"},
+  {0x2E, Kind::ROL, Absolute, "ROL abs"}, {0x3E, Kind::ROL, AbsoluteX, "ROL abs,X"},
+  {0x6A, Kind::ROR, Implied, "ROR A"}, {0x66, Kind::ROR, ZeroPage, "ROR zp"}, {0x76, Kind::ROR, ZeroPageX, "ROR zp,X"},
+  {0x6E, Kind::ROR, Absolute, "ROR abs"}, {0x7E, Kind::ROR, AbsoluteX, "ROR abs,X"},
+  {0xE6, Kind::INC, ZeroPage, "INC zp"}, {0xF6, Kind::INC, ZeroPageX, "INC zp,X"}, {0xEE, Kind::INC, Absolute, "INC abs"},
+  {0xFE, Kind::INC, AbsoluteX, "INC abs,X"},
+  {0xC6, Kind::DEC, ZeroPage, "DEC zp"}, {0xD6, Kind::DEC, ZeroPageX, "DEC zp,X"}, {0xCE, Kind::DEC, Absolute, "DEC abs"},
+  {0xDE, Kind::DEC, AbsoluteX, "DEC abs,X"},
+  {0x85, Kind::STA, ZeroPage, "STA zp"}, {0x95, Kind::STA, ZeroPageX, "STA zp,X"}, {0x8D, Kind::STA, Absolute, "STA abs"},
+  {0x9D, Kind::STA, AbsoluteX, "STA abs,X"}, {0x99, Kind::STA, AbsoluteY, "STA abs,Y"},
+  {0x81, Kind::STA, IndirectX, "STA (zp,X)"}, {0x91, Kind::STA, IndirectY, "STA (zp),Y"},
+  {0x86, Kind::STX, ZeroPage, "STX zp"}, {0x96, Kind::STX, ZeroPageY, "STX zp,Y"}, {0x8E, Kind::STX, Absolute, "STX abs"},
+  {0x84, Kind::STY, ZeroPage, "STY zp"}, {0x94, Kind::STY, ZeroPageX, "STY zp,X"}, {0x8C, Kind::STY, Absolute, "STY abs"},
+  {0xE8, Kind::INX, Implied, "INX"}, {0xC8, Kind::INY, Implied, "INY"}, {0xCA, Kind::DEX, Implied, "DEX"},
+  {0x88, Kind::DEY, Implied, "DEY"}, {0xAA, Kind::TAX, Implied, "TAX"}, {0xA8, Kind::TAY, Implied, "TAY"},
+  {0x8A, Kind::TXA, Implied, "TXA"}, {0x98, Kind::TYA, Implied, "TYA"}, {0xBA, Kind::TSX, Implied, "TSX"},
+  {0x9A, Kind::TXS, Implied, "TXS"}, {0x18, Kind::CLC, Implied, "CLC"}, {0x38, Kind::SEC, Implied, "SEC"},
+  {0x58, Kind::CLI, Implied, "CLI"}, {0x78, Kind::SEI, Implied, "SEI"}, {0xB8, Kind::CLV, Implied, "CLV"},
+  {0xD8, Kind::CLD, Implied, "CLD"}, {0xF8, Kind::SED, Implied, "SED"}, {0xEA, Kind::NOP, Implied, "NOP"},
+};
+
+struct Branch
+{
+  byte code;
+  byte flag;
+  bool taken_when_set;
+  const char* name;
+};
+
+constexpr Branch BRANCHES[] = {
+  {0x10, N, false, "BPL"}, {0x30, N, true, "BMI"}, {0x50, V, false, "BVC"}, {0x70, V, true, "BVS"},
+  {0x90, C, false, "BCC"}, {0xB0, C, true, "BCS"}, {0xD0, Z, false, "BNE"}, {0xF0, Z, true, "BEQ"},
+};
+
+// Registers and the operand byte around one instruction
+struct Regs
+{
+  byte a = 0, x = 0, y = 0, p = 0, s = 0, m = 0;
+};
+
+byte SetNZ(byte p, byte value)
+{
+  p &= ~(N | Z);
+  if (value == 0)
+    p |= Z;
+  return p | (value & N);
+}
+
+byte SetFlag(byte p, byte flag, bool set)
+{
+  return set ? p | flag : p & ~flag;
+}
+
+// The reference model: binary arithmetic only, as on the 2A03
+Regs Model(Kind kind, Regs in)
+{
+  Regs out = in;
+  auto add = [&](byte operand) {
+    uint32_t sum = in.a + operand + (in.p & C);
+    out.a = byte(sum);
+    out.p = SetFlag(out.p, C, sum > 0xFF);
+    out.p = SetFlag(out.p, V, ~(in.a ^ operand) & (in.a ^ sum) & 0x80);
+    out.p = SetNZ(out.p, out.a);
+  };
+  auto compare = [&](byte reg) {
+    out.p = SetFlag(out.p, C, reg >= in.m);
+    out.p = SetNZ(out.p, byte(reg - in.m));
+  };
+  // shifts work on A for the implied forms, on memory otherwise
+  auto shift = [&](byte& value, byte result, bool carry) {
+    value = result;
+    out.p = SetFlag(SetNZ(out.p, result), C, carry);
+  };
+
+  switch (kind)
+    {
+    case Kind::ADC: add(in.m); break;
+    case Kind::SBC: add(in.m ^ 0xFF); break;
+    case Kind::AND: out.p = SetNZ(out.p, out.a = in.a & in.m); break;
+    case Kind::ORA: out.p = SetNZ(out.p, out.a = in.a | in.m); break;
+    case Kind::EOR: out.p = SetNZ(out.p, out.a = in.a ^ in.m); break;
+    case Kind::CMP: compare(in.a); break;
+    case Kind::CPX: compare(in.x); break;
+    case Kind::CPY: compare(in.y); break;
+    case Kind::BIT:
+      out.p = SetFlag(out.p, Z, (in.a & in.m) == 0);
+      out.p = (out.p & ~(N | V)) | (in.m & (N | V));
+      break;
+    case Kind::LDA: out.p = SetNZ(out.p, out.a = in.m); break;
+    case Kind::LDX: out.p = SetNZ(out.p, out.x = in.m); break;
+    case Kind::LDY: out.p = SetNZ(out.p, out.y = in.m); break;
+    case Kind::ASL: shift(out.m, byte(in.m << 1), in.m & 0x80); break;
+    case Kind::LSR: shift(out.m, byte(in.m >> 1), in.m & 0x01); break;
+    case Kind::ROL: shift(out.m, byte(in.m << 1 | (in.p & C)), in.m & 0x80); break;
+    case Kind::ROR: shift(out.m, byte(in.m >> 1 | (in.p & C) << 7), in.m & 0x01); break;
+    case Kind::INC: out.p = SetNZ(out.p, ++out.m); break;
+    case Kind::DEC: out.p = SetNZ(out.p, --out.m); break;
+    case Kind::STA: out.m = in.a; break;
+    case Kind::STX: out.m = in.x; break;
+    case Kind::STY: out.m = in.y; break;
+    case Kind::INX: out.p = SetNZ(out.p, ++out.x); break;
+    case Kind::INY: out.p = SetNZ(out.p, ++out.y); break;
+    case Kind::DEX: out.p = SetNZ(out.p, --out.x); break;
+    case Kind::DEY: out.p = SetNZ(out.p, --out.y); break;
+    case Kind::TAX: out.p = SetNZ(out.p, out.x = in.a); break;
+    case Kind::TAY: out.p = SetNZ(out.p, out.y = in.a); break;
+    case Kind::TXA: out.p = SetNZ(out.p, out.a = in.x); break;
+    case Kind::TYA: out.p = SetNZ(out.p, out.a = in.y); break;
+    case Kind::TSX: out.p = SetNZ(out.p, out.x = in.s); break;
+    case Kind::TXS: out.s = in.x; break;
+    case Kind::CLC: out.p &= ~C; break;
+    case Kind::SEC: out.p |= C; break;
+    case Kind::CLI: out.p &= ~0x04; break;
+    case Kind::SEI: out.p |= 0x04; break;
+    case Kind::CLV: out.p &= ~V; break;
+    case Kind::CLD: out.p &= ~0x08; break;
+    case Kind::SED: out.p |= 0x08; break;
+    case Kind::NOP: break;
+    }
+  return out;
+}
+
+bool ShiftsAccumulator(const Opcode& opcode)
+{
+  return opcode.mode == Implied &&
+         (opcode.kind == Kind::ASL || opcode.kind == Kind::LSR || opcode.kind == Kind::ROL || opcode.kind == Kind::ROR);
+}
+
+/*
+ *  Assembles the checks back to back. Each one sets up the stack pointer,
+ *  memory, X, Y, the status and A, runs the instruction, pushes the status
+ *  and compares everything with the model, JMP FAIL_TRAP on the first
+ *  difference.
+ */
+class ProgramBuilder
+{
+public:
+  ProgramBuilder() : image(Memory::GetMemorySize(), 0), pc(CODE_START), random(6502)
+  {
+    pc = FAIL_TRAP;
+    Emit({0x4C, byte(FAIL_TRAP), byte(FAIL_TRAP >> 8)}); // JMP *
+
+    // BRK handler: keep the pushed status for the check to look at
+    pc = BRK_HANDLER;
+    Emit({0x68, 0x8D, byte(BRK_STATUS), byte(BRK_STATUS >> 8), 0x48, 0x40}); // PLA; STA; PHA; RTI
+    image[0xFFFE] = byte(BRK_HANDLER);
+    image[0xFFFF] = byte(BRK_HANDLER >> 8);
+
+    pc = CODE_START;
+  }
+
+  void Build()
+  {
+    Store(byte(PASSES), PASS_COUNT);
+    Store(byte(PASSES >> 8), PASS_COUNT + 1);
+    word pass = pc;
+
+    for (int round = 0; round < CHECKS_PER_OPCODE; round++)
+      {
+        for (const Opcode& opcode : OPCODES)
+          CheckOpcode(opcode);
+        for (const Branch& branch : BRANCHES)
+          CheckBranch(branch);
+        CheckBrk();
+      }
+    CheckJsr();
+    CheckIndirectJump();
+
+    // LDA lo; BNE +3; DEC hi; DEC lo; LDA lo; ORA hi; BEQ +3; JMP pass
+    byte lo[2] = {byte(PASS_COUNT), byte(PASS_COUNT >> 8)};
+    byte hi[2] = {byte(PASS_COUNT + 1), byte((PASS_COUNT + 1) >> 8)};
+    Emit({0xAD, lo[0], lo[1], 0xD0, 0x03, 0xCE, hi[0], hi[1], 0xCE, lo[0], lo[1]});
+    Emit({0xAD, lo[0], lo[1], 0x0D, hi[0], hi[1], 0xF0, 0x03, 0x4C, byte(pass), byte(pass >> 8)});
+
+    success = pc;
+    Emit({0x4C, byte(success), byte(success >> 8)}); // JMP *
+  }
+
+  std::vector<byte> image;
+  std::vector<std::string> names; // by check number
+  word success = 0;
+
+private:
+  byte Operand()
+  {
+    // boundaries of the carry, overflow and sign flags come up often
+    static constexpr byte EDGES[] = {0x00, 0x01, 0x7F, 0x80, 0x81, 0xFE, 0xFF};
+    if (random() % 3 == 0)
+      return EDGES[random() % std::size(EDGES)];
+    return byte(random());
+  }
+
+  word DataAddress()
+  {
+    return word(DATA_START + random() % (DATA_END - DATA_START));
+  }
+
+  void Emit(std::initializer_list<byte> bytes)
+  {
+    for (byte value : bytes)
+      image[pc++] = value;
+  }
+
+  void Patch(word addr, word value)
+  {
+    image[addr] = byte(value);
+    image[addr + 1] = byte(value >> 8);
+  }
+
+  void Store(byte value, word addr)
+  {
+    Emit({0xA9, value, 0x8D, byte(addr), byte(addr >> 8)}); // LDA #; STA abs
+  }
+
+  // CMP/CPX/CPY/... #expected, then on to the fail trap if different
+  void Expect(byte compare, byte expected)
+  {
+    Emit({compare, expected, 0xF0, 0x03, 0x4C, byte(FAIL_TRAP), byte(FAIL_TRAP >> 8)});
+  }
+
+  void Begin(const std::string& name, byte stack)
+  {
+    ASSERT_LT(pc, CODE_END - 0x100) << "generated program does not fit";
+    word number = names.size();
+    names.push_back(name);
+    Store(byte(number), CHECK_NUMBER);
+    Store(byte(number >> 8), CHECK_NUMBER + 1);
+    Emit({0xA2, stack, 0x9A}); // LDX #; TXS
+  }
+
+  // LDX, LDY, then the status through the stack with A loaded last
+  void SetRegisters(const Regs& in)
+  {
+    Emit({0xA2, in.x, 0xA0, in.y, 0xA9, in.p, 0x48, 0xA9, in.a, 0x28});
+  }
+
+  void CheckOpcode(const Opcode& opcode)
+  {
+    Regs in;
+    in.a = Operand();
+    in.x = Operand();
+    in.y = Operand();
+    in.p = byte(random()) & ~PUSHED;
+    in.s = byte(0x80 + random() % 0x80);
+    in.m = Operand();
+    Regs out = Model(opcode.kind, in);
+    if (ShiftsAccumulator(opcode))
+      {
+        // same model, operand and result in A
+        Regs acc = in;
+        acc.m = in.a;
+        out = Model(opcode.kind, acc);
+        out.a = out.m;
+        out.m = in.m;
+      }
+
+    Begin(opcode.name, in.s);
+
+    // operand and pointers are put in place by the check itself, so every
+    // check can use the whole data area
+    word ea = 0;
+    byte operand[2] = {0, 0};
+    byte zp = byte(random());
+    switch (opcode.mode)
+      {
+      case Implied:
+        break;
+      case Immediate:
+        operand[0] = in.m;
+        break;
+      case ZeroPage:
+        ea = zp;
+        operand[0] = zp;
+        break;
+      case ZeroPageX:
+        ea = byte(zp + in.x);
+        operand[0] = zp;
+        break;
+      case ZeroPageY:
+        ea = byte(zp + in.y);
+        operand[0] = zp;
+        break;
+      case Absolute:
+        ea = DataAddress();
+        operand[0] = byte(ea), operand[1] = byte(ea >> 8);
+        break;
+      case AbsoluteX:
+      case AbsoluteY:
+        {
+          ea = DataAddress();
+          word base = ea - (opcode.mode == AbsoluteX ? in.x : in.y);
+          operand[0] = byte(base), operand[1] = byte(base >> 8);
+          break;
+        }
+      case IndirectX:
+        {
+          ea = DataAddress();
+          byte pointer = zp + in.x;
+          Store(byte(ea), pointer);
+          Store(byte(ea >> 8), byte(pointer + 1));
+          operand[0] = zp;
+          break;
+        }
+      case IndirectY:
+        {
+          ea = DataAddress();
+          word base = ea - in.y;
+          Store(byte(base), zp);
+          Store(byte(base >> 8), byte(zp + 1));
+          operand[0] = zp;
+          break;
+        }
+      }
+
+    bool memory = opcode.mode != Implied && opcode.mode != Immediate;
+    if (memory)
+      Store(in.m, ea);
+
+    SetRegisters(in);
+    image[pc++] = opcode.code;
+    if (opcode.mode != Implied)
+      image[pc++] = operand[0];
+    if (opcode.mode == Absolute || opcode.mode == AbsoluteX || opcode.mode == AbsoluteY)
+      image[pc++] = operand[1];
+
+    Emit({0x08}); // PHP
+    Expect(0xC9, out.a); // CMP #
+    Expect(0xE0, out.x); // CPX #
+    Expect(0xC0, out.y); // CPY #
+    Emit({0xBA}); // TSX
+    Expect(0xE0, byte(out.s - 1));
+    if (memory)
+      {
+        Emit({0xAD, byte(ea), byte(ea >> 8)}); // LDA abs
+        Expect(0xC9, out.m);
+      }
+    Emit({0x68}); // PLA
+    Expect(0xC9, out.p | PUSHED);
+  }
+
+  void CheckBranch(const Branch& branch)
+  {
+    byte p = byte(random()) & ~PUSHED;
+    bool taken = bool(p & branch.flag) == branch.taken_when_set;
+
+    Begin(std::string(branch.name) + (taken ? " taken" : " not taken"), 0xFF);
+    Emit({0xA9, p, 0x48, 0x28}); // LDA #; PHA; PLP
+    Emit({branch.code, 0x03});
+    word jump = pc;
+    if (!taken)
+      Emit({0x4C, 0x00, 0x00}); // JMP past the trap below
+    Emit({0x4C, byte(FAIL_TRAP), byte(FAIL_TRAP >> 8)});
+    if (!taken)
+      Patch(jump + 1, pc);
+  }
+
+  void CheckBrk()
+  {
+    byte p = byte(random()) & ~PUSHED & ~C;
+
+    // the byte after BRK is skipped; SEC there would show in the carry
+    Begin("BRK / RTI", 0xFF);
+    Emit({0xA9, p, 0x48, 0x28, 0x00, 0x38, 0x08}); // LDA #; PHA; PLP; BRK; SEC; PHP
+    Emit({0xAD, byte(BRK_STATUS), byte(BRK_STATUS >> 8)}); // LDA abs
+    Expect(0xC9, p | PUSHED);
+    Emit({0x68}); // PLA
+    Expect(0xC9, p | PUSHED);
+  }
+
+  void CheckJsr()
+  {
+    // JSR pushes the address of its own last byte, RTS returns past it
+    Begin("JSR / RTS", 0xFF);
+    word after = pc + 2;
+    word subroutine = pc + 6;
+    Emit({0x20, byte(subroutine), byte(subroutine >> 8)}); // JSR
+    word jump = pc;
+    Emit({0x4C, 0x00, 0x00}); // JMP past the subroutine
+    Emit({0x68}); // PLA
+    Expect(0xC9, byte(after));
+    Emit({0x68}); // PLA
+    Expect(0xC9, byte(after >> 8));
+    Emit({0xA9, byte(after >> 8), 0x48, 0xA9, byte(after), 0x48, 0x60}); // LDA #; PHA; LDA #; PHA; RTS
+    Patch(jump + 1, pc);
+  }
+
+  void CheckIndirectJump()
+  {
+    // the pointer's high byte comes from the start of the same page
+    Begin("JMP (ind) page wrap", 0xFF);
+    word low = pc + 1, high = pc + 6;
+    Store(0x00, 0x03FF);
+    Store(0x00, 0x0300);
+    Store(byte(FAIL_TRAP >> 8), 0x0400);
+    Emit({0x6C, 0xFF, 0x03}); // JMP ($03FF)
+    Emit({0x4C, byte(FAIL_TRAP), byte(FAIL_TRAP >> 8)});
+    image[low] = byte(pc);
+    image[high] = byte(pc >> 8);
+  }
+
+  word pc;
+  std::mt19937 random;
+};
+
+// JMP * or a branch onto itself
+bool IsTrap(const Memory& memory, word pc)
+{
+  byte opcode = memory.GetMemory(pc);
+  if (opcode == 0x4C)
+    return memory.GetMemory(pc + 1) == (pc & 0xFF) && memory.GetMemory(pc + 2) == (pc >> 8);
+  return OPCODE_TABLE[opcode].mode == AddrMode::REL && memory.GetMemory(pc + 1) == 0xFE;
+}
+} // namespace
+
+class FunctionalTest : public ::testing::TestWithParam<CpuEngine>
+{
+};
+
+TEST_P(FunctionalTest, ShouldReachSuccessTrap)
+{
+  std::vector<byte> image;
+  word load = 0, start = 0, success = 0;
+  std::vector<std::string> names;
+
+  if (const char* path = std::getenv("NES_6502_FUNCTIONAL_TEST"))
+    {
+      std::ifstream in(path, std::ios::binary);
+      ASSERT_TRUE(in) << path << " not found";
+      const char* label = std::getenv("NES_6502_FUNCTIONAL_SUCCESS");
+      ASSERT_NE(label, nullptr) << "NES_6502_FUNCTIONAL_SUCCESS must give the success trap of " << path;
+
+      image.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      load = KLAUS_LOAD_ADDRESS;
+      start = KLAUS_START_ADDRESS;
+      success = word(std::strtoul(label, nullptr, 16));
+    }
+  else
+    {
+      ProgramBuilder program;
+      ASSERT_NO_FATAL_FAILURE(program.Build());
+      image = program.image;
+      start = CODE_START;
+      success = program.success;
+      names = program.names;
+    }
+  ASSERT_EQ(image.size(), Memory::GetMemorySize());
+
+  Memory memory;
+  Cpu cpu(&memory);
+  for (size_t i = 0; i < image.size(); i++)
+    memory.SetMemory(image[i], word(load + i));
+
+  cpu.Reset();
+  cpu.PC = start;
+  cpu.engine = GetParam();
+
+  // short slices, so that what is timed is the program and not the trap
+  // spinning for the rest of a slice
+  auto started = std::chrono::steady_clock::now();
+  uint64_t first = cpu.cycles;
+  while (cpu.cycles - first < MAX_CYCLES && !IsTrap(memory, cpu.PC))
+    cpu.RunUntil(cpu.cycles + SLICE);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  uint64_t cycles = cpu.cycles - first;
+
+  std::printf("[          ] %llu cycles in %.3f s, %.1f MHz\n", (unsigned long long)cycles, seconds,
+              cycles / seconds / 1e6);
+  RecordProperty("cycles", std::to_string(cycles));
+  RecordProperty("seconds", std::to_string(seconds));
+
+  ASSERT_TRUE(IsTrap(memory, cpu.PC)) << "no trap after " << cycles << " cycles";
+  char trap[8];
+  std::snprintf(trap, sizeof(trap), "$%04X", cpu.PC);
+
+  word number = memory.GetMemory(CHECK_NUMBER) | memory.GetMemory(CHECK_NUMBER + 1) << 8;
+  std::string check = "test number " + std::to_string(memory.GetMemory(CHECK_NUMBER));
+  if (number < names.size())
+    check = "check " + std::to_string(number) + ", " + names[number];
+  ASSERT_EQ(cpu.PC, success) << "trapped at " << trap << ", " << check;
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, FunctionalTest,
+                         ::testing::Values(CpuEngine::Interpreter, CpuEngine::Cached, CpuEngine::Blocks,
+                                           CpuEngine::Jit));
@@ -0,0 +1,42 @@
+#include "gtest/gtest.h"
+
+#include "instruction.h"
+
+TEST(InstructionTest, ShouldDecodeOfficialOpcodes)
+{
+  OpcodeEntry lda_imm = OPCODE_TABLE[0xA9];
+
+  ASSERT_EQ(lda_imm.op, Op::LDA);
+  ASSERT_EQ(lda_imm.mode, AddrMode::IMM);
+  ASSERT_EQ(lda_imm.cycles, 2);
+  ASSERT_EQ(lda_imm.length, 2);
+
+  OpcodeEntry jmp_ind = OPCODE_TABLE[0x6C];
+
+  ASSERT_EQ(jmp_ind.op, Op::JMP);
+  ASSERT_EQ(jmp_ind.mode, AddrMode::IND);
+  ASSERT_EQ(jmp_ind.cycles, 5);
+  ASSERT_EQ(jmp_ind.length, 3);
+}
+
+TEST(InstructionTest, ShouldKeepOperandLengthForIllegalOpcodes)
+{
+  // DOP / TOP: unofficial NOPs that still carry operands
+  ASSERT_EQ(OPCODE_TABLE[0x04].length, 2);
+  ASSERT_EQ(OPCODE_TABLE[0x0C].length, 3);
+  ASSERT_EQ(OPCODE_TABLE[0x1A].length, 1);
+
+  // KIL
+  ASSERT_EQ(OPCODE_TABLE[0x02].op, Op::XXX);
+  ASSERT_EQ(OPCODE_TABLE[0x02].length, 1);
+}
+
+TEST(InstructionTest, ShouldResolveMnemonics)
+{
+  ASSERT_EQ(GetMnemonic(0x00), "BRK");
+  ASSERT_EQ(GetMnemonic(0x20), "JSR");
+  ASSERT_EQ(GetMnemonic(0xEA), "NOP");
+  ASSERT_EQ(GetMnemonic(0x02), "???");
+}
+
+static_assert(OPCODE_TABLE[0x8D].op == Op::STA, "table must be usable at compile time");
@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cartridge.h"
+#include "memory.h"
+#include "nes.h"
+#include "test_rom.h"
+
+TEST(MapperTest, ShouldRejectUnsupportedMapper)
+{
+  std::string path = WriteTemp(MakeBankedRom(5, 2, 1), "mmc5_test.nes");
+  Cartridge cartridge;
+  Memory memory;
+
+  ASSERT_TRUE(cartridge.Load(path));
+  EXPECT_FALSE(cartridge.MapInto(memory));
+  EXPECT_NE(cartridge.GetError().find("not supported"), std::string::npos);
+
+  std::remove(path.c_str());
+}
+
+TEST(MapperTest, ShouldSwitchUxRomBankOnWrite)
+{
+  std::string path = WriteTemp(MakeBankedRom(2, 4, 0), "uxrom_test.nes");
+  Cartridge cartridge;
+  Memory memory;
+
+  ASSERT_TRUE(cartridge.Load(path));
+  ASSERT_TRUE(cartridge.MapInto(memory)) << cartridge.GetError();
+
+  EXPECT_EQ(memory.GetMemory(0x8000), 0);
+  EXPECT_EQ(memory.GetMemory(0xC000), 3);
+
+  uint32_t fixed_version = memory.GetPageVersion(0xC0);
+  memory.SetMemory(2, 0x8000);
+
+  // the bank is a page pointer from then on, the fixed bank is untouched
+  EXPECT_EQ(memory.GetMemory(0x8000), 2);
+  EXPECT_EQ(memory.GetReadPage(0x80), cartridge.GetPrgRom() + 2 * 16384);
+  EXPECT_EQ(memory.GetMemory(0xC000), 3);
+  EXPECT_EQ(memory.GetPageVersion(0xC0), fixed_version);
+
+  std::remove(path.c_str());
+}
+
+TEST(MapperTest, ShouldLoadMmc1RegistersSerially)
+{
+  std::string path = WriteTemp(MakeBankedRom(1, 8, 1), "mmc1_test.nes");
+  Cartridge cartridge;
+  Memory memory;
+
+  ASSERT_TRUE(cartridge.Load(path));
+  ASSERT_TRUE(cartridge.MapInto(memory)) << cartridge.GetError();
+
+  // power-on: switchable bank at $8000, last bank fixed at $C000
+  EXPECT_EQ(memory.GetMemory(0xC000), 7);
+
+  // PRG bank 5, least significant bit first
+  for (byte bit : {1, 0, 1, 0, 0})
+    {
+      EXPECT_EQ(memory.GetMemory(0x8000), 0);
+      memory.SetMemory(bit, 0xE000);
+    }
+  EXPECT_EQ(memory.GetMemory(0x8000), 5);
+
+  // a write with bit 7 set drops the bits shifted in so far
+  memory.SetMemory(0x01, 0xE000);
+  memory.SetMemory(0x80, 0xE000);
+  for (byte bit : {0, 1, 0, 0, 0})
+    memory.SetMemory(bit, 0xE000);
+  EXPECT_EQ(memory.GetMemory(0x8000), 2);
+
+  std::remove(path.c_str());
+}
+
+TEST(MapperTest, ShouldRaiseMmc3IrqAtScheduledScanline)
+{
+  std::vector<byte> rom = MakeBankedRom(4, 2, 1);
+
+  // last 8 KB bank, fixed at $E000
+  PlaceCode(rom, 0xE000, {
+    0xA9, 0x05, // LDA #5
+    0x8D, 0x00, 0xC0, // STA $C000   latch
+    0x8D, 0x01, 0xC0, // STA $C001   reload
+    0x8D, 0x01, 0xE0, // STA $E001   enable
+    0xA9, 0x18, // LDA #$18
+    0x8D, 0x01, 0x20, // STA $2001   rendering on
+    0x58, // CLI
+    0x4C, 0x11, 0xE0}); // JMP *
+  PlaceCode(rom, 0xF000, {
+    0xE6, 0x00, // INC $00
+    0x8D, 0x00, 0xE0, // STA $E000   acknowledge and disable
+    0x40}); // RTI
+  SetVectors(rom, 0xE000, 0x0000, 0xF000);
+
+  std::string path = WriteTemp(rom, "mmc3_test.nes");
+  Nes nes;
+  ASSERT_TRUE(nes.LoadCartridge(path)) << nes.cartridge.GetError();
+
+  nes.RunUntil(100);
+
+  // reloaded to 5 on line 0, zero at dot 260 of line 5
+  uint64_t deadline = (5 * Ppu::DOTS_PER_SCANLINE + 260 + 1 + 2) / 3;
+  EXPECT_EQ(nes.scheduler.GetCycle(EventType::MapperIrq), deadline);
+
+  nes.RunUntil(deadline - 1);
+  EXPECT_EQ(nes.memory.GetMemory(0x0000), 0);
+
+  nes.RunUntil(deadline + 20);
+  EXPECT_EQ(nes.memory.GetMemory(0x0000), 1);
+  EXPECT_EQ(nes.cpu.irq_lines, 0);
+
+  // disabled by the handler, nothing more this frame
+  nes.RunFrame();
+  EXPECT_EQ(nes.memory.GetMemory(0x0000), 1);
+
+  std::remove(path.c_str());
+}
@@ -0,0 +1,139 @@
+#include "gtest/gtest.h"
+
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "movie.h"
+#include "nes.h"
+#include "test_rom.h"
+
+namespace
+{
+/*
+ *  NROM image that reads pad 1 in its NMI handler and folds it into a
+ *  running sum at $01, so every input shows up in the state from then on:
+ *
+ *  $8000  SEI; LDA #$80; STA $2000; JMP *
+ *  $9000  LDA #1; STA $4016; LDA #0; STA $4016; LDX #8
+ *  $900C  LDA $4016; LSR A; ROL $00; DEX; BNE $900C
+ *  $9015  LDA $00; CLC; ADC $01; STA $01; RTI
+ */
+std::string WritePadRom(const std::string& name)
+{
+  std::vector<byte> rom = MakeNrom({0x78, 0xA9, 0x80, 0x8D, 0x00, 0x20, 0x4C, 0x06, 0x80});
+  PlaceCode(rom, 0x9000, {0xA9, 0x01, 0x8D, 0x16, 0x40, 0xA9, 0x00, 0x8D, 0x16, 0x40, 0xA2, 0x08, 0xAD, 0x16, 0x40,
+                          0x4A, 0x26, 0x00, 0xCA, 0xD0, 0xF7, 0xA5, 0x00, 0x18, 0x65, 0x01, 0x85, 0x01, 0x40});
+  SetVectors(rom, 0x8000, 0x9000);
+  return WriteTemp(rom, name);
+}
+
+std::array<byte, 2> InputAt(int frame)
+{
+  // held for 30 frames at a time, the way people play
+  return {byte((frame / 30) % 2 ? Nes::BUTTON_A | Nes::BUTTON_RIGHT : 0), 0};
+}
+} // namespace
+
+TEST(MovieTest, ShouldShiftOutButtonsAfterStrobe)
+{
+  Nes nes;
+  nes.SetButtons(0, Nes::BUTTON_A | Nes::BUTTON_START);
+
+  nes.memory.SetMemory(1, Nes::JOYPAD1);
+  nes.memory.SetMemory(0, Nes::JOYPAD1);
+
+  byte bits = 0;
+  for (int i = 0; i < 8; i++)
+    bits |= (nes.memory.GetMemory(Nes::JOYPAD1) & 1) << i;
+
+  EXPECT_EQ(bits, Nes::BUTTON_A | Nes::BUTTON_START);
+  EXPECT_EQ(nes.memory.GetMemory(Nes::JOYPAD1) & 1, 1); // past the 8th read
+  EXPECT_EQ(nes.memory.GetMemory(Nes::JOYPAD2) & 1, 0);
+}
+
+TEST(MovieTest, ShouldReplayRecordedMovie)
+{
+  std::string rom = WritePadRom("movie_test.nes");
+  std::string path = ::testing::TempDir() + "movie_test.nesm";
+
+  auto recorder = std::make_unique<Nes>();
+  ASSERT_TRUE(recorder->LoadCartridge(rom)) << recorder->cartridge.GetError();
+
+  Movie recorded;
+  StateHasher hasher;
+  for (int frame = 0; frame < 120; frame++)
+    RecordFrame(*recorder, hasher, recorded, InputAt(frame));
+  ASSERT_TRUE(recorded.Save(path)) << recorded.GetError();
+
+  // four runs of held buttons, a header and one hash per frame
+  EXPECT_EQ(std::filesystem::file_size(path), 16 + 4 * 4 + 120 * 8);
+
+  Movie movie;
+  ASSERT_TRUE(movie.Load(path)) << movie.GetError();
+  ASSERT_EQ(movie.GetFrameCount(), 120u);
+
+  auto player = std::make_unique<Nes>();
+  ASSERT_TRUE(player->LoadCartridge(rom));
+  PlaybackResult result = PlayMovie(*player, movie);
+
+  EXPECT_TRUE(result.ok);
+  EXPECT_EQ(result.frames, 120u);
+  EXPECT_NE(player->memory.GetMemory(0x0001), 0);
+
+  std::remove(path.c_str());
+  std::remove(rom.c_str());
+}
+
+TEST(MovieTest, ShouldStopAtFirstDivergingFrame)
+{
+  std::string rom = WritePadRom("movie_diverge_test.nes");
+
+  auto recorder = std::make_unique<Nes>();
+  ASSERT_TRUE(recorder->LoadCartridge(rom));
+
+  Movie movie;
+  StateHasher hasher;
+  for (int frame = 0; frame < 60; frame++)
+    RecordFrame(*recorder, hasher, movie, InputAt(frame));
+
+  // a console that reads different buttons from frame 40 on
+  Movie altered;
+  for (size_t frame = 0; frame < movie.GetFrameCount(); frame++)
+    {
+      std::array<byte, 2> buttons = movie.GetFrame(frame).buttons;
+      if (frame >= 40)
+        buttons[0] ^= Nes::BUTTON_B;
+      altered.Append(buttons, movie.GetFrame(frame).hash);
+    }
+
+  auto player = std::make_unique<Nes>();
+  ASSERT_TRUE(player->LoadCartridge(rom));
+  PlaybackResult result = PlayMovie(*player, altered);
+
+  // the NMI that reads frame 40's buttons runs at the start of frame 40
+  EXPECT_FALSE(result.ok);
+  EXPECT_EQ(result.frames, 41u);
+
+  std::remove(rom.c_str());
+}
+
+TEST(MovieTest, ShouldRejectTruncatedMovie)
+{
+  std::string path = ::testing::TempDir() + "truncated_test.nesm";
+
+  Movie movie;
+  movie.Append({0, 0}, 1);
+  movie.Append({0, 0}, 2);
+  ASSERT_TRUE(movie.Save(path));
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+
+  EXPECT_FALSE(movie.Load(path));
+  EXPECT_NE(movie.GetError().find("truncated"), std::string::npos);
+  EXPECT_EQ(movie.GetFrameCount(), 0u);
+
+  std::remove(path.c_str());
+}
@@ -0,0 +1,149 @@
+#include "gtest/gtest.h"
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nes.h"
+#include "state_hash.h"
+#include "test_rom.h"
+
+namespace
+{
+// NROM-128 image running `reset` from $8000, with NMI and IRQ both vectored
+// to `handler` at $9000
+std::string WriteRom(const std::string& name, std::initializer_list<byte> reset, std::initializer_list<byte> handler)
+{
+  std::vector<byte> rom = MakeNrom(reset);
+  PlaceCode(rom, 0x9000, handler);
+  SetVectors(rom, 0x8000, 0x9000, 0x9000);
+  return WriteTemp(rom, name);
+}
+} // namespace
+
+TEST(NesTest, ShouldMirrorWorkRam)
+{
+  Nes nes;
+
+  nes.memory.SetMemory(0x5A, 0x0012);
+
+  ASSERT_EQ(nes.memory.GetMemory(0x0812), 0x5A);
+  ASSERT_EQ(nes.memory.GetMemory(0x1812), 0x5A);
+}
+
+TEST(NesTest, ShouldCopyOamWithDma)
+{
+  Nes nes;
+
+  for (word i = 0; i < 256; i++)
+    nes.memory.SetMemory(i, 0x0200 + i);
+
+  uint64_t start = nes.cpu.cycles;
+  nes.memory.SetMemory(0x02, Nes::OAM_DMA);
+
+  ASSERT_GE(nes.cpu.cycles - start, 513u);
+  nes.ppu.Write(0x2003, 0x10);
+  ASSERT_EQ(nes.ppu.Read(0x2004), 0x10);
+}
+
+TEST(NesTest, ShouldDeliverVblankNmiOncePerFrame)
+{
+  Nes nes;
+  ASSERT_TRUE(nes.LoadCartridge(WriteRom("nmi_counter.nes",
+                                         {0x78, 0xA9, 0x80, 0x8D, 0x00, 0x20, 0x4C, 0x06, 0x80}, // SEI; LDA #$80; STA $2000; JMP *
+                                         {0xE6, 0x00, 0x40})))                                   // INC $00; RTI
+    << nes.cartridge.GetError();
+
+  for (int i = 0; i < 5; i++)
+    {
+      nes.RunFrame();
+      ASSERT_EQ(nes.ppu.GetScanline(), Ppu::VBLANK_SCANLINE);
+    }
+
+  // the fifth NMI has been raised but not taken yet
+  ASSERT_EQ(nes.memory.GetMemory(0x0000), 4);
+}
+
+TEST(NesTest, ShouldTakeApuFrameIrqs)
+{
+  Nes nes;
+  ASSERT_TRUE(nes.LoadCartridge(WriteRom("irq_counter.nes",
+                                         {0x58, 0xA9, 0x00, 0x8D, 0x17, 0x40, 0x4C, 0x06, 0x80}, // CLI; LDA #0; STA $4017; JMP *
+                                         {0xE6, 0x00, 0xAD, 0x15, 0x40, 0x40})))                // INC $00; LDA $4015; RTI
+    << nes.cartridge.GetError();
+
+  nes.RunUntil(5 * 29830 + 1000);
+
+  // one IRQ per 4-step sequence, each acknowledged through $4015
+  ASSERT_EQ(nes.memory.GetMemory(0x0000), 5);
+  ASSERT_EQ(nes.cpu.irq_lines, 0);
+}
+
+TEST(NesTest, ShouldPowerOnWithIrqsMasked)
+{
+  Nes nes;
+  ASSERT_TRUE(nes.LoadCartridge(WriteRom("irq_masked.nes",
+                                         {0x4C, 0x00, 0x80}, // JMP *
+                                         {0xE6, 0x10, 0x40}))) // INC $10; RTI
+    << nes.cartridge.GetError();
+
+  for (int i = 0; i < 3; i++)
+    nes.RunFrame();
+
+  // the frame IRQ is raised but never taken until the game clears I
+  ASSERT_NE(nes.cpu.irq_lines, 0);
+  ASSERT_EQ(nes.memory.GetMemory(0x0010), 0);
+}
+
+TEST(NesTest, ShouldForkConsoleWithCartridge)
+{
+  auto nes = std::make_unique<Nes>();
+  ASSERT_TRUE(nes->LoadCartridge(WriteRom("fork_counter.nes",
+                                          {0x78, 0xA9, 0x80, 0x8D, 0x00, 0x20, // SEI; LDA #$80; STA $2000
+                                           0xE6, 0x10, 0x4C, 0x06, 0x80},      // loop: INC $10; JMP loop
+                                          {0xE6, 0x00, 0x40})))                // INC $00; RTI
+    << nes->cartridge.GetError();
+  nes->cpu.engine = CpuEngine::Cached;
+  for (int i = 0; i < 3; i++)
+    nes->RunFrame();
+
+  std::unique_ptr<Nes> fork = nes->Fork();
+  EXPECT_EQ(fork->cpu.engine, CpuEngine::Cached);
+  EXPECT_EQ(HashState(*fork), HashState(*nes));
+
+  // RAM and PRG RAM, mirrors included, are shared until written
+  EXPECT_EQ(nes->memory.CountSharedPages(), 0x40u);
+  EXPECT_EQ(fork->memory.CountSharedPages(), 0x40u);
+  fork->memory.SetMemory(0x01, 0x0801);
+  EXPECT_EQ(fork->memory.CountSharedPages(), 0x3Cu);
+  EXPECT_EQ(nes->memory.CountSharedPages(), 0x40u);
+  EXPECT_EQ(fork->memory.GetMemory(0x1801), 0x01);
+  EXPECT_EQ(nes->memory.GetMemory(0x1801), 0x00);
+  fork->memory.SetMemory(0x00, 0x0801);
+
+  // in lockstep from there, NMIs from each one's own PPU
+  for (int i = 0; i < 2; i++)
+    {
+      nes->RunFrame();
+      fork->RunFrame();
+    }
+  EXPECT_EQ(fork->memory.GetMemory(0x0000), 4);
+  EXPECT_EQ(HashState(*fork), HashState(*nes));
+
+  // work RAM, PRG RAM and the PPU are the fork's own
+  nes->memory.SetMemory(0x5A, 0x0020);
+  nes->memory.SetMemory(0xA5, 0x6000);
+  nes->memory.SetMemory(0x3F, 0x2006);
+  nes->memory.SetMemory(0x00, 0x2006);
+  nes->memory.SetMemory(0x0F, 0x2007);
+
+  EXPECT_EQ(fork->memory.GetMemory(0x0020), 0x00);
+  EXPECT_EQ(fork->memory.GetMemory(0x6000), 0x00);
+  EXPECT_NE(fork->ppu.PpuRead(0x3F00), nes->ppu.PpuRead(0x3F00));
+
+  // and it outlives the console it came from
+  nes.reset();
+  fork->RunFrame();
+  EXPECT_EQ(fork->memory.GetMemory(0x0000), 5);
+}
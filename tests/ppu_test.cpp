@@ -0,0 +1,138 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+#include "ppu.h"
+
+class PpuTest : public ::testing::Test
+{
+protected:
+  Ppu ppu;
+
+  void WriteVram(word addr, std::initializer_list<byte> data)
+  {
+    ppu.Write(0x2006, addr >> 8);
+    ppu.Write(0x2006, addr & 0xFF);
+    for (byte value : data)
+      ppu.Write(0x2007, value);
+  }
+
+  void RunToVblank()
+  {
+    ppu.CatchUp(ppu.NextVblankCycle());
+  }
+
+  // A scrolled background of two tiles plus a few sprites, sprite 0 on
+  // top of an opaque background pixel
+  static void BuildScene(Ppu& target)
+  {
+    for (word row = 0; row < 8; row++)
+      {
+        target.PpuWrite(0x0010 + row, 0xF0 >> (row & 3)); // tile 1, plane 0
+        target.PpuWrite(0x0028 + row, 0x3C);              // tile 2, plane 1
+      }
+
+    for (word i = 0; i < 0x3C0; i++)
+      target.PpuWrite(0x2000 + i, (i % 3) ? 1 : 2);
+    for (word i = 0; i < 0x40; i++)
+      target.PpuWrite(0x23C0 + i, i * 0x1B);
+
+    for (word i = 0; i < 32; i++)
+      target.PpuWrite(0x3F00 + i, i + 1);
+
+    const byte sprites[] = {
+      40, 1, 0x00, 44, // sprite 0
+      40, 2, 0x41, 48, // overlaps sprite 0, flipped
+      100, 1, 0x22, 7, // behind the background, partly clipped
+    };
+    target.Write(0x2003, 0);
+    for (byte value : sprites)
+      target.Write(0x2004, value);
+
+    target.Write(0x2000, 0x00);
+    target.Write(0x2005, 3); // fine X
+    target.Write(0x2005, 13);
+    target.Write(0x2001, 0x1E);
+  }
+};
+
+TEST_F(PpuTest, ShouldBufferVramReads)
+{
+  WriteVram(0x2400, {0x11, 0x22});
+
+  ppu.Write(0x2006, 0x24);
+  ppu.Write(0x2006, 0x00);
+
+  ppu.Read(0x2007); // stale buffer
+  ASSERT_EQ(ppu.Read(0x2007), 0x11);
+  ASSERT_EQ(ppu.Read(0x2007), 0x22);
+}
+
+TEST_F(PpuTest, ShouldIncrementAddressByRowWhenAsked)
+{
+  ppu.Write(0x2000, 0x04);
+  WriteVram(0x2000, {0xAA, 0xBB});
+
+  ASSERT_EQ(ppu.PpuRead(0x2000), 0xAA);
+  ASSERT_EQ(ppu.PpuRead(0x2020), 0xBB);
+}
+
+TEST_F(PpuTest, ShouldMirrorSpriteBackdropIntoBackground)
+{
+  WriteVram(0x3F10, {0x21});
+
+  ASSERT_EQ(ppu.PpuRead(0x3F00), 0x21);
+}
+
+TEST_F(PpuTest, ShouldMirrorNametables)
+{
+  ppu.SetMirroring(Mirroring::Vertical);
+  ppu.PpuWrite(0x2000, 0x12);
+  ASSERT_EQ(ppu.PpuRead(0x2800), 0x12);
+
+  ppu.SetMirroring(Mirroring::Horizontal);
+  ASSERT_EQ(ppu.PpuRead(0x2400), 0x12);
+}
+
+TEST_F(PpuTest, ShouldRaiseVblankAndClearItOnRead)
+{
+  RunToVblank();
+
+  ASSERT_EQ(ppu.GetScanline(), Ppu::VBLANK_SCANLINE);
+  ASSERT_EQ(ppu.Read(0x2002) & 0x80, 0x80);
+  ASSERT_EQ(ppu.Read(0x2002) & 0x80, 0x00);
+}
+
+TEST_F(PpuTest, ShouldReportSprite0Hit)
+{
+  BuildScene(ppu);
+
+  RunToVblank();
+  RunToVblank();
+
+  ASSERT_EQ(ppu.Read(0x2002) & 0x40, 0x40);
+}
+
+TEST_F(PpuTest, ScanlineAndDotModesShouldRenderTheSameFrame)
+{
+  Ppu dot_ppu;
+  dot_ppu.SetRenderMode(Ppu::RenderMode::Dot);
+
+  BuildScene(ppu);
+  BuildScene(dot_ppu);
+
+  for (int i = 0; i < 3; i++)
+    {
+      ppu.CatchUp(ppu.NextVblankCycle());
+      dot_ppu.CatchUp(dot_ppu.NextVblankCycle());
+    }
+
+  std::vector<byte> scanline(ppu.GetFrameBuffer(), ppu.GetFrameBuffer() + Ppu::WIDTH * Ppu::HEIGHT);
+  std::vector<byte> dot(dot_ppu.GetFrameBuffer(), dot_ppu.GetFrameBuffer() + Ppu::WIDTH * Ppu::HEIGHT);
+
+  ASSERT_EQ(ppu.GetFrame(), dot_ppu.GetFrame());
+  ASSERT_NE(std::count(scanline.begin(), scanline.end(), scanline[0]), static_cast<long>(scanline.size()));
+  ASSERT_EQ(scanline, dot);
+}
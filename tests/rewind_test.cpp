@@ -0,0 +1,111 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "rewind.h"
+
+namespace
+{
+constexpr size_t STATE_SIZE = 20000;
+
+// a mostly static state with a few bytes changing every frame, like RAM
+std::vector<byte> MakeState(int frame)
+{
+  std::vector<byte> state(STATE_SIZE, 0);
+  for (size_t i = 0; i < STATE_SIZE; i += 97)
+    state[i] = byte(i * 7);
+  for (int k = 0; k < 16; k++)
+    state[(frame * 131 + k * 1009) % STATE_SIZE] = byte(frame + k);
+  state[100] = byte(frame);
+  return state;
+}
+} // namespace
+
+TEST(RewindTest, ShouldRoundTripDeltas)
+{
+  std::vector<byte> reference = MakeState(1);
+  std::vector<byte> state = MakeState(2);
+  std::vector<byte> encoded(MaxEncodedSize(STATE_SIZE));
+  std::vector<byte> decoded(STATE_SIZE);
+
+  size_t size = EncodeDelta(state.data(), reference.data(), STATE_SIZE, encoded.data());
+  ASSERT_LT(size, STATE_SIZE / 20);
+  ASSERT_TRUE(DecodeDelta(encoded.data(), size, reference.data(), decoded.data(), STATE_SIZE));
+  ASSERT_EQ(decoded, state);
+
+  size = EncodeDelta(state.data(), nullptr, STATE_SIZE, encoded.data());
+  ASSERT_TRUE(DecodeDelta(encoded.data(), size, nullptr, decoded.data(), STATE_SIZE));
+  ASSERT_EQ(decoded, state);
+
+  ASSERT_FALSE(DecodeDelta(encoded.data(), size - 1, nullptr, decoded.data(), STATE_SIZE));
+}
+
+TEST(RewindTest, ShouldPopFramesNewestFirst)
+{
+  RewindBuffer rewind(STATE_SIZE, 600, 1 << 20, 30);
+
+  for (int frame = 0; frame < 100; frame++)
+    ASSERT_TRUE(rewind.Push(MakeState(frame)));
+  ASSERT_EQ(rewind.Frames(), 100u);
+
+  std::vector<byte> state(STATE_SIZE);
+  for (int frame = 99; frame >= 0; frame--)
+    {
+      ASSERT_TRUE(rewind.Pop(state));
+      ASSERT_EQ(state, MakeState(frame)) << "frame " << frame;
+    }
+  ASSERT_FALSE(rewind.Pop(state));
+}
+
+TEST(RewindTest, ShouldKeepWorkingWhenPushingAfterPopping)
+{
+  RewindBuffer rewind(STATE_SIZE, 600, 1 << 20, 10);
+  std::vector<byte> state(STATE_SIZE);
+
+  for (int frame = 0; frame < 25; frame++)
+    rewind.Push(MakeState(frame));
+  for (int i = 0; i < 7; i++)
+    rewind.Pop(state); // back to just after frame 17
+
+  for (int frame = 1000; frame < 1020; frame++)
+    rewind.Push(MakeState(frame));
+
+  for (int frame = 1019; frame >= 1000; frame--)
+    {
+      ASSERT_TRUE(rewind.Pop(state));
+      ASSERT_EQ(state, MakeState(frame));
+    }
+  ASSERT_TRUE(rewind.Pop(state));
+  ASSERT_EQ(state, MakeState(17));
+}
+
+TEST(RewindTest, ShouldDropWholeKeyframeGroupsWhenFull)
+{
+  // room for a couple of keyframes only
+  RewindBuffer rewind(STATE_SIZE, 600, 16 * 1024, 20);
+
+  for (int frame = 0; frame < 500; frame++)
+    ASSERT_TRUE(rewind.Push(MakeState(frame)));
+
+  ASSERT_LE(rewind.StorageUsed(), 16u * 1024);
+  ASSERT_LT(rewind.Frames(), 500u);
+
+  std::vector<byte> state(STATE_SIZE);
+  size_t frames = rewind.Frames();
+  for (size_t i = 0; i < frames; i++)
+    {
+      ASSERT_TRUE(rewind.Pop(state));
+      ASSERT_EQ(state, MakeState(499 - i));
+    }
+}
+
+TEST(RewindTest, ShouldLimitFramesToCapacity)
+{
+  RewindBuffer rewind(STATE_SIZE, 50, 1 << 20, 10);
+
+  for (int frame = 0; frame < 200; frame++)
+    rewind.Push(MakeState(frame));
+
+  ASSERT_LE(rewind.Frames(), 50u);
+  ASSERT_GE(rewind.Frames(), 40u);
+}
@@ -0,0 +1,113 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "cpu.h"
+#include "memory.h"
+#include "scheduler.h"
+
+namespace
+{
+// Records what ran when, optionally coming back every `period` cycles
+class RecordingSource : public EventSource
+{
+public:
+  RecordingSource(Scheduler& scheduler, uint64_t period = 0) : scheduler(scheduler), period(period) {}
+
+  void RunEvent(EventType type, uint64_t cycle) override
+  {
+    types.push_back(type);
+    cycles.push_back(cycle);
+    if (period)
+      scheduler.Schedule(type, due += period);
+  }
+
+  Scheduler& scheduler;
+  uint64_t period;
+  uint64_t due = 0;
+  std::vector<EventType> types;
+  std::vector<uint64_t> cycles;
+};
+} // namespace
+
+TEST(SchedulerTest, ShouldRunDueEventsEarliestFirst)
+{
+  Scheduler scheduler;
+  RecordingSource source(scheduler);
+  for (EventType type : {EventType::Vblank, EventType::FrameIrq, EventType::DmcIrq, EventType::MapperIrq})
+    scheduler.SetSource(type, &source);
+
+  scheduler.Schedule(EventType::Vblank, 300);
+  scheduler.Schedule(EventType::FrameIrq, 100);
+  scheduler.Schedule(EventType::DmcIrq, 200);
+  scheduler.Schedule(EventType::MapperIrq, 900);
+  ASSERT_EQ(scheduler.NextCycle(), 100u);
+
+  scheduler.RunDue(300);
+
+  ASSERT_EQ(source.types, (std::vector<EventType>{EventType::FrameIrq, EventType::DmcIrq, EventType::Vblank}));
+  ASSERT_EQ(scheduler.NextCycle(), 900u);
+  ASSERT_EQ(scheduler.GetCycle(EventType::Vblank), Scheduler::NEVER);
+}
+
+TEST(SchedulerTest, ShouldMoveAndCancelEvents)
+{
+  Scheduler scheduler;
+
+  scheduler.Schedule(EventType::Vblank, 100);
+  scheduler.Schedule(EventType::DmcIrq, 50);
+  scheduler.Schedule(EventType::DmcIrq, 150);
+  ASSERT_EQ(scheduler.NextCycle(), 100u);
+
+  scheduler.Schedule(EventType::Vblank, Scheduler::NEVER);
+  ASSERT_EQ(scheduler.NextCycle(), 150u);
+
+  scheduler.Clear();
+  ASSERT_EQ(scheduler.NextCycle(), Scheduler::NEVER);
+}
+
+TEST(SchedulerTest, ShouldPullInStopCycleOfRunningCpu)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+  Scheduler scheduler;
+  scheduler.ConnectCpu(&cpu);
+
+  cpu.stop_cycle = 500;
+  scheduler.Schedule(EventType::FrameIrq, 800);
+  ASSERT_EQ(cpu.stop_cycle, 500u);
+
+  scheduler.Schedule(EventType::FrameIrq, 200);
+  ASSERT_EQ(cpu.stop_cycle, 200u);
+}
+
+TEST(SchedulerTest, ShouldStopCpuAtEveryEvent)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+  Scheduler scheduler;
+  RecordingSource source(scheduler, 100);
+  scheduler.SetSource(EventType::Vblank, &source);
+  scheduler.ConnectCpu(&cpu);
+
+  // JMP $8000
+  memory.SetMemory(0x4C, 0x8000);
+  memory.SetMemory(0x00, 0x8001);
+  memory.SetMemory(0x80, 0x8002);
+  cpu.Reset();
+  cpu.PC = 0x8000;
+
+  uint64_t start = cpu.cycles;
+  source.due = start + 100;
+  scheduler.Schedule(EventType::Vblank, source.due);
+  cpu.RunUntil(start + 1000);
+
+  // every event runs within one instruction of its cycle, the one at the
+  // target included
+  ASSERT_EQ(source.cycles.size(), 10u);
+  for (size_t i = 0; i < source.cycles.size(); i++)
+    {
+      EXPECT_GE(source.cycles[i], start + 100 * (i + 1));
+      EXPECT_LT(source.cycles[i], start + 100 * (i + 1) + 3);
+    }
+}
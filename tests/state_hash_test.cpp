@@ -0,0 +1,116 @@
+#include "gtest/gtest.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "memory.h"
+#include "nes.h"
+#include "state_hash.h"
+#include "test_rom.h"
+
+namespace
+{
+// NROM image counting at $11 in a loop, NMIs off
+std::string WriteCounterRom(const std::string& name)
+{
+  // loop: INC $11; JMP loop
+  return WriteTemp(MakeNrom({0xE6, 0x11, 0x4C, 0x00, 0x80}), name);
+}
+} // namespace
+
+TEST(StateHashTest, ShouldHashBytesByContentAndLength)
+{
+  std::vector<byte> data(200);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = i * 7;
+
+  uint64_t hash = HashBytes(data.data(), data.size());
+  EXPECT_EQ(HashBytes(data.data(), data.size()), hash);
+  EXPECT_NE(HashBytes(data.data(), data.size() - 1), hash);
+
+  data[150] ^= 1;
+  EXPECT_NE(HashBytes(data.data(), data.size()), hash);
+
+  // a zero tail is padding only as far as the length goes
+  std::vector<byte> zeros(64, 0);
+  EXPECT_NE(HashBytes(zeros.data(), 63), HashBytes(zeros.data(), 64));
+}
+
+TEST(StateHashTest, ShouldMarkWrittenPagesAndTheirMirrorsDirty)
+{
+  Memory memory;
+  memory.MapStorage(0x00, 0x1F, memory.GetWritePage(0x00), 0x800);
+  memory.CleanPages();
+  EXPECT_FALSE(memory.IsDirty(0x00));
+
+  memory.SetMemory(0x42, 0x0811);
+
+  for (byte page : {0x00, 0x08, 0x10, 0x18})
+    EXPECT_TRUE(memory.IsDirty(page));
+  EXPECT_FALSE(memory.IsDirty(0x01));
+  EXPECT_EQ(memory.GetMemory(0x0011), 0x42);
+
+  // remapping dirties the page as well
+  memory.CleanPages();
+  memory.MapStorage(0x40, 0x40, memory.GetWritePage(0x01), 0x100);
+  EXPECT_TRUE(memory.IsDirty(0x40));
+  EXPECT_FALSE(memory.IsDirty(0x00));
+}
+
+TEST(StateHashTest, ShouldRehashOnlyDirtyPages)
+{
+  std::string path = WriteCounterRom("state_hash_test.nes");
+
+  auto nes = std::make_unique<Nes>();
+  ASSERT_TRUE(nes->LoadCartridge(path)) << nes->cartridge.GetError();
+
+  StateHasher hasher;
+  hasher.Hash(*nes);
+  EXPECT_EQ(hasher.GetRehashedPages(), Memory::PAGE_COUNT);
+
+  nes->RunFrame();
+  hasher.Hash(*nes);
+
+  // $0011 and its three mirrors
+  EXPECT_EQ(hasher.GetRehashedPages(), 4u);
+
+  // anyone else cleaning the pages makes the next call start over
+  nes->memory.CleanPages();
+  hasher.Hash(*nes);
+  EXPECT_EQ(hasher.GetRehashedPages(), Memory::PAGE_COUNT);
+
+  std::remove(path.c_str());
+}
+
+TEST(StateHashTest, ShouldMatchFullHashOnEveryEngine)
+{
+  std::string path = WriteCounterRom("state_hash_engine_test.nes");
+
+  for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Cached, CpuEngine::Blocks, CpuEngine::Jit})
+    {
+      auto nes = std::make_unique<Nes>();
+      auto reference = std::make_unique<Nes>();
+      ASSERT_TRUE(nes->LoadCartridge(path));
+      ASSERT_TRUE(reference->LoadCartridge(path));
+      nes->cpu.engine = engine;
+      nes->cpu.jit_threshold = 1;
+
+      // writes from generated code have to reach the dirty pages too
+      StateHasher hasher;
+      uint64_t previous = 0;
+      for (int frame = 0; frame < 5; frame++)
+        {
+          nes->RunFrame();
+          reference->RunFrame();
+
+          uint64_t hash = hasher.Hash(*nes);
+          EXPECT_EQ(hash, HashState(*reference)) << "engine " << int(engine) << " frame " << frame;
+          EXPECT_NE(hash, previous);
+          previous = hash;
+        }
+    }
+
+  std::remove(path.c_str());
+}
@@ -0,0 +1,105 @@
+#include "gtest/gtest.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "memory.h"
+#include "nes.h"
+#include "state.h"
+#include "state_hash.h"
+#include "test_rom.h"
+
+namespace
+{
+// NROM-128 image: bumps a RAM counter in a loop and a second one on NMI
+std::string WriteRom()
+{
+  std::vector<byte> rom = MakeNrom({0x78, 0xA9, 0x80, 0x8D, 0x00, 0x20, // SEI; LDA #$80; STA $2000
+                                     0xE6, 0x10, 0x4C, 0x06, 0x80});     // loop: INC $10; JMP loop
+  PlaceCode(rom, 0x9000, {0xE6, 0x11, 0x40});                         // INC $11; RTI
+  SetVectors(rom, 0x8000, 0x9000);
+  return WriteTemp(rom, "state.nes");
+}
+} // namespace
+
+TEST(StateTest, ShouldRestoreCpuAndMemory)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+
+  const byte program[] = {0xE8, 0x8A, 0x95, 0x00, 0x4C, 0x00, 0x80}; // INX; TXA; STA $00,X; JMP $8000
+  for (word i = 0; i < sizeof(program); i++)
+    memory.SetMemory(program[i], 0x8000 + i);
+  cpu.Reset();
+  cpu.PC = 0x8000;
+
+  cpu.RunUntil(500);
+
+  std::vector<byte> buffer(128 * 1024);
+  StateWriter writer(buffer);
+  cpu.SaveState(writer);
+  memory.SaveState(writer);
+  ASSERT_TRUE(writer.Ok());
+
+  cpu.RunUntil(1000);
+  byte x = cpu.X;
+  uint64_t cycles = cpu.cycles;
+  byte stored = memory.GetMemory(0x0080);
+
+  StateReader reader(buffer);
+  cpu.LoadState(reader);
+  memory.LoadState(reader);
+  ASSERT_TRUE(reader.Ok());
+  ASSERT_LT(cpu.cycles, 1000u);
+
+  cpu.RunUntil(1000);
+  ASSERT_EQ(cpu.X, x);
+  ASSERT_EQ(cpu.cycles, cycles);
+  ASSERT_EQ(memory.GetMemory(0x0080), stored);
+}
+
+TEST(StateTest, ShouldReplayTheSameFramesAfterLoading)
+{
+  Nes nes;
+  ASSERT_TRUE(nes.LoadCartridge(WriteRom())) << nes.cartridge.GetError();
+
+  for (int i = 0; i < 2; i++)
+    nes.RunFrame();
+
+  std::vector<byte> state(nes.SaveState({}));
+  ASSERT_EQ(nes.SaveState(state), state.size());
+
+  for (int i = 0; i < 3; i++)
+    nes.RunFrame();
+  uint64_t expected = HashState(nes);
+
+  ASSERT_TRUE(nes.LoadState(state));
+  for (int i = 0; i < 3; i++)
+    nes.RunFrame();
+
+  ASSERT_EQ(HashState(nes), expected);
+}
+
+TEST(StateTest, ShouldNotWriteIntoATooSmallBuffer)
+{
+  Nes nes;
+  std::array<byte, 64> buffer{};
+
+  ASSERT_GT(nes.SaveState(buffer), buffer.size());
+  ASSERT_EQ(buffer, (std::array<byte, 64>{}));
+}
+
+TEST(StateTest, ShouldRejectForeignStates)
+{
+  Nes nes;
+  std::vector<byte> state(nes.SaveState({}));
+  nes.SaveState(state);
+
+  std::vector<byte> truncated(state.begin(), state.end() - 1);
+  ASSERT_FALSE(nes.LoadState(truncated));
+
+  state[4] ^= 0xFF; // version
+  ASSERT_FALSE(nes.LoadState(state));
+}
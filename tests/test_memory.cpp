@@ -16,4 +16,220 @@ TEST(MemoryTest, ShouldSetupWithAllMemoryAddressesEqualsToZero)
     }
 
   EXPECT_FALSE(isDifferentThanZero);
-}
\ No newline at end of file
+}
+
+TEST(MemoryTest, ShouldMirrorStorageAcrossMappedPages)
+{
+  Memory memory;
+  byte ram[0x800] = {};
+
+  memory.MapStorage(0x00, 0x1F, ram, sizeof(ram));
+  memory.SetMemory(0x42, 0x0001);
+
+  EXPECT_EQ(ram[0x0001], 0x42);
+  EXPECT_EQ(memory.GetMemory(0x0801), 0x42);
+  EXPECT_EQ(memory.GetMemory(0x1801), 0x42);
+}
+
+TEST(MemoryTest, ShouldDropWritesToReadOnlyPages)
+{
+  Memory memory;
+  const byte rom[0x100] = {0xEA};
+
+  memory.MapReadOnly(0x80, 0xFF, rom, sizeof(rom));
+  memory.SetMemory(0x00, 0x8000);
+
+  EXPECT_EQ(memory.GetMemory(0x8000), 0xEA);
+  EXPECT_EQ(memory.GetMemory(0xFF00), 0xEA);
+  EXPECT_EQ(memory.GetWritePage(0x80), nullptr);
+}
+
+class RecordingDevice : public BusDevice
+{
+public:
+  word last_read = 0, last_write = 0;
+  byte last_data = 0;
+
+  byte Read(word addr) override
+  {
+    last_read = addr;
+    return 0x5A;
+  }
+
+  void Write(word addr, byte data) override
+  {
+    last_write = addr;
+    last_data = data;
+  }
+};
+
+TEST(MemoryTest, ShouldRouteDevicePagesThroughHandlers)
+{
+  Memory memory;
+  RecordingDevice device;
+
+  memory.MapDevice(0x20, 0x3F, &device);
+
+  EXPECT_EQ(memory.GetMemory(0x2002), 0x5A);
+  EXPECT_EQ(device.last_read, 0x2002);
+
+  memory.SetMemory(0x80, 0x3FF8);
+  EXPECT_EQ(device.last_write, 0x3FF8);
+  EXPECT_EQ(device.last_data, 0x80);
+
+  EXPECT_EQ(memory.GetReadPage(0x20), nullptr);
+}
+
+TEST(MemoryTest, ShouldReadZeroFromUnmappedPages)
+{
+  Memory memory;
+
+  memory.SetMemory(0x11, 0x5000);
+  memory.Unmap(0x50, 0x50);
+  memory.SetMemory(0x22, 0x5000);
+
+  EXPECT_EQ(memory.GetMemory(0x5000), 0x00);
+}
+
+TEST(MemoryTest, ShouldBumpVersionOfGuardedPagesOnWrite)
+{
+  Memory memory;
+  byte storage[Memory::PAGE_SIZE] = {};
+  memory.MapStorage(0x10, 0x13, storage, sizeof(storage)); // 4 mirrors
+
+  uint32_t version = memory.GetPageVersion(0x12);
+  uint32_t changes = memory.GetChangeCount();
+
+  // unguarded writes go straight through
+  memory.SetMemory(0x01, 0x1000);
+  EXPECT_EQ(memory.GetPageVersion(0x12), version);
+
+  // a guarded page and its mirrors change version on the next write only
+  memory.GuardPage(0x10);
+  memory.SetMemory(0x02, 0x1300);
+  EXPECT_NE(memory.GetPageVersion(0x12), version);
+  EXPECT_NE(memory.GetChangeCount(), changes);
+  EXPECT_EQ(memory.GetMemory(0x1000), 0x02);
+
+  version = memory.GetPageVersion(0x12);
+  memory.SetMemory(0x03, 0x1300);
+  EXPECT_EQ(memory.GetPageVersion(0x12), version);
+}
+
+TEST(MemoryTest, ShouldOnlyBumpVersionOfGuardedPagesOnMarkChanged)
+{
+  Memory memory;
+  byte storage[2 * Memory::PAGE_SIZE] = {};
+  memory.MapStorage(0x10, 0x11, storage, sizeof(storage));
+
+  uint32_t plain = memory.GetPageVersion(0x10);
+  uint32_t changes = memory.GetChangeCount();
+
+  // nothing can have been decoded from a page still writable directly
+  memory.MarkChanged(0x10, 0x10);
+  EXPECT_EQ(memory.GetPageVersion(0x10), plain);
+  EXPECT_EQ(memory.GetChangeCount(), changes);
+  EXPECT_TRUE(memory.IsDirty(0x10));
+
+  memory.GuardPage(0x11);
+  uint32_t guarded = memory.GetPageVersion(0x11);
+  memory.MarkChanged(0x10, 0x11);
+  EXPECT_EQ(memory.GetPageVersion(0x10), plain);
+  EXPECT_NE(memory.GetPageVersion(0x11), guarded);
+  EXPECT_NE(memory.GetChangeCount(), changes);
+}
+
+TEST(MemoryTest, ShouldBumpVersionOnRemap)
+{
+  Memory memory;
+  byte storage[Memory::PAGE_SIZE] = {};
+  uint32_t version = memory.GetPageVersion(0x40);
+
+  memory.MapStorage(0x40, 0x40, storage, sizeof(storage));
+
+  EXPECT_NE(memory.GetPageVersion(0x40), version);
+}
+
+TEST(MemoryTest, ShouldShareForkedPagesUntilWritten)
+{
+  Memory memory;
+  memory.SetMemory(0x11, 0x0010);
+  memory.SetMemory(0x22, 0x8000);
+
+  std::unique_ptr<Memory> fork = memory.Fork();
+
+  EXPECT_EQ(memory.CountSharedPages(), Memory::PAGE_COUNT);
+  EXPECT_EQ(fork->CountSharedPages(), Memory::PAGE_COUNT);
+  EXPECT_EQ(fork->GetReadPage(0x80), memory.GetReadPage(0x80));
+  EXPECT_EQ(fork->GetMemory(0x0010), 0x11);
+
+  // the first write copies the page, on whichever side it lands
+  fork->SetMemory(0x33, 0x0010);
+  memory.SetMemory(0x44, 0x8001);
+
+  EXPECT_EQ(memory.GetMemory(0x0010), 0x11);
+  EXPECT_EQ(fork->GetMemory(0x0010), 0x33);
+  EXPECT_EQ(memory.GetMemory(0x8001), 0x44);
+  EXPECT_EQ(fork->GetMemory(0x8001), 0x00);
+  EXPECT_EQ(memory.GetMemory(0x8000), 0x22);
+  EXPECT_EQ(fork->GetMemory(0x8000), 0x22);
+  EXPECT_EQ(fork->CountSharedPages(), Memory::PAGE_COUNT - 1);
+  EXPECT_EQ(memory.CountSharedPages(), Memory::PAGE_COUNT - 1);
+}
+
+TEST(MemoryTest, ShouldRefuseToForkForeignStorageAndDevices)
+{
+  byte storage[Memory::PAGE_SIZE] = {};
+  RecordingDevice device;
+
+  Memory ram;
+  ram.MapStorage(0x00, 0x00, storage, sizeof(storage));
+  EXPECT_EQ(ram.Fork(), nullptr);
+
+  Memory io;
+  io.MapDevice(0x20, 0x20, &device);
+  EXPECT_EQ(io.Fork(), nullptr);
+
+  // read-only storage is safe to share
+  Memory rom;
+  rom.MapReadOnly(0x80, 0x80, storage, sizeof(storage));
+  std::unique_ptr<Memory> fork = rom.Fork();
+  ASSERT_NE(fork, nullptr);
+  EXPECT_EQ(fork->GetReadPage(0x80), storage);
+}
+
+TEST(MemoryTest, ShouldKeepForkedMemoryAfterParentIsGone)
+{
+  auto memory = std::make_unique<Memory>();
+  memory->SetMemory(0x5A, 0x1234);
+
+  std::unique_ptr<Memory> fork = memory->Fork();
+  memory.reset();
+
+  EXPECT_EQ(fork->GetMemory(0x1234), 0x5A);
+  fork->SetMemory(0xA5, 0x1235);
+  EXPECT_EQ(fork->GetMemory(0x1234), 0x5A);
+  EXPECT_EQ(fork->GetMemory(0x1235), 0xA5);
+}
+
+TEST(MemoryTest, ShouldShareMirroredInternalFramesWithAnotherBus)
+{
+  Memory memory{Memory::Unmapped{}};
+  memory.MapInternal(0x00, 0x1F, 0x800); // 4 mirrors
+  memory.SetMemory(0x11, 0x0010);
+
+  Memory other{Memory::Unmapped{}};
+  other.MapInternal(0x00, 0x1F, 0x800);
+  memory.ShareFrames(other);
+
+  EXPECT_EQ(other.GetMemory(0x1810), 0x11);
+  EXPECT_EQ(memory.CountSharedPages(), 0x20u);
+  EXPECT_EQ(other.CountSharedPages(), 0x20u);
+
+  // a write copies the frame once, for every mirror showing it
+  other.SetMemory(0x22, 0x0810);
+  EXPECT_EQ(other.GetMemory(0x1010), 0x22);
+  EXPECT_EQ(memory.GetMemory(0x1010), 0x11);
+  EXPECT_EQ(other.CountSharedPages(), 0x1Cu);
+  EXPECT_EQ(memory.CountSharedPages(), 0x20u); // until it writes itself
+}
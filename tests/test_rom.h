@@ -0,0 +1,75 @@
+#ifndef GOOGLETESTSEXAMPLE_TEST_ROM_H
+#define GOOGLETESTSEXAMPLE_TEST_ROM_H
+
+#include <algorithm>
+#include <fstream>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "utils/types.h"
+
+/*
+ *  Cartridge images for the tests that boot something. Code and vectors
+ *  are placed by CPU address into the last 16 KB PRG bank, the one every
+ *  board here powers on with at $C000. NROM-128 mirrors it at $8000 too,
+ *  so one-bank images can use either address.
+ */
+
+// iNES image with zeroed PRG and CHR
+inline std::vector<byte> MakeINes(byte prg_banks, byte chr_banks, byte flags6 = 0, byte flags7 = 0)
+{
+  std::vector<byte> rom(16 + prg_banks * 16384 + chr_banks * 8192, 0);
+  rom[0] = 'N';
+  rom[1] = 'E';
+  rom[2] = 'S';
+  rom[3] = 0x1A;
+  rom[4] = prg_banks;
+  rom[5] = chr_banks;
+  rom[6] = flags6;
+  rom[7] = flags7;
+  return rom;
+}
+
+// iNES image of `mapper`, the first byte of every 16 KB PRG bank holding
+// the bank's number so tests can tell which one is mapped
+inline std::vector<byte> MakeBankedRom(byte mapper, byte prg_banks, byte chr_banks)
+{
+  std::vector<byte> rom = MakeINes(prg_banks, chr_banks, byte(mapper << 4), byte(mapper & 0xF0));
+  for (int bank = 0; bank < prg_banks; bank++)
+    rom[16 + bank * 16384] = bank;
+  return rom;
+}
+
+// Copies `code` to `addr` in the last PRG bank
+inline void PlaceCode(std::vector<byte>& rom, word addr, std::initializer_list<byte> code)
+{
+  size_t last_bank = 16 + (rom[4] - 1) * 16384;
+  std::copy(code.begin(), code.end(), rom.begin() + last_bank + (addr & 0x3FFF));
+}
+
+inline void SetVectors(std::vector<byte>& rom, word reset, word nmi = 0, word irq = 0)
+{
+  PlaceCode(rom, 0xFFFA, {byte(nmi), byte(nmi >> 8), byte(reset), byte(reset >> 8), byte(irq), byte(irq >> 8)});
+}
+
+// NROM-128 image running `code` from $8000
+inline std::vector<byte> MakeNrom(std::initializer_list<byte> code)
+{
+  std::vector<byte> rom = MakeINes(1, 1);
+  PlaceCode(rom, 0x8000, code);
+  SetVectors(rom, 0x8000);
+  return rom;
+}
+
+// Writes `data` to the test temp directory, returns its path
+inline std::string WriteTemp(const std::vector<byte>& data, const std::string& name)
+{
+  std::string path = ::testing::TempDir() + name;
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(data.data()), data.size());
+  return path;
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "memory.h"
+#include "trace.h"
+
+TEST(TraceTest, ShouldRoundCapacityUpToPowerOfTwo)
+{
+  RingTrace trace(5);
+
+  ASSERT_EQ(trace.Capacity(), 8);
+  ASSERT_EQ(trace.Size(), 0);
+}
+
+TEST(TraceTest, ShouldRecordStateBeforeEachInstruction)
+{
+  Memory memory;
+  Cpu cpu(&memory);
+  cpu.Reset();
+  cpu.PC = 0x8000;
+
+  // LDA #$42; TAX; INX
+  memory.SetMemory(0xA9, 0x8000);
+  memory.SetMemory(0x42, 0x8001);
+  memory.SetMemory(0xAA, 0x8002);
+  memory.SetMemory(0xE8, 0x8003);
+
+  RingTrace trace(16);
+  cpu.Execute(6, trace);
+
+  ASSERT_EQ(trace.Size(), 3);
+
+  ASSERT_EQ(trace[0].pc, 0x8000);
+  ASSERT_EQ(trace[0].opcode, 0xA9);
+  ASSERT_EQ(trace[0].operand_lo, 0x42);
+  ASSERT_EQ(trace[0].a, 0x00);
+
+  ASSERT_EQ(trace[2].pc, 0x8003);
+  ASSERT_EQ(trace[2].a, 0x42);
+  ASSERT_EQ(trace[2].x, 0x42);
+}
+
+TEST(TraceTest, ShouldNotReadDevicesWhenCapturingState)
+{
+  struct CountingDevice : BusDevice
+  {
+    int reads = 0;
+    byte Read(word) override
+    {
+      reads++;
+      return 0xEA;
+    }
+    void Write(word, byte) override {}
+  };
+
+  Memory memory;
+  Cpu cpu(&memory);
+  CountingDevice device;
+  memory.MapDevice(0x40, 0x40, &device);
+
+  cpu.PC = 0x4000;
+  TraceRecord record = cpu.TraceState();
+  EXPECT_EQ(record.opcode, 0xFF);
+  EXPECT_EQ(device.reads, 0);
+
+  // a JMP whose operand lies on the device page
+  memory.SetMemory(0x4C, 0x3FFF);
+  cpu.PC = 0x3FFF;
+  record = cpu.TraceState();
+  EXPECT_EQ(record.opcode, 0x4C);
+  EXPECT_EQ(record.operand_lo, 0xFF);
+  EXPECT_EQ(record.operand_hi, 0xFF);
+  EXPECT_EQ(device.reads, 0);
+}
+
+TEST(TraceTest, ShouldKeepOnlyNewestRecordsWhenFull)
+{
+  RingTrace trace(2);
+
+  for (word pc = 0; pc < 5; pc++)
+    trace.Record(TraceRecord{pc, 0xEA, 0, 0, 0, 0, 0, 0, 0xFD, 0});
+
+  ASSERT_EQ(trace.Count(), 5);
+  ASSERT_EQ(trace.Size(), 2);
+  ASSERT_EQ(trace[0].pc, 3);
+  ASSERT_EQ(trace[1].pc, 4);
+}
+
+TEST(TraceTest, ShouldDumpRecordsAsText)
+{
+  RingTrace trace(4);
+  trace.Record(TraceRecord{0xC000, 0x4C, 0xF5, 0xC5, 0x01, 0x02, 0x03, 0x24, 0xFD, 0});
+
+  std::ostringstream out;
+  trace.Dump(out);
+
+  ASSERT_EQ(out.str(), "C000  4C  JMP  A:01 X:02 Y:03 P:24 SP:FD\n");
+}
+
+namespace
+{
+std::string ReadFile(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+// JMP $C5F5 at $C000, then LDA ($89),Y and LSR A at $C5F5, from nestest's
+// power-up state
+void RunNestestSnippet(Memory& memory, Cpu& cpu, NestestTrace& trace)
+{
+  const byte program[] = {0xB1, 0x89, 0x4A};
+  memory.SetMemory(0x4C, 0xC000);
+  memory.SetMemory(0xF5, 0xC001);
+  memory.SetMemory(0xC5, 0xC002);
+  for (word i = 0; i < sizeof(program); i++)
+    memory.SetMemory(program[i], 0xC5F5 + i);
+  memory.SetMemory(0x00, 0x0089);
+  memory.SetMemory(0x03, 0x008A);
+  memory.SetMemory(0x89, 0x0300);
+
+  cpu.Reset();
+  cpu.PC = 0xC000;
+  cpu.SP = 0xFD;
+  cpu.status = 0x24;
+  cpu.cycles = 7;
+
+  cpu.RunUntil(cpu.cycles + 10, trace);
+}
+
+const char* const NESTEST_SNIPPET =
+  "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7\n"
+  "C5F5  B1 89     LDA ($89),Y = 0300 @ 0300 = 89  A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 30 CYC:10\n"
+  "C5F7  4A        LSR A                           A:89 X:00 Y:00 P:A4 SP:FD PPU:  0, 45 CYC:15\n";
+} // namespace
+
+TEST(NestestTraceTest, ShouldWriteNestestLogLines)
+{
+  std::string path = ::testing::TempDir() + "nestest_text.log";
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+
+  Memory memory;
+  Cpu cpu(&memory);
+  {
+    NestestTrace trace(memory, fd);
+    RunNestestSnippet(memory, cpu, trace);
+    ASSERT_TRUE(trace.Ok());
+  }
+  ::close(fd);
+
+  ASSERT_EQ(ReadFile(path), NESTEST_SNIPPET);
+}
+
+TEST(NestestTraceTest, ShouldConvertBinaryTraceToSameText)
+{
+  std::string binary_path = ::testing::TempDir() + "nestest.bin";
+  std::string text_path = ::testing::TempDir() + "nestest_converted.log";
+
+  int fd = ::open(binary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+
+  Memory memory;
+  Cpu cpu(&memory);
+  {
+    // a tiny buffer, so entries go out over several writes
+    NestestTrace trace(memory, fd, NestestTrace::Format::Binary, NestestTrace::MAX_LINE);
+    RunNestestSnippet(memory, cpu, trace);
+  }
+  ::close(fd);
+  ASSERT_EQ(ReadFile(binary_path).size(), 3 * sizeof(NestestTrace::Entry));
+
+  int in = ::open(binary_path.c_str(), O_RDONLY);
+  int out = ::open(text_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_TRUE(NestestTrace::ConvertToText(in, out));
+  ::close(in);
+  ::close(out);
+
+  ASSERT_EQ(ReadFile(text_path), NESTEST_SNIPPET);
+}